@@ -2,10 +2,20 @@
 
 // File to be included by projects using this library
 
-#include "helpers\Kinect_helpers.h"
-#include "helpers\FBX_helpers.h"
-#include "helpers\UI_helpers.h"
+#include "helpers/Kinect_helpers.h"
+#include "helpers/FBX_helpers.h"
+#include "helpers/UI_helpers.h"
 
 
-#include "kinect2fbx\HierarchyNodeDefinition.h"
-#include "kinect2fbx\KinectSkeletonMapper.h"
\ No newline at end of file
+#include "kinect2fbx/BodyFrame.h"
+#include "kinect2fbx/HierarchyNodeDefinition.h"
+#include "kinect2fbx/SkeletonBinding.h"
+#include "kinect2fbx/KinectSkeletonMapper.h"
+#include "kinect2fbx/CaptureJournal.h"
+#include "kinect2fbx/DepthProjection.h"
+#include "kinect2fbx/PipelineMetrics.h"
+#include "kinect2fbx/TraceRecorder.h"
+#include "kinect2fbx/MappingWorkerPool.h"
+#include "kinect2fbx/PostProcessingFilters.h"
+#include "kinect2fbx/KSubscriberChannel.h"
+#include "kinect2fbx/KPreRollBuffer.h"
\ No newline at end of file
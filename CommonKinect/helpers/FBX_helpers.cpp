@@ -1,10 +1,13 @@
 #include "FBX_helpers.h"
-#include "UI_helpers.h"
+#include "../kinect2fbx/PipelineMetrics.h"
+#include "../kinect2fbx/TraceRecorder.h"
 
+// IO settings of the manager passed to LoadScene/SaveScene ( each manager has its own, so
+// scenes can be loaded and saved from different threads, one manager per thread )
 #ifdef IOS_REF
 #undef  IOS_REF
-#define IOS_REF (*(gSdkManager->GetIOSettings()))
 #endif
+#define IOS_REF (*(pSdkManager->GetIOSettings()))
 
 
 // a UI file provide a function to print messages
@@ -13,16 +16,23 @@ extern void UI_Printf(const char* msg, ...);
 
 // Creates an instance of the SDK manager.
 void InitializeSdkManager()
+{
+	gSdkManager = CreateSdkManager();
+}
+
+// Creates a new SDK manager, with its own IO settings
+FbxManager *CreateSdkManager()
 {
 	// Create the FBX SDK memory manager object.
 	// The SDK Manager allocates and frees memory
 	// for almost all the classes in the SDK.
-	gSdkManager = FbxManager::Create();
+	FbxManager *lSdkManager = FbxManager::Create();
 
 	// create an IOSettings object
-	FbxIOSettings * ios = FbxIOSettings::Create(gSdkManager, IOSROOT);
-	gSdkManager->SetIOSettings(ios);
+	FbxIOSettings * ios = FbxIOSettings::Create(lSdkManager, IOSROOT);
+	lSdkManager->SetIOSettings(ios);
 
+	return lSdkManager;
 }
 
 // Destroys an instance of the SDK manager
@@ -174,12 +184,18 @@ bool SaveScene(
 	FbxScene* pScene,
 	const char* pFilename,
 	int pFileFormat,
-	bool pEmbedMedia
+	bool pEmbedMedia,
+	FbxProgressCallback pProgressCallback,
+	void* pProgressArgs
 	)
 {
 	int lMajor, lMinor, lRevision;
 	bool lStatus = true;
 
+	// Time spent writing the file
+	MetricTimer lTimer(MetricHistogram_SaveSceneTime);
+	TRACE_SCOPE("save_scene");
+
 	// Create an exporter.
 	FbxExporter* lExporter = FbxExporter::Create(pSdkManager, "");
 
@@ -241,8 +257,15 @@ bool SaveScene(
 		IOS_REF.SetBoolProp(EXP_FBX_GLOBAL_SETTINGS, true);
 	}
 
+	// Report progress while writing, if anyone is listening
+	if (pProgressCallback)
+		lExporter->SetProgressCallback(pProgressCallback, pProgressArgs);
+
 	// Export the scene.
-	lStatus = lExporter->Export(pScene);
+	{
+		TRACE_SCOPE("fbx_export");
+		lStatus = lExporter->Export(pScene);
+	}
 
 	// Destroy the exporter.
 	lExporter->Destroy();
@@ -250,6 +273,21 @@ bool SaveScene(
 	return lStatus;
 }
 
+// Creates an empty scene, ready to receive animation
+// ( one animation stack, with one layer )
+FbxScene *CreateAnimationScene(FbxManager* pSdkManager)
+{
+	FbxScene* lScene = FbxScene::Create(pSdkManager, "");
+
+	// The animation nodes can only exist on AnimLayers therefore it is mandatory to
+	// add at least one AnimLayer to the AnimStack.
+	FbxAnimStack* lAnimStack = FbxAnimStack::Create(lScene, "Base animation");
+	FbxAnimLayer* lAnimLayer = FbxAnimLayer::Create(lScene, "Base Layer");
+	lAnimStack->AddMember(lAnimLayer);
+
+	return lScene;
+}
+
 // Get the filters for the <Open file> dialog
 // (description + file extention)
 const char *GetReaderOFNFilters()
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "..\stdafx.h"
+#include "../stdafx.h"
 
 
 // Node property
@@ -12,6 +12,11 @@ extern FbxManager*   gSdkManager;
 
 void InitializeSdkManager();
 
+/// <summary>
+/// Creates a new SDK manager, with its own IO settings. Used when each thread needs its own manager
+/// </summary>
+FbxManager *CreateSdkManager();
+
 void DestroySdkObjects(
 	FbxManager* pSdkManager,
 	bool pExitStatus
@@ -36,9 +41,18 @@ bool SaveScene(
 	FbxScene* pScene,
 	const char* pFilename,
 	int pFileFormat,
-	bool pEmbedMedia
+	bool pEmbedMedia,
+	FbxProgressCallback pProgressCallback = NULL,	// Optional, reports export progress
+	void* pProgressArgs = NULL
 	);
 
+/// <summary>
+/// Creates an empty scene, ready to receive animation ( one animation stack, with one layer )
+/// </summary>
+/// <param name="pSdkManager">FBX SDK manager</param>
+/// <returns>New scene</returns>
+FbxScene *CreateAnimationScene(FbxManager* pSdkManager);
+
 
 // Filtering methods
 /// <summary>
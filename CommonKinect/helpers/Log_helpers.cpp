@@ -0,0 +1,184 @@
+#include "Log_helpers.h"
+
+
+/// <summary>
+/// Copies a string, truncating it if needed. Output is always null terminated
+/// </summary>
+static void copyLine(char *target, size_t size, const char *source) {
+	size_t i = 0;
+	for (; i + 1 < size && source[i] != '\0'; i++)
+		target[i] = source[i];
+	target[i] = '\0';
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+LogRing::LogRing() :
+m_head(0),
+m_tail(0),
+m_nDropped(0)
+{
+	// Every slot starts free, for the first lap
+	for (size_t i = 0; i < c_capacity; i++) {
+		m_slots[i].m_sequence = i;
+		m_slots[i].m_text[0] = '\0';
+	}
+}
+
+/// <summary>
+/// Copies a line into the ring. Can be called by any thread
+/// </summary>
+/// <param name="line">Null terminated line</param>
+/// <returns>False if ring is full and line was dropped</returns>
+bool LogRing::push(const char *line) {
+
+	// Claim a slot
+	size_t pos = m_head.load(std::memory_order_relaxed);
+	Slot *slot;
+	for (;;) {
+		slot = &m_slots[pos & (c_capacity - 1)];
+		size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+
+		if (sequence == pos) {
+			// Slot is free, take it unless another producer did first
+			if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (sequence < pos) {
+			// Slot still holds a line from the previous lap, consumer is too far behind
+			m_nDropped++;
+			return false;
+		}
+		else {
+			// Another producer took it, try again further on
+			pos = m_head.load(std::memory_order_relaxed);
+		}
+	}
+
+	copyLine(slot->m_text, c_lineSize, line);
+
+	// Publish the line
+	slot->m_sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+/// <summary>
+/// Copies the oldest line out of the ring, and removes it. Must only be called by the consumer thread
+/// </summary>
+/// <param name="line">Output, receives the line</param>
+/// <param name="size">Size of the output buffer</param>
+/// <returns>False if ring is empty</returns>
+bool LogRing::pop(char *line, size_t size) {
+
+	Slot &slot = m_slots[m_tail & (c_capacity - 1)];
+	if (slot.m_sequence.load(std::memory_order_acquire) != m_tail + 1)
+		return false;
+
+	copyLine(line, size, slot.m_text);
+
+	// Slot is free again, for the next lap
+	slot.m_sequence.store(m_tail + c_capacity, std::memory_order_release);
+	m_tail++;
+	return true;
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+LogFileSink::LogFileSink() :
+m_pFile(NULL),
+m_maxSize(0),
+m_size(0)
+{
+}
+
+/// <summary>
+/// Destructor, closes the file
+/// </summary>
+LogFileSink::~LogFileSink() {
+	close();
+}
+
+/// <summary>
+/// Opens a log file, appending to it if it exists
+/// </summary>
+/// <param name="fileName">Log file name</param>
+/// <param name="maxSize">Size, in bytes, at which the file is rotated</param>
+/// <returns>True if file could be opened</returns>
+bool LogFileSink::open(const char *fileName, long maxSize) {
+
+	// Only one file at a time
+	close();
+
+	m_fileName = fileName;
+	m_maxSize = maxSize;
+
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	m_pFile = fopen(fileName, "ab");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+
+	if (!m_pFile)
+		return false;
+
+	// Appending, so the file may not be empty
+	fseek(m_pFile, 0, SEEK_END);
+	m_size = ftell(m_pFile);
+	return true;
+}
+
+/// <summary>
+/// Writes text to the file, rotating it first if needed
+/// </summary>
+/// <param name="text">Text to be written</param>
+/// <param name="length">Text length</param>
+void LogFileSink::write(const char *text, size_t length) {
+	if (!m_pFile)
+		return;
+
+	if (m_size > 0 && m_size + (long)length > m_maxSize)
+		rotate();
+
+	if (!m_pFile)
+		return;
+
+	m_size += (long)fwrite(text, 1, length, m_pFile);
+}
+
+/// <summary>
+/// Makes sure everything written so far reaches the disk
+/// </summary>
+void LogFileSink::flush() {
+	if (m_pFile)
+		fflush(m_pFile);
+}
+
+/// <summary>
+/// Closes the file
+/// </summary>
+void LogFileSink::close() {
+	if (m_pFile) {
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+}
+
+/// <summary>
+/// Keeps current file as the previous one, and starts a new file
+/// </summary>
+void LogFileSink::rotate() {
+	fclose(m_pFile);
+	m_pFile = NULL;
+
+	FbxString previousFileName = m_fileName + ".1";
+	if (FbxFileUtils::Exist(previousFileName.Buffer()))
+		FbxFileUtils::Delete(previousFileName.Buffer());
+	FbxFileUtils::Rename(m_fileName.Buffer(), previousFileName.Buffer());
+
+	// If file could not be renamed, it starts over
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	m_pFile = fopen(m_fileName.Buffer(), "wb");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+	m_size = 0;
+}
\ No newline at end of file
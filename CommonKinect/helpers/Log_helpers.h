@@ -0,0 +1,127 @@
+#pragma once
+
+#include "../stdafx.h"
+#include <stdio.h>
+
+/*
+	Bounded multi-producer, single-consumer ring of log lines.
+	Lines are copied into preallocated slots, so producers never block nor allocate.
+	When the ring is full, the line is dropped and counted
+*/
+class LogRing {
+public:
+	// Number of slots ( power of two )
+	static const size_t c_capacity = 256;
+
+	// Longest line kept, including terminating null character. Longer lines are truncated
+	static const size_t c_lineSize = 512;
+
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	LogRing();
+
+	/// <summary>
+	/// Copies a line into the ring. Can be called by any thread
+	/// </summary>
+	/// <param name="line">Null terminated line</param>
+	/// <returns>False if ring is full and line was dropped</returns>
+	bool push(const char *line);
+
+	/// <summary>
+	/// Copies the oldest line out of the ring, and removes it. Must only be called by the consumer thread
+	/// </summary>
+	/// <param name="line">Output, receives the line</param>
+	/// <param name="size">Size of the output buffer</param>
+	/// <returns>False if ring is empty</returns>
+	bool pop(char *line, size_t size);
+
+	/// <summary>
+	/// Number of lines dropped because the ring was full
+	/// </summary>
+	unsigned int getDroppedCount() const { return m_nDropped; };
+
+private:
+	struct Slot {
+		// Tells whether slot is free ( equal to write position ) or holds a line ( write position + 1 )
+		std::atomic<size_t> m_sequence;
+		char m_text[c_lineSize];
+	};
+
+	// Preallocated slots
+	Slot m_slots[c_capacity];
+
+	// Write position, shared by producers ( kept on its own cache line )
+	std::atomic<size_t> m_head;
+	char m_headPadding[64 - sizeof(std::atomic<size_t>)];
+
+	// Read position, owned by consumer
+	size_t m_tail;
+
+	// Lines dropped so far
+	std::atomic<unsigned int> m_nDropped;
+};
+
+/*
+	Log file. When it grows too big, it is renamed with a ".1" suffix ( replacing the previous one ) and a new file is started
+*/
+class LogFileSink {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	LogFileSink();
+
+	/// <summary>
+	/// Destructor, closes the file
+	/// </summary>
+	~LogFileSink();
+
+	/// <summary>
+	/// Opens a log file, appending to it if it exists
+	/// </summary>
+	/// <param name="fileName">Log file name</param>
+	/// <param name="maxSize">Size, in bytes, at which the file is rotated</param>
+	/// <returns>True if file could be opened</returns>
+	bool open(const char *fileName, long maxSize);
+
+	/// <summary>
+	/// Writes text to the file, rotating it first if needed
+	/// </summary>
+	/// <param name="text">Text to be written</param>
+	/// <param name="length">Text length</param>
+	void write(const char *text, size_t length);
+
+	/// <summary>
+	/// Makes sure everything written so far reaches the disk
+	/// </summary>
+	void flush();
+
+	/// <summary>
+	/// Closes the file
+	/// </summary>
+	void close();
+
+	/// <summary>
+	/// Whether a file is open
+	/// </summary>
+	bool isOpen() const { return m_pFile != NULL; };
+
+private:
+	// Log file
+	FILE *m_pFile;
+
+	// Log file name
+	FbxString m_fileName;
+
+	// Size at which file is rotated
+	long m_maxSize;
+
+	// Current file size
+	long m_size;
+
+	/// <summary>
+	/// Keeps current file as the previous one, and starts a new file
+	/// </summary>
+	void rotate();
+};
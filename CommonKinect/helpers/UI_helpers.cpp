@@ -1,70 +1,140 @@
 #include "UI_helpers.h"
 #include "FBX_helpers.h"
 
+#include <string>
+
+
+
+// Longest text kept in the EXECUTE_STATUS edit box, oldest lines are removed past it
+static const int c_logMaxEditLength = 60000;
+
+// Log lines waiting to be shown, filled by any thread and drained by the UI thread
+static LogRing gLogRing;
+
+// Optional log file, only written by the UI thread
+static LogFileSink gLogFile;
+
+// Dropped lines already reported
+static unsigned int gLogReportedDrops = 0;
 
 
 // call this to add a message to the EXECUTE_STATUS edit box
 // same variable arguments list as function printf()
+// message is only queued, so it is safe ( and cheap ) to call from any thread
 void UI_Printf(
 	const char* pMsg,
 	...
 	)
 {
-	if (ghWnd == NULL) return;
-
 	// build the pMsg with variable arguments 
-	char msg[2048];
+	char msg[LogRing::c_lineSize];
 	va_list Arguments;
 	va_start(Arguments, pMsg);     // Initialize variable arguments.
-	FBXSDK_vsprintf(msg, 2048, pMsg, Arguments);
+	FBXSDK_vsprintf(msg, sizeof(msg), pMsg, Arguments);
 	va_end(Arguments);            // Reset variable arguments.
 
-	// get the HWND of the editbox
-	HWND hWndStatus = GetDlgItem(ghWnd, EXECUTE_STATUS);
+	if (msg[0] == '\0') return;
 
-	// append \r\n to the msg to print on a new line
-	int msglen = int(strlen(msg));
-	if (msglen < 1) return;
-	msglen = msglen + int(strlen("\r\n")) + 1;
+	// never waits, line is dropped if UI thread is too far behind
+	gLogRing.push(msg);
+}
 
-	char* msgrn = (char*)GlobalAlloc(GPTR, msglen);
-	memset(msgrn, 0, msglen);
-	FBXSDK_strcat(msgrn, msglen, msg);
-	FBXSDK_strcat(msgrn, msglen, "\r\n");
-	//----------
+// gets queued log lines, each one followed by \r\n
+static void DrainLog(
+	std::string &text,
+	unsigned int maxLines
+	)
+{
+	char line[LogRing::c_lineSize];
+	unsigned int nLines = 0;
+	while (nLines < maxLines && gLogRing.pop(line, sizeof(line)))
+	{
+		text += line;
+		text += "\r\n";
+		nLines++;
+	}
 
-	// append the new message to the end
-	int len = GetWindowTextLength(hWndStatus);
-	if (len > 0)
+	// let the user know some lines are missing
+	unsigned int dropped = gLogRing.getDroppedCount();
+	if (dropped != gLogReportedDrops)
 	{
-		// get the Editbox text content
-		char* buf = (char*)GlobalAlloc(GPTR, len + 1);
-		GetDlgItemText(ghWnd, EXECUTE_STATUS, buf, len + 1);
-
-		// append the new text
-		msglen = int(strlen(msgrn)) + len + 1;
-		char* s = (char*)GlobalAlloc(GPTR, msglen);
-		memset(s, 0, msglen);
-		FBXSDK_strcat(s, msglen, buf);
-		FBXSDK_strcat(s, msglen, msgrn);
-
-		// set the new text
-		SetWindowText(hWndStatus, s);
-
-		GlobalFree((HANDLE)buf);
-		GlobalFree((HANDLE)s);
+		char msg[64];
+		FBXSDK_sprintf(msg, sizeof(msg), "( %u log lines dropped )\r\n", dropped - gLogReportedDrops);
+		text += msg;
+		gLogReportedDrops = dropped;
 	}
-	else
+}
+
+// shows log lines queued by UI_Printf, and writes them to the log file if one is open
+// must only be called by the UI thread, at most maxLines are shown per call
+void UI_FlushLog(
+	unsigned int maxLines
+	)
+{
+	// reused across calls, so flushing does not allocate once it has grown
+	static std::string text;
+	text.clear();
+	DrainLog(text, maxLines);
+
+	if (text.empty()) return;
+
+	gLogFile.write(text.c_str(), text.size());
+	gLogFile.flush();
+
+	if (ghWnd == NULL) return;
+
+	// get the HWND of the editbox
+	HWND hWndStatus = GetDlgItem(ghWnd, EXECUTE_STATUS);
+	if (hWndStatus == NULL) return;
+
+	// text is appended, instead of rewriting the whole content
+	SendMessage(hWndStatus, EM_SETLIMITTEXT, (WPARAM)(c_logMaxEditLength + text.size()), 0);
+	int len = GetWindowTextLength(hWndStatus);
+
+	// remove oldest lines, keeping the edit box bounded
+	if (len + int(text.size()) > c_logMaxEditLength)
 	{
-		SetWindowText(hWndStatus, msgrn);
+		int firstKept = len + int(text.size()) - c_logMaxEditLength;
+		if (firstKept < len)
+		{
+			int line = int(SendMessage(hWndStatus, EM_LINEFROMCHAR, (WPARAM)firstKept, 0));
+			int lineStart = int(SendMessage(hWndStatus, EM_LINEINDEX, (WPARAM)(line + 1), 0));
+			if (lineStart > 0) firstKept = lineStart;
+		}
+		if (firstKept > len) firstKept = len;
+
+		SendMessage(hWndStatus, EM_SETSEL, 0, (LPARAM)firstKept);
+		SendMessage(hWndStatus, EM_REPLACESEL, FALSE, (LPARAM)"");
+		len = GetWindowTextLength(hWndStatus);
 	}
 
-	GlobalFree((HANDLE)msgrn);
+	// append the new lines to the end
+	SendMessage(hWndStatus, EM_SETSEL, (WPARAM)len, (LPARAM)len);
+	SendMessage(hWndStatus, EM_REPLACESEL, FALSE, (LPARAM)text.c_str());
 
 	// scroll to bottom
 	SendMessage(hWndStatus, (UINT)EM_SCROLL, SB_BOTTOM, (LPARAM)0);
 }
 
+// starts writing log lines to a file, rotated when it reaches maxSize bytes
+bool UI_OpenLogFile(
+	const char* pFileName,
+	long maxSize
+	)
+{
+	return gLogFile.open(pFileName, maxSize);
+}
+
+// writes any queued log line to the log file, and closes it
+void UI_CloseLogFile()
+{
+	std::string text;
+	DrainLog(text, LogRing::c_capacity);
+
+	gLogFile.write(text.c_str(), text.size());
+	gLogFile.close();
+}
+
 
 
 // check if in the filepath the file extention exist
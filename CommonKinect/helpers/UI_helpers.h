@@ -1,7 +1,8 @@
 #pragma once
-#include "..\stdafx.h"
+#include "../stdafx.h"
 
 #include "WindowIDS.h" // So we can write to specific windows
+#include "Log_helpers.h"
 
 // extern variables
 extern HWND      ghWnd;                 // main window
@@ -15,6 +16,21 @@ void UI_Printf(
 	...
 	);
 
+// shows log lines queued by UI_Printf, and writes them to the log file if one is open
+// must only be called by the UI thread, at most maxLines are shown per call
+void UI_FlushLog(
+	unsigned int maxLines
+	);
+
+// starts writing log lines to a file, rotated when it reaches maxSize bytes
+bool UI_OpenLogFile(
+	const char* pFileName,
+	long maxSize
+	);
+
+// writes any queued log line to the log file, and closes it
+void UI_CloseLogFile();
+
 // show the <Open file> dialog
 void GetOutputFileName(HWND hWndParent, char *gszOutputFile);
 
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+
+#include "KinectTypes.h"
+
+/*
+	Decoded state of a single body slot
+*/
+struct BodyData {
+	// Whether this slot holds a tracked body. Remaining fields are only meaningful if it does
+	bool isTracked;
+
+	// Kinect tracking id, used to tell bodies apart across frames
+	UINT64 trackingId;
+
+	// Hand states
+	HandState leftHandState;
+	HandState rightHandState;
+
+	// Joint positions and tracking states
+	Joint joints[JointType_Count];
+
+	// Joint orientations
+	JointOrientation orientations[JointType_Count];
+};
+
+/*
+	Immutable snapshot of a Kinect body frame, decoded once and shared by every frame subscriber.
+	It holds no COM references, so it can be queued, stored and read from any thread
+*/
+struct BodyFrame {
+	// Frame timestamp ( Kinect clock, 100ns increments )
+	INT64 frameTime;
+
+	// PipelineMetrics::getTime when the frame was decoded, used to measure latency ( 0 if not measured )
+	INT64 captureCounter;
+
+	// Whether body data could be read for this frame
+	bool readStatus;
+
+	// All body slots, in Kinect order
+	BodyData bodies[BODY_COUNT];
+};
+
+// Frames are shared between threads, and never modified once published
+typedef std::shared_ptr<const BodyFrame> BodyFrame_ptr;
@@ -0,0 +1,754 @@
+#include "CaptureJournal.h"
+#include "KinectSkeletonMapper.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// File and chunk identifiers
+static const char c_journalMagic[4] = { 'K', 'C', 'J', 'F' };
+static const char c_chunkMagic[4] = { 'C', 'H', 'N', 'K' };
+
+// Sizes, in bytes, of the fixed parts of the format
+static const size_t c_fileHeaderSize = 16;
+static const size_t c_chunkHeaderSize = 16;
+static const size_t c_frameHeaderSize = 10;
+static const size_t c_bodyHeaderSize = 12;
+static const size_t c_jointRecordSize = 29;
+static const size_t c_settingsHeaderSize = 8;
+
+// Settings written by this version: keying, joint smoothing ( with every joint ) and post processing
+static const size_t c_settingsSize = 17 + 5 + JointType_Count * 16 + 22;
+
+// Oldest format version that can still be read, and first one recording its settings
+static const unsigned short c_oldestJournalVersion = 1;
+static const unsigned short c_settingsJournalVersion = 2;
+
+// Settings bigger than this are considered corrupted
+static const unsigned int c_maxSettingsSize = 64 * 1024;
+
+// Chunks bigger than this are considered corrupted ( a chunk never holds more than a few seconds of data )
+static const unsigned int c_maxChunkSize = 64 * 1024 * 1024;
+
+
+// Serialization helpers ( journal is little endian, as is every platform we run on )
+template <class T>
+static void putValue(std::vector<unsigned char> &buffer, T value) {
+	size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(T));
+	memcpy(&buffer[offset], &value, sizeof(T));
+}
+
+template <class T>
+static T getValue(const unsigned char *buffer, size_t &offset) {
+	T value;
+	memcpy(&value, buffer + offset, sizeof(T));
+	offset += sizeof(T);
+	return value;
+}
+
+/// <summary>
+/// Serializes the settings of a take, as laid out in the journal header
+/// </summary>
+static void serializeSettings(std::vector<unsigned char> &buffer, const CaptureJournalSettings &settings) {
+	putValue<unsigned char>(buffer, settings.m_keying.m_bAdaptive ? 1 : 0);
+	putValue<double>(buffer, settings.m_keying.m_angleTolerance);
+	putValue<double>(buffer, settings.m_keying.m_positionTolerance);
+
+	const JointFilterSettings &jointFilter = settings.m_jointFilter;
+	putValue<unsigned char>(buffer, jointFilter.m_bEnabled ? 1 : 0);
+	putValue<float>(buffer, jointFilter.m_inferredCutoffScale);
+	for (int j = 0; j < JointType_Count; j++) {
+		putValue<float>(buffer, jointFilter.m_position[j].m_minCutoff);
+		putValue<float>(buffer, jointFilter.m_position[j].m_beta);
+		putValue<float>(buffer, jointFilter.m_orientation[j].m_minCutoff);
+		putValue<float>(buffer, jointFilter.m_orientation[j].m_beta);
+	}
+
+	const PostProcessingSettings &postProcessing = settings.m_postProcessing;
+	putValue<int>(buffer, (int)postProcessing.m_resampleMode);
+	putValue<unsigned char>(buffer, postProcessing.m_bUnroll ? 1 : 0);
+	putValue<unsigned char>(buffer, postProcessing.m_bReduceKeys ? 1 : 0);
+	putValue<double>(buffer, postProcessing.m_reductionAngleTolerance);
+	putValue<double>(buffer, postProcessing.m_reductionPositionTolerance);
+}
+
+/// <summary>
+/// Deserializes the settings of a take
+/// </summary>
+/// <returns>False if buffer is too small to hold them</returns>
+static bool deserializeSettings(const unsigned char *buffer, size_t size, CaptureJournalSettings &settings) {
+	// Later versions may add settings after these
+	if (size < c_settingsSize)
+		return false;
+
+	size_t offset = 0;
+	settings.m_keying.m_bAdaptive = getValue<unsigned char>(buffer, offset) != 0;
+	settings.m_keying.m_angleTolerance = getValue<double>(buffer, offset);
+	settings.m_keying.m_positionTolerance = getValue<double>(buffer, offset);
+
+	JointFilterSettings &jointFilter = settings.m_jointFilter;
+	jointFilter.m_bEnabled = getValue<unsigned char>(buffer, offset) != 0;
+	jointFilter.m_inferredCutoffScale = getValue<float>(buffer, offset);
+	for (int j = 0; j < JointType_Count; j++) {
+		jointFilter.m_position[j].m_minCutoff = getValue<float>(buffer, offset);
+		jointFilter.m_position[j].m_beta = getValue<float>(buffer, offset);
+		jointFilter.m_orientation[j].m_minCutoff = getValue<float>(buffer, offset);
+		jointFilter.m_orientation[j].m_beta = getValue<float>(buffer, offset);
+	}
+
+	PostProcessingSettings &postProcessing = settings.m_postProcessing;
+	postProcessing.m_resampleMode = FbxTime::EMode(getValue<int>(buffer, offset));
+	postProcessing.m_bUnroll = getValue<unsigned char>(buffer, offset) != 0;
+	postProcessing.m_bReduceKeys = getValue<unsigned char>(buffer, offset) != 0;
+	postProcessing.m_reductionAngleTolerance = getValue<double>(buffer, offset);
+	postProcessing.m_reductionPositionTolerance = getValue<double>(buffer, offset);
+	return true;
+}
+
+/// <summary>
+/// Makes sure everything written so far reaches the disk
+/// </summary>
+/// <returns>False if buffered data could not be written</returns>
+static bool commitFile(FILE *pFile) {
+	if (fflush(pFile) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(pFile)) == 0;
+#else
+	return fsync(fileno(pFile)) == 0;
+#endif
+}
+
+
+/// <summary>
+/// Computes CRC-32 ( IEEE 802.3 ) of a buffer
+/// </summary>
+/// <param name="data">Data buffer</param>
+/// <param name="size">Buffer size, in bytes</param>
+/// <param name="crc">Previous CRC, when computing it over several buffers</param>
+unsigned int computeCRC32(const void *data, size_t size, unsigned int crc) {
+	static unsigned int s_crcTable[256];
+	static std::once_flag s_crcTableFlag;
+
+	std::call_once(s_crcTableFlag, [] {
+		for (unsigned int i = 0; i < 256; i++) {
+			unsigned int c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			s_crcTable[i] = c;
+		}
+	});
+
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = s_crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+/// <summary>
+/// Returns the journal file name used for a given export file
+/// </summary>
+/// <param name="exportFileName">Export file name</param>
+FbxString getCaptureJournalFileName(const char *exportFileName) {
+	FbxString journalName(exportFileName);
+	journalName += CAPTURE_JOURNAL_EXTENSION;
+	return journalName;
+}
+
+/// <summary>
+/// Returns the export file name a given journal was recorded for ( inverse of getCaptureJournalFileName )
+/// </summary>
+/// <param name="journalFileName">Journal file name</param>
+FbxString getExportFileNameFromJournal(const char *journalFileName) {
+	FbxString exportName(journalFileName);
+	FbxString journalExtension(CAPTURE_JOURNAL_EXTENSION);
+
+	// Strip journal extension
+	if (exportName.GetLen() > journalExtension.GetLen() &&
+		exportName.Right(journalExtension.GetLen()).Lower() == journalExtension)
+		exportName = exportName.Left(exportName.GetLen() - journalExtension.GetLen());
+
+	// Journals that were renamed may have lost the original extension
+	if (exportName.GetLen() < 4 || exportName.Right(4).Lower() != ".fbx")
+		exportName += ".fbx";
+
+	return exportName;
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+CaptureJournalWriter::CaptureJournalWriter() :
+m_pFile(NULL),
+m_quit(false),
+m_nCommittedFrames(0),
+m_bFailed(false),
+m_nLostFrames(0)
+{
+}
+
+/// <summary>
+/// Destructor, commits anything still pending
+/// </summary>
+CaptureJournalWriter::~CaptureJournalWriter() {
+	close();
+}
+
+/// <summary>
+/// Creates a new journal file ( overwriting any existing one ) and starts the writer thread
+/// </summary>
+/// <param name="fileName">Journal file name</param>
+/// <param name="settings">Settings the take is recorded with, written in the header</param>
+/// <returns>True if file could be created</returns>
+bool CaptureJournalWriter::open(const char *fileName, const CaptureJournalSettings &settings) {
+
+	// Only one journal at a time
+	close();
+
+	if (!FbxFileUtils::Exist(fileName) || FbxFileUtils::Delete(fileName)) {
+		m_pFile = fopen(fileName, "wb");
+	}
+
+	if (!m_pFile)
+		return false;
+
+	// Write file header
+	std::vector<unsigned char> header;
+	header.insert(header.end(), c_journalMagic, c_journalMagic + sizeof(c_journalMagic));
+	putValue<unsigned short>(header, CAPTURE_JOURNAL_VERSION);
+	putValue<unsigned char>(header, BODY_COUNT);
+	putValue<unsigned char>(header, JointType_Count);
+	putValue<unsigned int>(header, 0);
+	putValue<unsigned int>(header, computeCRC32(&header[0], header.size()));
+
+	// Settings follow, with their own size and CRC
+	size_t settingsOffset = header.size();
+	header.resize(settingsOffset + c_settingsHeaderSize);
+	serializeSettings(header, settings);
+	unsigned int settingsSize = (unsigned int)(header.size() - settingsOffset - c_settingsHeaderSize);
+	unsigned int settingsCRC = computeCRC32(&settingsSize, sizeof(settingsSize));
+	settingsCRC = computeCRC32(&header[settingsOffset + c_settingsHeaderSize], settingsSize, settingsCRC);
+	memcpy(&header[settingsOffset], &settingsSize, sizeof(settingsSize));
+	memcpy(&header[settingsOffset + 4], &settingsCRC, sizeof(settingsCRC));
+
+	if (fwrite(&header[0], 1, header.size(), m_pFile) != header.size() || !commitFile(m_pFile)) {
+		fclose(m_pFile);
+		m_pFile = NULL;
+		return false;
+	}
+
+	// Frames that arrived while closing the previous journal do not belong to this one
+	m_pending.clear();
+	m_nCommittedFrames = 0;
+	m_bFailed = false;
+	m_nLostFrames = 0;
+	m_quit = false;
+	m_writer = std::thread(&CaptureJournalWriter::WriterThread, this);
+
+	return true;
+}
+
+/// <summary>
+/// Queues a frame to be written. Never waits for disk access
+/// </summary>
+/// <param name="frame">Decoded frame</param>
+void CaptureJournalWriter::append(const BodyFrame_ptr &frame) {
+	if (!m_pFile || !frame)
+		return;
+
+	// Nothing is written after a failure, so frames are not kept in memory either
+	if (m_bFailed) {
+		m_nLostFrames++;
+		return;
+	}
+
+	size_t pendingCount;
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_pending.push_back(frame);
+		pendingCount = m_pending.size();
+	}
+
+	// Enough frames for a full group, no need to wait for the interval
+	if (pendingCount >= c_groupCommitFrameCount)
+		m_pendingCondition.notify_one();
+}
+
+/// <summary>
+/// Commits every queued frame, stops the writer thread and closes the file
+/// </summary>
+void CaptureJournalWriter::close() {
+	if (m_writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_pendingMutex);
+			m_quit = true;
+		}
+		m_pendingCondition.notify_one();
+		m_writer.join();
+	}
+
+	if (m_pFile) {
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+}
+
+/// <summary>
+/// Writer thread, commits queued frames in groups
+/// </summary>
+void CaptureJournalWriter::WriterThread() {
+
+	std::vector<BodyFrame_ptr> group;
+	bool quit = false;
+	const std::chrono::milliseconds interval((long long)c_groupCommitInterval);
+
+	while (!quit) {
+		{
+			std::unique_lock<std::mutex> lock(m_pendingMutex);
+			m_pendingCondition.wait_for(lock, interval,
+				[this] { return m_quit || m_pending.size() >= c_groupCommitFrameCount; });
+
+			// Take every pending frame at once, so capture path is never held by disk access
+			group.swap(m_pending);
+			quit = m_quit;
+		}
+
+		if (!group.empty()) {
+			if (m_bFailed) {
+				m_nLostFrames += (unsigned int)group.size();
+			}
+			else if (WriteChunk(group)) {
+				m_nCommittedFrames += (unsigned int)group.size();
+			}
+			else {
+				// Anything appended after a partial chunk could not be read back, so writing stops here.
+				// Frames committed so far stay readable ( see CaptureJournalReader::recover )
+				m_bFailed = true;
+				m_nLostFrames += (unsigned int)group.size();
+				UI_Printf("Capture journal could not be written, journaling stopped after %u frames", (unsigned int)m_nCommittedFrames);
+			}
+			group.clear();
+		}
+	}
+}
+
+/// <summary>
+/// Serializes frames into a single chunk and commits it to disk
+/// </summary>
+/// <param name="frames">Frames to be written</param>
+/// <returns>True if chunk was written and committed completely</returns>
+bool CaptureJournalWriter::WriteChunk(const std::vector<BodyFrame_ptr> &frames) {
+
+	std::vector<unsigned char> &buffer = m_chunkBuffer;
+	buffer.clear();
+
+	// Leave room for the chunk header, filled in once the payload is known
+	buffer.resize(c_chunkHeaderSize);
+
+	for (auto &frame : frames) {
+
+		unsigned char trackedCount = 0;
+		for (int i = 0; i < BODY_COUNT; i++) {
+			if (frame->bodies[i].isTracked)
+				trackedCount++;
+		}
+
+		putValue<INT64>(buffer, frame->frameTime);
+		putValue<unsigned char>(buffer, frame->readStatus ? 1 : 0);
+		putValue<unsigned char>(buffer, trackedCount);
+
+		for (int i = 0; i < BODY_COUNT; i++) {
+			const BodyData &body = frame->bodies[i];
+			if (!body.isTracked)
+				continue;
+
+			putValue<unsigned char>(buffer, (unsigned char)i);
+			putValue<unsigned char>(buffer, (unsigned char)body.leftHandState);
+			putValue<unsigned char>(buffer, (unsigned char)body.rightHandState);
+			putValue<unsigned char>(buffer, 0);
+			putValue<UINT64>(buffer, body.trackingId);
+
+			for (int j = 0; j < JointType_Count; j++) {
+				const CameraSpacePoint &pos = body.joints[j].Position;
+				const Vector4 &ori = body.orientations[j].Orientation;
+				putValue<float>(buffer, pos.X);
+				putValue<float>(buffer, pos.Y);
+				putValue<float>(buffer, pos.Z);
+				putValue<float>(buffer, ori.x);
+				putValue<float>(buffer, ori.y);
+				putValue<float>(buffer, ori.z);
+				putValue<float>(buffer, ori.w);
+				putValue<unsigned char>(buffer, (unsigned char)body.joints[j].TrackingState);
+			}
+		}
+	}
+
+	// Fill chunk header in
+	unsigned int payloadSize = (unsigned int)(buffer.size() - c_chunkHeaderSize);
+	unsigned int frameCount = (unsigned int)frames.size();
+	unsigned int crc = computeCRC32(&payloadSize, sizeof(payloadSize));
+	crc = computeCRC32(&frameCount, sizeof(frameCount), crc);
+	crc = computeCRC32(&buffer[c_chunkHeaderSize], payloadSize, crc);
+
+	memcpy(&buffer[0], c_chunkMagic, sizeof(c_chunkMagic));
+	memcpy(&buffer[4], &payloadSize, sizeof(payloadSize));
+	memcpy(&buffer[8], &frameCount, sizeof(frameCount));
+	memcpy(&buffer[12], &crc, sizeof(crc));
+
+	// Single write and single commit for the whole group. A short write may only show when buffers are flushed
+	bool success = fwrite(&buffer[0], 1, buffer.size(), m_pFile) == buffer.size();
+	return commitFile(m_pFile) && success;
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+CaptureJournalReader::CaptureJournalReader() :
+m_pFile(NULL),
+m_nChunkOffset(0),
+m_nChunkFramesLeft(0),
+m_bTruncated(false),
+m_nValidLength(0),
+m_bHasSettings(false)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+CaptureJournalReader::~CaptureJournalReader() {
+	close();
+}
+
+/// <summary>
+/// Opens a journal and validates its header
+/// </summary>
+/// <param name="fileName">Journal file name</param>
+/// <returns>True if file is a journal this version can read</returns>
+bool CaptureJournalReader::open(const char *fileName) {
+	close();
+
+	m_pFile = fopen(fileName, "rb");
+	if (!m_pFile)
+		return false;
+
+	unsigned char header[c_fileHeaderSize];
+	if (fread(header, 1, sizeof(header), m_pFile) != sizeof(header)) {
+		close();
+		return false;
+	}
+
+	size_t offset = sizeof(c_journalMagic);
+	unsigned short version = getValue<unsigned short>(header, offset);
+	unsigned char bodyCount = getValue<unsigned char>(header, offset);
+	unsigned char jointCount = getValue<unsigned char>(header, offset);
+	getValue<unsigned int>(header, offset);
+	unsigned int headerCRC = getValue<unsigned int>(header, offset);
+
+	bool isValid = (memcmp(header, c_journalMagic, sizeof(c_journalMagic)) == 0) &&
+		(headerCRC == computeCRC32(header, c_fileHeaderSize - sizeof(headerCRC))) &&
+		(version >= c_oldestJournalVersion && version <= CAPTURE_JOURNAL_VERSION) &&
+		(bodyCount == BODY_COUNT) &&
+		(jointCount == JointType_Count);
+
+	if (!isValid) {
+		close();
+		return false;
+	}
+
+	m_nValidLength = c_fileHeaderSize;
+
+	// Journals without settings were recorded with the defaults
+	if (version >= c_settingsJournalVersion && !ReadSettings()) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Reads and validates the settings following the file header
+/// </summary>
+/// <returns>False if settings are truncated or corrupted</returns>
+bool CaptureJournalReader::ReadSettings() {
+
+	unsigned char header[c_settingsHeaderSize];
+	if (fread(header, 1, sizeof(header), m_pFile) != sizeof(header))
+		return false;
+
+	size_t offset = 0;
+	unsigned int settingsSize = getValue<unsigned int>(header, offset);
+	unsigned int settingsCRC = getValue<unsigned int>(header, offset);
+	if (settingsSize == 0 || settingsSize > c_maxSettingsSize)
+		return false;
+
+	std::vector<unsigned char> settings(settingsSize);
+	if (fread(&settings[0], 1, settingsSize, m_pFile) != settingsSize)
+		return false;
+
+	unsigned int crc = computeCRC32(&settingsSize, sizeof(settingsSize));
+	crc = computeCRC32(&settings[0], settingsSize, crc);
+	if (crc != settingsCRC || !deserializeSettings(&settings[0], settingsSize, m_settings))
+		return false;
+
+	m_bHasSettings = true;
+	m_nValidLength += c_settingsHeaderSize + settingsSize;
+	return true;
+}
+
+/// <summary>
+/// Closes the journal
+/// </summary>
+void CaptureJournalReader::close() {
+	if (m_pFile) {
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+
+	m_chunkBuffer.clear();
+	m_nChunkOffset = 0;
+	m_nChunkFramesLeft = 0;
+	m_bTruncated = false;
+	m_nValidLength = 0;
+	m_settings = CaptureJournalSettings();
+	m_bHasSettings = false;
+}
+
+/// <summary>
+/// Loads and validates the next chunk
+/// </summary>
+/// <returns>False at end of file or at an invalid chunk</returns>
+bool CaptureJournalReader::ReadChunk() {
+
+	unsigned char header[c_chunkHeaderSize];
+	size_t headerRead = fread(header, 1, sizeof(header), m_pFile);
+
+	// Clean end of file
+	if (headerRead == 0)
+		return false;
+
+	size_t offset = sizeof(c_chunkMagic);
+	unsigned int payloadSize = 0, frameCount = 0, chunkCRC = 0;
+	if (headerRead == sizeof(header)) {
+		payloadSize = getValue<unsigned int>(header, offset);
+		frameCount = getValue<unsigned int>(header, offset);
+		chunkCRC = getValue<unsigned int>(header, offset);
+	}
+
+	if (headerRead != sizeof(header) || memcmp(header, c_chunkMagic, sizeof(c_chunkMagic)) != 0 || payloadSize > c_maxChunkSize) {
+		m_bTruncated = true;
+		return false;
+	}
+
+	m_chunkBuffer.resize(payloadSize);
+	if (payloadSize > 0 && fread(&m_chunkBuffer[0], 1, payloadSize, m_pFile) != payloadSize) {
+		m_bTruncated = true;
+		return false;
+	}
+
+	unsigned int crc = computeCRC32(&payloadSize, sizeof(payloadSize));
+	crc = computeCRC32(&frameCount, sizeof(frameCount), crc);
+	if (payloadSize > 0)
+		crc = computeCRC32(&m_chunkBuffer[0], payloadSize, crc);
+
+	if (crc != chunkCRC) {
+		m_bTruncated = true;
+		return false;
+	}
+
+	m_nValidLength += c_chunkHeaderSize + payloadSize;
+	m_nChunkOffset = 0;
+	m_nChunkFramesLeft = frameCount;
+	return true;
+}
+
+/// <summary>
+/// Reads the next frame from the journal
+/// </summary>
+/// <param name="frame">Output frame</param>
+/// <returns>False when there are no more valid frames</returns>
+bool CaptureJournalReader::readFrame(BodyFrame &frame) {
+	if (!m_pFile)
+		return false;
+
+	// Move on to the next chunk, skipping empty ones
+	while (m_nChunkFramesLeft == 0) {
+		if (m_bTruncated || !ReadChunk())
+			return false;
+	}
+
+	const unsigned char *buffer = m_chunkBuffer.empty() ? NULL : &m_chunkBuffer[0];
+	size_t size = m_chunkBuffer.size();
+	size_t &offset = m_nChunkOffset;
+
+	// Chunk passed its CRC, but make sure it is consistent before trusting it
+	if (offset + c_frameHeaderSize > size) {
+		m_bTruncated = true;
+		return false;
+	}
+
+	frame.frameTime = getValue<INT64>(buffer, offset);
+	frame.captureCounter = 0;
+	frame.readStatus = getValue<unsigned char>(buffer, offset) != 0;
+	unsigned char trackedCount = getValue<unsigned char>(buffer, offset);
+
+	for (int i = 0; i < BODY_COUNT; i++) {
+		frame.bodies[i].isTracked = false;
+		frame.bodies[i].trackingId = 0;
+		frame.bodies[i].leftHandState = HandState_Unknown;
+		frame.bodies[i].rightHandState = HandState_Unknown;
+	}
+
+	for (unsigned char b = 0; b < trackedCount; b++) {
+		if (offset + c_bodyHeaderSize + JointType_Count * c_jointRecordSize > size) {
+			m_bTruncated = true;
+			return false;
+		}
+
+		unsigned char slot = getValue<unsigned char>(buffer, offset);
+		if (slot >= BODY_COUNT) {
+			m_bTruncated = true;
+			return false;
+		}
+
+		BodyData &body = frame.bodies[slot];
+		body.isTracked = true;
+		body.leftHandState = HandState(getValue<unsigned char>(buffer, offset));
+		body.rightHandState = HandState(getValue<unsigned char>(buffer, offset));
+		getValue<unsigned char>(buffer, offset);
+		body.trackingId = getValue<UINT64>(buffer, offset);
+
+		for (int j = 0; j < JointType_Count; j++) {
+			Joint &joint = body.joints[j];
+			JointOrientation &ori = body.orientations[j];
+
+			joint.JointType = JointType(j);
+			joint.Position.X = getValue<float>(buffer, offset);
+			joint.Position.Y = getValue<float>(buffer, offset);
+			joint.Position.Z = getValue<float>(buffer, offset);
+
+			ori.JointType = JointType(j);
+			ori.Orientation.x = getValue<float>(buffer, offset);
+			ori.Orientation.y = getValue<float>(buffer, offset);
+			ori.Orientation.z = getValue<float>(buffer, offset);
+			ori.Orientation.w = getValue<float>(buffer, offset);
+
+			joint.TrackingState = TrackingState(getValue<unsigned char>(buffer, offset));
+		}
+	}
+
+	m_nChunkFramesLeft--;
+	return true;
+}
+
+/// <summary>
+/// Rewrites a truncated or corrupted journal, keeping only its valid chunks
+/// </summary>
+/// <param name="fileName">Journal file name</param>
+/// <param name="recoveredFrames">Output, number of frames kept. May be NULL</param>
+/// <returns>True if the journal is valid after the call</returns>
+bool CaptureJournalReader::recover(const char *fileName, unsigned int *recoveredFrames) {
+
+	// Scan the whole journal, to find where valid data ends
+	CaptureJournalReader reader;
+	if (!reader.open(fileName))
+		return false;
+
+	std::unique_ptr<BodyFrame> frame(new BodyFrame);
+	unsigned int frameCount = 0;
+	while (reader.readFrame(*frame))
+		frameCount++;
+
+	if (recoveredFrames)
+		*recoveredFrames = frameCount;
+
+	bool isTruncated = reader.isTruncated();
+	long long validLength = reader.getValidLength();
+
+	// Frames inside a partially valid chunk are not kept, drop the whole chunk
+	if (isTruncated && reader.m_nChunkFramesLeft > 0) {
+		validLength -= c_chunkHeaderSize + reader.m_chunkBuffer.size();
+	}
+	reader.close();
+
+	// Nothing to be fixed
+	if (!isTruncated)
+		return true;
+
+	// Copy valid part to a temporary file, and replace the original with it
+	FbxString tempFileName(fileName);
+	tempFileName += ".tmp";
+
+	FILE *pSource = fopen(fileName, "rb");
+	FILE *pTarget = fopen(tempFileName.Buffer(), "wb");
+	bool success = pSource && pTarget;
+
+	std::vector<unsigned char> copyBuffer(64 * 1024);
+	long long left = validLength;
+	while (success && left > 0) {
+		size_t toCopy = (size_t)((left < (long long)copyBuffer.size()) ? left : copyBuffer.size());
+		success = (fread(&copyBuffer[0], 1, toCopy, pSource) == toCopy) &&
+			(fwrite(&copyBuffer[0], 1, toCopy, pTarget) == toCopy);
+		left -= toCopy;
+	}
+
+	if (pTarget) {
+		commitFile(pTarget);
+		fclose(pTarget);
+	}
+	if (pSource)
+		fclose(pSource);
+
+	success = success && FbxFileUtils::Delete(fileName) && FbxFileUtils::Rename(tempFileName.Buffer(), fileName);
+
+	// Count frames actually kept
+	if (success && recoveredFrames) {
+		*recoveredFrames = 0;
+		if (reader.open(fileName)) {
+			while (reader.readFrame(*frame))
+				(*recoveredFrames)++;
+		}
+	}
+
+	return success;
+}
+
+
+/// <summary>
+/// Rebuilds the animation of a take, by mapping every journaled frame exactly as the exporter did while recording.
+/// Post processing is left to the caller, as the saver does it apart from mapping
+/// </summary>
+/// <param name="reader">Opened journal</param>
+/// <param name="session">Take being mapped ( its scene needs an animation stack and layer )</param>
+/// <param name="pSettings">Keying and joint smoothing the take is mapped with ( NULL uses the ones recorded in the journal )</param>
+/// <returns>Number of frames replayed</returns>
+unsigned int replayCaptureJournal(CaptureJournalReader &reader, MappingSession &session, const CaptureJournalSettings *pSettings) {
+
+	const CaptureJournalSettings &settings = pSettings ? *pSettings : reader.getSettings();
+	session.m_keying = settings.m_keying;
+	session.m_jointFilter.setSettings(settings.m_jointFilter);
+
+	unsigned int frameCount = 0;
+
+	// Frames are big, keep them off the stack
+	std::unique_ptr<BodyFrame> frame(new BodyFrame);
+
+	while (reader.readFrame(*frame)) {
+		if (KinectSkeletonMapper::mapFrame(session, *frame))
+			frameCount++;
+	}
+
+	return frameCount;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "../stdafx.h"
+#include "BodyFrame.h"
+#include "SkeletonBinding.h"
+#include "PostProcessingFilters.h"
+
+#include <stdio.h>
+
+/*
+	Capture journal: compact, append-only record of the decoded frames of a take.
+
+	Layout ( little endian ):
+	  File header  : magic "KCJF", uint16 version, uint8 body count, uint8 joint count, uint32 reserved, uint32 CRC
+	  Settings     : uint32 payload size, uint32 CRC, payload ( since version 2, see CaptureJournalSettings )
+	                 uint8 adaptive keying, float64 angle tolerance, float64 position tolerance,
+	                 uint8 joint smoothing, float32 inferred cutoff scale, and for each joint float32 position min cutoff,
+	                 position beta, orientation min cutoff, orientation beta,
+	                 int32 resample time mode, uint8 unroll, uint8 reduce keys, float64 reduction angle tolerance,
+	                 float64 reduction position tolerance
+	  Chunk        : uint32 magic "CHNK", uint32 payload size, uint32 frame count, uint32 CRC, payload
+	  Frame record : int64 frame time, uint8 read status, uint8 tracked body count, then for each tracked body
+	                 uint8 slot, uint8 left hand state, uint8 right hand state, uint8 padding, uint64 tracking id,
+	                 and for each joint float3 position, float4 orientation, uint8 tracking state
+
+	Chunk CRCs cover the chunk size, frame count and payload, so a chunk that was only partially written
+	( e.g. power loss ) is detected and everything before it can still be recovered.
+*/
+
+// Journal format version ( version 1 journals, with no settings, can still be read )
+#define CAPTURE_JOURNAL_VERSION 2
+
+// Default extension for journal files
+#define CAPTURE_JOURNAL_EXTENSION ".kcj"
+
+
+/*
+	Settings a take was recorded with, so replaying its journal gives the same FBX file the recording did
+*/
+struct CaptureJournalSettings {
+	// How keys were added
+	KeyingSettings m_keying;
+
+	// How joints were smoothed before they were keyed
+	JointFilterSettings m_jointFilter;
+
+	// Filters run before the take was saved
+	PostProcessingSettings m_postProcessing;
+};
+
+
+/*
+	Writes a capture journal from a background thread.
+	Frames queued by the capture path are grouped into chunks, each one written and committed to disk at once.
+	Once a chunk cannot be written ( e.g. disk full ), the writer stops: every frame after it is counted as lost
+	instead of being appended behind a broken chunk
+*/
+class CaptureJournalWriter {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	CaptureJournalWriter();
+
+	/// <summary>
+	/// Destructor, commits anything still pending
+	/// </summary>
+	~CaptureJournalWriter();
+
+	/// <summary>
+	/// Creates a new journal file ( overwriting any existing one ) and starts the writer thread
+	/// </summary>
+	/// <param name="fileName">Journal file name</param>
+	/// <param name="settings">Settings the take is recorded with, written in the header</param>
+	/// <returns>True if file could be created</returns>
+	bool open(const char *fileName, const CaptureJournalSettings &settings = CaptureJournalSettings());
+
+	/// <summary>
+	/// Queues a frame to be written. Never waits for disk access
+	/// </summary>
+	/// <param name="frame">Decoded frame</param>
+	void append(const BodyFrame_ptr &frame);
+
+	/// <summary>
+	/// Commits every queued frame, stops the writer thread and closes the file
+	/// </summary>
+	void close();
+
+	/// <summary>
+	/// Returns whether a journal is currently open
+	/// </summary>
+	bool isOpen() { return m_pFile != NULL; };
+
+	/// <summary>
+	/// Number of frames committed to disk so far
+	/// </summary>
+	unsigned int getCommittedFrameCount() { return m_nCommittedFrames; };
+
+	/// <summary>
+	/// Returns whether writing failed, leaving the journal incomplete
+	/// </summary>
+	bool hasFailed() { return m_bFailed; };
+
+	/// <summary>
+	/// Number of frames queued that never reached the journal, because writing failed
+	/// </summary>
+	unsigned int getLostFrameCount() { return m_nLostFrames; };
+
+private:
+	// Maximum time frames wait in memory before being committed, in milliseconds
+	static const unsigned int c_groupCommitInterval = 250;
+
+	// Frames queued beyond this amount wake the writer up before the interval expires
+	static const size_t c_groupCommitFrameCount = 32;
+
+	// Journal file
+	FILE *m_pFile;
+
+	// Background writer
+	std::thread m_writer;
+
+	// Frames waiting to be written, protected by m_pendingMutex
+	std::vector<BodyFrame_ptr> m_pending;
+	std::mutex m_pendingMutex;
+	std::condition_variable m_pendingCondition;
+
+	// Quit writer thread
+	bool m_quit;
+
+	// Serialization buffer, reused between chunks
+	std::vector<unsigned char> m_chunkBuffer;
+
+	// Number of frames committed to disk
+	std::atomic<unsigned int> m_nCommittedFrames;
+
+	// Writing failed, and frames lost since
+	std::atomic<bool> m_bFailed;
+	std::atomic<unsigned int> m_nLostFrames;
+
+	/// <summary>
+	/// Writer thread, commits queued frames in groups
+	/// </summary>
+	void WriterThread();
+
+	/// <summary>
+	/// Serializes frames into a single chunk and commits it to disk
+	/// </summary>
+	/// <param name="frames">Frames to be written</param>
+	/// <returns>True if chunk was written and committed completely</returns>
+	bool WriteChunk(const std::vector<BodyFrame_ptr> &frames);
+};
+
+
+/*
+	Reads frames back from a capture journal
+*/
+class CaptureJournalReader {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	CaptureJournalReader();
+
+	/// <summary>
+	/// Destructor
+	/// </summary>
+	~CaptureJournalReader();
+
+	/// <summary>
+	/// Opens a journal and validates its header
+	/// </summary>
+	/// <param name="fileName">Journal file name</param>
+	/// <returns>True if file is a journal this version can read</returns>
+	bool open(const char *fileName);
+
+	/// <summary>
+	/// Closes the journal
+	/// </summary>
+	void close();
+
+	/// <summary>
+	/// Reads the next frame from the journal
+	/// </summary>
+	/// <param name="frame">Output frame</param>
+	/// <returns>False when there are no more valid frames</returns>
+	bool readFrame(BodyFrame &frame);
+
+	/// <summary>
+	/// Returns true if reading stopped at a chunk that was truncated or corrupted
+	/// </summary>
+	bool isTruncated() { return m_bTruncated; };
+
+	/// <summary>
+	/// Returns whether the journal recorded its settings ( journals written before version 2 did not )
+	/// </summary>
+	bool hasSettings() { return m_bHasSettings; };
+
+	/// <summary>
+	/// Settings the take was recorded with ( defaults if the journal did not record them )
+	/// </summary>
+	const CaptureJournalSettings &getSettings() { return m_settings; };
+
+	/// <summary>
+	/// Number of bytes, from the beginning of the file, known to hold valid data
+	/// </summary>
+	long long getValidLength() { return m_nValidLength; };
+
+	/// <summary>
+	/// Rewrites a truncated or corrupted journal, keeping only its valid chunks
+	/// </summary>
+	/// <param name="fileName">Journal file name</param>
+	/// <param name="recoveredFrames">Output, number of frames kept. May be NULL</param>
+	/// <returns>True if the journal is valid after the call</returns>
+	static bool recover(const char *fileName, unsigned int *recoveredFrames = NULL);
+
+private:
+	// Journal file
+	FILE *m_pFile;
+
+	// Current chunk payload, and read position within it
+	std::vector<unsigned char> m_chunkBuffer;
+	size_t m_nChunkOffset;
+
+	// Frames left in current chunk
+	unsigned int m_nChunkFramesLeft;
+
+	// Reading stopped at an invalid chunk
+	bool m_bTruncated;
+
+	// End of the last valid chunk
+	long long m_nValidLength;
+
+	// Settings read from the header
+	CaptureJournalSettings m_settings;
+	bool m_bHasSettings;
+
+	/// <summary>
+	/// Reads and validates the settings following the file header
+	/// </summary>
+	/// <returns>False if settings are truncated or corrupted</returns>
+	bool ReadSettings();
+
+	/// <summary>
+	/// Loads and validates the next chunk
+	/// </summary>
+	/// <returns>False at end of file or at an invalid chunk</returns>
+	bool ReadChunk();
+};
+
+
+/// <summary>
+/// Rebuilds the animation of a take, by mapping every journaled frame exactly as the exporter did while recording.
+/// Post processing is left to the caller, as the saver does it apart from mapping
+/// </summary>
+/// <param name="reader">Opened journal</param>
+/// <param name="session">Take being mapped ( its scene needs an animation stack and layer )</param>
+/// <param name="pSettings">Keying and joint smoothing the take is mapped with ( NULL uses the ones recorded in the journal )</param>
+/// <returns>Number of frames replayed</returns>
+unsigned int replayCaptureJournal(CaptureJournalReader &reader, MappingSession &session, const CaptureJournalSettings *pSettings = NULL);
+
+/// <summary>
+/// Computes CRC-32 ( IEEE 802.3 ) of a buffer
+/// </summary>
+/// <param name="data">Data buffer</param>
+/// <param name="size">Buffer size, in bytes</param>
+/// <param name="crc">Previous CRC, when computing it over several buffers</param>
+unsigned int computeCRC32(const void *data, size_t size, unsigned int crc = 0);
+
+/// <summary>
+/// Returns the journal file name used for a given export file
+/// </summary>
+/// <param name="exportFileName">Export file name</param>
+FbxString getCaptureJournalFileName(const char *exportFileName);
+
+/// <summary>
+/// Returns the export file name a given journal was recorded for ( inverse of getCaptureJournalFileName )
+/// </summary>
+/// <param name="journalFileName">Journal file name</param>
+FbxString getExportFileNameFromJournal(const char *journalFileName);
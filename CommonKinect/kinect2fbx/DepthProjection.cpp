@@ -0,0 +1,120 @@
+#include "DepthProjection.h"
+
+#include <limits>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define DEPTHPROJECTION_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/// <summary>
+/// Same as projectToDepthSpace, one point at a time without SSE
+/// </summary>
+void projectToDepthSpaceScalar(const DepthIntrinsics &intrinsics, const CameraSpacePoint *points, size_t count, float *depthX, float *depthY) {
+
+	const float invalid = -std::numeric_limits<float>::infinity();
+
+	for (size_t i = 0; i < count; i++) {
+		// Points behind the camera cannot be seen
+		if (!(points[i].Z > 0.0f)) {
+			depthX[i] = invalid;
+			depthY[i] = invalid;
+			continue;
+		}
+
+		// Normalized image coordinates
+		float x = points[i].X / points[i].Z;
+		float y = points[i].Y / points[i].Z;
+
+		// Radial distortion
+		float r2 = x * x + y * y;
+		float distortion = 1.0f + r2 * (intrinsics.radialDistortionSecondOrder + r2 * (intrinsics.radialDistortionFourthOrder + r2 * intrinsics.radialDistortionSixthOrder));
+
+		// Depth image is mirrored, and its Y axis points down
+		depthX[i] = intrinsics.principalPointX + intrinsics.focalLengthX * x * distortion;
+		depthY[i] = intrinsics.principalPointY - intrinsics.focalLengthY * y * distortion;
+	}
+}
+
+#ifdef DEPTHPROJECTION_SSE2
+
+/// <summary>
+/// Projects camera space points to depth image pixels, with radial distortion. Uses SSE when available
+/// </summary>
+/// <param name="intrinsics">Depth camera calibration</param>
+/// <param name="points">Camera space points, in meters</param>
+/// <param name="count">Number of points</param>
+/// <param name="depthX, depthY">Output, depth image coordinates ( -infinity for points not in front of the camera, as the SDK does )</param>
+void projectToDepthSpace(const DepthIntrinsics &intrinsics, const CameraSpacePoint *points, size_t count, float *depthX, float *depthY) {
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 invalid = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+	const __m128 fx = _mm_set1_ps(intrinsics.focalLengthX);
+	const __m128 fy = _mm_set1_ps(intrinsics.focalLengthY);
+	const __m128 cx = _mm_set1_ps(intrinsics.principalPointX);
+	const __m128 cy = _mm_set1_ps(intrinsics.principalPointY);
+	const __m128 k2 = _mm_set1_ps(intrinsics.radialDistortionSecondOrder);
+	const __m128 k4 = _mm_set1_ps(intrinsics.radialDistortionFourthOrder);
+	const __m128 k6 = _mm_set1_ps(intrinsics.radialDistortionSixthOrder);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const CameraSpacePoint *p = points + i;
+
+		// Points are stored X, Y, Z one after another, gather each coordinate of four of them
+		__m128 X = _mm_setr_ps(p[0].X, p[1].X, p[2].X, p[3].X);
+		__m128 Y = _mm_setr_ps(p[0].Y, p[1].Y, p[2].Y, p[3].Y);
+		__m128 Z = _mm_setr_ps(p[0].Z, p[1].Z, p[2].Z, p[3].Z);
+
+		// Points behind the camera cannot be seen ( their lanes are replaced at the end )
+		__m128 visible = _mm_cmpgt_ps(Z, zero);
+		__m128 invZ = _mm_div_ps(one, _mm_or_ps(_mm_and_ps(visible, Z), _mm_andnot_ps(visible, one)));
+
+		// Normalized image coordinates
+		__m128 x = _mm_mul_ps(X, invZ);
+		__m128 y = _mm_mul_ps(Y, invZ);
+
+		// Radial distortion
+		__m128 r2 = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+		__m128 distortion = _mm_add_ps(k4, _mm_mul_ps(r2, k6));
+		distortion = _mm_add_ps(k2, _mm_mul_ps(r2, distortion));
+		distortion = _mm_add_ps(one, _mm_mul_ps(r2, distortion));
+
+		// Depth image is mirrored, and its Y axis points down
+		__m128 u = _mm_add_ps(cx, _mm_mul_ps(fx, _mm_mul_ps(x, distortion)));
+		__m128 v = _mm_sub_ps(cy, _mm_mul_ps(fy, _mm_mul_ps(y, distortion)));
+
+		_mm_storeu_ps(depthX + i, _mm_or_ps(_mm_and_ps(visible, u), _mm_andnot_ps(visible, invalid)));
+		_mm_storeu_ps(depthY + i, _mm_or_ps(_mm_and_ps(visible, v), _mm_andnot_ps(visible, invalid)));
+	}
+
+	// Remaining points
+	projectToDepthSpaceScalar(intrinsics, points + i, count - i, depthX + i, depthY + i);
+}
+
+/// <summary>
+/// Whether projectToDepthSpace was built with SSE
+/// </summary>
+bool isDepthProjectionVectorized() {
+	return true;
+}
+
+#else
+
+/// <summary>
+/// Projects camera space points to depth image pixels, with radial distortion. Uses SSE when available
+/// </summary>
+void projectToDepthSpace(const DepthIntrinsics &intrinsics, const CameraSpacePoint *points, size_t count, float *depthX, float *depthY) {
+	projectToDepthSpaceScalar(intrinsics, points, count, depthX, depthY);
+}
+
+/// <summary>
+/// Whether projectToDepthSpace was built with SSE
+/// </summary>
+bool isDepthProjectionVectorized() {
+	return false;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "KinectTypes.h"
+
+/*
+	Projection of camera space points to the depth image, using the calibration of the depth camera.
+	Replaces one coordinate mapper call per joint with a single pass over every joint of a frame
+*/
+
+// Depth camera calibration ( same fields as the SDK CameraIntrinsics )
+struct DepthIntrinsics {
+	float focalLengthX, focalLengthY;
+	float principalPointX, principalPointY;
+	float radialDistortionSecondOrder, radialDistortionFourthOrder, radialDistortionSixthOrder;
+
+	/// <summary>
+	/// Whether calibration is known. Sensor reports zeros until it has been running for a while
+	/// </summary>
+	bool isValid() const { return focalLengthX > 0.0f && focalLengthY > 0.0f; };
+};
+
+/// <summary>
+/// Projects camera space points to depth image pixels, with radial distortion. Uses SSE when available
+/// </summary>
+/// <param name="intrinsics">Depth camera calibration</param>
+/// <param name="points">Camera space points, in meters</param>
+/// <param name="count">Number of points</param>
+/// <param name="depthX, depthY">Output, depth image coordinates ( -infinity for points not in front of the camera, as the SDK does )</param>
+void projectToDepthSpace(const DepthIntrinsics &intrinsics, const CameraSpacePoint *points, size_t count, float *depthX, float *depthY);
+
+/// <summary>
+/// Same as projectToDepthSpace, one point at a time without SSE
+/// </summary>
+void projectToDepthSpaceScalar(const DepthIntrinsics &intrinsics, const CameraSpacePoint *points, size_t count, float *depthX, float *depthY);
+
+/// <summary>
+/// Whether projectToDepthSpace was built with SSE
+/// </summary>
+bool isDepthProjectionVectorized();
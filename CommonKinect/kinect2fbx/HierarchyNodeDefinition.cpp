@@ -118,4 +118,30 @@ std::shared_ptr<HierarchyNodeDefinition>     GetDefaultHierarchyNodeDefinition()
 
 	// Hips joint is our root, return it
 	return Hips;
+}
+
+/// <summary>
+/// Flattens a node hierarchy, breadth first, so it can be traversed without recursion
+/// </summary>
+/// <param name="root">Hierarchy root</param>
+/// <returns>Topologically sorted nodes, starting with the root</returns>
+std::vector<FlatHierarchyNode> FlattenHierarchyNodeDefinition(const std::shared_ptr<HierarchyNodeDefinition> &root) {
+	std::vector<FlatHierarchyNode> nodes;
+
+	FlatHierarchyNode rootNode;
+	rootNode.m_definition = root;
+	rootNode.m_parentIndex = -1;
+	nodes.push_back(rootNode);
+
+	// Nodes are appended while the array is walked, so every node is queued after its parent
+	for (size_t i = 0; i < nodes.size(); i++) {
+		for (auto &child : nodes[i].m_definition->m_children) {
+			FlatHierarchyNode childNode;
+			childNode.m_definition = child;
+			childNode.m_parentIndex = (int)i;
+			nodes.push_back(childNode);
+		}
+	}
+
+	return nodes;
 }
\ No newline at end of file
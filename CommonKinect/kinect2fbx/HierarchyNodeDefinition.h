@@ -1,6 +1,6 @@
 #pragma once
 
-#include "..\stdafx.h"
+#include "../stdafx.h"
 
 
 // Definte MotionBuilder joints name, which follows convention
@@ -74,4 +74,23 @@ struct HierarchyNodeDefinition {
 /// <returns>Returns a reference to the default hierarchy</returns>
 std::shared_ptr<HierarchyNodeDefinition>     GetDefaultHierarchyNodeDefinition();
 
+/*
+	Entry of a hierarchy flattened into an array. Parents always come before their children
+*/
+struct FlatHierarchyNode {
+
+	// Node definition
+	std::shared_ptr<HierarchyNodeDefinition> m_definition;
+
+	// Index of parent node in the array ( -1 for the hierarchy root )
+	int m_parentIndex;
+};
+
+/// <summary>
+/// Flattens a node hierarchy, breadth first, so it can be traversed without recursion
+/// </summary>
+/// <param name="root">Hierarchy root</param>
+/// <returns>Topologically sorted nodes, starting with the root</returns>
+std::vector<FlatHierarchyNode> FlattenHierarchyNodeDefinition(const std::shared_ptr<HierarchyNodeDefinition> &root);
+
 
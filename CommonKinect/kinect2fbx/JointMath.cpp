@@ -0,0 +1,230 @@
+#include "JointMath.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define JOINTMATH_SSE2
+#include <emmintrin.h>
+#endif
+
+// Radians to degrees
+static const float c_radToDeg = 57.2957795f;
+
+// Below this, the Y rotation is +/-90 degrees and X and Z rotate around the same axis
+static const float c_gimbalLockThreshold = 1e-6f;
+
+
+/// <summary>
+/// Removes every rotation, keeping allocated memory
+/// </summary>
+void JointRotationBatch::clear() {
+	m_parentX.clear();
+	m_parentY.clear();
+	m_parentZ.clear();
+	m_parentW.clear();
+	m_globalX.clear();
+	m_globalY.clear();
+	m_globalZ.clear();
+	m_globalW.clear();
+	m_eulerX.clear();
+	m_eulerY.clear();
+	m_eulerZ.clear();
+}
+
+/// <summary>
+/// Adds a joint rotation to the batch
+/// </summary>
+/// <param name="parentRot">Global rotation of parent joint ( unit quaternion )</param>
+/// <param name="globalRot">Global rotation of the joint ( unit quaternion )</param>
+void JointRotationBatch::add(const JointQuaternion &parentRot, const JointQuaternion &globalRot) {
+	m_parentX.push_back((float)parentRot.x);
+	m_parentY.push_back((float)parentRot.y);
+	m_parentZ.push_back((float)parentRot.z);
+	m_parentW.push_back((float)parentRot.w);
+	m_globalX.push_back((float)globalRot.x);
+	m_globalY.push_back((float)globalRot.y);
+	m_globalZ.push_back((float)globalRot.z);
+	m_globalW.push_back((float)globalRot.w);
+}
+
+/// <summary>
+/// Converts every rotation in the batch to local euler angles
+/// </summary>
+void JointRotationBatch::computeLocalEuler() {
+	size_t count = size();
+	m_eulerX.resize(count);
+	m_eulerY.resize(count);
+	m_eulerZ.resize(count);
+
+	if (count == 0)
+		return;
+
+	computeLocalEulerXYZ(&m_parentX[0], &m_parentY[0], &m_parentZ[0], &m_parentW[0],
+		&m_globalX[0], &m_globalY[0], &m_globalZ[0], &m_globalW[0], count,
+		&m_eulerX[0], &m_eulerY[0], &m_eulerZ[0]);
+}
+
+
+/// <summary>
+/// Same as computeLocalEulerXYZ, one joint at a time without SSE
+/// </summary>
+void computeLocalEulerXYZScalar(const float *px, const float *py, const float *pz, const float *pw,
+	const float *gx, const float *gy, const float *gz, const float *gw, size_t count,
+	float *ex, float *ey, float *ez) {
+
+	for (size_t i = 0; i < count; i++) {
+		// Local rotation: conjugate(parent) * global
+		float x = pw[i] * gx[i] - px[i] * gw[i] - py[i] * gz[i] + pz[i] * gy[i];
+		float y = pw[i] * gy[i] + px[i] * gz[i] - py[i] * gw[i] - pz[i] * gx[i];
+		float z = pw[i] * gz[i] - px[i] * gy[i] + py[i] * gx[i] - pz[i] * gw[i];
+		float w = pw[i] * gw[i] + px[i] * gx[i] + py[i] * gy[i] + pz[i] * gz[i];
+
+		// Rotation matrix entries needed by the decomposition
+		float m00 = 1.0f - 2.0f * (y * y + z * z);
+		float m10 = 2.0f * (x * y + w * z);
+		float m20 = 2.0f * (x * z - w * y);
+		float m21 = 2.0f * (y * z + w * x);
+		float m22 = 1.0f - 2.0f * (x * x + y * y);
+		float cosY = sqrtf(m21 * m21 + m22 * m22);
+
+		ey[i] = atan2f(-m20, cosY) * c_radToDeg;
+		if (cosY > c_gimbalLockThreshold) {
+			ex[i] = atan2f(m21, m22) * c_radToDeg;
+			ez[i] = atan2f(m10, m00) * c_radToDeg;
+		}
+		else {
+			// Gimbal lock, put all of it on X
+			float m11 = 1.0f - 2.0f * (x * x + z * z);
+			float m12 = 2.0f * (y * z - w * x);
+			ex[i] = atan2f(-m12, m11) * c_radToDeg;
+			ez[i] = 0.0f;
+		}
+	}
+}
+
+#ifdef JOINTMATH_SSE2
+
+/// <summary>
+/// Picks a where mask is set, b elsewhere
+/// </summary>
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// <summary>
+/// Four-wide atan2, in radians. Polynomial approximation, error is below 1e-6 radians
+/// </summary>
+static inline __m128 atan2_ps(__m128 y, __m128 x) {
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	__m128 ax = _mm_andnot_ps(signMask, x);
+	__m128 ay = _mm_andnot_ps(signMask, y);
+
+	// Reduce to the first octant, [0, 1]. atan2(0, 0) is 0
+	__m128 mn = _mm_min_ps(ax, ay);
+	__m128 mx = _mm_max_ps(ax, ay);
+	__m128 a = _mm_and_ps(_mm_div_ps(mn, mx), _mm_cmpgt_ps(mx, zero));
+
+	// Then to [0, tan(pi/8)], where the polynomial is accurate
+	__m128 reduce = _mm_cmpgt_ps(a, _mm_set1_ps(0.414213562f));
+	__m128 t = select_ps(reduce, _mm_div_ps(_mm_sub_ps(a, one), _mm_add_ps(a, one)), a);
+	__m128 r = _mm_and_ps(reduce, _mm_set1_ps(0.785398163f));
+
+	__m128 t2 = _mm_mul_ps(t, t);
+	__m128 p = _mm_set1_ps(8.05374449538e-2f);
+	p = _mm_sub_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.38776856032e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.99777106478e-1f));
+	p = _mm_sub_ps(_mm_mul_ps(p, t2), _mm_set1_ps(3.33329491539e-1f));
+	p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, t2), t), t);
+	r = _mm_add_ps(r, p);
+
+	// Back to the original quadrant
+	r = select_ps(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(1.570796327f), r), r);
+	r = select_ps(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(3.141592654f), r), r);
+	return _mm_xor_ps(r, _mm_and_ps(signMask, y));
+}
+
+/// <summary>
+/// Converts global joint rotations to local euler angles, following the same XYZ convention as FbxAMatrix::GetR.
+/// Uses SSE when available
+/// </summary>
+/// <param name="px, py, pz, pw">Global rotation of parent joints ( unit quaternions )</param>
+/// <param name="gx, gy, gz, gw">Global rotation of joints ( unit quaternions )</param>
+/// <param name="count">Number of joints</param>
+/// <param name="ex, ey, ez">Output, local rotations in degrees</param>
+void computeLocalEulerXYZ(const float *px, const float *py, const float *pz, const float *pw,
+	const float *gx, const float *gy, const float *gz, const float *gw, size_t count,
+	float *ex, float *ey, float *ez) {
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 radToDeg = _mm_set1_ps(c_radToDeg);
+	const __m128 gimbalLockThreshold = _mm_set1_ps(c_gimbalLockThreshold);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 pX = _mm_loadu_ps(px + i), pY = _mm_loadu_ps(py + i), pZ = _mm_loadu_ps(pz + i), pW = _mm_loadu_ps(pw + i);
+		__m128 gX = _mm_loadu_ps(gx + i), gY = _mm_loadu_ps(gy + i), gZ = _mm_loadu_ps(gz + i), gW = _mm_loadu_ps(gw + i);
+
+		// Local rotation: conjugate(parent) * global
+		__m128 x = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(pW, gX), _mm_mul_ps(pX, gW)), _mm_sub_ps(_mm_mul_ps(pZ, gY), _mm_mul_ps(pY, gZ)));
+		__m128 y = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(pW, gY), _mm_mul_ps(pY, gW)), _mm_sub_ps(_mm_mul_ps(pX, gZ), _mm_mul_ps(pZ, gX)));
+		__m128 z = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(pW, gZ), _mm_mul_ps(pZ, gW)), _mm_sub_ps(_mm_mul_ps(pY, gX), _mm_mul_ps(pX, gY)));
+		__m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pW, gW), _mm_mul_ps(pX, gX)), _mm_add_ps(_mm_mul_ps(pY, gY), _mm_mul_ps(pZ, gZ)));
+
+		// Rotation matrix entries needed by the decomposition
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 m00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+		__m128 m10 = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(x, y), _mm_mul_ps(w, z)));
+		__m128 m20 = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(x, z), _mm_mul_ps(w, y)));
+		__m128 m21 = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(y, z), _mm_mul_ps(w, x)));
+		__m128 m22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+		__m128 m11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+		__m128 m12 = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(y, z), _mm_mul_ps(w, x)));
+		__m128 cosY = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(m21, m21), _mm_mul_ps(m22, m22)));
+
+		__m128 rotX = atan2_ps(m21, m22);
+		__m128 rotY = atan2_ps(_mm_sub_ps(_mm_setzero_ps(), m20), cosY);
+		__m128 rotZ = atan2_ps(m10, m00);
+
+		// Gimbal lock, put all of it on X
+		__m128 locked = _mm_cmple_ps(cosY, gimbalLockThreshold);
+		rotX = select_ps(locked, atan2_ps(_mm_sub_ps(_mm_setzero_ps(), m12), m11), rotX);
+		rotZ = _mm_andnot_ps(locked, rotZ);
+
+		_mm_storeu_ps(ex + i, _mm_mul_ps(rotX, radToDeg));
+		_mm_storeu_ps(ey + i, _mm_mul_ps(rotY, radToDeg));
+		_mm_storeu_ps(ez + i, _mm_mul_ps(rotZ, radToDeg));
+	}
+
+	// Remaining joints
+	computeLocalEulerXYZScalar(px + i, py + i, pz + i, pw + i, gx + i, gy + i, gz + i, gw + i, count - i, ex + i, ey + i, ez + i);
+}
+
+/// <summary>
+/// Whether computeLocalEulerXYZ was built with SSE
+/// </summary>
+bool isLocalEulerVectorized() {
+	return true;
+}
+
+#else
+
+/// <summary>
+/// Converts global joint rotations to local euler angles, following the same XYZ convention as FbxAMatrix::GetR.
+/// Uses SSE when available
+/// </summary>
+void computeLocalEulerXYZ(const float *px, const float *py, const float *pz, const float *pw,
+	const float *gx, const float *gy, const float *gz, const float *gw, size_t count,
+	float *ex, float *ey, float *ez) {
+	computeLocalEulerXYZScalar(px, py, pz, pw, gx, gy, gz, gw, count, ex, ey, ez);
+}
+
+/// <summary>
+/// Whether computeLocalEulerXYZ was built with SSE
+/// </summary>
+bool isLocalEulerVectorized() {
+	return false;
+}
+
+#endif
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <math.h>
+#include <vector>
+
+/*
+	Rotation math used when mapping joints. Works on plain quaternions, so
+	relative orientations can be computed without building and inverting FBX matrices
+*/
+
+// Quaternion ( same component order as FbxQuaternion )
+struct JointQuaternion {
+	double x, y, z, w;
+};
+
+/// <summary>
+/// Identity rotation
+/// </summary>
+inline JointQuaternion quatIdentity() {
+	JointQuaternion q = { 0.0, 0.0, 0.0, 1.0 };
+	return q;
+}
+
+/// <summary>
+/// Conjugate of a quaternion. For unit quaternions this is also its inverse
+/// </summary>
+inline JointQuaternion quatConjugate(const JointQuaternion &q) {
+	JointQuaternion r = { -q.x, -q.y, -q.z, q.w };
+	return r;
+}
+
+/// <summary>
+/// Quaternion product. Rotation b is applied first, then a ( same as multiplying their FBX matrices a * b )
+/// </summary>
+inline JointQuaternion quatMultiply(const JointQuaternion &a, const JointQuaternion &b) {
+	JointQuaternion r;
+	r.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+	r.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+	r.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+	r.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+	return r;
+}
+
+/// <summary>
+/// Scales a quaternion to unit length
+/// </summary>
+/// <returns>False if quaternion is null, and cannot represent a rotation</returns>
+inline bool quatNormalize(JointQuaternion &q) {
+	double norm = sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	if (norm == 0.0)
+		return false;
+
+	q.x /= norm;
+	q.y /= norm;
+	q.z /= norm;
+	q.w /= norm;
+	return true;
+}
+
+/// <summary>
+/// Rotation given by euler angles, following the same XYZ convention as FbxAMatrix::SetR ( X is applied first, then Y, then Z )
+/// </summary>
+/// <param name="x, y, z">Euler angles, in degrees</param>
+inline JointQuaternion quatFromEulerXYZ(double x, double y, double z) {
+	const double halfDegToRad = 3.14159265358979323846 / 360.0;
+	JointQuaternion qx = { sin(x * halfDegToRad), 0.0, 0.0, cos(x * halfDegToRad) };
+	JointQuaternion qy = { 0.0, sin(y * halfDegToRad), 0.0, cos(y * halfDegToRad) };
+	JointQuaternion qz = { 0.0, 0.0, sin(z * halfDegToRad), cos(z * halfDegToRad) };
+	return quatMultiply(qz, quatMultiply(qy, qx));
+}
+
+/// <summary>
+/// Spherical interpolation between two unit quaternions, at constant angular speed.
+/// Quaternions are expected in the same hemisphere, so the shortest arc is taken
+/// </summary>
+/// <param name="a">Rotation at s = 0</param>
+/// <param name="b">Rotation at s = 1</param>
+/// <param name="s">Interpolation parameter, from 0 to 1</param>
+inline JointQuaternion quatSlerp(const JointQuaternion &a, const JointQuaternion &b, double s) {
+	double cosAngle = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	if (cosAngle > 1.0)
+		cosAngle = 1.0;
+
+	// Nearly the same rotation, where the sine below vanishes. Linear interpolation is as accurate there
+	double wa = 1.0 - s;
+	double wb = s;
+	if (cosAngle < 0.9999) {
+		double angle = acos(cosAngle);
+		double sinAngle = sin(angle);
+		wa = sin(wa * angle) / sinAngle;
+		wb = sin(wb * angle) / sinAngle;
+	}
+
+	JointQuaternion r = { wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z, wa * a.w + wb * b.w };
+	quatNormalize(r);
+	return r;
+}
+
+/*
+	Rotations of many joints ( of every body in a frame ), stored as structure of arrays so they can be converted together
+*/
+struct JointRotationBatch {
+
+	/// <summary>
+	/// Number of rotations in the batch
+	/// </summary>
+	size_t size() const { return m_parentX.size(); };
+
+	/// <summary>
+	/// Removes every rotation, keeping allocated memory
+	/// </summary>
+	void clear();
+
+	/// <summary>
+	/// Adds a joint rotation to the batch
+	/// </summary>
+	/// <param name="parentRot">Global rotation of parent joint ( unit quaternion )</param>
+	/// <param name="globalRot">Global rotation of the joint ( unit quaternion )</param>
+	void add(const JointQuaternion &parentRot, const JointQuaternion &globalRot);
+
+	/// <summary>
+	/// Converts every rotation in the batch to local euler angles
+	/// </summary>
+	void computeLocalEuler();
+
+	// Global rotation of parent joints
+	std::vector<float> m_parentX, m_parentY, m_parentZ, m_parentW;
+
+	// Global rotation of joints
+	std::vector<float> m_globalX, m_globalY, m_globalZ, m_globalW;
+
+	// Output, local rotation of joints in euler angles ( degrees )
+	std::vector<float> m_eulerX, m_eulerY, m_eulerZ;
+};
+
+/// <summary>
+/// Converts global joint rotations to local euler angles, following the same XYZ convention as FbxAMatrix::GetR.
+/// Uses SSE when available
+/// </summary>
+/// <param name="px, py, pz, pw">Global rotation of parent joints ( unit quaternions )</param>
+/// <param name="gx, gy, gz, gw">Global rotation of joints ( unit quaternions )</param>
+/// <param name="count">Number of joints</param>
+/// <param name="ex, ey, ez">Output, local rotations in degrees</param>
+void computeLocalEulerXYZ(const float *px, const float *py, const float *pz, const float *pw,
+	const float *gx, const float *gy, const float *gz, const float *gw, size_t count,
+	float *ex, float *ey, float *ez);
+
+/// <summary>
+/// Same as computeLocalEulerXYZ, one joint at a time without SSE
+/// </summary>
+void computeLocalEulerXYZScalar(const float *px, const float *py, const float *pz, const float *pw,
+	const float *gx, const float *gy, const float *gz, const float *gw, size_t count,
+	float *ex, float *ey, float *ez);
+
+/// <summary>
+/// Whether computeLocalEulerXYZ was built with SSE
+/// </summary>
+bool isLocalEulerVectorized();
@@ -0,0 +1,438 @@
+#include "JointNoiseFilter.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define JOINTFILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Constant definitions
+const float JointNoiseFilter::c_maxFrameGap = 0.5f;
+const float JointNoiseFilter::c_speedCutoff = 1.0f;
+
+// Cutoff frequencies are turned into smoothing factors through 2 * pi * cutoff * dt
+static const float c_twoPi = 6.28318531f;
+
+// Below this length, smoothed orientations are left unnormalized
+static const float c_minOrientationNorm = 1e-12f;
+
+
+/// <summary>
+/// Constructor, default parameters ( extremities smoothed the most ), not enabled
+/// </summary>
+JointFilterSettings::JointFilterSettings() :
+m_bEnabled(false),
+m_inferredCutoffScale(0.3f)
+{
+	for (int j = 0; j < JointType_Count; j++) {
+		m_position[j].m_minCutoff = 1.0f;
+		m_position[j].m_beta = 5.0f;
+		m_orientation[j].m_minCutoff = 1.0f;
+		m_orientation[j].m_beta = 2.0f;
+	}
+
+	// Hands and feet jitter the most, and their orientations are hardly ever right
+	const JointType extremities[] = { JointType_HandLeft, JointType_HandRight, JointType_HandTipLeft, JointType_HandTipRight,
+		JointType_ThumbLeft, JointType_ThumbRight, JointType_FootLeft, JointType_FootRight };
+	for (JointType jointType : extremities) {
+		m_position[jointType].m_minCutoff = 0.6f;
+		m_orientation[jointType].m_minCutoff = 0.5f;
+	}
+}
+
+
+/// <summary>
+/// Constructor, not enabled
+/// </summary>
+JointNoiseFilter::JointNoiseFilter() {
+	setSettings(JointFilterSettings());
+	reset();
+}
+
+/// <summary>
+/// Sets filter parameters, kept until changed again
+/// </summary>
+/// <param name="settings">Filter settings</param>
+void JointNoiseFilter::setSettings(const JointFilterSettings &settings) {
+	m_settings = settings;
+
+	// Padding lanes get no smoothing at all, and never move
+	memset(m_positionMinCutoff, 0, sizeof(m_positionMinCutoff));
+	memset(m_positionBeta, 0, sizeof(m_positionBeta));
+	memset(m_orientationMinCutoff, 0, sizeof(m_orientationMinCutoff));
+	memset(m_orientationBeta, 0, sizeof(m_orientationBeta));
+
+	for (int slot = 0; slot < BODY_COUNT; slot++) {
+		for (int j = 0; j < JointType_Count; j++) {
+			int lane = slot * JointType_Count + j;
+			m_positionMinCutoff[lane] = settings.m_position[j].m_minCutoff;
+			m_positionBeta[lane] = settings.m_position[j].m_beta;
+			m_orientationMinCutoff[lane] = settings.m_orientation[j].m_minCutoff;
+			m_orientationBeta[lane] = settings.m_orientation[j].m_beta;
+		}
+	}
+}
+
+/// <summary>
+/// Forgets every body, so the next take starts from scratch
+/// </summary>
+void JointNoiseFilter::reset() {
+	for (int slot = 0; slot < BODY_COUNT; slot++) {
+		m_bSlotUsed[slot] = false;
+		m_trackingIds[slot] = 0;
+		m_lastFrameTimes[slot] = 0;
+	}
+
+	memset(m_dt, 0, sizeof(m_dt));
+	memset(m_cutoffScale, 0, sizeof(m_cutoffScale));
+	memset(m_positionX, 0, sizeof(m_positionX));
+	memset(m_positionY, 0, sizeof(m_positionY));
+	memset(m_positionZ, 0, sizeof(m_positionZ));
+	memset(m_smoothPositionX, 0, sizeof(m_smoothPositionX));
+	memset(m_smoothPositionY, 0, sizeof(m_smoothPositionY));
+	memset(m_smoothPositionZ, 0, sizeof(m_smoothPositionZ));
+	memset(m_positionSpeed, 0, sizeof(m_positionSpeed));
+	memset(m_orientationX, 0, sizeof(m_orientationX));
+	memset(m_orientationY, 0, sizeof(m_orientationY));
+	memset(m_orientationZ, 0, sizeof(m_orientationZ));
+	memset(m_orientationW, 0, sizeof(m_orientationW));
+	memset(m_smoothOrientationX, 0, sizeof(m_smoothOrientationX));
+	memset(m_smoothOrientationY, 0, sizeof(m_smoothOrientationY));
+	memset(m_smoothOrientationZ, 0, sizeof(m_smoothOrientationZ));
+	memset(m_smoothOrientationW, 0, sizeof(m_smoothOrientationW));
+	memset(m_orientationSpeed, 0, sizeof(m_orientationSpeed));
+}
+
+/// <summary>
+/// Smooths the joints of bodies captured at the same time
+/// </summary>
+/// <param name="frameTime">Frame time, in milliseconds</param>
+/// <param name="kBodies">Tracked bodies ( at most BODY_COUNT, each with its own tracking id )</param>
+/// <param name="bodyCount">Number of bodies</param>
+/// <param name="filteredBodies">Output, smoothed copy of every body, valid until the next frame ( may be the same array as kBodies )</param>
+void JointNoiseFilter::apply(INT64 frameTime, const BodyData * const *kBodies, int bodyCount, const BodyData **filteredBodies) {
+
+	int slots[BODY_COUNT];
+	bool bNewBodies[BODY_COUNT];
+	assignSlots(kBodies, bodyCount, slots, bNewBodies);
+
+	bool bSlotSeen[BODY_COUNT] = { false };
+	for (int i = 0; i < bodyCount; i++) {
+		int slot = slots[i];
+		bSlotSeen[slot] = true;
+
+		// Bodies lost for a while start over, rather than being smoothed from where they were
+		float dt = (float)(frameTime - m_lastFrameTimes[slot]) / 1000.0f;
+		if (bNewBodies[i] || dt < 0.0f || dt > c_maxFrameGap)
+			loadBody(slot, *kBodies[i], 0.0f);
+		else if (dt == 0.0f)
+			holdBody(slot);
+		else
+			loadBody(slot, *kBodies[i], dt);
+
+		m_lastFrameTimes[slot] = frameTime;
+	}
+
+	for (int slot = 0; slot < BODY_COUNT; slot++) {
+		if (!bSlotSeen[slot])
+			holdBody(slot);
+	}
+
+	filterLanes();
+
+	// Smoothed joints replace the captured ones, everything else is copied as it is
+	for (int i = 0; i < bodyCount; i++) {
+		int slot = slots[i];
+		BodyData &filtered = m_filtered[slot];
+		filtered = *kBodies[i];
+
+		for (int j = 0; j < JointType_Count; j++) {
+			int lane = slot * JointType_Count + j;
+			filtered.joints[j].Position.X = m_smoothPositionX[lane];
+			filtered.joints[j].Position.Y = m_smoothPositionY[lane];
+			filtered.joints[j].Position.Z = m_smoothPositionZ[lane];
+
+			// Joints without orientation keep none, so the mapper estimates it from the smoothed positions
+			Vector4 &orientation = filtered.orientations[j].Orientation;
+			if (orientation.x != 0.0f || orientation.y != 0.0f || orientation.z != 0.0f || orientation.w != 0.0f) {
+				orientation.x = m_smoothOrientationX[lane];
+				orientation.y = m_smoothOrientationY[lane];
+				orientation.z = m_smoothOrientationZ[lane];
+				orientation.w = m_smoothOrientationW[lane];
+			}
+		}
+
+		filteredBodies[i] = &filtered;
+	}
+}
+
+/// <summary>
+/// Finds the group of lanes of every body, giving new bodies the group unused for the longest time
+/// </summary>
+/// <param name="kBodies">Tracked bodies</param>
+/// <param name="bodyCount">Number of bodies</param>
+/// <param name="slots">Output, group of lanes of every body</param>
+/// <param name="bNewBodies">Output, whether each body got a group of its own this frame</param>
+void JointNoiseFilter::assignSlots(const BodyData * const *kBodies, int bodyCount, int *slots, bool *bNewBodies) {
+
+	bool bTaken[BODY_COUNT] = { false };
+
+	for (int i = 0; i < bodyCount; i++) {
+		slots[i] = -1;
+		bNewBodies[i] = false;
+		for (int slot = 0; slot < BODY_COUNT; slot++) {
+			if (m_bSlotUsed[slot] && !bTaken[slot] && m_trackingIds[slot] == kBodies[i]->trackingId) {
+				slots[i] = slot;
+				bTaken[slot] = true;
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < bodyCount; i++) {
+		if (slots[i] >= 0)
+			continue;
+
+		// Groups never used come first, then the one whose body was seen the longest time ago
+		int best = -1;
+		for (int slot = 0; slot < BODY_COUNT; slot++) {
+			if (bTaken[slot])
+				continue;
+			if (best < 0 || (m_bSlotUsed[best] && (!m_bSlotUsed[slot] || m_lastFrameTimes[slot] < m_lastFrameTimes[best])))
+				best = slot;
+		}
+
+		slots[i] = best;
+		bNewBodies[i] = true;
+		bTaken[best] = true;
+		m_bSlotUsed[best] = true;
+		m_trackingIds[best] = kBodies[i]->trackingId;
+	}
+}
+
+/// <summary>
+/// Loads the joints of a body into its lanes
+/// </summary>
+/// <param name="slot">Group of lanes of the body</param>
+/// <param name="kBody">Body captured in this frame</param>
+/// <param name="dt">Time since the previous frame of the body, in seconds ( 0 if it starts over )</param>
+void JointNoiseFilter::loadBody(int slot, const BodyData &kBody, float dt) {
+
+	bool bRestart = dt == 0.0f;
+
+	for (int j = 0; j < JointType_Count; j++) {
+		int lane = slot * JointType_Count + j;
+		const Joint &kJoint = kBody.joints[j];
+		const Vector4 &kOrientation = kBody.orientations[j].Orientation;
+
+		m_dt[lane] = dt;
+		m_cutoffScale[lane] = kJoint.TrackingState == TrackingState_Inferred ? m_settings.m_inferredCutoffScale : 1.0f;
+
+		// Joints Kinect lost track of stay where they were smoothed to
+		bool bTracked = kJoint.TrackingState != TrackingState_NotTracked;
+		if (bRestart || bTracked) {
+			m_positionX[lane] = kJoint.Position.X;
+			m_positionY[lane] = kJoint.Position.Y;
+			m_positionZ[lane] = kJoint.Position.Z;
+		}
+		else {
+			m_positionX[lane] = m_smoothPositionX[lane];
+			m_positionY[lane] = m_smoothPositionY[lane];
+			m_positionZ[lane] = m_smoothPositionZ[lane];
+		}
+
+		bool bHasOrientation = kOrientation.x != 0.0f || kOrientation.y != 0.0f || kOrientation.z != 0.0f || kOrientation.w != 0.0f;
+		if (bRestart || (bTracked && bHasOrientation)) {
+			m_orientationX[lane] = kOrientation.x;
+			m_orientationY[lane] = kOrientation.y;
+			m_orientationZ[lane] = kOrientation.z;
+			m_orientationW[lane] = kOrientation.w;
+		}
+		else {
+			m_orientationX[lane] = m_smoothOrientationX[lane];
+			m_orientationY[lane] = m_smoothOrientationY[lane];
+			m_orientationZ[lane] = m_smoothOrientationZ[lane];
+			m_orientationW[lane] = m_smoothOrientationW[lane];
+		}
+
+		// Starting over, smoothed values are the captured ones
+		if (bRestart) {
+			m_smoothPositionX[lane] = m_positionX[lane];
+			m_smoothPositionY[lane] = m_positionY[lane];
+			m_smoothPositionZ[lane] = m_positionZ[lane];
+			m_positionSpeed[lane] = 0.0f;
+			m_smoothOrientationX[lane] = m_orientationX[lane];
+			m_smoothOrientationY[lane] = m_orientationY[lane];
+			m_smoothOrientationZ[lane] = m_orientationZ[lane];
+			m_smoothOrientationW[lane] = m_orientationW[lane];
+			m_orientationSpeed[lane] = 0.0f;
+		}
+	}
+}
+
+/// <summary>
+/// Keeps the lanes of a body as they are, for a frame it is missing from
+/// </summary>
+/// <param name="slot">Group of lanes of the body</param>
+void JointNoiseFilter::holdBody(int slot) {
+	int first = slot * JointType_Count;
+	int end = first + JointType_Count;
+	for (int lane = first; lane < end; lane++) {
+		m_dt[lane] = 0.0f;
+		m_positionX[lane] = m_smoothPositionX[lane];
+		m_positionY[lane] = m_smoothPositionY[lane];
+		m_positionZ[lane] = m_smoothPositionZ[lane];
+		m_orientationX[lane] = m_smoothOrientationX[lane];
+		m_orientationY[lane] = m_smoothOrientationY[lane];
+		m_orientationZ[lane] = m_smoothOrientationZ[lane];
+		m_orientationW[lane] = m_smoothOrientationW[lane];
+	}
+}
+
+/// <summary>
+/// Runs the filter over a range of lanes, one lane at a time
+/// </summary>
+/// <param name="first">First lane</param>
+/// <param name="end">One past the last lane</param>
+void JointNoiseFilter::filterLanesScalar(int first, int end) {
+
+	for (int i = first; i < end; i++) {
+		float dt = m_dt[i];
+
+		// Speed is smoothed as well, at a fixed cutoff. Factors are written so dt = 0 leaves everything as it is
+		float speedK = dt * c_twoPi * c_speedCutoff;
+		float speedAlpha = speedK / (speedK + 1.0f);
+		float speedGain = c_twoPi * c_speedCutoff / (speedK + 1.0f);
+
+		// Positions
+		float dx = m_positionX[i] - m_smoothPositionX[i];
+		float dy = m_positionY[i] - m_smoothPositionY[i];
+		float dz = m_positionZ[i] - m_smoothPositionZ[i];
+		float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+		m_positionSpeed[i] += distance * speedGain - speedAlpha * m_positionSpeed[i];
+
+		float k = dt * c_twoPi * m_cutoffScale[i] * (m_positionMinCutoff[i] + m_positionBeta[i] * m_positionSpeed[i]);
+		float alpha = k / (k + 1.0f);
+		m_smoothPositionX[i] += alpha * dx;
+		m_smoothPositionY[i] += alpha * dy;
+		m_smoothPositionZ[i] += alpha * dz;
+
+		// Orientations, taken to the hemisphere of the smoothed one so blending follows the shortest arc
+		float qx = m_orientationX[i], qy = m_orientationY[i], qz = m_orientationZ[i], qw = m_orientationW[i];
+		float sx = m_smoothOrientationX[i], sy = m_smoothOrientationY[i], sz = m_smoothOrientationZ[i], sw = m_smoothOrientationW[i];
+		if (qx * sx + qy * sy + qz * sz + qw * sw < 0.0f) {
+			qx = -qx;
+			qy = -qy;
+			qz = -qz;
+			qw = -qw;
+		}
+		float ox = qx - sx, oy = qy - sy, oz = qz - sz, ow = qw - sw;
+		distance = sqrtf(ox * ox + oy * oy + oz * oz + ow * ow);
+		m_orientationSpeed[i] += distance * speedGain - speedAlpha * m_orientationSpeed[i];
+
+		k = dt * c_twoPi * m_cutoffScale[i] * (m_orientationMinCutoff[i] + m_orientationBeta[i] * m_orientationSpeed[i]);
+		alpha = k / (k + 1.0f);
+		sx += alpha * ox;
+		sy += alpha * oy;
+		sz += alpha * oz;
+		sw += alpha * ow;
+
+		float norm = sqrtf(sx * sx + sy * sy + sz * sz + sw * sw);
+		if (norm > c_minOrientationNorm) {
+			sx /= norm;
+			sy /= norm;
+			sz /= norm;
+			sw /= norm;
+		}
+		m_smoothOrientationX[i] = sx;
+		m_smoothOrientationY[i] = sy;
+		m_smoothOrientationZ[i] = sz;
+		m_smoothOrientationW[i] = sw;
+	}
+}
+
+#ifdef JOINTFILTER_SSE2
+
+/// <summary>
+/// Runs the filter over every lane, four at a time when SSE is available
+/// </summary>
+void JointNoiseFilter::filterLanes() {
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 twoPi = _mm_set1_ps(c_twoPi);
+	const __m128 speedCutoff = _mm_set1_ps(c_twoPi * c_speedCutoff);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 minNorm = _mm_set1_ps(c_minOrientationNorm);
+
+	for (int i = 0; i < c_laneCount; i += 4) {
+		__m128 dt = _mm_loadu_ps(m_dt + i);
+		__m128 cutoffToK = _mm_mul_ps(_mm_mul_ps(dt, twoPi), _mm_loadu_ps(m_cutoffScale + i));
+
+		// Speed is smoothed as well, at a fixed cutoff. Factors are written so dt = 0 leaves everything as it is
+		__m128 speedK = _mm_mul_ps(dt, speedCutoff);
+		__m128 speedAlpha = _mm_div_ps(speedK, _mm_add_ps(speedK, one));
+		__m128 speedGain = _mm_div_ps(speedCutoff, _mm_add_ps(speedK, one));
+
+		// Positions
+		__m128 sx = _mm_loadu_ps(m_smoothPositionX + i), sy = _mm_loadu_ps(m_smoothPositionY + i), sz = _mm_loadu_ps(m_smoothPositionZ + i);
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(m_positionX + i), sx);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(m_positionY + i), sy);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(m_positionZ + i), sz);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 speed = _mm_loadu_ps(m_positionSpeed + i);
+		speed = _mm_sub_ps(_mm_add_ps(speed, _mm_mul_ps(distance, speedGain)), _mm_mul_ps(speedAlpha, speed));
+		_mm_storeu_ps(m_positionSpeed + i, speed);
+
+		__m128 k = _mm_mul_ps(cutoffToK, _mm_add_ps(_mm_loadu_ps(m_positionMinCutoff + i), _mm_mul_ps(_mm_loadu_ps(m_positionBeta + i), speed)));
+		__m128 alpha = _mm_div_ps(k, _mm_add_ps(k, one));
+		_mm_storeu_ps(m_smoothPositionX + i, _mm_add_ps(sx, _mm_mul_ps(alpha, dx)));
+		_mm_storeu_ps(m_smoothPositionY + i, _mm_add_ps(sy, _mm_mul_ps(alpha, dy)));
+		_mm_storeu_ps(m_smoothPositionZ + i, _mm_add_ps(sz, _mm_mul_ps(alpha, dz)));
+
+		// Orientations, taken to the hemisphere of the smoothed one so blending follows the shortest arc
+		__m128 qx = _mm_loadu_ps(m_orientationX + i), qy = _mm_loadu_ps(m_orientationY + i), qz = _mm_loadu_ps(m_orientationZ + i), qw = _mm_loadu_ps(m_orientationW + i);
+		__m128 ox = _mm_loadu_ps(m_smoothOrientationX + i), oy = _mm_loadu_ps(m_smoothOrientationY + i), oz = _mm_loadu_ps(m_smoothOrientationZ + i), ow = _mm_loadu_ps(m_smoothOrientationW + i);
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, ox), _mm_mul_ps(qy, oy)), _mm_add_ps(_mm_mul_ps(qz, oz), _mm_mul_ps(qw, ow)));
+		__m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, zero), signMask);
+		qx = _mm_xor_ps(qx, flip);
+		qy = _mm_xor_ps(qy, flip);
+		qz = _mm_xor_ps(qz, flip);
+		qw = _mm_xor_ps(qw, flip);
+
+		__m128 ex = _mm_sub_ps(qx, ox), ey = _mm_sub_ps(qy, oy), ez = _mm_sub_ps(qz, oz), ew = _mm_sub_ps(qw, ow);
+		distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_add_ps(_mm_mul_ps(ez, ez), _mm_mul_ps(ew, ew))));
+		speed = _mm_loadu_ps(m_orientationSpeed + i);
+		speed = _mm_sub_ps(_mm_add_ps(speed, _mm_mul_ps(distance, speedGain)), _mm_mul_ps(speedAlpha, speed));
+		_mm_storeu_ps(m_orientationSpeed + i, speed);
+
+		k = _mm_mul_ps(cutoffToK, _mm_add_ps(_mm_loadu_ps(m_orientationMinCutoff + i), _mm_mul_ps(_mm_loadu_ps(m_orientationBeta + i), speed)));
+		alpha = _mm_div_ps(k, _mm_add_ps(k, one));
+		ox = _mm_add_ps(ox, _mm_mul_ps(alpha, ex));
+		oy = _mm_add_ps(oy, _mm_mul_ps(alpha, ey));
+		oz = _mm_add_ps(oz, _mm_mul_ps(alpha, ez));
+		ow = _mm_add_ps(ow, _mm_mul_ps(alpha, ew));
+
+		// Null orientations ( padding lanes, joints Kinect gives none ) stay as they are
+		__m128 norm = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_add_ps(_mm_mul_ps(oz, oz), _mm_mul_ps(ow, ow))));
+		__m128 valid = _mm_cmpgt_ps(norm, minNorm);
+		__m128 scale = _mm_or_ps(_mm_and_ps(valid, _mm_div_ps(one, _mm_max_ps(norm, minNorm))), _mm_andnot_ps(valid, one));
+		_mm_storeu_ps(m_smoothOrientationX + i, _mm_mul_ps(ox, scale));
+		_mm_storeu_ps(m_smoothOrientationY + i, _mm_mul_ps(oy, scale));
+		_mm_storeu_ps(m_smoothOrientationZ + i, _mm_mul_ps(oz, scale));
+		_mm_storeu_ps(m_smoothOrientationW + i, _mm_mul_ps(ow, scale));
+	}
+}
+
+#else
+
+/// <summary>
+/// Runs the filter over every lane, four at a time when SSE is available
+/// </summary>
+void JointNoiseFilter::filterLanes() {
+	filterLanesScalar(0, c_laneCount);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "BodyFrame.h"
+
+/*
+	Smoothing of a single joint ( One Euro filter ). Cutoff frequency rises with speed,
+	so still joints lose their jitter while fast ones get little lag
+*/
+struct JointFilterParameters {
+	// Cutoff frequency of a still joint, in Hz. Lower is smoother
+	float m_minCutoff;
+
+	// Cutoff frequency added per unit of speed ( meters per second for positions, quaternion units per second for orientations )
+	float m_beta;
+};
+
+/*
+	How joints are smoothed before they are keyed
+*/
+struct JointFilterSettings {
+	// Smooth joint positions and orientations of every body
+	bool m_bEnabled;
+
+	// Parameters of every joint, by Kinect joint type
+	JointFilterParameters m_position[JointType_Count];
+	JointFilterParameters m_orientation[JointType_Count];
+
+	// Cutoff frequencies of inferred joints are scaled by this, as Kinect only guesses where they are
+	float m_inferredCutoffScale;
+
+	/// <summary>
+	/// Constructor, default parameters ( extremities smoothed the most ), not enabled
+	/// </summary>
+	JointFilterSettings();
+};
+
+/*
+	Streaming smoothing of the joints of every body of a take, frame after frame. Filter state is kept for
+	every joint of BODY_COUNT bodies in fixed arrays, one lane per joint, and every lane is filtered in a single
+	pass over all of them ( four at a time with SSE ), so every frame costs the same and nothing is allocated.
+	Joints that are not tracked, and bodies missing from a frame, keep their last smoothed values
+*/
+class JointNoiseFilter {
+public:
+	/// <summary>
+	/// Constructor, not enabled
+	/// </summary>
+	JointNoiseFilter();
+
+	/// <summary>
+	/// Sets filter parameters, kept until changed again
+	/// </summary>
+	/// <param name="settings">Filter settings</param>
+	void setSettings(const JointFilterSettings &settings);
+
+	/// <summary>
+	/// Filter settings
+	/// </summary>
+	const JointFilterSettings &getSettings() const { return m_settings; };
+
+	/// <summary>
+	/// Whether joints are being smoothed
+	/// </summary>
+	bool isEnabled() const { return m_settings.m_bEnabled; };
+
+	/// <summary>
+	/// Forgets every body, so the next take starts from scratch
+	/// </summary>
+	void reset();
+
+	/// <summary>
+	/// Smooths the joints of bodies captured at the same time
+	/// </summary>
+	/// <param name="frameTime">Frame time, in milliseconds</param>
+	/// <param name="kBodies">Tracked bodies ( at most BODY_COUNT, each with its own tracking id )</param>
+	/// <param name="bodyCount">Number of bodies</param>
+	/// <param name="filteredBodies">Output, smoothed copy of every body, valid until the next frame ( may be the same array as kBodies )</param>
+	void apply(INT64 frameTime, const BodyData * const *kBodies, int bodyCount, const BodyData **filteredBodies);
+
+private:
+	// One lane per joint of every body, rounded up to whole SSE registers
+	static const int c_laneCount = ((BODY_COUNT * JointType_Count + 3) / 4) * 4;
+
+	// Longest time between two frames of a body before its joints start over, in seconds
+	static const float c_maxFrameGap;
+
+	// Cutoff frequency of the speed estimate, in Hz
+	static const float c_speedCutoff;
+
+	// Filter parameters
+	JointFilterSettings m_settings;
+
+	// Body filtered by every group of JointType_Count lanes
+	bool m_bSlotUsed[BODY_COUNT];
+	UINT64 m_trackingIds[BODY_COUNT];
+	INT64 m_lastFrameTimes[BODY_COUNT];
+
+	// Smoothed copy of every body, by group of lanes
+	BodyData m_filtered[BODY_COUNT];
+
+	// Parameters of every lane, for its joint type
+	float m_positionMinCutoff[c_laneCount];
+	float m_positionBeta[c_laneCount];
+	float m_orientationMinCutoff[c_laneCount];
+	float m_orientationBeta[c_laneCount];
+
+	// Time since the previous frame of every lane, in seconds ( 0 keeps the lane as it is )
+	float m_dt[c_laneCount];
+
+	// Cutoff scale of every lane, for the tracking state of its joint
+	float m_cutoffScale[c_laneCount];
+
+	// Joint positions of the frame, and their smoothed values and speeds
+	float m_positionX[c_laneCount], m_positionY[c_laneCount], m_positionZ[c_laneCount];
+	float m_smoothPositionX[c_laneCount], m_smoothPositionY[c_laneCount], m_smoothPositionZ[c_laneCount];
+	float m_positionSpeed[c_laneCount];
+
+	// Joint orientations of the frame, and their smoothed values and speeds
+	float m_orientationX[c_laneCount], m_orientationY[c_laneCount], m_orientationZ[c_laneCount], m_orientationW[c_laneCount];
+	float m_smoothOrientationX[c_laneCount], m_smoothOrientationY[c_laneCount], m_smoothOrientationZ[c_laneCount], m_smoothOrientationW[c_laneCount];
+	float m_orientationSpeed[c_laneCount];
+
+	/// <summary>
+	/// Finds the group of lanes of every body, giving new bodies the group unused for the longest time
+	/// </summary>
+	/// <param name="kBodies">Tracked bodies</param>
+	/// <param name="bodyCount">Number of bodies</param>
+	/// <param name="slots">Output, group of lanes of every body</param>
+	/// <param name="bNewBodies">Output, whether each body got a group of its own this frame</param>
+	void assignSlots(const BodyData * const *kBodies, int bodyCount, int *slots, bool *bNewBodies);
+
+	/// <summary>
+	/// Loads the joints of a body into its lanes
+	/// </summary>
+	/// <param name="slot">Group of lanes of the body</param>
+	/// <param name="kBody">Body captured in this frame</param>
+	/// <param name="dt">Time since the previous frame of the body, in seconds ( 0 if it starts over )</param>
+	void loadBody(int slot, const BodyData &kBody, float dt);
+
+	/// <summary>
+	/// Keeps the lanes of a body as they are, for a frame it is missing from
+	/// </summary>
+	/// <param name="slot">Group of lanes of the body</param>
+	void holdBody(int slot);
+
+	/// <summary>
+	/// Runs the filter over a range of lanes, one lane at a time
+	/// </summary>
+	/// <param name="first">First lane</param>
+	/// <param name="end">One past the last lane</param>
+	void filterLanesScalar(int first, int end);
+
+	/// <summary>
+	/// Runs the filter over every lane, four at a time when SSE is available
+	/// </summary>
+	void filterLanes();
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../stdafx.h"
+
+/*
+ Bounded single-producer/single-consumer lock-free ring.
+ All slots are allocated up front, so neither side ever blocks nor allocates.
+*/
+template <class T>
+class KFrameRing {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="capacity">Number of slots ( rounded up to a power of two )</param>
+	KFrameRing(size_t capacity = 8) :
+	m_head(0),
+	m_tail(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+
+		m_slots.resize(size);
+		m_mask = size - 1;
+	}
+
+	/// <summary>
+	/// Copies an item into the ring. Must only be called by the producer thread
+	/// </summary>
+	/// <param name="item">Item to be queued</param>
+	/// <returns>False if ring is full and item was not queued</returns>
+	bool push(const T &item) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+
+		// Consumer is too far behind
+		if (head - m_tail.load(std::memory_order_acquire) > m_mask)
+			return false;
+
+		m_slots[head & m_mask] = item;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// <summary>
+	/// Returns the oldest queued item, without removing it. Must only be called by the consumer thread
+	/// </summary>
+	/// <returns>Pointer to the item, or NULL if ring is empty</returns>
+	T* front() {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+
+		if (tail == m_head.load(std::memory_order_acquire))
+			return NULL;
+
+		return &m_slots[tail & m_mask];
+	}
+
+	/// <summary>
+	/// Releases the item returned by front(). Must only be called by the consumer thread
+	/// </summary>
+	void pop() {
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/// <summary>
+	/// Number of slots in the ring
+	/// </summary>
+	size_t capacity() const { return m_mask + 1; };
+
+private:
+	// Preallocated slots
+	std::vector<T> m_slots;
+
+	// Capacity - 1, used to wrap indices
+	size_t m_mask;
+
+	// Write position, owned by producer ( kept on its own cache line )
+	std::atomic<size_t> m_head;
+	char m_headPadding[64 - sizeof(std::atomic<size_t>)];
+
+	// Read position, owned by consumer
+	std::atomic<size_t> m_tail;
+	char m_tailPadding[64 - sizeof(std::atomic<size_t>)];
+};
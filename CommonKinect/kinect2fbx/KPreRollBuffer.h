@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../stdafx.h"
+#include "BodyFrame.h"
+
+/*
+ Keeps copies of the last frames received, so a take can start before recording was requested.
+ Slots are allocated once, and the oldest frame is overwritten when the buffer is full, so it never grows nor allocates
+*/
+class KPreRollBuffer {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="capacity">Number of frames kept</param>
+	KPreRollBuffer(size_t capacity) :
+	m_frames(capacity > 0 ? capacity : 1),
+	m_first(0),
+	m_count(0)
+	{
+	}
+
+	/// <summary>
+	/// Copies a frame into the buffer, replacing the oldest one if buffer is full
+	/// </summary>
+	/// <param name="bFrame">Decoded frame</param>
+	void push(const BodyFrame &bFrame) {
+		if (m_count < m_frames.size()) {
+			m_frames[(m_first + m_count) % m_frames.size()] = bFrame;
+			m_count++;
+		}
+		else {
+			m_frames[m_first] = bFrame;
+			m_first = (m_first + 1) % m_frames.size();
+		}
+	}
+
+	/// <summary>
+	/// Returns a buffered frame
+	/// </summary>
+	/// <param name="index">Frame index, 0 being the oldest one</param>
+	const BodyFrame &at(size_t index) const { return m_frames[(m_first + index) % m_frames.size()]; };
+
+	/// <summary>
+	/// Forgets every buffered frame, keeping allocated memory
+	/// </summary>
+	void clear() {
+		m_first = 0;
+		m_count = 0;
+	}
+
+	/// <summary>
+	/// Number of buffered frames
+	/// </summary>
+	size_t size() const { return m_count; };
+
+	/// <summary>
+	/// Number of frames that can be kept
+	/// </summary>
+	size_t capacity() const { return m_frames.size(); };
+
+	/// <summary>
+	/// Memory used by the frames, in bytes. Fixed on construction
+	/// </summary>
+	size_t getMemorySize() const { return m_frames.capacity() * sizeof(BodyFrame); };
+
+private:
+	// Preallocated frames
+	std::vector<BodyFrame> m_frames;
+
+	// Slot of the oldest frame
+	size_t m_first;
+
+	// Number of buffered frames
+	size_t m_count;
+};
@@ -0,0 +1,169 @@
+#include "KSubscriberChannel.h"
+#include "PipelineMetrics.h"
+#include "TraceRecorder.h"
+
+/// <summary>
+/// Constructor, starts the worker thread
+/// </summary>
+/// <param name="subscriber">Subscriber that will receive the frames</param>
+/// <param name="capacity">Maximum number of frames waiting to be delivered</param>
+KSubscriberChannel::KSubscriberChannel(const FrameSubscriber_ptr &subscriber, size_t capacity) :
+m_pSubscriber(subscriber),
+m_ring(capacity),
+m_bFrameQueued(false),
+#ifndef _WIN32
+m_bWorkerWaiting(false),
+#endif
+m_quit(false),
+m_nDelivered(0),
+m_nDropped(0),
+m_nLatencyTotal(0),
+m_nLatencyMax(0)
+{
+#ifdef _WIN32
+	m_hQueuedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+	m_worker = std::thread(&KSubscriberChannel::Process, this);
+}
+
+/// <summary>
+/// Destructor, stops the worker thread
+/// </summary>
+KSubscriberChannel::~KSubscriberChannel() {
+	stop();
+#ifdef _WIN32
+	CloseHandle(m_hQueuedEvent);
+#endif
+}
+
+/// <summary>
+/// Queues a frame to be delivered. Must only be called by the capture thread
+/// </summary>
+/// <param name="bFrame">Decoded frame</param>
+/// <returns>False if the subscriber is too far behind and the frame was dropped</returns>
+bool KSubscriberChannel::publish(const BodyFrame_ptr &bFrame) {
+
+	if (!m_ring.push(bFrame)) {
+		m_nDropped++;
+		PipelineMetrics::add(MetricCounter_FramesDroppedSubscriberFull);
+		return false;
+	}
+
+	Signal();
+	return true;
+}
+
+/// <summary>
+/// Delivers any frame still queued and stops the worker thread
+/// </summary>
+void KSubscriberChannel::stop() {
+	if (!m_worker.joinable())
+		return;
+
+	m_quit = true;
+	Signal();
+	m_worker.join();
+}
+
+/// <summary>
+/// Average time, in milliseconds, between frame decoding and the end of its delivery
+/// </summary>
+double KSubscriberChannel::getAverageLatency() {
+	unsigned int delivered = m_nDelivered;
+	if (!delivered)
+		return 0.0;
+
+	return double(m_nLatencyTotal) / (1000.0 * delivered);
+}
+
+/// <summary>
+/// Maximum time, in milliseconds, between frame decoding and the end of its delivery
+/// </summary>
+double KSubscriberChannel::getMaxLatency() {
+	return double(m_nLatencyMax) / 1000.0;
+}
+
+/// <summary>
+/// Wakes the worker thread up
+/// </summary>
+void KSubscriberChannel::Signal() {
+	// Worker was already told, and clears the flag before draining, so it will find this frame
+	if (m_bFrameQueued.exchange(true))
+		return;
+
+#ifdef _WIN32
+	SetEvent(m_hQueuedEvent);
+#else
+	// Both flags are sequentially consistent: either the worker sees the frame flag before sleeping, or it is seen waiting here
+	if (m_bWorkerWaiting) {
+		std::lock_guard<std::mutex> lock(m_queuedMutex);
+		m_queuedCondition.notify_one();
+	}
+#endif
+}
+
+/// <summary>
+/// Sleeps until a frame is queued, or the wait times out
+/// </summary>
+void KSubscriberChannel::Wait() {
+	// Frames queued while the ring was drained need no sleep
+	if (m_bFrameQueued.exchange(false))
+		return;
+
+#ifdef _WIN32
+	WaitForSingleObject(m_hQueuedEvent, c_workerWaitTimeout);
+#else
+	const std::chrono::milliseconds timeout(c_workerWaitTimeout);
+
+	std::unique_lock<std::mutex> lock(m_queuedMutex);
+	m_bWorkerWaiting = true;
+	m_queuedCondition.wait_for(lock, timeout, [this] { return m_bFrameQueued.load(); });
+	m_bWorkerWaiting = false;
+#endif
+	m_bFrameQueued = false;
+}
+
+/// <summary>
+/// Worker thread, delivers queued frames to the subscriber
+/// </summary>
+void KSubscriberChannel::Process() {
+
+	TraceRecorder::setThreadName("Subscriber channel");
+
+	while (!m_quit) {
+		// Sleep while there is nothing to deliver
+		Wait();
+		Drain();
+	}
+
+	// Make sure nothing is left behind
+	Drain();
+}
+
+/// <summary>
+/// Delivers every frame currently queued
+/// </summary>
+void KSubscriberChannel::Drain() {
+
+	BodyFrame_ptr *bFrame;
+	while ((bFrame = m_ring.front()) != NULL) {
+
+		m_pSubscriber->notify(*bFrame);
+
+		// Measure end-to-end latency, from decoding until subscriber is done with the frame
+		if ((*bFrame)->captureCounter) {
+			INT64 latency = INT64(PipelineMetrics::getTime()) - (*bFrame)->captureCounter;
+			m_nLatencyTotal += latency;
+			PipelineMetrics::record(MetricHistogram_FrameLatency, (unsigned long long)latency);
+
+			INT64 currentMax = m_nLatencyMax;
+			while (latency > currentMax && !m_nLatencyMax.compare_exchange_weak(currentMax, latency));
+		}
+
+		// Drop our reference, so the frame is freed as soon as every subscriber is done with it
+		bFrame->reset();
+
+		m_ring.pop();
+		m_nDelivered++;
+	}
+}
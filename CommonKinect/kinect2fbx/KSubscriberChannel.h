@@ -0,0 +1,140 @@
+#pragma once
+
+#include "../stdafx.h"
+#include "BodyFrame.h"
+#include "KFrameRing.h"
+
+/*
+ Receives decoded frames, one at a time, from the thread of its channel
+*/
+class FrameSubscriber {
+public:
+	/// <summary>
+	/// Destructor
+	/// </summary>
+	virtual ~FrameSubscriber() {};
+
+	/// <summary>
+	/// Notify class about a frame that arrived
+	/// </summary>
+	/// <param name="bFrame">Decoded incoming frame</param>
+	virtual void notify(const BodyFrame_ptr &bFrame) = 0;
+};
+
+typedef std::shared_ptr<FrameSubscriber> FrameSubscriber_ptr;
+
+/*
+ Delivers frames to a single subscriber.
+ Frames are queued in a lock-free ring by the capture thread and drained by a dedicated worker,
+ so a slow subscriber never adds latency to the capture thread or to other subscribers.
+*/
+class KSubscriberChannel {
+public:
+	/// <summary>
+	/// Constructor, starts the worker thread
+	/// </summary>
+	/// <param name="subscriber">Subscriber that will receive the frames</param>
+	/// <param name="capacity">Maximum number of frames waiting to be delivered</param>
+	KSubscriberChannel(const FrameSubscriber_ptr &subscriber, size_t capacity = c_defaultCapacity);
+
+	/// <summary>
+	/// Destructor, stops the worker thread
+	/// </summary>
+	~KSubscriberChannel();
+
+	/// <summary>
+	/// Queues a frame to be delivered. Must only be called by the capture thread
+	/// </summary>
+	/// <param name="bFrame">Decoded frame</param>
+	/// <returns>False if the subscriber is too far behind and the frame was dropped</returns>
+	bool publish(const BodyFrame_ptr &bFrame);
+
+	/// <summary>
+	/// Delivers any frame still queued and stops the worker thread
+	/// </summary>
+	void stop();
+
+	/// <summary>
+	/// Returns the subscriber fed by this channel
+	/// </summary>
+	const FrameSubscriber_ptr& getSubscriber() { return m_pSubscriber; };
+
+	/// <summary>
+	/// Number of frames delivered to the subscriber
+	/// </summary>
+	unsigned int getDeliveredCount() { return m_nDelivered; };
+
+	/// <summary>
+	/// Number of frames dropped because the ring was full
+	/// </summary>
+	unsigned int getDroppedCount() { return m_nDropped; };
+
+	/// <summary>
+	/// Average time, in milliseconds, between frame decoding and the end of its delivery
+	/// </summary>
+	double getAverageLatency();
+
+	/// <summary>
+	/// Maximum time, in milliseconds, between frame decoding and the end of its delivery
+	/// </summary>
+	double getMaxLatency();
+
+private:
+	// Default ring capacity ( a few frames at 30fps )
+	static const size_t c_defaultCapacity = 8;
+
+	// Worker wait timeout, in milliseconds
+	static const int c_workerWaitTimeout = 100;
+
+	// Subscriber fed by this channel
+	FrameSubscriber_ptr m_pSubscriber;
+
+	// Frames waiting for delivery
+	KFrameRing<BodyFrame_ptr> m_ring;
+
+	// Set whenever a frame is queued, and cleared by the worker before it drains the ring.
+	// Only the publish raising it wakes the worker, so frames queued while it drains cost a single atomic exchange
+	std::atomic_bool m_bFrameQueued;
+
+#ifdef _WIN32
+	// Auto-reset event the worker sleeps on. Setting it never waits for the worker, so the capture thread takes no lock
+	HANDLE m_hQueuedEvent;
+#else
+	// No capture thread outside Windows. Worker says it is about to sleep, and only then is woken under the mutex
+	std::atomic_bool m_bWorkerWaiting;
+	std::mutex m_queuedMutex;
+	std::condition_variable m_queuedCondition;
+#endif
+
+	// Worker thread
+	std::thread m_worker;
+
+	// Quit worker thread
+	std::atomic_bool m_quit;
+
+	// Delivery statistics, latencies in microseconds
+	std::atomic<unsigned int> m_nDelivered;
+	std::atomic<unsigned int> m_nDropped;
+	std::atomic<INT64> m_nLatencyTotal;
+	std::atomic<INT64> m_nLatencyMax;
+
+	/// <summary>
+	/// Wakes the worker thread up
+	/// </summary>
+	void Signal();
+
+	/// <summary>
+	/// Sleeps until a frame is queued, or the wait times out
+	/// </summary>
+	void Wait();
+
+	/// <summary>
+	/// Worker thread, delivers queued frames to the subscriber
+	/// </summary>
+	void Process();
+
+	/// <summary>
+	/// Delivers every frame currently queued
+	/// </summary>
+	void Drain();
+};
@@ -1,74 +1,345 @@
 #include "KinectSkeletonMapper.h"
-#include "..\helpers\FBX_helpers.h"
+#include "../helpers/FBX_helpers.h"
+#include "PipelineMetrics.h"
+#include "TraceRecorder.h"
+#include "MappingWorkerPool.h"
+#include "CaptureJournal.h"
 
 // Constant definitions
 const char * KinectSkeletonMapper::c_SkelRootIdPatternPreffix = "Skel%d:";
+const char * KinectSkeletonMapper::c_SpareSkelPatternPreffix = "Spare%d:";
 const char *KinectSkeletonMapper::c_jointTypePropertyDefaultName = "JointType";
 const std::shared_ptr<HierarchyNodeDefinition> KinectSkeletonMapper::c_defaultNodeHierarchy = GetDefaultHierarchyNodeDefinition();
+const std::vector<FlatHierarchyNode> KinectSkeletonMapper::c_flatNodeHierarchy = FlattenHierarchyNodeDefinition(KinectSkeletonMapper::c_defaultNodeHierarchy);
 const JointType KinectSkeletonMapper::c_kinectRootJointType = JointType_SpineBase;
 const float KinectSkeletonMapper::c_rotationContinuityMaxOffset = 180;
+const double KinectSkeletonMapper::c_fullTurnDegrees = 360;
 const float KinectSkeletonMapper::c_positionalScalingFactor = 60;
+const unsigned int KinectSkeletonMapper::c_keyCommitFrameCount = 300;
 const char *KinectSkeletonMapper::c_DefaultRootJointName = "Reference";
 
+/*
+	Bodies of a frame being mapped in parallel
+*/
+struct BodyMappingContext {
+	const MappingSession *m_pSession;
+	SkeletonBinding * const *m_bindings;
+	const BodyData * const *m_bodies;
+	FbxTime m_frameTime;
+};
+
 
 /// <summary>
 /// Map current frame of Kinect Body to FBX scene
 /// </summary>
-/// <param name="pScene">FBX Scene</param>
+/// <param name="session">Take being mapped</param>
 /// <param name="frameTime">Current frame time</param>
-/// <param name="kBody">Kinect Body</param>
-void KinectSkeletonMapper::map(FbxScene* pScene, INT64 frameTime ,IBody *kBody) {
+/// <param name="kBody">Decoded Kinect Body</param>
+void KinectSkeletonMapper::map(MappingSession &session, INT64 frameTime, const BodyData &kBody) {
+	const BodyData *kBodies[1] = { &kBody };
+	mapBodies(session, frameTime, kBodies, 1);
+};
+
+/// <summary>
+/// Map every tracked body of a decoded frame to FBX scene
+/// </summary>
+/// <param name="session">Take being mapped</param>
+/// <param name="bFrame">Decoded Kinect frame</param>
+/// <returns>False if frame could not be read, and was skipped</returns>
+bool KinectSkeletonMapper::mapFrame(MappingSession &session, const BodyFrame &bFrame) {
+
+	// If failed to read bodies for this frame, just skip everything
+	if (!bFrame.readStatus)
+		return false;
+
+	const BodyData *kBodies[BODY_COUNT];
+	int bodyCount = 0;
+	for (int i = 0; i < BODY_COUNT; ++i)
+	{
+		if (bFrame.bodies[i].isTracked)
+			kBodies[bodyCount++] = &bFrame.bodies[i];
+	}
 
-	FbxString bodyRootName = getPreffixedNodeName(kBody, c_DefaultRootJointName);
+	if (bodyCount == 0)
+		return true;
 
-	FbxNode *skelNode;
-	// Check whether skeleton has already been added to the scene
-	skelNode = pScene->FindNodeByName(bodyRootName);
+	// Kinect clock works in increments of 100ns. Who the hell needs documentation, let people figure it out.
+	INT64 timeMS = bFrame.frameTime / 10000;
 
-	// Get Kinect Joint Information
-	Joint joints[JointType_Count];
-	JointOrientation orientations[JointType_Count];
+	if (session.m_initTime == 0)
+		session.m_initTime = timeMS;
 
-	HRESULT hr;
-	hr = kBody->GetJoints(_countof(joints), joints);
-	// If we successfully retrieved the Joint array
-	if (!SUCCEEDED(hr)) {
-		return;
+	MetricTimer timer(MetricHistogram_MapFrameTime);
+	TRACE_SCOPE("map_frame");
+	mapBodies(session, timeMS - session.m_initTime + 1, kBodies, bodyCount);
+
+	return true;
+};
+
+/// <summary>
+/// Maps the frames received shortly before a take started, oldest first, so the take starts at the oldest one. The buffer is emptied afterwards
+/// </summary>
+/// <param name="session">Take being mapped, no frame mapped yet</param>
+/// <param name="preRoll">Frames received while not recording</param>
+/// <param name="bFrame">First frame received while recording. Only older frames are mapped</param>
+/// <param name="duration">How far back before it frames are mapped, in Kinect time ( 100ns increments )</param>
+/// <param name="pJournal">Journal of the take, gets its own copy of every frame ( may be NULL )</param>
+/// <returns>Number of frames mapped</returns>
+unsigned int KinectSkeletonMapper::mapPreRoll(MappingSession &session, KPreRollBuffer &preRoll, const BodyFrame &bFrame, INT64 duration, CaptureJournalWriter *pJournal) {
+
+	INT64 firstTime = bFrame.frameTime - duration;
+
+	unsigned int nMapped = 0;
+	for (size_t i = 0; i < preRoll.size(); i++) {
+		const BodyFrame &preFrame = preRoll.at(i);
+		if (preFrame.frameTime < firstTime || preFrame.frameTime >= bFrame.frameTime)
+			continue;
+
+		// Journal gets its own copy, as buffer slots are reused
+		if (pJournal)
+			pJournal->append(std::make_shared<BodyFrame>(preFrame));
+
+		if (mapFrame(session, preFrame))
+			nMapped++;
 	}
 
-	hr = kBody->GetJointOrientations(_countof(orientations), orientations);
-	// If we successfully retrieved the JointOrientation array
-	if (!SUCCEEDED(hr)) {
+	// Buffer refills from scratch once recording stops
+	preRoll.clear();
+
+	return nMapped;
+}
+
+/// <summary>
+/// Maps several bodies captured at the same time. Skeletons are created first, one at a time, as they change the scene.
+/// Bodies are then mapped in parallel when the session has workers, otherwise rotations of all of them are converted in a single batch
+/// </summary>
+/// <param name="session">Take being mapped</param>
+/// <param name="frameTime">Current frame time</param>
+/// <param name="kBodies">Decoded Kinect bodies ( at most BODY_COUNT )</param>
+/// <param name="bodyCount">Number of bodies</param>
+void KinectSkeletonMapper::mapBodies(MappingSession &session, INT64 frameTime, const BodyData * const *kBodies, int bodyCount) {
+
+	// Nothing can be mapped without a layer
+	if (!session.m_pLayer)
 		return;
+
+	// Set key timestamp
+	FbxTime ltime;
+	ltime.SetMilliSeconds(frameTime);
+
+	// Untracked slots carry no joint information
+	SkeletonBinding *bindings[BODY_COUNT];
+	const BodyData *trackedBodies[BODY_COUNT];
+	int mappedCount = 0;
+	for (int i = 0; i < bodyCount; i++) {
+		if (!kBodies[i]->isTracked)
+			continue;
+
+		bindings[mappedCount] = &getBinding(session, *kBodies[i]);
+		trackedBodies[mappedCount] = kBodies[i];
+		mappedCount++;
 	}
 
+	// Joints of every body are smoothed together, before anything is keyed
+	if (session.m_jointFilter.isEnabled() && mappedCount > 0) {
+		TRACE_SCOPE("filter_joints");
+		session.m_jointFilter.apply(frameTime, trackedBodies, mappedCount, trackedBodies);
+	}
 
-	if (!skelNode) {
-		// Initialize body
-		skelNode = init(pScene, kBody);
+	if (session.m_pWorkers && session.m_pWorkers->getWorkerCount() > 0 && mappedCount > 1) {
+		// Each body only writes to the key buffers of its own skeleton, so bodies do not depend on each other
+		BodyMappingContext context = { &session, bindings, trackedBodies, ltime };
+		session.m_pWorkers->run(&KinectSkeletonMapper::mapBodyTask, &context, mappedCount);
+	}
+	else {
+		session.m_rotationBatch.clear();
+		session.m_batchJoints.clear();
+
+		// Queue rotations of every body. Each body owns a contiguous range of the batch
+		size_t firstRotations[BODY_COUNT + 1];
+		for (int i = 0; i < mappedCount; i++) {
+			firstRotations[i] = session.m_rotationBatch.size();
+			collectRotations(session.m_rotationBatch, session.m_batchJoints, *bindings[i], ltime, trackedBodies[i]->joints, trackedBodies[i]->orientations);
+		}
+		firstRotations[mappedCount] = session.m_rotationBatch.size();
 
-		// Set translation scale value
-		//setTransScaling(skelNode, joints);
+		// Whole frame at once
+		{
+			TRACE_SCOPE("compute_local_euler");
+			session.m_rotationBatch.computeLocalEuler();
+		}
 
-		// Set body initial alignment
-		setInitialAlignmentRules(skelNode, joints, orientations);
+		for (int i = 0; i < mappedCount; i++)
+			addRotationKeys(session.m_rotationBatch, session.m_batchJoints, session.m_bVerifyRotations, *bindings[i], ltime, firstRotations[i], firstRotations[i + 1]);
 	}
+	session.m_nMappedBodies += mappedCount;
 
-	// Add key information to curves
-	addAnimationKeys(pScene, skelNode, frameTime, joints, orientations);
+	// Keys reach the curves in bulk, a few times per minute. Samples held back by adaptive keying still wait for the next frame
+	if (++session.m_nBufferedFrames >= c_keyCommitFrameCount)
+		session.commitKeys(false);
+}
 
-};
+/// <summary>
+/// Maps a single body of a frame, on a mapping worker. Its rotations are converted in a batch of its own
+/// </summary>
+/// <param name="pContext">Bodies of the frame ( BodyMappingContext )</param>
+/// <param name="index">Body to be mapped</param>
+void KinectSkeletonMapper::mapBodyTask(void *pContext, int index) {
+
+	TRACE_SCOPE("map_body");
+
+	const BodyMappingContext &context = *static_cast<const BodyMappingContext*>(pContext);
+	SkeletonBinding &binding = *context.m_bindings[index];
+	const BodyData &kBody = *context.m_bodies[index];
+
+	binding.m_rotationBatch.clear();
+	binding.m_batchJoints.clear();
+	collectRotations(binding.m_rotationBatch, binding.m_batchJoints, binding, context.m_frameTime, kBody.joints, kBody.orientations);
+
+	binding.m_rotationBatch.computeLocalEuler();
+
+	addRotationKeys(binding.m_rotationBatch, binding.m_batchJoints, context.m_pSession->m_bVerifyRotations, binding, context.m_frameTime, 0, binding.m_rotationBatch.size());
+}
+
+/// <summary>
+/// Gets the skeleton of a body, adding it to the scene the first time the body is seen
+/// </summary>
+/// <param name="session">Take being mapped</param>
+/// <param name="kBody">Decoded Kinect body</param>
+/// <returns>Skeleton bound to the body</returns>
+SkeletonBinding &KinectSkeletonMapper::getBinding(MappingSession &session, const BodyData &kBody) {
+
+	// Skeletons are only looked up by name the first time their body is seen
+	auto bindingIt = session.m_bindings.find(kBody.trackingId);
+	if (bindingIt == session.m_bindings.end()) {
+
+		FbxString bodyRootName = getPreffixedNodeName(kBody.trackingId, c_DefaultRootJointName);
+
+		FbxNode *skelNode;
+		// Check whether skeleton has already been added to the scene
+		skelNode = session.m_pScene->FindNodeByName(bodyRootName);
+
+		std::unique_ptr<SkeletonBinding> binding;
+		if (skelNode) {
+			binding = bindSkeleton(session.m_pLayer, skelNode);
+		}
+		else if (!session.m_spareSkeletons.empty()) {
+			// Skeleton built ahead of time, only its names change
+			binding = std::move(session.m_spareSkeletons.front());
+			session.m_spareSkeletons.erase(session.m_spareSkeletons.begin());
+			renameSpareSkeleton(*binding, kBody.trackingId);
+
+			// Set body initial alignment
+			setInitialAlignmentRules(binding->m_pRootNode, kBody.joints, kBody.orientations);
+		}
+		else {
+			// Initialize body ( no spare skeleton left, the frame waits for it )
+			PipelineMetrics::add(MetricCounter_SkeletonsBuiltWhileMapping);
+			skelNode = init(session.m_pScene, kBody.trackingId);
+
+			// Set translation scale value
+			//setTransScaling(skelNode, kBody.joints);
+
+			// Set body initial alignment
+			setInitialAlignmentRules(skelNode, kBody.joints, kBody.orientations);
+
+			binding = bindSkeleton(session.m_pLayer, skelNode);
+		}
+
+		// Skeletons only know how to key once a body is bound to them
+		binding->setKeying(session.m_keying);
+
+		bindingIt = session.m_bindings.insert(std::make_pair(kBody.trackingId, std::move(binding))).first;
+	}
+
+	return *bindingIt->second;
+}
+
+/// <summary>
+/// Gives a spare skeleton the node names of a body
+/// </summary>
+/// <param name="binding">Spare skeleton</param>
+/// <param name="trackingId">Tracking id of the body it is bound to</param>
+void KinectSkeletonMapper::renameSpareSkeleton(SkeletonBinding &binding, UINT64 trackingId) {
+
+	// Every node name starts with the same spare prefix, found from the root name
+	size_t preffixLength = strlen(binding.m_pRootNode->GetName()) - strlen(c_DefaultRootJointName);
+
+	for (auto &jBinding : binding.m_joints) {
+		FbxString nodeName = getPreffixedNodeName(trackingId, jBinding.m_pNode->GetName() + preffixLength);
+		jBinding.m_pNode->SetName(nodeName);
+
+		FbxNodeAttribute *pAttribute = jBinding.m_pNode->GetNodeAttribute();
+		if (pAttribute)
+			pAttribute->SetName(nodeName);
+	}
+}
+
+/// <summary>
+/// Adds skeletons to the scene ahead of time. Bodies seen for the first time are bound to one of them,
+/// instead of having a skeleton built while their frame is being mapped
+/// </summary>
+/// <param name="session">Take being mapped</param>
+/// <param name="count">Number of spare skeletons the take should have</param>
+void KinectSkeletonMapper::prepareSpareSkeletons(MappingSession &session, unsigned int count) {
+
+	if (!session.m_pLayer)
+		return;
+
+	TRACE_SCOPE("prepare_spare_skeletons");
+
+	while (session.m_spareSkeletons.size() < count) {
+		// Names only have to be unique until the skeleton is bound
+		FbxNode *skelNode = init(session.m_pScene, session.m_nSpareSkeletons++, c_SpareSkelPatternPreffix);
+		session.m_spareSkeletons.push_back(bindSkeleton(session.m_pLayer, skelNode));
+	}
+}
+
+/// <summary>
+/// Removes skeletons no body has been bound to, so they are not saved with the take
+/// </summary>
+/// <param name="session">Take being mapped</param>
+void KinectSkeletonMapper::removeSpareSkeletons(MappingSession &session) {
+
+	for (auto &binding : session.m_spareSkeletons) {
+
+		// Children first, joints were bound breadth first
+		for (auto jIt = binding->m_joints.rbegin(); jIt != binding->m_joints.rend(); ++jIt) {
+			FbxNode *fNode = jIt->m_pNode;
+
+			FbxAnimCurveNode *curveNodes[2] = { fNode->LclTranslation.GetCurveNode(session.m_pLayer), fNode->LclRotation.GetCurveNode(session.m_pLayer) };
+			for (int n = 0; n < 2; n++) {
+				if (!curveNodes[n])
+					continue;
+				for (unsigned int c = 0; c < curveNodes[n]->GetChannelsCount(); c++) {
+					FbxAnimCurve *pCurve = curveNodes[n]->GetCurve(c);
+					if (pCurve)
+						pCurve->Destroy();
+				}
+				curveNodes[n]->Destroy();
+			}
+
+			FbxNodeAttribute *pAttribute = fNode->GetNodeAttribute();
+			fNode->Destroy();
+			if (pAttribute)
+				pAttribute->Destroy();
+		}
+	}
+	session.m_spareSkeletons.clear();
+}
 
 /// <summary>
 /// Initialize body , by adding its corresponding skeleton to the FBX scene
 /// </summary>
 /// <param name="pScene">FBX scene</param>
-/// <param name="kBody">Kinect body to be initialized</param>
+/// <param name="trackingId">Tracking id of the body to be initialized</param>
+/// <param name="namePattern">Prefix of node names, formatted with the tracking id</param>
 /// <returns>Pointer to skeleton root node</returns>
-FbxNode * KinectSkeletonMapper::init(FbxScene*  pScene, IBody *kBody) {
+FbxNode * KinectSkeletonMapper::init(FbxScene*  pScene, UINT64 trackingId, const char *namePattern) {
 
+	TRACE_SCOPE("create_skeleton");
 
-	FbxString bodyRootName = getPreffixedNodeName(kBody, c_DefaultRootJointName);
+	FbxString bodyRootName = getPreffixedNodeName(trackingId, c_DefaultRootJointName, namePattern);
 
 	// Create skeleton root Node
 	FbxSkeleton* lSkeletonRootAttribute = FbxSkeleton::Create(pScene, bodyRootName);
@@ -80,7 +351,7 @@ FbxNode * KinectSkeletonMapper::init(FbxScene*  pScene, IBody *kBody) {
 	pScene->GetRootNode()->AddChild(lSkeletonRoot);
 
 	// Create Joint Hierarchy
-	createHierarchy(pScene, kBody, lSkeletonRoot, c_defaultNodeHierarchy);
+	createHierarchy(pScene, trackingId, lSkeletonRoot, c_flatNodeHierarchy, namePattern);
 
 	// Keyframes for T-pose at time 0
 	keyInCurrentOrientation(pScene, lSkeletonRoot);
@@ -88,6 +359,103 @@ FbxNode * KinectSkeletonMapper::init(FbxScene*  pScene, IBody *kBody) {
 	return lSkeletonRoot;
 }
 
+/// <summary>
+/// Resolves every node and animation curve of a skeleton, so frames can be mapped without any lookup
+/// </summary>
+/// <param name="pLayer">FBX animation layer</param>
+/// <param name="rootNode">Skeleton root node</param>
+/// <returns>Flattened skeleton</returns>
+std::unique_ptr<SkeletonBinding> KinectSkeletonMapper::bindSkeleton(FbxAnimLayer *pLayer, FbxNode *rootNode) {
+
+	std::unique_ptr<SkeletonBinding> binding(new SkeletonBinding);
+	binding->m_pRootNode = rootNode;
+	binding->m_maxRotationError = 0;
+
+	// Breadth first, so children of each joint end up next to each other
+	std::vector<JointBinding> &joints = binding->m_joints;
+	joints.push_back(JointBinding(rootNode));
+
+	for (size_t i = 0; i < joints.size(); i++) {
+		FbxNode *fNode = joints[i].m_pNode;
+
+		joints[i].m_jointType = getJointTypeProperty(fNode);
+		joints[i].m_baseTranslation = fNode->LclTranslation.Get();
+
+		// Translation only for the root joint
+		if (joints[i].m_jointType == c_kinectRootJointType) {
+			joints[i].m_translationCurves[0].m_pCurve = fNode->LclTranslation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_X, true);
+			joints[i].m_translationCurves[1].m_pCurve = fNode->LclTranslation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Y, true);
+			joints[i].m_translationCurves[2].m_pCurve = fNode->LclTranslation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Z, true);
+		}
+
+		joints[i].m_rotationCurves[0].m_pCurve = fNode->LclRotation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_X, true);
+		joints[i].m_rotationCurves[1].m_pCurve = fNode->LclRotation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Y, true);
+		joints[i].m_rotationCurves[2].m_pCurve = fNode->LclRotation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Z, true);
+
+		// New rotation keys follow the last one in the curves ( T-pose key, for a new skeleton )
+		joints[i].m_lastEuler = fNode->LclRotation.Get();
+		for (int c = 0; c < 3; c++) {
+			FbxAnimCurve *pCurve = joints[i].m_rotationCurves[c].m_pCurve;
+			if (pCurve && pCurve->KeyGetCount() > 0)
+				joints[i].m_lastEuler[c] = pCurve->KeyGetValue(pCurve->KeyGetCount() - 1);
+		}
+
+		// Queue children
+		int childCount = fNode->GetChildCount();
+		joints[i].m_firstChild = (int)joints.size();
+		joints[i].m_childCount = childCount;
+		for (int c = 0; c < childCount; c++) {
+			joints.push_back(JointBinding(fNode->GetChild(c), (int)i));
+		}
+	}
+
+	resolveOrientationSources(*binding);
+
+	// Room for every key buffered between two commits
+	for (auto &jBinding : joints) {
+		for (int c = 0; c < 3; c++) {
+			if (jBinding.m_translationCurves[c].m_pCurve) {
+				jBinding.m_translationCurves[c].m_times.reserve(c_keyCommitFrameCount);
+				jBinding.m_translationCurves[c].m_values.reserve(c_keyCommitFrameCount);
+			}
+			if (jBinding.m_orientationSource < JointType_Count) {
+				jBinding.m_rotationCurves[c].m_times.reserve(c_keyCommitFrameCount);
+				jBinding.m_rotationCurves[c].m_values.reserve(c_keyCommitFrameCount);
+			}
+		}
+	}
+	binding->m_globalRotations.resize(joints.size(), quatIdentity());
+
+	return binding;
+}
+
+/// <summary>
+/// Decides which Kinect information drives the rotation of each joint
+/// </summary>
+/// <param name="binding">Skeleton whose joints have been resolved</param>
+void KinectSkeletonMapper::resolveOrientationSources(SkeletonBinding &binding) {
+
+	for (auto &jBinding : binding.m_joints) {
+
+		// Only joints with a Kinect twin, and leading to another one, are animated
+		if (jBinding.m_jointType >= JointType_Count || jBinding.m_childCount == 0)
+			continue;
+
+		const JointBinding &childBinding = binding.m_joints[jBinding.m_firstChild];
+		if (childBinding.m_jointType >= JointType_Count)
+			continue;
+
+		if (jBinding.m_childCount == 1) {
+			// Orientation for Kinect joints is always related to the parent bone
+			jBinding.m_orientationSource = childBinding.m_jointType;
+			jBinding.m_boneEndIndex = jBinding.m_firstChild;
+		}
+		else {
+			jBinding.m_orientationSource = jBinding.m_jointType;
+		}
+	}
+}
+
 
 /// <summary>
 /// Add keys for orientation at time t
@@ -127,68 +495,68 @@ void KinectSkeletonMapper::keyInCurrentOrientation(FbxScene *pScene, FbxNode *pN
 
 
 /// <summary>
-/// Recursive function that creates a FBX node hierarchy on the scene, based on a given definitons
+/// Creates a FBX node hierarchy on the scene, based on a flattened definition
 /// </summary>
 /// <param name="pScene">Current FBX scene</param>
-/// <param name="kBody">Kinect Body</param>
-/// <param name="fNode">Current FBX node</param>
-/// <param name="hNode">Hierarchical definition</param>
-void KinectSkeletonMapper::createHierarchy(FbxScene *pScene, IBody *kBody ,FbxNode *fNode, const std::shared_ptr<HierarchyNodeDefinition> &hNode) {
+/// <param name="trackingId">Kinect Body tracking id</param>
+/// <param name="fNode">FBX node receiving the hierarchy</param>
+/// <param name="hNodes">Flattened hierarchical definition</param>
+/// <param name="namePattern">Prefix of node names, formatted with the tracking id</param>
+void KinectSkeletonMapper::createHierarchy(FbxScene *pScene, UINT64 trackingId ,FbxNode *fNode, const std::vector<FlatHierarchyNode> &hNodes, const char *namePattern) {
 
-	// Create new limb attribute
-	FbxString nodeName = getPreffixedNodeName(kBody, hNode->m_fNodeName);
-	FbxSkeleton* lSkeletonLimbAttribute = FbxSkeleton::Create(pScene, nodeName);
-	lSkeletonLimbAttribute->SetSkeletonType(FbxSkeleton::eLimbNode);
+	// Created nodes, parents always come first
+	std::vector<FbxNode*> limbs(hNodes.size());
 
+	for (size_t i = 0; i < hNodes.size(); i++) {
+		const std::shared_ptr<HierarchyNodeDefinition> &hNode = hNodes[i].m_definition;
 
-	// Create new limb node
-	FbxNode* lSkeletonLimb = FbxNode::Create(pScene, nodeName);
-	lSkeletonLimb->SetNodeAttribute(lSkeletonLimbAttribute);
+		// Create new limb attribute
+		FbxString nodeName = getPreffixedNodeName(trackingId, hNode->m_fNodeName, namePattern);
+		FbxSkeleton* lSkeletonLimbAttribute = FbxSkeleton::Create(pScene, nodeName);
+		lSkeletonLimbAttribute->SetSkeletonType(FbxSkeleton::eLimbNode);
 
-	// Set joint initial orientation
-	lSkeletonLimb->LclTranslation.Set(hNode->m_translation);
-	lSkeletonLimb->LclRotation.Set(hNode->m_rotation);
 
-	// Pre Rotation is active for this joint
-	if (hNode->m_preRot != FbxDouble3()) {
-		lSkeletonLimb->SetRotationActive(true);
-		lSkeletonLimb->SetPreRotation(FbxNode::eSourcePivot, hNode->m_preRot);
-	}
+		// Create new limb node
+		FbxNode* lSkeletonLimb = FbxNode::Create(pScene, nodeName);
+		lSkeletonLimb->SetNodeAttribute(lSkeletonLimbAttribute);
 
-	// Set color attribute ( yellow )
-	lSkeletonLimbAttribute->SetLimbNodeColor(FbxColor(1,1,0));
+		// Set joint initial orientation
+		lSkeletonLimb->LclTranslation.Set(hNode->m_translation);
+		lSkeletonLimb->LclRotation.Set(hNode->m_rotation);
 
-	// Set joint ype
-	if ( hNode->m_kTwin < JointType_Count)
-		setJointTypeProperty(lSkeletonLimb, hNode->m_kTwin);
-
-	// Add node to hierarchy
-	fNode->AddChild(lSkeletonLimb);
+		// Pre Rotation is active for this joint
+		if (hNode->m_preRot != FbxDouble3()) {
+			lSkeletonLimb->SetRotationActive(true);
+			lSkeletonLimb->SetPreRotation(FbxNode::eSourcePivot, hNode->m_preRot);
+		}
 
-	// Traverse node children to add remaining nodes
-	for (auto &it : hNode->m_children) {
-		createHierarchy(pScene, kBody, lSkeletonLimb, it);
-	}
+		// Set color attribute ( yellow )
+		lSkeletonLimbAttribute->SetLimbNodeColor(FbxColor(1,1,0));
 
+		// Set joint ype
+		if ( hNode->m_kTwin < JointType_Count)
+			setJointTypeProperty(lSkeletonLimb, hNode->m_kTwin);
 
+		// Add node to hierarchy
+		FbxNode *parentNode = hNodes[i].m_parentIndex < 0 ? fNode : limbs[hNodes[i].m_parentIndex];
+		parentNode->AddChild(lSkeletonLimb);
 
+		limbs[i] = lSkeletonLimb;
+	}
 }
 
 
 /// <summary>
 /// Gets pre-fixed name of a node
 /// </summary>
-/// <param name="inKBody">Kinect body for which the preffix will be retrieved</param>
+/// <param name="trackingId">Tracking id of the body for which the preffix will be retrieved</param>
 /// <param name="nodeName">Node name without preffix</param>
-/// <param name="outName">Variable where name will be written to</param>
-FbxString KinectSkeletonMapper::getPreffixedNodeName(IBody *inKBody, const FbxString nodeName) {
+/// <param name="namePattern">Prefix, formatted with the tracking id</param>
+FbxString KinectSkeletonMapper::getPreffixedNodeName(UINT64 trackingId, const FbxString nodeName, const char *namePattern) {
 
-	UINT64 bodyTrackingId;
 	char nameBuffer[20];
 
-	// Get body tracking  id
-	inKBody->get_TrackingId(&bodyTrackingId);
-	sprintf_s(nameBuffer, c_SkelRootIdPatternPreffix, bodyTrackingId);
+	FBXSDK_sprintf(nameBuffer, sizeof(nameBuffer), namePattern, (int)trackingId);
 	
 	FbxString prefixedName(nameBuffer);
 	prefixedName += nodeName;
@@ -196,6 +564,60 @@ FbxString KinectSkeletonMapper::getPreffixedNodeName(IBody *inKBody, const FbxSt
 	return prefixedName;
 }
 
+/// <summary>
+/// Finds the skeleton of a body by name, then the joint type and animation curves of every joint, the way every frame
+/// did before skeletons were bound. Only used to measure what binding saves
+/// </summary>
+/// <param name="session">Take being mapped</param>
+/// <param name="trackingId">Tracking id of the body</param>
+/// <returns>Number of joints found ( 0 if the body has no skeleton yet )</returns>
+int KinectSkeletonMapper::lookUpSkeleton(const MappingSession &session, UINT64 trackingId) {
+
+	FbxString bodyRootName = getPreffixedNodeName(trackingId, c_DefaultRootJointName);
+
+	FbxNode *skelNode = session.m_pScene->FindNodeByName(bodyRootName);
+	if (!skelNode || !session.m_pLayer)
+		return 0;
+
+	return lookUpJoints(session.m_pLayer, skelNode);
+}
+
+/// <summary>
+/// Reads the joint type and animation curves of a joint and of every joint below it, by name
+/// </summary>
+/// <param name="pLayer">FBX animation layer</param>
+/// <param name="fNode">Joint node</param>
+/// <returns>Number of joints read</returns>
+int KinectSkeletonMapper::lookUpJoints(FbxAnimLayer *pLayer, FbxNode *fNode) {
+
+	JointType nodeJointType = getJointTypeProperty(fNode);
+
+	// Translation only for the root joint
+	if (nodeJointType == c_kinectRootJointType) {
+		fNode->LclTranslation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_X, true);
+		fNode->LclTranslation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Y, true);
+		fNode->LclTranslation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Z, true);
+	}
+
+	fNode->LclRotation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_X, true);
+	fNode->LclRotation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Y, true);
+	fNode->LclRotation.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Z, true);
+
+	int jointCount = 1;
+	int childCount = fNode->GetChildCount();
+	for (int i = 0; i < childCount; i++) {
+		FbxNode *childNode = fNode->GetChild(i);
+
+		// Orientation of a joint came from the type of its first child
+		if (i == 0)
+			getJointTypeProperty(childNode);
+
+		jointCount += lookUpJoints(pLayer, childNode);
+	}
+
+	return jointCount;
+}
+
 /// <summary>
 /// Gets joint type property, based on Kinect's JointType
 /// </summary>
@@ -239,133 +661,148 @@ void KinectSkeletonMapper::setJointTypeProperty(FbxNode *fNode, JointType kType)
 
 
 /// <summary>
-/// A new frame has been received, add animation corresponding to the motion
-/// </summary>
-/// <param name="pScene">FBX scene</param>
-/// <param name="rootNode">FBX root node</param>
-/// <param name="frameTime">Current frame time</param>
-/// <param name="kBody">Kinect body to have animation extracted</param>
-void KinectSkeletonMapper::addAnimationKeys(FbxScene*  pScene, FbxNode *rootNode, INT64 frameTime, IBody *kBody) {
-	// Get Kinect Joint Information
-	Joint joints[JointType_Count];
-	JointOrientation orientations[JointType_Count];
-
-	HRESULT hr;
-	hr = kBody->GetJoints(_countof(joints), joints);
-	// If we successfully retrieved the Joint array
-	if (!SUCCEEDED(hr)) {
-		return;
-	}
-
-	hr = kBody->GetJointOrientations(_countof(orientations), orientations);
-	// If we successfully retrieved the JointOrientation array
-	if (!SUCCEEDED(hr)) {
-		return;
-	}
-	addAnimationKeys(pScene, rootNode, frameTime, joints, orientations);
-}
-/// <summary>
-/// A new frame has been received, add animation corresponding to the motion
+/// A new frame has been received, add translation keys and queue the rotation of every animated joint.
+/// Joints are visited in a single forward pass, parents before children
 /// </summary>
-/// <param name="pScene">FBX scene</param>
-/// <param name="rootNode">FBX root node</param>
+/// <param name="batch">Receives queued rotations</param>
+/// <param name="batchJoints">Receives the joint of every queued rotation</param>
+/// <param name="binding">Skeleton to be animated</param>
 /// <param name="frameTime">Current frame time</param>
 /// <param name="joints">Kinect joint position array</param>
 /// <param name="orientations">Kinect joint orientation array</param>
-void KinectSkeletonMapper::addAnimationKeys(FbxScene*  pScene, FbxNode *rootNode, INT64 frameTime, Joint *joints, JointOrientation *orientations) {
+void KinectSkeletonMapper::collectRotations(JointRotationBatch &batch, std::vector<JointBinding*> &batchJoints, SkeletonBinding &binding, FbxTime frameTime, const Joint *joints, const JointOrientation *orientations) {
 
-	FbxAnimStack *baseAnimStack = pScene->GetCurrentAnimationStack();
+	// Skeleton root is never animated
+	std::vector<JointQuaternion> &globalRotations = binding.m_globalRotations;
+	globalRotations[0] = quatIdentity();
 
-	// Anim Stack invalid
-	if (!baseAnimStack)
-		return;
+	size_t jointCount = binding.m_joints.size();
+	for (size_t i = 1; i < jointCount; i++) {
+		JointBinding &jBinding = binding.m_joints[i];
+		const JointQuaternion &parentRot = globalRotations[jBinding.m_parentIndex];
 
-	FbxAnimLayer *baseAnimLayer = baseAnimStack->GetMember<FbxAnimLayer>();
+		// This is the root joint in Kinect
+		if (jBinding.m_translationCurves[0].m_pCurve)
+			addTranslationKeys(jBinding, frameTime, joints[jBinding.m_jointType]);
+
+		// Joints that are not animated carry their parent orientation down to their children
+		JointQuaternion globalRot;
+		if (!getGlobalOrientation(binding, jBinding, joints, orientations, globalRot)) {
+			globalRotations[i] = parentRot;
+			continue;
+		}
 
-	//Anim layer invalid
-	if (!baseAnimLayer)
-		return;
+		// Converted to relative orientation later, together with the rest of the frame
+		batch.add(parentRot, globalRot);
+		batchJoints.push_back(&jBinding);
 
-	int childCount = rootNode->GetChildCount();
-	for (int i = 0; i < childCount; i++) {
-		FbxNode *childNode = rootNode->GetChild(i);
-		animateHierarchy(baseAnimLayer, childNode, frameTime, joints, orientations);
+		globalRotations[i] = globalRot;
 	}
-
-
 }
 
 /// <summary>
-/// Recursively add animation keys to each node in the hierarchy
+/// Adds rotation keys for a range of converted rotations, all of them belonging to the same skeleton
 /// </summary>
-/// <param name="pLayer">FBX  animation layer</param>
-/// <param name="fNode">FBX node to be animated</param>
+/// <param name="batch">Converted rotations</param>
+/// <param name="batchJoints">Joint of every rotation</param>
+/// <param name="verifyRotations">Cross-check every key against the FbxAMatrix reference</param>
+/// <param name="binding">Skeleton to be animated</param>
 /// <param name="frameTime">Current frame time</param>
-/// <param name="kJoints">Kinect joints to bild animation</param>
-/// <param name="kJointOrientations">Kinect joint orientations to build animation</param>
-/// <param name="accumulator">Auxiliary matrix that helps converting from absolute orientation to relative. Defaults to identity</param>
-void KinectSkeletonMapper::animateHierarchy(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, Joint *kJoints, JointOrientation *kOrientations, FbxAMatrix accumullator) {
+/// <param name="firstRotation">First rotation of the skeleton in the batch</param>
+/// <param name="endRotation">One past the last rotation of the skeleton in the batch</param>
+void KinectSkeletonMapper::addRotationKeys(const JointRotationBatch &batch, const std::vector<JointBinding*> &batchJoints, bool verifyRotations, SkeletonBinding &binding, FbxTime frameTime, size_t firstRotation, size_t endRotation) {
 
-	// Retrieve node joint type
-	JointType nodeJointType = getJointTypeProperty(fNode);
+	for (size_t i = firstRotation; i < endRotation; i++) {
+		JointBinding &jBinding = *batchJoints[i];
 
-	// Number of children this node has
-	int childCount = fNode->GetChildCount();
+		// Continuous with the previous key, so curves need no unroll filter once the take is over
+		FbxDouble3 euler = makeRotationContinuous(jBinding.m_lastEuler, FbxDouble3(batch.m_eulerX[i], batch.m_eulerY[i], batch.m_eulerZ[i]));
+		jBinding.m_lastEuler = euler;
 
+		addKeys(jBinding.m_rotationCurves, frameTime, euler);
 
-	// Check if joint type is valid
-	if (nodeJointType < JointType_Count && childCount > 0 ) {
-		
-		
-		// This is the root joint in Kinect
-		if (nodeJointType == c_kinectRootJointType) {
-			addTranslationKeys(pLayer, fNode, frameTime, kJoints[nodeJointType]);
+		if (verifyRotations) {
+			JointQuaternion parentRot = { batch.m_parentX[i], batch.m_parentY[i], batch.m_parentZ[i], batch.m_parentW[i] };
+			JointQuaternion globalRot = { batch.m_globalX[i], batch.m_globalY[i], batch.m_globalZ[i], batch.m_globalW[i] };
+			double error = checkLocalRotation(parentRot, globalRot, euler);
+			if (error > binding.m_maxRotationError)
+				binding.m_maxRotationError = error;
 		}
-
-		// Set the orientation of this joint 
-		FbxNode *childNode = fNode->GetChild(0);
-		JointType childJointType = getJointTypeProperty(childNode);
-
-		if (childJointType < JointType_Count) {
-			if ( childCount == 1  ) {
-				if (!isOrientationNull(kOrientations[childJointType])) {
-					// Orientation for Kinect joints is always related to the parent bone
-					addRotationKeys(pLayer, fNode, frameTime, kOrientations[childJointType], accumullator);
-				}
-				else { // The trickiest case, no orientation information for the last bone
-					// We can estimate it ourselves, but there will not be roll rotation
-					FbxQuaternion ori = estimateBoneOri(childNode, kJoints[nodeJointType], kJoints[childJointType]);
-					addRotationKeys(pLayer, fNode, frameTime, ori, accumullator);
-				}
-			}
-			else {
-				addRotationKeys(pLayer, fNode, frameTime, kOrientations[nodeJointType], accumullator);
-			}
-		}
-
 	}
+}
 
+/// <summary>
+/// Global orientation of a joint, according to Kinect
+/// </summary>
+/// <param name="binding">Skeleton being animated</param>
+/// <param name="jBinding">Joint to be animated</param>
+/// <param name="kJoints">Kinect joint positions</param>
+/// <param name="kOrientations">Kinect joint orientations</param>
+/// <param name="qRot">Output, unit quaternion</param>
+/// <returns>False if there is no valid orientation for this joint</returns>
+bool KinectSkeletonMapper::getGlobalOrientation(const SkeletonBinding &binding, const JointBinding &jBinding, const Joint *kJoints, const JointOrientation *kOrientations, JointQuaternion &qRot) {
+
+	if (jBinding.m_orientationSource >= JointType_Count)
+		return false;
+
+	const JointOrientation &kOrientation = kOrientations[jBinding.m_orientationSource];
+
+	if (!isOrientationNull(kOrientation) || jBinding.m_boneEndIndex < 0) {
+		qRot.x = kOrientation.Orientation.x;
+		qRot.y = kOrientation.Orientation.y;
+		qRot.z = kOrientation.Orientation.z;
+		qRot.w = kOrientation.Orientation.w;
+	}
+	else { // The trickiest case, no orientation information for the last bone
+		// We can estimate it ourselves, but there will not be roll rotation
+		const JointBinding &childBinding = binding.m_joints[jBinding.m_boneEndIndex];
+		FbxQuaternion ori = estimateBoneOri(childBinding.m_baseTranslation, kJoints[jBinding.m_jointType], kJoints[childBinding.m_jointType]);
+		qRot.x = ori[0];
+		qRot.y = ori[1];
+		qRot.z = ori[2];
+		qRot.w = ori[3];
+	}
 
+	// Kinect quaternions are not exactly unit length
+	return quatNormalize(qRot);
+}
 
-	// Add animations keys for the rest of hierarchy
-	for (int i = 0; i < childCount; i++) {
-		FbxNode *childNode = fNode->GetChild(i);
-		animateHierarchy(pLayer, childNode, frameTime, kJoints, kOrientations,accumullator);
+/// <summary>
+/// Computes the same local rotation through FBX matrices, as it used to be done, and compares it to ours
+/// </summary>
+/// <param name="parentRot">Global rotation of the parent joint</param>
+/// <param name="globalRot">Global rotation of the joint</param>
+/// <param name="euler">Local rotation keyed by us, in euler angles</param>
+/// <returns>Largest difference among X, Y and Z, in degrees</returns>
+double KinectSkeletonMapper::checkLocalRotation(const JointQuaternion &parentRot, const JointQuaternion &globalRot, const FbxDouble3 &euler) {
+
+	fbxsdk::FbxAMatrix parentMat, qMat;
+	parentMat.SetQ(FbxQuaternion(parentRot.x, parentRot.y, parentRot.z, parentRot.w));
+	qMat.SetQ(FbxQuaternion(globalRot.x, globalRot.y, globalRot.z, globalRot.w));
+	FbxVector4 reference = (parentMat.Inverse() * qMat).GetR();
+
+	double maxError = 0;
+	for (int i = 0; i < 3; i++) {
+		// Keys are moved by whole turns to follow the previous one
+		double error = fmod(fabs(reference[i] - euler[i]), 360.0);
+		if (error > 180.0)
+			error = 360.0 - error;
+		if (error > maxError)
+			maxError = error;
 	}
-
+	return maxError;
 }
 
 /// <summary>
 /// Extracts translation information from kinect, and add it as a key to our animation layer
 /// </summary>
-/// <param name="pLayer">FBX  animation layer</param>
-/// <param name="fNode">FBX node to be animated</param>
+/// <param name="jBinding">Joint to be animated</param>
 /// <param name="frameTime">Current frame time</param>
 /// <param name="kJoint">Kinect joint to have position extracted from</param>
-void KinectSkeletonMapper::addTranslationKeys(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, Joint &kJoint) {
+void KinectSkeletonMapper::addTranslationKeys(JointBinding &jBinding, FbxTime frameTime, const Joint &kJoint) {
 
 	// Define X, Y and Z coordinates
-	FbxDouble3 originalPos = fNode->LclTranslation.Get();
+	const FbxDouble3 &originalPos = jBinding.m_baseTranslation;
 	float scalingFactor = c_positionalScalingFactor;
 	//float scalingFactor = getTranslationScaleProperty(fNode);
 	float Xpos, Ypos, Zpos;
@@ -373,100 +810,44 @@ void KinectSkeletonMapper::addTranslationKeys(FbxAnimLayer*  pLayer, FbxNode *fN
 	Ypos = (kJoint.Position.Y*scalingFactor) + ((float)originalPos[1]);
 	Zpos = ((kJoint.Position.Z)*scalingFactor) + ((float)originalPos[2]);
 
-
-	// Set key timestamp
-	FbxTime ltime;
-	ltime.SetMilliSeconds(frameTime);
-
-	applyTransformation(pLayer, fNode, FbxDouble3(Xpos, Ypos, Zpos), ltime, true);
+	addKeys(jBinding.m_translationCurves, frameTime, FbxDouble3(Xpos, Ypos, Zpos));
 }
 
 
 /// <summary>
-/// Extracts rotation information from kinect, and add it as a key to our animation layer
-/// </summary>
-/// <param name="pLayer">FBX  animation layer</param>
-/// <param name="fNode">FBX node to be animated</param>
-/// <param name="frameTime">Current frame time</param>
-/// <param name="kOrientation">Kinect joint orientation</param>
-/// <param name="accumullator">Used to compute orientations based on parent joint</param>
-void KinectSkeletonMapper::addRotationKeys(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, JointOrientation &kOrientation, FbxAMatrix &accumullator) {
-
-	// Joint orientation, represented as a quaternion
-	fbxsdk::FbxQuaternion qRot;
-
-	//Extract quaternion from kinect
-	qRot = fbxsdk::FbxQuaternion(kOrientation.Orientation.x,
-		kOrientation.Orientation.y, kOrientation.Orientation.z, kOrientation.Orientation.w);
-
-	addRotationKeys(pLayer, fNode, frameTime, qRot, accumullator);
-}
-
-/// <summary>
-/// Extracts rotation information from kinect, and add it as a key to our animation layer
+/// Buffers one key for each of the given X, Y and Z curves
 /// </summary>
-/// <param name="pLayer">FBX  animation layer</param>
-/// <param name="fNode">FBX node to be animated</param>
-/// <param name="frameTime">Current frame time</param>
-/// <param name="qRot">Joint orientation as quaternion</param>
-/// <param name="accumullator">Used to compute orientations based on parent joint</param>
-void KinectSkeletonMapper::addRotationKeys(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, FbxQuaternion qRot, FbxAMatrix &accumullator) {
-
-	// Decompose it into euler angles ( make sure to convert from absolute orientation to relative )
-	fbxsdk::FbxAMatrix localOriMat, qMat;
-	qMat.SetQ(qRot);
-	localOriMat = accumullator.Inverse() * qMat;
-	FbxVector4 euler = localOriMat.GetR();
-
-	// Make sure rotation is continuous (switched to post-processing filter)
-	//if (rotationCurveX->KeyGetCount() > 0) {
-	//	FbxVector4 previousEulerRotation = getEulerRotation(rotationCurveX->KeyGetCount()-1, rotationCurveX, rotationCurveY, rotationCurveZ);
-	//	euler = makeRotationContinuous(previousEulerRotation, euler);
-	//}
-
-	// Set key timestamp
-	FbxTime ltime;
-	ltime.SetMilliSeconds(frameTime);
-
-	applyTransformation(pLayer, fNode, euler, ltime, false);
-
-	// Update accumulator, based on local orientation
-	accumullator = accumullator * localOriMat;
+/// <param name="curves">X, Y and Z curves</param>
+/// <param name="frameTime">Key time</param>
+/// <param name="values">X, Y and Z values</param>
+void KinectSkeletonMapper::addKeys(CurveKeyBuffer *curves, FbxTime frameTime, const FbxDouble3 &values) {
+	for (int i = 0; i < 3; i++)
+		curves[i].add(frameTime, (float)values[i]);
 }
 
 
 /// <summary>
-/// Applies post processing filters to our motion data
+/// Applies post processing filters to our motion data. Every joint transform is filtered on its own, shared among the workers
 /// </summary>
 /// <param name="pScene">FBX  scene</param>
-void KinectSkeletonMapper::applyPostProcessingFilters(FbxScene*  pScene) {
-
-	FbxAnimStack *baseAnimStack = pScene->GetCurrentAnimationStack();
-
-	// Anim Stack invalid
-	if (!baseAnimStack)
-		return;
-
-	FbxAnimLayer *baseAnimLayer = baseAnimStack->GetMember<FbxAnimLayer>();
-
-	//Anim layer invalid
-	if (!baseAnimLayer)
-		return;
-
-	// Apply unroll filter to the whole hierarchy
-	// This will ensure we get rid of discontinuity errors caused by euler conversion ( Euler sucks! )
-	FbxAnimCurveFilterUnroll lUnrollFilter;
-	
-	// Apply filter for each skeleton in scene
-	int sceneChildrenCount = pScene->GetRootNode()->GetChildCount();
-	for (int i = 0; i < sceneChildrenCount; i++)  {
-		FbxNode *fNode =  pScene->GetRootNode()->GetChild(i);
-		FbxNodeAttribute *fNodeAttribute =  fNode->GetNodeAttribute();  
-		if (fNodeAttribute && (fNodeAttribute->GetAttributeType() == FbxNodeAttribute::eSkeleton ) ) {
-			applyFilterHierarchically(lUnrollFilter, fNode->GetChild(0));
-		}
-	}
-
+/// <param name="settings">Filters to be run</param>
+/// <param name="pWorkers">Threads filtering along with the calling one ( NULL filters on the calling thread only )</param>
+/// <param name="pReport">Output, key counts before and after filtering ( may be NULL )</param>
+/// <param name="stageCallback">Called after every filter ( may be NULL )</param>
+/// <param name="pStageContext">Passed to the stage callback</param>
+void KinectSkeletonMapper::applyPostProcessingFilters(FbxScene*  pScene, const PostProcessingSettings &settings, MappingWorkerPool *pWorkers, PostProcessingReport *pReport,
+	PostProcessingPipeline::StageCallback stageCallback, void *pStageContext) {
+
+	TRACE_SCOPE("post_processing_filters");
+
+	// Rotation keys are made continuous as they are added ( see makeRotationContinuous ), so discontinuity errors caused by
+	// euler conversion ( Euler sucks! ) need no unroll filter going over whole curves, unless asked for
+	PostProcessingPipeline pipeline(settings);
+	pipeline.apply(pScene, pWorkers, pReport, stageCallback, pStageContext);
+
+	// Resampled keys fall on the frames of the scene, as applications opening it count them
+	if (settings.m_resampleMode != FbxTime::eDefaultMode)
+		pScene->GetGlobalSettings().SetTimeMode(settings.m_resampleMode);
 }
 
 
@@ -488,26 +869,18 @@ FbxVector4 KinectSkeletonMapper::getEulerRotation(int keyIndex, FbxAnimCurve *ro
 }
 
 /// <summary>
-/// Make sure rotation in Euler angles is continuous
+/// Make sure rotation in Euler angles is continuous. Each angle is moved by whole turns to the closest one to the previous key, as the unroll filter does
 /// </summary>
 /// <param name="previousEuler">Rotation for the previous frame</param>
 /// <param name="currentEuler">Rotaion for the current frame</param>
 /// <return>Continuous rotation, in euler angles</return>
-FbxVector4 KinectSkeletonMapper::makeRotationContinuous(FbxVector4 previousEuler, FbxVector4 currentEuler) {
-	FbxVector4 resultingRotation;
+FbxDouble3 KinectSkeletonMapper::makeRotationContinuous(const FbxDouble3 &previousEuler, const FbxDouble3 &currentEuler) {
+	FbxDouble3 resultingRotation;
 
-	// For each coordinate
+	// Previous key may be many turns away, so turns are counted rather than added one at a time
 	for (int i = 0; i < 3; i++) {
-		resultingRotation[i] = currentEuler[i];
-
-		// Curve is non-continuous, fix it
-		while (abs(resultingRotation[i] - previousEuler[i]) > c_rotationContinuityMaxOffset) {
-			if (resultingRotation[i] < previousEuler[i])
-				resultingRotation[i] += c_rotationContinuityMaxOffset;
-			else
-				resultingRotation[i] -= c_rotationContinuityMaxOffset;
-		} 
-
+		double turns = floor((previousEuler[i] - currentEuler[i]) / c_fullTurnDegrees + 0.5);
+		resultingRotation[i] = currentEuler[i] + turns * c_fullTurnDegrees;
 	}
 	return resultingRotation;
 }
@@ -517,7 +890,7 @@ FbxVector4 KinectSkeletonMapper::makeRotationContinuous(FbxVector4 previousEuler
 /// </summary>
 /// <param name="fNode">Root FBX  node</param>
 /// <param name="kJoints">Kinect joint position info</param>
-void KinectSkeletonMapper::setTransScaling(FbxNode *fNode, Joint *joints) {
+void KinectSkeletonMapper::setTransScaling(FbxNode *fNode, const Joint *joints) {
 
 	int childCount = fNode->GetChildCount();
 
@@ -553,7 +926,7 @@ void KinectSkeletonMapper::setTransScaling(FbxNode *fNode, Joint *joints) {
 /// <param name="fNode">Root FBX  node</param>
 /// <param name="kJoints">Kinect joint position info</param>
 /// <param name="kOrientations">Kinect joint orientation info</param>
-void KinectSkeletonMapper::setInitialAlignmentRules(FbxNode *fNode, Joint *joints, JointOrientation *orientations) {
+void KinectSkeletonMapper::setInitialAlignmentRules(FbxNode *fNode, const Joint *joints, const JointOrientation *orientations) {
 	
 
 	int childCount = fNode->GetChildCount();
@@ -592,12 +965,12 @@ void KinectSkeletonMapper::setInitialAlignmentRules(FbxNode *fNode, Joint *joint
 /// <summary>
 /// Estimates rotation between parent joint and hild joint. Used to compensate for missing Kinect info
 /// </summary>
-/// <param name="cNode">Child FBX Node</param>
+/// <param name="boneRef">Child joint translation, when skeleton was created</param>
 /// <param name="pJoint">Parent Kinect Joint</param>
 /// <param name="cJoint">Child Kinect Joint</param>
-FbxQuaternion KinectSkeletonMapper::estimateBoneOri(FbxNode *cNode, const Joint &pJoint, const Joint &cJoint) {
+FbxQuaternion KinectSkeletonMapper::estimateBoneOri(const FbxDouble3 &boneRef, const Joint &pJoint, const Joint &cJoint) {
 
-	FbxVector4 ref = cNode->LclTranslation.Get();
+	FbxVector4 ref = boneRef;
 	ref.Normalize();
 	FbxVector4 goal(cJoint.Position.X - pJoint.Position.X, cJoint.Position.Y - pJoint.Position.Y, cJoint.Position.Z - pJoint.Position.Z);
 	goal.Normalize();
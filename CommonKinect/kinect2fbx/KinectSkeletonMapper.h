@@ -1,7 +1,13 @@
 #pragma once
 
-#include "..\stdafx.h"
+#include "../stdafx.h"
 #include "HierarchyNodeDefinition.h"
+#include "BodyFrame.h"
+#include "SkeletonBinding.h"
+#include "PostProcessingFilters.h"
+#include "KPreRollBuffer.h"
+
+class CaptureJournalWriter;
 
 /*
  Static class responsible for mapping Kinect skeleton frames to FBX scene
@@ -11,83 +17,196 @@ public:
 	/// <summary>
 	/// Map current frame of Kinect Body to FBX scene
 	/// </summary>
-	/// <param name="pScene">FBX scene</param>
+	/// <param name="session">Take being mapped</param>
 	/// <param name="frameTime">Current frame time</param>
-	/// <param name="kBody">Kinect body to be mapped</param>
-	static void map(FbxScene* pScene, INT64 frameTime, IBody *kBody);
+	/// <param name="kBody">Decoded Kinect body to be mapped</param>
+	static void map(MappingSession &session, INT64 frameTime, const BodyData &kBody);
+
+	/// <summary>
+	/// Map every tracked body of a decoded frame to FBX scene
+	/// </summary>
+	/// <param name="session">Take being mapped</param>
+	/// <param name="bFrame">Decoded Kinect frame</param>
+	/// <returns>False if frame could not be read, and was skipped</returns>
+	static bool mapFrame(MappingSession &session, const BodyFrame &bFrame);
+
+	/// <summary>
+	/// Maps the frames received shortly before a take started, oldest first, so the take starts at the oldest one. The buffer is emptied afterwards
+	/// </summary>
+	/// <param name="session">Take being mapped, no frame mapped yet</param>
+	/// <param name="preRoll">Frames received while not recording</param>
+	/// <param name="bFrame">First frame received while recording. Only older frames are mapped</param>
+	/// <param name="duration">How far back before it frames are mapped, in Kinect time ( 100ns increments )</param>
+	/// <param name="pJournal">Journal of the take, gets its own copy of every frame ( may be NULL )</param>
+	/// <returns>Number of frames mapped</returns>
+	static unsigned int mapPreRoll(MappingSession &session, KPreRollBuffer &preRoll, const BodyFrame &bFrame, INT64 duration, CaptureJournalWriter *pJournal);
 
 
 	/// <summary>
-	/// Applies post processing filters to our motion data
+	/// Applies post processing filters to our motion data. Every joint transform is filtered on its own, shared among the workers
 	/// </summary>
 	/// <param name="pScene">FBX  scene</param>
-	static void applyPostProcessingFilters(FbxScene*  pScene);
+	/// <param name="settings">Filters to be run</param>
+	/// <param name="pWorkers">Threads filtering along with the calling one ( NULL filters on the calling thread only )</param>
+	/// <param name="pReport">Output, key counts before and after filtering ( may be NULL )</param>
+	/// <param name="stageCallback">Called after every filter ( may be NULL )</param>
+	/// <param name="pStageContext">Passed to the stage callback</param>
+	static void applyPostProcessingFilters(FbxScene*  pScene, const PostProcessingSettings &settings = PostProcessingSettings(), MappingWorkerPool *pWorkers = NULL, PostProcessingReport *pReport = NULL,
+		PostProcessingPipeline::StageCallback stageCallback = NULL, void *pStageContext = NULL);
+
+	/// <summary>
+	/// Adds skeletons to the scene ahead of time. Bodies seen for the first time are bound to one of them,
+	/// instead of having a skeleton built while their frame is being mapped
+	/// </summary>
+	/// <param name="session">Take being mapped</param>
+	/// <param name="count">Number of spare skeletons the take should have</param>
+	static void prepareSpareSkeletons(MappingSession &session, unsigned int count);
+
+	/// <summary>
+	/// Removes skeletons no body has been bound to, so they are not saved with the take
+	/// </summary>
+	/// <param name="session">Take being mapped</param>
+	static void removeSpareSkeletons(MappingSession &session);
+
+	/// <summary>
+	/// Finds the skeleton of a body by name, then the joint type and animation curves of every joint, the way every frame
+	/// did before skeletons were bound. Only used to measure what binding saves
+	/// </summary>
+	/// <param name="session">Take being mapped</param>
+	/// <param name="trackingId">Tracking id of the body</param>
+	/// <returns>Number of joints found ( 0 if the body has no skeleton yet )</returns>
+	static int lookUpSkeleton(const MappingSession &session, UINT64 trackingId);
+
+	/// <summary>
+	/// Make sure rotation in Euler angles is continuous. Each angle is moved by whole turns to the closest one to the previous key, as the unroll filter does
+	/// </summary>
+	/// <param name="previousEuler">Rotation for the previous frame</param>
+	/// <param name="currentEuler">Rotaion for the current frame</param>
+	/// <return>Continuous rotation, in euler angles</return>
+	static FbxDouble3 makeRotationContinuous(const FbxDouble3 &previousEuler, const FbxDouble3 &currentEuler);
 private:
 
 
 	// Constants:
 	// Define how skeletons should be identified in the FBX scene
 	static const char *c_SkelRootIdPatternPreffix;
+	// Skeletons built ahead of time, until they are bound to a body
+	static const char *c_SpareSkelPatternPreffix;
 	// Root joint name
 	static const char *c_DefaultRootJointName;
 	// Define node hierarchy
 	static const std::shared_ptr<HierarchyNodeDefinition> c_defaultNodeHierarchy;
+	// Node hierarchy, flattened so skeletons are created without recursion
+	static const std::vector<FlatHierarchyNode> c_flatNodeHierarchy;
 	// Default name used by us to store Kinect's Joint type in FBX file
 	static const char *c_jointTypePropertyDefaultName;
 	// Default Kinect root skeleton joint
 	static const JointType c_kinectRootJointType;
 	// If rotation difference is bigger than the following constant, we consider the rotation to be non-continuous
 	static const float c_rotationContinuityMaxOffset;
+	// Euler angles a full turn apart describe the same rotation
+	static const double c_fullTurnDegrees;
 
 	// We use this to scale the translation of the root joint when mapping
 	static const float  c_positionalScalingFactor;
 
+	// Keys are buffered, and committed to their curves every this many frames
+	static const unsigned int c_keyCommitFrameCount;
+
 	// Private methods
 
 	/// <summary>
 	/// Initialize body , by adding its corresponding skeleton to the FBX scene
 	/// </summary>
 	/// <param name="pScene">FBX scene</param>
-	/// <param name="kBody">Kinect body to be initialized</param>
+	/// <param name="trackingId">Tracking id of the body to be initialized</param>
+	/// <param name="namePattern">Prefix of node names, formatted with the tracking id</param>
 	/// <returns>Pointer to skeleton root node</returns>
-	static FbxNode * init(FbxScene*  pScene, IBody *kBody);
+	static FbxNode * init(FbxScene*  pScene, UINT64 trackingId, const char *namePattern = c_SkelRootIdPatternPreffix);
 
 	/// <summary>
-	/// A new frame has been received, add animation corresponding to the motion
+	/// Maps several bodies captured at the same time. Skeletons are created first, one at a time, as they change the scene.
+	/// Bodies are then mapped in parallel when the session has workers, otherwise rotations of all of them are converted in a single batch
 	/// </summary>
-	/// <param name="pScene">FBX scene</param>
+	/// <param name="session">Take being mapped</param>
 	/// <param name="frameTime">Current frame time</param>
-	/// <param name="kBody">Kinect body to have animation extracted</param>
-	static void addAnimationKeys(FbxScene*  pScene, FbxNode *rootNode, INT64 frameTime, IBody *kBody);
+	/// <param name="kBodies">Decoded Kinect bodies ( at most BODY_COUNT )</param>
+	/// <param name="bodyCount">Number of bodies</param>
+	static void mapBodies(MappingSession &session, INT64 frameTime, const BodyData * const *kBodies, int bodyCount);
 
 	/// <summary>
-	/// A new frame has been received, add animation corresponding to the motion
+	/// Maps a single body of a frame, on a mapping worker. Its rotations are converted in a batch of its own
 	/// </summary>
-	/// <param name="pScene">FBX scene</param>
-	/// <param name="rootNode">FBX root node</param>
+	/// <param name="pContext">Bodies of the frame ( BodyMappingContext )</param>
+	/// <param name="index">Body to be mapped</param>
+	static void mapBodyTask(void *pContext, int index);
+
+	/// <summary>
+	/// Gets the skeleton of a body, adding it to the scene the first time the body is seen
+	/// </summary>
+	/// <param name="session">Take being mapped</param>
+	/// <param name="kBody">Decoded Kinect body</param>
+	/// <returns>Skeleton bound to the body</returns>
+	static SkeletonBinding &getBinding(MappingSession &session, const BodyData &kBody);
+
+	/// <summary>
+	/// Gives a spare skeleton the node names of a body
+	/// </summary>
+	/// <param name="binding">Spare skeleton</param>
+	/// <param name="trackingId">Tracking id of the body it is bound to</param>
+	static void renameSpareSkeleton(SkeletonBinding &binding, UINT64 trackingId);
+
+	/// <summary>
+	/// Resolves every node and animation curve of a skeleton, so frames can be mapped without any lookup
+	/// </summary>
+	/// <param name="pLayer">FBX animation layer</param>
+	/// <param name="rootNode">Skeleton root node</param>
+	/// <returns>Flattened skeleton</returns>
+	static std::unique_ptr<SkeletonBinding> bindSkeleton(FbxAnimLayer *pLayer, FbxNode *rootNode);
+
+	/// <summary>
+	/// A new frame has been received, add translation keys and queue the rotation of every animated joint.
+	/// Joints are visited in a single forward pass, parents before children
+	/// </summary>
+	/// <param name="batch">Receives queued rotations</param>
+	/// <param name="batchJoints">Receives the joint of every queued rotation</param>
+	/// <param name="binding">Skeleton to be animated</param>
 	/// <param name="frameTime">Current frame time</param>
 	/// <param name="joints">Kinect joint position array</param>
 	/// <param name="orientations">Kinect joint orientation array</param>
-	static void addAnimationKeys(FbxScene*  pScene, FbxNode *rootNode, INT64 frameTime, Joint *joints, JointOrientation *orientations);
+	static void collectRotations(JointRotationBatch &batch, std::vector<JointBinding*> &batchJoints, SkeletonBinding &binding, FbxTime frameTime, const Joint *joints, const JointOrientation *orientations);
+
+	/// <summary>
+	/// Adds rotation keys for a range of converted rotations, all of them belonging to the same skeleton
+	/// </summary>
+	/// <param name="batch">Converted rotations</param>
+	/// <param name="batchJoints">Joint of every rotation</param>
+	/// <param name="verifyRotations">Cross-check every key against the FbxAMatrix reference</param>
+	/// <param name="binding">Skeleton to be animated</param>
+	/// <param name="frameTime">Current frame time</param>
+	/// <param name="firstRotation">First rotation of the skeleton in the batch</param>
+	/// <param name="endRotation">One past the last rotation of the skeleton in the batch</param>
+	static void addRotationKeys(const JointRotationBatch &batch, const std::vector<JointBinding*> &batchJoints, bool verifyRotations, SkeletonBinding &binding, FbxTime frameTime, size_t firstRotation, size_t endRotation);
 
 	/// <summary>
-	/// Recursive function that creates a FBX node hierarchy on the scene, based on a given definitons
+	/// Creates a FBX node hierarchy on the scene, based on a flattened definition
 	/// </summary>
 	/// <param name="pScene">Current FBX scene</param>
-	/// <param name="kBody">Kinect Body</param>
-	/// <param name="fNode">Current FBX node</param>
-	/// <param name="hNode">Hierarchical definition</param>
-	static void createHierarchy(FbxScene *pScene, IBody *kBody, FbxNode *fNode, const std::shared_ptr<HierarchyNodeDefinition> &hNode);
+	/// <param name="trackingId">Kinect Body tracking id</param>
+	/// <param name="fNode">FBX node receiving the hierarchy</param>
+	/// <param name="hNodes">Flattened hierarchical definition</param>
+	/// <param name="namePattern">Prefix of node names, formatted with the tracking id</param>
+	static void createHierarchy(FbxScene *pScene, UINT64 trackingId, FbxNode *fNode, const std::vector<FlatHierarchyNode> &hNodes, const char *namePattern = c_SkelRootIdPatternPreffix);
 
 
 	/// <summary>
 	/// Gets pre-fixed name of a node
 	/// </summary>
-	/// <param name="inKBody">Kinect body for which the preffix will be retrieved</param>
+	/// <param name="trackingId">Tracking id of the body for which the preffix will be retrieved</param>
 	/// <param name="nodeName">Node name without preffix</param>
-	/// <param name="outName">Variable where name will be written to</param>
+	/// <param name="namePattern">Prefix, formatted with the tracking id</param>
 	/// <return>VName with prefix</return>
-	static FbxString getPreffixedNodeName(IBody *inKBody, const FbxString nodeName);
+	static FbxString getPreffixedNodeName(UINT64 trackingId, const FbxString nodeName, const char *namePattern = c_SkelRootIdPatternPreffix);
 
 
 	/// <summary>
@@ -104,44 +223,55 @@ private:
 	static JointType getJointTypeProperty(FbxNode *fNode);
 
 	/// <summary>
-	/// Recursively add animation keys to each node in the hierarchy
+	/// Reads the joint type and animation curves of a joint and of every joint below it, by name
 	/// </summary>
-	/// <param name="pLayer">FBX  animation layer</param>
-	/// <param name="fNode">FBX node to be animated</param>
-	/// <param name="kJoints">Kinect joints to bild animation</param>
-	/// <param name="kJointOrientations">Kinect joint orientations to build animation</param>
-	/// <param name="accumulator">Auxiliary matrix that helps converting from absolute orientation to relative. Defaults to identity</param>
-	static void animateHierarchy(FbxAnimLayer*  pScene, FbxNode *fNode, INT64 frameTime, Joint *kJoints, JointOrientation *kOrientations, FbxAMatrix accumullator = getIdentityMat());
+	/// <param name="pLayer">FBX animation layer</param>
+	/// <param name="fNode">Joint node</param>
+	/// <returns>Number of joints read</returns>
+	static int lookUpJoints(FbxAnimLayer *pLayer, FbxNode *fNode);
+
+	/// <summary>
+	/// Decides which Kinect information drives the rotation of each joint
+	/// </summary>
+	/// <param name="binding">Skeleton whose joints have been resolved</param>
+	static void resolveOrientationSources(SkeletonBinding &binding);
 
 
 	/// <summary>
 	/// Extracts translation information from kinect, and add it as a key to our animation layer
 	/// </summary>
-	/// <param name="pLayer">FBX  animation layer</param>
-	/// <param name="fNode">FBX node to be animated</param>
+	/// <param name="jBinding">Joint to be animated</param>
 	/// <param name="frameTime">Current frame time</param>
 	/// <param name="kJoint">Kinect joint to have position extracted from</param>
-	static void addTranslationKeys(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, Joint &kJoint);
+	static void addTranslationKeys(JointBinding &jBinding, FbxTime frameTime, const Joint &kJoint);
 
 	/// <summary>
-	/// Extracts rotation information from kinect, and add it as a key to our animation layer
+	/// Global orientation of a joint, according to Kinect
 	/// </summary>
-	/// <param name="pLayer">FBX  animation layer</param>
-	/// <param name="fNode">FBX node to be animated</param>
-	/// <param name="frameTime">Current frame time</param>
-	/// <param name="kOrientation">Kinect joint orientation</param>
-	/// <param name="accumullator">Used to compute orientations based on parent joint</param>
-	static void addRotationKeys(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, JointOrientation &kOrientation, FbxAMatrix &accumullator);
+	/// <param name="binding">Skeleton being animated</param>
+	/// <param name="jBinding">Joint to be animated</param>
+	/// <param name="kJoints">Kinect joint positions</param>
+	/// <param name="kOrientations">Kinect joint orientations</param>
+	/// <param name="qRot">Output, unit quaternion</param>
+	/// <returns>False if there is no valid orientation for this joint</returns>
+	static bool getGlobalOrientation(const SkeletonBinding &binding, const JointBinding &jBinding, const Joint *kJoints, const JointOrientation *kOrientations, JointQuaternion &qRot);
 
 	/// <summary>
-	/// Extracts rotation information from kinect, and add it as a key to our animation layer
+	/// Computes the same local rotation through FBX matrices, as it used to be done, and compares it to ours
 	/// </summary>
-	/// <param name="pLayer">FBX  animation layer</param>
-	/// <param name="fNode">FBX node to be animated</param>
-	/// <param name="frameTime">Current frame time</param>
-	/// <param name="qRot">Joint orientation as quaternion</param>
-	/// <param name="accumullator">Used to compute orientations based on parent joint</param>
-	static void addRotationKeys(FbxAnimLayer*  pLayer, FbxNode *fNode, INT64 frameTime, FbxQuaternion qRot, FbxAMatrix &accumullator);
+	/// <param name="parentRot">Global rotation of the parent joint</param>
+	/// <param name="globalRot">Global rotation of the joint</param>
+	/// <param name="euler">Local rotation keyed by us, in euler angles</param>
+	/// <returns>Largest difference among X, Y and Z, in degrees</returns>
+	static double checkLocalRotation(const JointQuaternion &parentRot, const JointQuaternion &globalRot, const FbxDouble3 &euler);
+
+	/// <summary>
+	/// Buffers one key for each of the given X, Y and Z curves
+	/// </summary>
+	/// <param name="curves">X, Y and Z curves</param>
+	/// <param name="frameTime">Key time</param>
+	/// <param name="values">X, Y and Z values</param>
+	static void addKeys(CurveKeyBuffer *curves, FbxTime frameTime, const FbxDouble3 &values);
 
 	/// <summary>
 	/// Finds euler rotation for key with certain index
@@ -153,21 +283,13 @@ private:
 	/// <return>Rotation in euler angles</return>
 	static FbxVector4 getEulerRotation(int keyIndex, FbxAnimCurve *rotationCurveX, FbxAnimCurve *rotationCurveY, FbxAnimCurve *rotationCurveZ);
 
-	/// <summary>
-	/// Make sure rotation in Euler angles is continuous
-	/// </summary>
-	/// <param name="previousEuler">Rotation for the previous frame</param>
-	/// <param name="currentEuler">Rotaion for the current frame</param>
-	/// <return>Continuous rotation, in euler angles</return>
-	static FbxVector4 makeRotationContinuous(FbxVector4 previousEuler, FbxVector4 currentEuler);
-
 
 	/// <summary>
 	/// Defines how translation values will be calculated
 	/// </summary>
 	/// <param name="fNode">Root FBX  node</param>
 	/// <param name="kJoints">Kinect joint position info</param>
-	static void setTransScaling(FbxNode *fNode, Joint *joints);
+	static void setTransScaling(FbxNode *fNode, const Joint *joints);
 
 	/// <summary>
 	/// Sets some initial alignment rules, based on assumptions about the sensor
@@ -175,14 +297,14 @@ private:
 	/// <param name="fNode">Root FBX  node</param>
 	/// <param name="kJoints">Kinect joint position info</param>
 	/// <param name="kOrientations">Kinect joint orientation info</param>
-	static void KinectSkeletonMapper::setInitialAlignmentRules(FbxNode *fNode, Joint *kJoints, JointOrientation *kOrientations);
+	static void setInitialAlignmentRules(FbxNode *fNode, const Joint *kJoints, const JointOrientation *kOrientations);
 
 	/// <summary>
 	/// Add keys for orientation at time t
 	/// </summary>
 	/// <param name="pScene">Fbx Scene</param>
 	/// <param name="pNode">Fbx root Node</param>
-	static void KinectSkeletonMapper::keyInCurrentOrientation(FbxScene *pScene, FbxNode *pNode, FbxTime time = 0);
+	static void keyInCurrentOrientation(FbxScene *pScene, FbxNode *pNode, FbxTime time = 0);
 
 	/// <summary>
 	/// Get Identity Mat
@@ -207,9 +329,9 @@ private:
 	/// <summary>
 	/// Estimates rotation between parent joint and hild joint. Used to compensate for missing Kinect info
 	/// </summary>
-	/// <param name="cNode">Child FBX Node</param>
+	/// <param name="boneRef">Child joint translation, when skeleton was created</param>
 	/// <param name="pJoint">Parent Kinect Joint</param>
 	/// <param name="cJoint">Child Kinect Joint</param>
-	static FbxQuaternion estimateBoneOri(FbxNode *cNode, const Joint &pJoint, const Joint &cJoint);
+	static FbxQuaternion estimateBoneOri(const FbxDouble3 &boneRef, const Joint &pJoint, const Joint &cJoint);
 
 };
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+
+// Kinect data types used by the capture pipeline.
+// On Windows they come straight from the Kinect SDK. Elsewhere ( e.g. when converting or
+// benchmarking recorded data ) plain definitions with the same layout are provided instead.
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <Kinect.h>
+
+#else
+
+#include <stdint.h>
+
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef unsigned char BOOLEAN;
+
+#ifndef BODY_COUNT
+#define BODY_COUNT 6
+#endif
+
+enum _JointType {
+	JointType_SpineBase = 0,
+	JointType_SpineMid = 1,
+	JointType_Neck = 2,
+	JointType_Head = 3,
+	JointType_ShoulderLeft = 4,
+	JointType_ElbowLeft = 5,
+	JointType_WristLeft = 6,
+	JointType_HandLeft = 7,
+	JointType_ShoulderRight = 8,
+	JointType_ElbowRight = 9,
+	JointType_WristRight = 10,
+	JointType_HandRight = 11,
+	JointType_HipLeft = 12,
+	JointType_KneeLeft = 13,
+	JointType_AnkleLeft = 14,
+	JointType_FootLeft = 15,
+	JointType_HipRight = 16,
+	JointType_KneeRight = 17,
+	JointType_AnkleRight = 18,
+	JointType_FootRight = 19,
+	JointType_SpineShoulder = 20,
+	JointType_HandTipLeft = 21,
+	JointType_ThumbLeft = 22,
+	JointType_HandTipRight = 23,
+	JointType_ThumbRight = 24,
+	JointType_Count = (JointType_ThumbRight + 1)
+};
+typedef enum _JointType JointType;
+
+enum _TrackingState {
+	TrackingState_NotTracked = 0,
+	TrackingState_Inferred = 1,
+	TrackingState_Tracked = 2
+};
+typedef enum _TrackingState TrackingState;
+
+enum _HandState {
+	HandState_Unknown = 0,
+	HandState_NotTracked = 1,
+	HandState_Open = 2,
+	HandState_Closed = 3,
+	HandState_Lasso = 4
+};
+typedef enum _HandState HandState;
+
+typedef struct _CameraSpacePoint {
+	float X;
+	float Y;
+	float Z;
+} CameraSpacePoint;
+
+typedef struct _Vector4 {
+	float x;
+	float y;
+	float z;
+	float w;
+} Vector4;
+
+// Members share their type names, as in the SDK, so the enums are referred to by tag
+typedef struct _Joint {
+	enum _JointType JointType;
+	CameraSpacePoint Position;
+	enum _TrackingState TrackingState;
+} Joint;
+
+typedef struct _JointOrientation {
+	enum _JointType JointType;
+	Vector4 Orientation;
+} JointOrientation;
+
+#endif
@@ -0,0 +1,116 @@
+#include "MappingWorkerPool.h"
+#include "TraceRecorder.h"
+
+
+/// <summary>
+/// Constructor, starts the worker threads
+/// </summary>
+/// <param name="workerCount">Number of worker threads, besides the thread calling run ( 0 runs every task on the calling thread )</param>
+MappingWorkerPool::MappingWorkerPool(unsigned int workerCount) :
+m_task(NULL),
+m_pContext(NULL),
+m_count(0),
+m_nextIndex(0),
+m_generation(0),
+m_nBusyWorkers(0),
+m_quit(false)
+{
+	for (unsigned int i = 0; i < workerCount; i++)
+		m_workers.push_back(std::thread(&MappingWorkerPool::WorkerThread, this));
+}
+
+/// <summary>
+/// Destructor, stops the worker threads
+/// </summary>
+MappingWorkerPool::~MappingWorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_workQueued.notify_all();
+
+	for (auto &worker : m_workers)
+		worker.join();
+}
+
+/// <summary>
+/// Runs a task for every index from 0 to count - 1, and waits for all of them. Calling thread runs tasks too
+/// </summary>
+/// <param name="task">Task function</param>
+/// <param name="pContext">Passed to every task</param>
+/// <param name="count">Number of tasks</param>
+void MappingWorkerPool::run(Task task, void *pContext, int count) {
+
+	// Nobody to share the work with
+	if (m_workers.empty() || count < 2) {
+		for (int i = 0; i < count; i++)
+			task(pContext, i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = task;
+		m_pContext = pContext;
+		m_count = count;
+		m_nextIndex = 0;
+		m_nBusyWorkers = (unsigned int)m_workers.size();
+		m_generation++;
+	}
+	m_workQueued.notify_all();
+
+	RunTasks();
+
+	// Every worker has to be done before the context goes away
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_nBusyWorkers > 0)
+		m_workDone.wait(lock);
+}
+
+/// <summary>
+/// Worker count suited to this machine, for a given number of tasks per run
+/// </summary>
+/// <param name="maxTasks">Largest number of tasks of a run</param>
+unsigned int MappingWorkerPool::getDefaultWorkerCount(unsigned int maxTasks) {
+	unsigned int cores = std::thread::hardware_concurrency();
+
+	// Calling thread takes one of the tasks, and one of the cores
+	unsigned int workerCount = cores > 1 ? cores - 1 : 0;
+	if (maxTasks > 0 && workerCount > maxTasks - 1)
+		workerCount = maxTasks - 1;
+	return workerCount;
+}
+
+/// <summary>
+/// Worker thread, joins every run until asked to quit
+/// </summary>
+void MappingWorkerPool::WorkerThread() {
+
+	TraceRecorder::setThreadName("Mapping worker");
+
+	unsigned int generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		while (m_generation == generation && !m_quit)
+			m_workQueued.wait(lock);
+		if (m_quit)
+			break;
+		generation = m_generation;
+
+		lock.unlock();
+		RunTasks();
+		lock.lock();
+
+		if (--m_nBusyWorkers == 0)
+			m_workDone.notify_one();
+	}
+}
+
+/// <summary>
+/// Takes tasks of the current run until there are none left
+/// </summary>
+void MappingWorkerPool::RunTasks() {
+	int index;
+	while ((index = m_nextIndex++) < m_count)
+		m_task(m_pContext, index);
+}
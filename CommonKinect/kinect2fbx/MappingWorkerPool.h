@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../stdafx.h"
+
+/*
+	Small set of persistent threads running the independent parts of a frame ( e.g. one task per body ) at the same time.
+	Threads are created once, so a frame only pays for waking them up
+*/
+class MappingWorkerPool {
+public:
+	// Task function, called once for every index
+	typedef void(*Task)(void *pContext, int index);
+
+	/// <summary>
+	/// Constructor, starts the worker threads
+	/// </summary>
+	/// <param name="workerCount">Number of worker threads, besides the thread calling run ( 0 runs every task on the calling thread )</param>
+	MappingWorkerPool(unsigned int workerCount);
+
+	/// <summary>
+	/// Destructor, stops the worker threads
+	/// </summary>
+	~MappingWorkerPool();
+
+	/// <summary>
+	/// Runs a task for every index from 0 to count - 1, and waits for all of them. Calling thread runs tasks too
+	/// </summary>
+	/// <param name="task">Task function</param>
+	/// <param name="pContext">Passed to every task</param>
+	/// <param name="count">Number of tasks</param>
+	void run(Task task, void *pContext, int count);
+
+	/// <summary>
+	/// Number of worker threads, besides the thread calling run
+	/// </summary>
+	unsigned int getWorkerCount() const { return (unsigned int)m_workers.size(); };
+
+	/// <summary>
+	/// Worker count suited to this machine, for a given number of tasks per run
+	/// </summary>
+	/// <param name="maxTasks">Largest number of tasks of a run</param>
+	static unsigned int getDefaultWorkerCount(unsigned int maxTasks);
+
+private:
+	// Worker threads
+	std::vector<std::thread> m_workers;
+
+	// Protects everything below, except the task index
+	std::mutex m_mutex;
+	std::condition_variable m_workQueued;
+	std::condition_variable m_workDone;
+
+	// Current run
+	Task m_task;
+	void *m_pContext;
+	int m_count;
+
+	// Next task to be taken
+	std::atomic<int> m_nextIndex;
+
+	// Increased for every run, so workers know there is new work
+	unsigned int m_generation;
+
+	// Workers that have not finished the current run yet
+	unsigned int m_nBusyWorkers;
+
+	// Quit worker threads
+	bool m_quit;
+
+	/// <summary>
+	/// Worker thread, joins every run until asked to quit
+	/// </summary>
+	void WorkerThread();
+
+	/// <summary>
+	/// Takes tasks of the current run until there are none left
+	/// </summary>
+	void RunTasks();
+};
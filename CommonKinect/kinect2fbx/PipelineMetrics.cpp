@@ -0,0 +1,319 @@
+#include "PipelineMetrics.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _MSC_VER
+#define METRICS_THREAD_LOCAL __declspec(thread)
+#else
+#define METRICS_THREAD_LOCAL __thread
+#endif
+
+
+// Names written to JSON, in enum order
+static const char *c_counterNames[MetricCounter_Count] = {
+	"frames_received",
+	"frames_dropped_list_busy",
+	"frames_dropped_subscriber_full",
+	"body_read_failures",
+	"bodies_tracked",
+	"keys_committed",
+	"skeletons_built_while_mapping",
+	"keys_removed_by_reduction",
+	"samples_not_keyed"
+};
+static const char *c_histogramNames[MetricHistogram_Count] = {
+	"map_frame_us",
+	"frame_latency_us",
+	"keys_per_curve",
+	"flush_scene_us",
+	"save_scene_us"
+};
+
+/*
+	Histogram of a single thread
+*/
+struct HistogramShard {
+	std::atomic<unsigned long long> m_count;
+	std::atomic<unsigned long long> m_sum;
+	std::atomic<unsigned long long> m_max;
+	std::atomic<unsigned long long> m_buckets[HistogramSnapshot::c_bucketCount];
+};
+
+/*
+	Metrics of a single thread. Only its thread writes to it, other threads only read it
+*/
+struct MetricShard {
+	std::atomic<unsigned long long> m_counters[MetricCounter_Count];
+	HistogramShard m_histograms[MetricHistogram_Count];
+
+	/// <summary>
+	/// Constructor, zeroes every value
+	/// </summary>
+	MetricShard() {
+		for (int i = 0; i < MetricCounter_Count; i++)
+			m_counters[i] = 0;
+
+		for (int i = 0; i < MetricHistogram_Count; i++) {
+			m_histograms[i].m_count = 0;
+			m_histograms[i].m_sum = 0;
+			m_histograms[i].m_max = 0;
+			for (int b = 0; b < HistogramSnapshot::c_bucketCount; b++)
+				m_histograms[i].m_buckets[b] = 0;
+		}
+	}
+};
+
+// Shards of every thread that recorded something. They are never freed, so values of finished threads are kept
+static std::mutex s_shardMutex;
+static std::vector<MetricShard*> s_shards;
+
+// Shard of the calling thread ( NULL until it records its first value )
+static METRICS_THREAD_LOCAL MetricShard *t_pShard = NULL;
+
+#ifdef _WIN32
+/// <summary>
+/// Performance counter ticks per microsecond
+/// </summary>
+static double getCounterFrequency() {
+	LARGE_INTEGER qpf = { 0 };
+	QueryPerformanceFrequency(&qpf);
+	return double(qpf.QuadPart) / 1000000.0;
+}
+static const double s_ticksPerMicrosecond = getCounterFrequency();
+#endif
+
+// Time when metrics started being recorded
+static const unsigned long long s_startTime = PipelineMetrics::getTime();
+
+
+/// <summary>
+/// Shard of the calling thread, created the first time it is needed
+/// </summary>
+static MetricShard &getShard() {
+	MetricShard *pShard = t_pShard;
+	if (!pShard) {
+		pShard = new MetricShard();
+
+		std::lock_guard<std::mutex> lock(s_shardMutex);
+		s_shards.push_back(pShard);
+		t_pShard = pShard;
+	}
+	return *pShard;
+}
+
+/// <summary>
+/// Increases a value only written by the calling thread ( no read-modify-write instruction is needed )
+/// </summary>
+static inline void increase(std::atomic<unsigned long long> &value, unsigned long long amount) {
+	value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Bucket a value falls in
+/// </summary>
+static inline int getBucket(unsigned long long value) {
+	int bucket = 0;
+	while (value) {
+		bucket++;
+		value >>= 1;
+	}
+	return bucket < HistogramSnapshot::c_bucketCount ? bucket : HistogramSnapshot::c_bucketCount - 1;
+}
+
+/// <summary>
+/// Appends formatted text to a string
+/// </summary>
+static void appendFormat(std::string &text, const char *pFormat, ...) {
+	char buffer[256];
+	va_list arguments;
+	va_start(arguments, pFormat);
+	FBXSDK_vsprintf(buffer, sizeof(buffer), pFormat, arguments);
+	va_end(arguments);
+	text += buffer;
+}
+
+
+/// <summary>
+/// Mean of recorded values
+/// </summary>
+double HistogramSnapshot::getMean() const {
+	if (m_count == 0)
+		return 0.0;
+
+	return double(m_sum) / double(m_count);
+}
+
+/// <summary>
+/// Estimates a percentile, as the upper bound of the bucket it falls in ( never above the largest value )
+/// </summary>
+/// <param name="fraction">Percentile, between 0 and 1</param>
+unsigned long long HistogramSnapshot::getPercentile(double fraction) const {
+	if (m_count == 0)
+		return 0;
+
+	// Rank of the value we are looking for ( 1 based )
+	unsigned long long rank = (unsigned long long)ceil(fraction * double(m_count));
+	if (rank < 1)
+		rank = 1;
+
+	unsigned long long seen = 0;
+	for (int b = 0; b < c_bucketCount; b++) {
+		seen += m_buckets[b];
+		if (seen >= rank) {
+			unsigned long long upperBound = (b == 0) ? 0 : (1ULL << b) - 1;
+			return upperBound < m_max ? upperBound : m_max;
+		}
+	}
+
+	return m_max;
+}
+
+/// <summary>
+/// Formats the snapshot as a JSON object
+/// </summary>
+std::string MetricsSnapshot::toJSON() const {
+	std::string json;
+
+	appendFormat(json, "{\n\t\"uptime_s\": %.3f,\n\t\"counters\": {\n", m_uptime);
+	for (int i = 0; i < MetricCounter_Count; i++) {
+		appendFormat(json, "\t\t\"%s\": %llu%s\n", c_counterNames[i], m_counters[i], (i + 1 < MetricCounter_Count) ? "," : "");
+	}
+
+	json += "\t},\n\t\"histograms\": {\n";
+	for (int i = 0; i < MetricHistogram_Count; i++) {
+		const HistogramSnapshot &histogram = m_histograms[i];
+
+		appendFormat(json, "\t\t\"%s\": { \"count\": %llu, \"sum\": %llu, \"mean\": %.3f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu, \"buckets\": [",
+			c_histogramNames[i], histogram.m_count, histogram.m_sum, histogram.getMean(),
+			histogram.getPercentile(0.5), histogram.getPercentile(0.9), histogram.getPercentile(0.99), histogram.m_max);
+
+		// Trailing empty buckets are left out
+		int bucketCount = HistogramSnapshot::c_bucketCount;
+		while (bucketCount > 0 && histogram.m_buckets[bucketCount - 1] == 0)
+			bucketCount--;
+		for (int b = 0; b < bucketCount; b++)
+			appendFormat(json, "%s%llu", b ? ", " : "", histogram.m_buckets[b]);
+
+		appendFormat(json, "] }%s\n", (i + 1 < MetricHistogram_Count) ? "," : "");
+	}
+	json += "\t}\n}\n";
+
+	return json;
+}
+
+
+/// <summary>
+/// Adds to a counter
+/// </summary>
+/// <param name="counter">Counter to be increased</param>
+/// <param name="value">Amount added</param>
+void PipelineMetrics::add(MetricCounter counter, unsigned long long value) {
+	increase(getShard().m_counters[counter], value);
+}
+
+/// <summary>
+/// Records a value in a histogram
+/// </summary>
+/// <param name="histogram">Histogram receiving the value</param>
+/// <param name="value">Recorded value</param>
+void PipelineMetrics::record(MetricHistogram histogram, unsigned long long value) {
+	HistogramShard &shard = getShard().m_histograms[histogram];
+
+	increase(shard.m_count, 1);
+	increase(shard.m_sum, value);
+	increase(shard.m_buckets[getBucket(value)], 1);
+	if (value > shard.m_max.load(std::memory_order_relaxed))
+		shard.m_max.store(value, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Sums the shards of every thread
+/// </summary>
+MetricsSnapshot PipelineMetrics::getSnapshot() {
+	MetricsSnapshot snapshot;
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	snapshot.m_uptime = double(getTime() - s_startTime) / 1000000.0;
+
+	std::lock_guard<std::mutex> lock(s_shardMutex);
+	for (auto pShard : s_shards) {
+		for (int i = 0; i < MetricCounter_Count; i++)
+			snapshot.m_counters[i] += pShard->m_counters[i].load(std::memory_order_relaxed);
+
+		for (int i = 0; i < MetricHistogram_Count; i++) {
+			const HistogramShard &shard = pShard->m_histograms[i];
+			HistogramSnapshot &histogram = snapshot.m_histograms[i];
+
+			histogram.m_count += shard.m_count.load(std::memory_order_relaxed);
+			histogram.m_sum += shard.m_sum.load(std::memory_order_relaxed);
+			unsigned long long shardMax = shard.m_max.load(std::memory_order_relaxed);
+			if (shardMax > histogram.m_max)
+				histogram.m_max = shardMax;
+			for (int b = 0; b < HistogramSnapshot::c_bucketCount; b++)
+				histogram.m_buckets[b] += shard.m_buckets[b].load(std::memory_order_relaxed);
+		}
+	}
+
+	return snapshot;
+}
+
+/// <summary>
+/// Writes a snapshot as JSON. File is replaced at once, so readers never see a partial snapshot
+/// </summary>
+/// <param name="fileName">JSON file name</param>
+/// <returns>True if file could be written</returns>
+bool PipelineMetrics::writeSnapshot(const char *fileName) {
+	std::string json = getSnapshot().toJSON();
+
+	// Written next to the target first
+	FbxString tempFileName = FbxString(fileName) + ".tmp";
+
+	FILE *pFile;
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	pFile = fopen(tempFileName.Buffer(), "wb");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+	if (!pFile)
+		return false;
+
+	bool success = fwrite(json.c_str(), 1, json.size(), pFile) == json.size();
+	success = (fclose(pFile) == 0) && success;
+	if (!success)
+		return false;
+
+#ifdef _WIN32
+	return MoveFileExA(tempFileName.Buffer(), fileName, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(tempFileName.Buffer(), fileName) == 0;
+#endif
+}
+
+/// <summary>
+/// Monotonic clock used to time pipeline stages ( performance counter on Windows )
+/// </summary>
+/// <returns>Time in microseconds, from an arbitrary origin</returns>
+unsigned long long PipelineMetrics::getTime() {
+#ifdef _WIN32
+	LARGE_INTEGER qpcNow = { 0 };
+	QueryPerformanceCounter(&qpcNow);
+	return (unsigned long long)(double(qpcNow.QuadPart) / s_ticksPerMicrosecond);
+#else
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/// <summary>
+/// Name of a counter, as written to JSON
+/// </summary>
+const char *PipelineMetrics::getName(MetricCounter counter) {
+	return c_counterNames[counter];
+}
+
+/// <summary>
+/// Name of a histogram, as written to JSON
+/// </summary>
+const char *PipelineMetrics::getName(MetricHistogram histogram) {
+	return c_histogramNames[histogram];
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "../stdafx.h"
+#include <string>
+
+/*
+	Counters and histograms describing the capture to export pipeline.
+	Every thread accumulates into its own shard, so recording a value never contends with other threads.
+	Shards are only summed when a snapshot is taken
+*/
+
+// Counted events
+enum MetricCounter {
+	// Body frames acquired from the sensor
+	MetricCounter_FramesReceived,
+	// Frames not delivered because the subscriber list could not be locked in time
+	MetricCounter_FramesDroppedListBusy,
+	// Frames not delivered because a subscriber was too far behind
+	MetricCounter_FramesDroppedSubscriberFull,
+	// Frames whose body data could not be read ( GetAndRefreshBodyData failed )
+	MetricCounter_BodyReadFailures,
+	// Tracked bodies, summed over every frame received
+	MetricCounter_BodiesTracked,
+	// Animation keys committed to curves
+	MetricCounter_KeysCommitted,
+	// Skeletons built while a frame was being mapped, because no spare skeleton was left
+	MetricCounter_SkeletonsBuiltWhileMapping,
+	// Keys removed by key reduction, when a take is saved
+	MetricCounter_KeysRemovedByReduction,
+	// Samples adaptive keying did not need to key, while mapping
+	MetricCounter_SamplesNotKeyed,
+
+	MetricCounter_Count
+};
+
+// Recorded distributions
+enum MetricHistogram {
+	// Time to map every body of a frame, in microseconds
+	MetricHistogram_MapFrameTime,
+	// Time from frame decoding until a subscriber is done with it, in microseconds
+	MetricHistogram_FrameLatency,
+	// Keys committed to a curve at once
+	MetricHistogram_KeysPerCurve,
+	// Time to hand a take over to the saver, in microseconds
+	MetricHistogram_FlushSceneTime,
+	// Time to write a FBX file, in microseconds
+	MetricHistogram_SaveSceneTime,
+
+	MetricHistogram_Count
+};
+
+/*
+	Distribution of recorded values. Buckets grow in powers of two: bucket 0 holds zeros, bucket i holds [2^(i-1), 2^i)
+*/
+struct HistogramSnapshot {
+	// Number of buckets
+	static const int c_bucketCount = 40;
+
+	// Number of recorded values
+	unsigned long long m_count;
+
+	// Sum of recorded values
+	unsigned long long m_sum;
+
+	// Largest recorded value
+	unsigned long long m_max;
+
+	// Number of values in each bucket
+	unsigned long long m_buckets[c_bucketCount];
+
+	/// <summary>
+	/// Mean of recorded values
+	/// </summary>
+	double getMean() const;
+
+	/// <summary>
+	/// Estimates a percentile, as the upper bound of the bucket it falls in ( never above the largest value )
+	/// </summary>
+	/// <param name="fraction">Percentile, between 0 and 1</param>
+	unsigned long long getPercentile(double fraction) const;
+};
+
+/*
+	Metrics summed over every thread, at some point in time
+*/
+struct MetricsSnapshot {
+	// Seconds since metrics were first recorded
+	double m_uptime;
+
+	// Counter values
+	unsigned long long m_counters[MetricCounter_Count];
+
+	// Histograms
+	HistogramSnapshot m_histograms[MetricHistogram_Count];
+
+	/// <summary>
+	/// Formats the snapshot as a JSON object
+	/// </summary>
+	std::string toJSON() const;
+};
+
+/*
+	Static class recording pipeline metrics
+*/
+class PipelineMetrics {
+public:
+	/// <summary>
+	/// Adds to a counter
+	/// </summary>
+	/// <param name="counter">Counter to be increased</param>
+	/// <param name="value">Amount added</param>
+	static void add(MetricCounter counter, unsigned long long value = 1);
+
+	/// <summary>
+	/// Records a value in a histogram
+	/// </summary>
+	/// <param name="histogram">Histogram receiving the value</param>
+	/// <param name="value">Recorded value</param>
+	static void record(MetricHistogram histogram, unsigned long long value);
+
+	/// <summary>
+	/// Sums the shards of every thread
+	/// </summary>
+	static MetricsSnapshot getSnapshot();
+
+	/// <summary>
+	/// Writes a snapshot as JSON. File is replaced at once, so readers never see a partial snapshot
+	/// </summary>
+	/// <param name="fileName">JSON file name</param>
+	/// <returns>True if file could be written</returns>
+	static bool writeSnapshot(const char *fileName);
+
+	/// <summary>
+	/// Monotonic clock used to time pipeline stages ( performance counter on Windows )
+	/// </summary>
+	/// <returns>Time in microseconds, from an arbitrary origin</returns>
+	static unsigned long long getTime();
+
+	/// <summary>
+	/// Name of a counter, as written to JSON
+	/// </summary>
+	static const char *getName(MetricCounter counter);
+
+	/// <summary>
+	/// Name of a histogram, as written to JSON
+	/// </summary>
+	static const char *getName(MetricHistogram histogram);
+};
+
+/*
+	Records the time spent in a scope, in microseconds
+*/
+class MetricTimer {
+public:
+	/// <summary>
+	/// Constructor, starts timing
+	/// </summary>
+	/// <param name="histogram">Histogram receiving the time</param>
+	MetricTimer(MetricHistogram histogram) :
+	m_histogram(histogram),
+	m_start(PipelineMetrics::getTime())
+	{
+	}
+
+	/// <summary>
+	/// Destructor, records the elapsed time
+	/// </summary>
+	~MetricTimer() {
+		PipelineMetrics::record(m_histogram, PipelineMetrics::getTime() - m_start);
+	}
+
+private:
+	MetricHistogram m_histogram;
+	unsigned long long m_start;
+};
@@ -0,0 +1,691 @@
+#include "PostProcessingFilters.h"
+#include "KinectSkeletonMapper.h"
+#include "MappingWorkerPool.h"
+#include "TraceRecorder.h"
+#include "PipelineMetrics.h"
+
+#include <math.h>
+#include <algorithm>
+
+// Constant definitions
+const int PostProcessingPipeline::c_curveNodesPerShard = 8;
+const int KeyReductionStage::c_maxSegmentKeys = 256;
+
+/*
+	Keys of the curve nodes being filtered in parallel
+*/
+struct FilterShardContext {
+	const CurveFilterStage *m_pStage;
+	std::vector<FilterCurveKeys> *m_pKeys;
+};
+
+
+/// <summary>
+/// Filters the curves of a single transform, on the calling thread. Reads, filters and writes back its keys unless overridden
+/// </summary>
+/// <param name="curveNode">Curves to be filtered</param>
+void CurveFilterStage::apply(const FilterCurveNode &curveNode) const {
+	FilterCurveKeys keys;
+	readKeys(curveNode, keys);
+	filterKeys(keys);
+	writeKeys(curveNode, keys);
+}
+
+/// <summary>
+/// Copies the keys of the curves of a transform, on the calling thread
+/// </summary>
+/// <param name="curveNode">Curves to be read</param>
+/// <param name="keys">Output, keys of every curve</param>
+void CurveFilterStage::readKeys(const FilterCurveNode &curveNode, FilterCurveKeys &keys) const {
+	keys.m_isRotation = curveNode.m_isRotation;
+	for (unsigned int c = 0; c < 3; c++)
+		readCurve(curveNode.m_pCurveNode->GetCurve(c), false, keys.m_curves[c]);
+}
+
+/// <summary>
+/// Replaces keys of the curves of a transform by the ones filtered, on the calling thread. Curves left unchanged are not touched
+/// </summary>
+/// <param name="curveNode">Curves to be written</param>
+/// <param name="keys">Filtered keys of every curve</param>
+void CurveFilterStage::writeKeys(const FilterCurveNode &curveNode, const FilterCurveKeys &keys) const {
+	for (unsigned int c = 0; c < 3; c++) {
+		FbxAnimCurve *pCurve = curveNode.m_pCurveNode->GetCurve(c);
+		if (pCurve && keys.m_curves[c].m_bChanged)
+			writeCurve(pCurve, keys.m_curves[c]);
+	}
+}
+
+/// <summary>
+/// Copies the keys of a curve
+/// </summary>
+/// <param name="pCurve">Curve to be read ( may be NULL )</param>
+/// <param name="bDerivatives">Whether slopes of the keys are read as well</param>
+/// <param name="keys">Output, keys of the curve</param>
+void CurveFilterStage::readCurve(FbxAnimCurve *pCurve, bool bDerivatives, CurveKeys &keys) {
+
+	int keyCount = pCurve ? pCurve->KeyGetCount() : 0;
+	keys.m_times.resize(keyCount);
+	keys.m_values.resize(keyCount);
+	keys.m_interpolations.resize(keyCount);
+	keys.m_leftDerivatives.resize(bDerivatives ? keyCount : 0);
+	keys.m_rightDerivatives.resize(bDerivatives ? keyCount : 0);
+	keys.m_bUserTangents = false;
+	keys.m_bChanged = false;
+
+	for (int k = 0; k < keyCount; k++) {
+		keys.m_times[k] = pCurve->KeyGetTime(k);
+		keys.m_values[k] = pCurve->KeyGetValue(k);
+		keys.m_interpolations[k] = pCurve->KeyGetInterpolation(k);
+		if (bDerivatives) {
+			keys.m_leftDerivatives[k] = pCurve->KeyGetLeftDerivative(k);
+			keys.m_rightDerivatives[k] = pCurve->KeyGetRightDerivative(k);
+		}
+	}
+}
+
+/// <summary>
+/// Replaces every key of a curve
+/// </summary>
+/// <param name="pCurve">Curve to be rewritten</param>
+/// <param name="keys">New keys</param>
+void CurveFilterStage::writeCurve(FbxAnimCurve *pCurve, const CurveKeys &keys) {
+
+	int keyCount = (int)keys.m_times.size();
+
+	pCurve->KeyModifyBegin();
+	pCurve->KeyClear();
+	pCurve->ResizeKeyBuffer(keyCount);
+	for (int k = 0; k < keyCount; k++) {
+		if (keys.m_bUserTangents) {
+			float nextLeftDerivative = k + 1 < keyCount ? keys.m_leftDerivatives[k + 1] : 0.0f;
+			pCurve->KeySet(k, keys.m_times[k], keys.m_values[k], keys.m_interpolations[k],
+				FbxAnimCurveDef::eTangentUser, keys.m_rightDerivatives[k], nextLeftDerivative);
+		}
+		else {
+			pCurve->KeySet(k, keys.m_times[k], keys.m_values[k], keys.m_interpolations[k]);
+		}
+	}
+	pCurve->KeyModifyEnd();
+}
+
+
+/// <summary>
+/// Unrolls a rotation curve node. Translation is left as it is
+/// </summary>
+/// <param name="curveNode">Curves to be filtered</param>
+void UnrollFilterStage::apply(const FilterCurveNode &curveNode) const {
+
+	if (!curveNode.m_isRotation)
+		return;
+
+	// Filters keep scratch data while applied, so every call gets its own
+	FbxAnimCurveFilterUnroll filter;
+	filter.Apply(*curveNode.m_pCurveNode);
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="timeMode">Frame rate of the resampled keys</param>
+ResampleStage::ResampleStage(FbxTime::EMode timeMode) :
+m_timeMode(timeMode)
+{
+}
+
+/// <summary>
+/// Copies the keys of the curves of a transform. Rotation channels keyed apart are evaluated at the keys of all of them,
+/// so the three channels of every rotation key are read together
+/// </summary>
+/// <param name="curveNode">Curves to be read</param>
+/// <param name="keys">Output, keys of every curve</param>
+void ResampleStage::readKeys(const FilterCurveNode &curveNode, FilterCurveKeys &keys) const {
+
+	CurveFilterStage::readKeys(curveNode, keys);
+	if (!keys.m_isRotation)
+		return;
+
+	FbxAnimCurve *curves[3];
+	for (unsigned int c = 0; c < 3; c++) {
+		curves[c] = curveNode.m_pCurveNode->GetCurve(c);
+		if (!curves[c] || keys.m_curves[c].m_times.empty())
+			return;
+	}
+
+	// Mapper keys the three channels together. Channels keyed apart ( or reduced ) are evaluated at the keys of all of them,
+	// which takes the curves themselves, so it is done here rather than while filtering
+	int firstKey = hasTPoseKey(keys) ? 1 : 0;
+	if (keys.m_curves[1].m_times == keys.m_curves[0].m_times && keys.m_curves[2].m_times == keys.m_curves[0].m_times)
+		return;
+
+	std::vector<FbxTime> keyTimes;
+	for (int c = 0; c < 3; c++)
+		keyTimes.insert(keyTimes.end(), keys.m_curves[c].m_times.begin() + firstKey, keys.m_curves[c].m_times.end());
+	std::sort(keyTimes.begin(), keyTimes.end());
+	keyTimes.erase(std::unique(keyTimes.begin(), keyTimes.end()), keyTimes.end());
+
+	for (int c = 0; c < 3; c++) {
+		CurveKeys &curveKeys = keys.m_curves[c];
+		FbxAnimCurveDef::EInterpolationType interpolation = curveKeys.m_interpolations[firstKey];
+
+		curveKeys.m_times.resize(firstKey);
+		curveKeys.m_values.resize(firstKey);
+		curveKeys.m_interpolations.resize(firstKey);
+		for (auto &time : keyTimes) {
+			curveKeys.m_times.push_back(time);
+			curveKeys.m_values.push_back(curves[c]->Evaluate(time));
+			curveKeys.m_interpolations.push_back(interpolation);
+		}
+	}
+}
+
+/// <summary>
+/// Replaces the keys of a transform by keys on every frame from its first captured key to its last one
+/// </summary>
+/// <param name="keys">Keys to be filtered</param>
+void ResampleStage::filterKeys(FilterCurveKeys &keys) const {
+
+	for (int c = 0; c < 3; c++) {
+		if (keys.m_curves[c].m_times.empty())
+			return;
+	}
+
+	// T-pose key is left out of interpolation, so a body first seen long after the start of the take does not blend from it
+	int firstKey = hasTPoseKey(keys) ? 1 : 0;
+
+	// Every channel gets the same frames, from the first captured key of the transform to its last one, rounded to the closest frame
+	double start = keys.m_curves[0].m_times[firstKey].GetSecondDouble();
+	double end = keys.m_curves[0].m_times.back().GetSecondDouble();
+	for (int c = 1; c < 3; c++) {
+		start = std::min(start, keys.m_curves[c].m_times[firstKey].GetSecondDouble());
+		end = std::max(end, keys.m_curves[c].m_times.back().GetSecondDouble());
+	}
+
+	double frameRate = FbxTime::GetFrameRate(m_timeMode);
+	FbxLongLong firstFrame = (FbxLongLong)floor(start * frameRate + 0.5);
+	FbxLongLong lastFrame = (FbxLongLong)floor(end * frameRate + 0.5);
+
+	// Bodies seen from the start of the take get their first frame at time 0, replacing the T-pose key with the first captured pose
+	int keptKeys = (firstKey > 0 && firstFrame > 0) ? firstKey : 0;
+
+	std::vector<double> frameSeconds((size_t)(lastFrame - firstFrame + 1));
+	for (size_t f = 0; f < frameSeconds.size(); f++) {
+		FbxTime frameTime;
+		frameTime.SetFrame(firstFrame + (FbxLongLong)f, m_timeMode);
+		frameSeconds[f] = frameTime.GetSecondDouble();
+	}
+
+	std::vector<float> values[3];
+	if (keys.m_isRotation) {
+		resampleRotation(keys, firstKey, frameSeconds, values);
+	}
+	else {
+		for (int c = 0; c < 3; c++)
+			resampleLinear(keys.m_curves[c], firstKey, frameSeconds, values[c]);
+	}
+
+	// New keys are interpolated as the first captured key was
+	for (int c = 0; c < 3; c++)
+		setFrameKeys(keys.m_curves[c], keptKeys, firstFrame, values[c], keys.m_curves[c].m_interpolations[firstKey]);
+}
+
+/// <summary>
+/// Whether the first key of every curve is the T-pose key added when the skeleton was created ( see KinectSkeletonMapper::init ).
+/// Captured frames are keyed at least a millisecond after the start of a take, so only that key is at time 0
+/// </summary>
+/// <param name="keys">Keys of the X, Y and Z curves</param>
+bool ResampleStage::hasTPoseKey(const FilterCurveKeys &keys) {
+	// Skeletons never seen in the take ( spare ones ) only have their T-pose key, which is then resampled as it is
+	for (int c = 0; c < 3; c++) {
+		const std::vector<FbxTime> &times = keys.m_curves[c].m_times;
+		if (times.size() < 2 || times[0] != FbxTime(0))
+			return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Interpolates keys linearly at every frame, holding the first and last values outside of them
+/// </summary>
+/// <param name="keys">Keys of the curve</param>
+/// <param name="firstKey">First key to be interpolated</param>
+/// <param name="frameSeconds">Time of every frame</param>
+/// <param name="values">Output, value at every frame</param>
+void ResampleStage::resampleLinear(const CurveKeys &keys, int firstKey, const std::vector<double> &frameSeconds, std::vector<float> &values) {
+
+	size_t keyCount = keys.m_times.size();
+	values.resize(frameSeconds.size());
+
+	// Frames and keys are both in order, so the key before each frame is found by walking forward
+	size_t k = firstKey;
+	for (size_t f = 0; f < frameSeconds.size(); f++) {
+		double t = frameSeconds[f];
+		while (k + 1 < keyCount && keys.m_times[k + 1].GetSecondDouble() <= t)
+			k++;
+
+		double keySeconds = keys.m_times[k].GetSecondDouble();
+		if (k + 1 >= keyCount || t <= keySeconds) {
+			values[f] = keys.m_values[k];
+		}
+		else {
+			double s = (t - keySeconds) / (keys.m_times[k + 1].GetSecondDouble() - keySeconds);
+			values[f] = (float)(keys.m_values[k] + (keys.m_values[k + 1] - keys.m_values[k]) * s);
+		}
+	}
+}
+
+/// <summary>
+/// Interpolates euler rotation keys along the shortest arc at every frame, holding the first and last rotations outside of them
+/// </summary>
+/// <param name="keys">Keys of the X, Y and Z rotation curves, at the same times</param>
+/// <param name="firstKey">First key of every curve to be interpolated</param>
+/// <param name="frameSeconds">Time of every frame</param>
+/// <param name="values">Output, X, Y and Z euler angles at every frame</param>
+void ResampleStage::resampleRotation(const FilterCurveKeys &keys, int firstKey, const std::vector<double> &frameSeconds, std::vector<float> values[3]) {
+
+	// Keys as quaternions, each one in the hemisphere of the previous one so interpolation takes the shortest arc
+	size_t keyCount = keys.m_curves[0].m_times.size() - firstKey;
+	std::vector<double> keySeconds(keyCount);
+	std::vector<JointQuaternion> keyRotations(keyCount);
+	FbxDouble3 firstEuler;
+	for (size_t k = 0; k < keyCount; k++) {
+		FbxDouble3 euler;
+		for (int c = 0; c < 3; c++)
+			euler[c] = keys.m_curves[c].m_values[firstKey + k];
+		if (k == 0)
+			firstEuler = euler;
+
+		keySeconds[k] = keys.m_curves[0].m_times[firstKey + k].GetSecondDouble();
+		keyRotations[k] = quatFromEulerXYZ(euler[0], euler[1], euler[2]);
+		if (k > 0) {
+			const JointQuaternion &prev = keyRotations[k - 1];
+			JointQuaternion &q = keyRotations[k];
+			if (prev.x * q.x + prev.y * q.y + prev.z * q.z + prev.w * q.w < 0.0) {
+				q.x = -q.x;
+				q.y = -q.y;
+				q.z = -q.z;
+				q.w = -q.w;
+			}
+		}
+	}
+
+	// Rotation at every frame, converted back to euler angles all together ( four frames at a time with SSE )
+	JointRotationBatch batch;
+	size_t k = 0;
+	for (size_t f = 0; f < frameSeconds.size(); f++) {
+		double t = frameSeconds[f];
+		while (k + 1 < keyCount && keySeconds[k + 1] <= t)
+			k++;
+
+		if (k + 1 >= keyCount || t <= keySeconds[k]) {
+			batch.add(quatIdentity(), keyRotations[k]);
+		}
+		else {
+			double s = (t - keySeconds[k]) / (keySeconds[k + 1] - keySeconds[k]);
+			batch.add(quatIdentity(), quatSlerp(keyRotations[k], keyRotations[k + 1], s));
+		}
+	}
+	batch.computeLocalEuler();
+
+	// Euler angles keep the turns of the original keys
+	FbxDouble3 previous = firstEuler;
+	for (int c = 0; c < 3; c++)
+		values[c].resize(frameSeconds.size());
+	for (size_t f = 0; f < frameSeconds.size(); f++) {
+		previous = KinectSkeletonMapper::makeRotationContinuous(previous, FbxDouble3(batch.m_eulerX[f], batch.m_eulerY[f], batch.m_eulerZ[f]));
+		for (int c = 0; c < 3; c++)
+			values[c][f] = (float)previous[c];
+	}
+}
+
+/// <summary>
+/// Replaces keys of a curve by one key per frame
+/// </summary>
+/// <param name="keys">Keys to be replaced</param>
+/// <param name="firstKey">First key to be replaced, keys before it are kept as they are</param>
+/// <param name="firstFrame">Frame of the first key</param>
+/// <param name="values">Value at every frame</param>
+/// <param name="interpolation">Interpolation of the new keys</param>
+void ResampleStage::setFrameKeys(CurveKeys &keys, int firstKey, FbxLongLong firstFrame, const std::vector<float> &values, FbxAnimCurveDef::EInterpolationType interpolation) const {
+
+	size_t keyCount = firstKey + values.size();
+	keys.m_times.resize(keyCount);
+	keys.m_values.resize(keyCount);
+	keys.m_interpolations.resize(keyCount);
+	for (size_t f = 0; f < values.size(); f++) {
+		keys.m_times[firstKey + f].SetFrame(firstFrame + (FbxLongLong)f, m_timeMode);
+		keys.m_values[firstKey + f] = values[f];
+		keys.m_interpolations[firstKey + f] = interpolation;
+	}
+
+	// Tangents of the new keys are computed by FBX SDK when they are written back, as for the keys added by the mapper
+	keys.m_bUserTangents = false;
+	keys.m_bChanged = true;
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="angleTolerance">Largest error of rotation curves, in degrees</param>
+/// <param name="positionTolerance">Largest error of translation curves, in scene units</param>
+KeyReductionStage::KeyReductionStage(double angleTolerance, double positionTolerance) :
+m_angleTolerance(angleTolerance),
+m_positionTolerance(positionTolerance)
+{
+}
+
+/// <summary>
+/// Copies the keys of the curves of a transform, along with the slopes interpolation gave them
+/// </summary>
+/// <param name="curveNode">Curves to be read</param>
+/// <param name="keys">Output, keys of every curve</param>
+void KeyReductionStage::readKeys(const FilterCurveNode &curveNode, FilterCurveKeys &keys) const {
+	// Tangents are read from the full curve, as interpolation shaped it when the keys were added
+	keys.m_isRotation = curveNode.m_isRotation;
+	for (unsigned int c = 0; c < 3; c++)
+		readCurve(curveNode.m_pCurveNode->GetCurve(c), true, keys.m_curves[c]);
+}
+
+/// <summary>
+/// Reduces the keys of every curve of a transform
+/// </summary>
+/// <param name="keys">Keys to be filtered</param>
+void KeyReductionStage::filterKeys(FilterCurveKeys &keys) const {
+
+	// Euler angles are keyed in degrees, so a single tolerance holds for every rotation channel
+	double tolerance = keys.m_isRotation ? m_angleTolerance : m_positionTolerance;
+
+	for (int c = 0; c < 3; c++)
+		reduceCurve(keys.m_curves[c], tolerance);
+}
+
+/// <summary>
+/// Reduces the keys of a single curve
+/// </summary>
+/// <param name="keys">Keys of the curve, with their slopes</param>
+/// <param name="tolerance">Largest error, in curve units</param>
+void KeyReductionStage::reduceCurve(CurveKeys &keys, double tolerance) {
+
+	int keyCount = (int)keys.m_times.size();
+	if (keyCount < 3)
+		return;
+
+	std::vector<double> seconds(keyCount);
+	for (int k = 0; k < keyCount; k++)
+		seconds[k] = keys.m_times[k].GetSecondDouble();
+
+	// Each kept key is followed by the longest segment found within tolerance. Segment lengths are doubled until one fails,
+	// then the failing length is bisected. Only lengths actually checked are used, so every removed key is within tolerance
+	std::vector<int> keptKeys;
+	keptKeys.push_back(0);
+	int first = 0;
+	while (first < keyCount - 1) {
+		int limit = keyCount - 1 - first;
+		if (limit > c_maxSegmentKeys)
+			limit = c_maxSegmentKeys;
+
+		int good = 1;
+		int bad = limit + 1;
+		for (int length = 2; length <= limit; length *= 2) {
+			if (!isSegmentWithin(keys, seconds, first, first + length, tolerance)) {
+				bad = length;
+				break;
+			}
+			good = length;
+		}
+		if (bad > limit && good < limit) {
+			if (isSegmentWithin(keys, seconds, first, first + limit, tolerance))
+				good = limit;
+			else
+				bad = limit;
+		}
+		while (bad - good > 1) {
+			int length = (good + bad) / 2;
+			if (isSegmentWithin(keys, seconds, first, first + length, tolerance))
+				good = length;
+			else
+				bad = length;
+		}
+
+		first += good;
+		keptKeys.push_back(first);
+	}
+
+	if ((int)keptKeys.size() == keyCount)
+		return;
+
+	// Kept keys only move towards the front, so they are compacted in place
+	for (size_t i = 0; i < keptKeys.size(); i++) {
+		int k = keptKeys[i];
+		keys.m_times[i] = keys.m_times[k];
+		keys.m_values[i] = keys.m_values[k];
+		keys.m_interpolations[i] = keys.m_interpolations[k];
+		keys.m_leftDerivatives[i] = keys.m_leftDerivatives[k];
+		keys.m_rightDerivatives[i] = keys.m_rightDerivatives[k];
+	}
+	keys.m_times.resize(keptKeys.size());
+	keys.m_values.resize(keptKeys.size());
+	keys.m_interpolations.resize(keptKeys.size());
+	keys.m_leftDerivatives.resize(keptKeys.size());
+	keys.m_rightDerivatives.resize(keptKeys.size());
+
+	// Auto tangents of cubic keys would change with their new neighbours, so they become user tangents with their old slopes
+	keys.m_bUserTangents = true;
+	keys.m_bChanged = true;
+
+	PipelineMetrics::add(MetricCounter_KeysRemovedByReduction, keyCount - keptKeys.size());
+}
+
+/// <summary>
+/// Whether a single segment between two keys reconstructs every key in between within tolerance
+/// </summary>
+/// <param name="keys">Keys of the curve, before any of them is removed</param>
+/// <param name="seconds">Time of every key, in seconds</param>
+/// <param name="first">Key starting the segment</param>
+/// <param name="last">Key ending the segment</param>
+/// <param name="tolerance">Largest error, in curve units</param>
+bool KeyReductionStage::isSegmentWithin(const CurveKeys &keys, const std::vector<double> &seconds, int first, int last, double tolerance) {
+
+	FbxAnimCurveDef::EInterpolationType interpolation = keys.m_interpolations[first];
+	double t0 = seconds[first];
+	double duration = seconds[last] - t0;
+	double v0 = keys.m_values[first];
+	double v1 = keys.m_values[last];
+
+	// Hermite tangents, scaled to the segment
+	double m0 = keys.m_rightDerivatives[first] * duration;
+	double m1 = keys.m_leftDerivatives[last] * duration;
+
+	for (int k = first + 1; k < last; k++) {
+		// Keys with another interpolation are never merged into the segment
+		if (keys.m_interpolations[k] != interpolation)
+			return false;
+
+		double s = (seconds[k] - t0) / duration;
+		double value;
+		if (interpolation == FbxAnimCurveDef::eInterpolationConstant) {
+			value = v0;
+		}
+		else if (interpolation == FbxAnimCurveDef::eInterpolationLinear) {
+			value = v0 + (v1 - v0) * s;
+		}
+		else {
+			double s2 = s * s;
+			double s3 = s2 * s;
+			value = (2 * s3 - 3 * s2 + 1) * v0 + (s3 - 2 * s2 + s) * m0 + (-2 * s3 + 3 * s2) * v1 + (s3 - s2) * m1;
+		}
+
+		if (fabs(value - keys.m_values[k]) > tolerance)
+			return false;
+	}
+	return true;
+}
+
+
+/// <summary>
+/// Constructor, stages chosen by the settings
+/// </summary>
+/// <param name="settings">Filters to be run</param>
+PostProcessingPipeline::PostProcessingPipeline(const PostProcessingSettings &settings) {
+	// Before anything else, so every other stage works on keys at the final frame rate
+	if (settings.m_resampleMode != FbxTime::eDefaultMode)
+		addStage(std::unique_ptr<CurveFilterStage>(new ResampleStage(settings.m_resampleMode)));
+
+	if (settings.m_bUnroll)
+		addStage(std::unique_ptr<CurveFilterStage>(new UnrollFilterStage));
+
+	// After unrolling, so turns are not mistaken for motion
+	if (settings.m_bReduceKeys)
+		addStage(std::unique_ptr<CurveFilterStage>(new KeyReductionStage(settings.m_reductionAngleTolerance, settings.m_reductionPositionTolerance)));
+}
+
+/// <summary>
+/// Appends a stage, run after every stage added before it
+/// </summary>
+/// <param name="stage">Stage to be added</param>
+void PostProcessingPipeline::addStage(std::unique_ptr<CurveFilterStage> stage) {
+	m_stages.push_back(std::move(stage));
+}
+
+/// <summary>
+/// Lists every animated transform of the scene, in the layer of its current animation stack. Nodes are listed in scene order,
+/// so the list is always the same for the same scene
+/// </summary>
+/// <param name="pScene">FBX scene</param>
+/// <param name="curveNodes">Output, curve nodes of the scene</param>
+void PostProcessingPipeline::collectCurveNodes(FbxScene *pScene, std::vector<FilterCurveNode> &curveNodes) {
+
+	curveNodes.clear();
+
+	FbxAnimStack *baseAnimStack = pScene->GetCurrentAnimationStack();
+	if (!baseAnimStack)
+		return;
+	FbxAnimLayer *pLayer = baseAnimStack->GetMember<FbxAnimLayer>();
+	if (!pLayer)
+		return;
+
+	// Scene keeps a flat list of its nodes, so the skeleton trees need no walking
+	int nodeCount = pScene->GetNodeCount();
+	for (int i = 0; i < nodeCount; i++) {
+		FbxNode *fNode = pScene->GetNode(i);
+
+		FilterCurveNode translation = { fNode->LclTranslation.GetCurveNode(pLayer), false };
+		if (translation.m_pCurveNode && translation.m_pCurveNode->GetChannelsCount() == 3)
+			curveNodes.push_back(translation);
+
+		FilterCurveNode rotation = { fNode->LclRotation.GetCurveNode(pLayer), true };
+		if (rotation.m_pCurveNode && rotation.m_pCurveNode->GetChannelsCount() == 3)
+			curveNodes.push_back(rotation);
+	}
+}
+
+/// <summary>
+/// Runs every stage on a list of curve nodes, and waits for all of them
+/// </summary>
+/// <param name="curveNodes">Curve nodes to be filtered</param>
+/// <param name="pWorkers">Threads sharing the curve nodes with the calling one ( NULL filters them all on the calling thread )</param>
+/// <param name="stageCallback">Called after every stage ( may be NULL )</param>
+/// <param name="pStageContext">Passed to the stage callback</param>
+void PostProcessingPipeline::apply(const std::vector<FilterCurveNode> &curveNodes, MappingWorkerPool *pWorkers, StageCallback stageCallback, void *pStageContext) const {
+
+	if (m_stages.empty() || curveNodes.empty())
+		return;
+
+	int shardCount = (int)((curveNodes.size() + c_curveNodesPerShard - 1) / c_curveNodesPerShard);
+
+	std::vector<FilterCurveKeys> keys;
+	for (size_t s = 0; s < m_stages.size(); s++) {
+		const CurveFilterStage *stage = m_stages[s].get();
+		TRACE_SCOPE(stage->getName());
+
+		if (!stage->isThreadSafe()) {
+			// Stages that may not run on several threads go over every curve node on the calling thread
+			for (auto &curveNode : curveNodes)
+				stage->apply(curveNode);
+		}
+		else {
+			// Only plain keys are shared with the workers, FBX SDK curves are read and written on the calling thread.
+			// Keys go back to the curves after every stage, so the next one reads the tangents FBX SDK computes for them
+			keys.resize(curveNodes.size());
+			for (size_t i = 0; i < curveNodes.size(); i++)
+				stage->readKeys(curveNodes[i], keys[i]);
+
+			FilterShardContext context = { stage, &keys };
+			if (pWorkers)
+				pWorkers->run(&PostProcessingPipeline::applyShard, &context, shardCount);
+			else {
+				for (int i = 0; i < shardCount; i++)
+					applyShard(&context, i);
+			}
+
+			for (size_t i = 0; i < curveNodes.size(); i++)
+				stage->writeKeys(curveNodes[i], keys[i]);
+		}
+
+		if (stageCallback)
+			stageCallback(pStageContext, stage->getName(), s + 1, m_stages.size());
+	}
+}
+
+/// <summary>
+/// Runs every stage on every animated transform of a scene
+/// </summary>
+/// <param name="pScene">FBX scene</param>
+/// <param name="pWorkers">Threads sharing the curve nodes with the calling one ( NULL filters them all on the calling thread )</param>
+/// <param name="pReport">Output, key counts before and after the stages ( may be NULL )</param>
+/// <param name="stageCallback">Called after every stage ( may be NULL )</param>
+/// <param name="pStageContext">Passed to the stage callback</param>
+void PostProcessingPipeline::apply(FbxScene *pScene, MappingWorkerPool *pWorkers, PostProcessingReport *pReport, StageCallback stageCallback, void *pStageContext) const {
+
+	if (m_stages.empty() && !pReport)
+		return;
+
+	std::vector<FilterCurveNode> curveNodes;
+	collectCurveNodes(pScene, curveNodes);
+
+	if (pReport)
+		pReport->m_nKeysBefore = countKeys(curveNodes);
+
+	apply(curveNodes, pWorkers, stageCallback, pStageContext);
+
+	if (pReport)
+		pReport->m_nKeysAfter = countKeys(curveNodes);
+}
+
+/// <summary>
+/// Number of keys in a list of curve nodes
+/// </summary>
+/// <param name="curveNodes">Curve nodes to be counted</param>
+unsigned long long PostProcessingPipeline::countKeys(const std::vector<FilterCurveNode> &curveNodes) {
+	unsigned long long keyCount = 0;
+	for (auto &curveNode : curveNodes) {
+		for (unsigned int c = 0; c < curveNode.m_pCurveNode->GetChannelsCount(); c++) {
+			FbxAnimCurve *pCurve = curveNode.m_pCurveNode->GetCurve(c);
+			if (pCurve)
+				keyCount += pCurve->KeyGetCount();
+		}
+	}
+	return keyCount;
+}
+
+/// <summary>
+/// Filters the keys of a shard of curve nodes with a thread safe stage, on a worker
+/// </summary>
+/// <param name="pContext">Stage and keys ( FilterShardContext )</param>
+/// <param name="index">Shard to be filtered</param>
+void PostProcessingPipeline::applyShard(void *pContext, int index) {
+
+	TRACE_SCOPE("filter_shard");
+
+	const FilterShardContext &context = *static_cast<const FilterShardContext*>(pContext);
+	std::vector<FilterCurveKeys> &keys = *context.m_pKeys;
+
+	size_t first = (size_t)index * c_curveNodesPerShard;
+	size_t end = first + c_curveNodesPerShard;
+	if (end > keys.size())
+		end = keys.size();
+
+	for (size_t i = first; i < end; i++)
+		context.m_pStage->filterKeys(keys[i]);
+}
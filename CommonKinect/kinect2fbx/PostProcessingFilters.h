@@ -0,0 +1,409 @@
+#pragma once
+
+#include "../stdafx.h"
+#include "JointMath.h"
+
+class MappingWorkerPool;
+
+/*
+	Animation curves of one transform of one joint ( X, Y and Z ), filtered as a whole
+*/
+struct FilterCurveNode {
+	// Curve node of the transform, in the animation layer of the take
+	FbxAnimCurveNode *m_pCurveNode;
+
+	// Rotation ( LclRotation ) or translation ( LclTranslation )
+	bool m_isRotation;
+};
+
+/*
+	Keys of a single curve, copied out of FBX SDK so they can be filtered on any thread
+*/
+struct CurveKeys {
+	std::vector<FbxTime> m_times;
+	std::vector<float> m_values;
+	std::vector<FbxAnimCurveDef::EInterpolationType> m_interpolations;
+
+	// Slopes on both sides of every key, only read for stages asking for them ( see CurveFilterStage::readCurve )
+	std::vector<float> m_leftDerivatives;
+	std::vector<float> m_rightDerivatives;
+
+	// Keys are written back with the slopes above as user tangents, instead of the tangents FBX SDK computes for new keys
+	bool m_bUserTangents;
+
+	// Set by stages changing the keys, so curves left as they are are not rewritten
+	bool m_bChanged;
+
+	/// <summary>
+	/// Constructor, no keys
+	/// </summary>
+	CurveKeys() :
+	m_bUserTangents(false),
+	m_bChanged(false)
+	{
+	}
+};
+
+/*
+	Keys of the X, Y and Z curves of a transform, filtered as a whole
+*/
+struct FilterCurveKeys {
+	// Keys of every curve ( a missing curve has none )
+	CurveKeys m_curves[3];
+
+	// Rotation ( LclRotation ) or translation ( LclTranslation )
+	bool m_isRotation;
+};
+
+/*
+	Step of post processing, applied to every curve node of a take on its own.
+	FBX SDK does not document its curves as safe to change from several threads, even different ones, so stages only
+	run on the calling thread unless they say otherwise ( see isThreadSafe ). Those that do never touch FBX SDK objects
+	while filtering: the pipeline reads keys of every curve node on the calling thread, several threads filter them
+	as plain arrays ( see filterKeys ), then the calling thread writes them back. Stages keep no state while applied
+*/
+class CurveFilterStage {
+public:
+	virtual ~CurveFilterStage() {};
+
+	/// <summary>
+	/// Name of the stage, as shown in timelines
+	/// </summary>
+	virtual const char *getName() const = 0;
+
+	/// <summary>
+	/// Whether the stage filters plain keys ( filterKeys ), so several threads may filter different curve nodes at once.
+	/// Stages must not say so if they use FBX SDK objects while filtering
+	/// </summary>
+	virtual bool isThreadSafe() const { return false; };
+
+	/// <summary>
+	/// Filters the curves of a single transform, on the calling thread. Reads, filters and writes back its keys unless overridden
+	/// </summary>
+	/// <param name="curveNode">Curves to be filtered</param>
+	virtual void apply(const FilterCurveNode &curveNode) const;
+
+	/// <summary>
+	/// Copies the keys of the curves of a transform, on the calling thread
+	/// </summary>
+	/// <param name="curveNode">Curves to be read</param>
+	/// <param name="keys">Output, keys of every curve</param>
+	virtual void readKeys(const FilterCurveNode &curveNode, FilterCurveKeys &keys) const;
+
+	/// <summary>
+	/// Filters the keys of a transform, on any thread. Touches nothing but the keys
+	/// </summary>
+	/// <param name="keys">Keys to be filtered, marked as changed when they are</param>
+	virtual void filterKeys(FilterCurveKeys &keys) const {};
+
+	/// <summary>
+	/// Replaces keys of the curves of a transform by the ones filtered, on the calling thread. Curves left unchanged are not touched
+	/// </summary>
+	/// <param name="curveNode">Curves to be written</param>
+	/// <param name="keys">Filtered keys of every curve</param>
+	void writeKeys(const FilterCurveNode &curveNode, const FilterCurveKeys &keys) const;
+
+protected:
+	/// <summary>
+	/// Copies the keys of a curve
+	/// </summary>
+	/// <param name="pCurve">Curve to be read ( may be NULL )</param>
+	/// <param name="bDerivatives">Whether slopes of the keys are read as well</param>
+	/// <param name="keys">Output, keys of the curve</param>
+	static void readCurve(FbxAnimCurve *pCurve, bool bDerivatives, CurveKeys &keys);
+
+	/// <summary>
+	/// Replaces every key of a curve
+	/// </summary>
+	/// <param name="pCurve">Curve to be rewritten</param>
+	/// <param name="keys">New keys</param>
+	static void writeCurve(FbxAnimCurve *pCurve, const CurveKeys &keys);
+};
+
+/*
+	Unroll filter of FBX SDK, making euler rotation curves continuous. Keys added by the mapper already are,
+	so it is only needed by scenes keyed some other way. It filters FBX SDK curves, so it runs on the calling thread
+*/
+class UnrollFilterStage : public CurveFilterStage {
+public:
+	/// <summary>
+	/// Name of the stage, as shown in timelines
+	/// </summary>
+	virtual const char *getName() const { return "unroll_filter"; };
+
+	/// <summary>
+	/// Unrolls a rotation curve node. Translation is left as it is
+	/// </summary>
+	/// <param name="curveNode">Curves to be filtered</param>
+	virtual void apply(const FilterCurveNode &curveNode) const;
+};
+
+/*
+	Resamples a transform to a key on every frame of a fixed frame rate. Keys added by the mapper are timed by the sensor,
+	so they jitter and skip the frames dropped on the way. Rotations are interpolated between the original keys along
+	the shortest arc ( quaternion SLERP ), translations linearly, and gaps are filled the same way.
+	The T-pose key the mapper adds at time 0 when it creates a skeleton is not a captured pose: frames start at the first
+	captured key, so bodies entering a take late are not blended from the T-pose, and the T-pose key is kept as it is
+*/
+class ResampleStage : public CurveFilterStage {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="timeMode">Frame rate of the resampled keys</param>
+	ResampleStage(FbxTime::EMode timeMode);
+
+	/// <summary>
+	/// Name of the stage, as shown in timelines
+	/// </summary>
+	virtual const char *getName() const { return "resample"; };
+
+	/// <summary>
+	/// Filters plain keys only
+	/// </summary>
+	virtual bool isThreadSafe() const { return true; };
+
+	/// <summary>
+	/// Copies the keys of the curves of a transform. Rotation channels keyed apart are evaluated at the keys of all of them,
+	/// so the three channels of every rotation key are read together
+	/// </summary>
+	/// <param name="curveNode">Curves to be read</param>
+	/// <param name="keys">Output, keys of every curve</param>
+	virtual void readKeys(const FilterCurveNode &curveNode, FilterCurveKeys &keys) const;
+
+	/// <summary>
+	/// Replaces the keys of a transform by keys on every frame from its first captured key to its last one
+	/// </summary>
+	/// <param name="keys">Keys to be filtered</param>
+	virtual void filterKeys(FilterCurveKeys &keys) const;
+
+private:
+	// Frame rate of the resampled keys
+	FbxTime::EMode m_timeMode;
+
+	/// <summary>
+	/// Whether the first key of every curve is the T-pose key added when the skeleton was created ( see KinectSkeletonMapper::init ).
+	/// Captured frames are keyed at least a millisecond after the start of a take, so only that key is at time 0
+	/// </summary>
+	/// <param name="keys">Keys of the X, Y and Z curves</param>
+	static bool hasTPoseKey(const FilterCurveKeys &keys);
+
+	/// <summary>
+	/// Interpolates keys linearly at every frame, holding the first and last values outside of them
+	/// </summary>
+	/// <param name="keys">Keys of the curve</param>
+	/// <param name="firstKey">First key to be interpolated</param>
+	/// <param name="frameSeconds">Time of every frame</param>
+	/// <param name="values">Output, value at every frame</param>
+	static void resampleLinear(const CurveKeys &keys, int firstKey, const std::vector<double> &frameSeconds, std::vector<float> &values);
+
+	/// <summary>
+	/// Interpolates euler rotation keys along the shortest arc at every frame, holding the first and last rotations outside of them
+	/// </summary>
+	/// <param name="keys">Keys of the X, Y and Z rotation curves, at the same times</param>
+	/// <param name="firstKey">First key of every curve to be interpolated</param>
+	/// <param name="frameSeconds">Time of every frame</param>
+	/// <param name="values">Output, X, Y and Z euler angles at every frame</param>
+	static void resampleRotation(const FilterCurveKeys &keys, int firstKey, const std::vector<double> &frameSeconds, std::vector<float> values[3]);
+
+	/// <summary>
+	/// Replaces keys of a curve by one key per frame
+	/// </summary>
+	/// <param name="keys">Keys to be replaced</param>
+	/// <param name="firstKey">First key to be replaced, keys before it are kept as they are</param>
+	/// <param name="firstFrame">Frame of the first key</param>
+	/// <param name="values">Value at every frame</param>
+	/// <param name="interpolation">Interpolation of the new keys</param>
+	void setFrameKeys(CurveKeys &keys, int firstKey, FbxLongLong firstFrame, const std::vector<float> &values, FbxAnimCurveDef::EInterpolationType interpolation) const;
+};
+
+/*
+	Removes keys that interpolation from the remaining ones reconstructs within a tolerance.
+	Kept keys keep their interpolation, and cubic ones keep the tangents they had before any key was removed,
+	so the error measured while reducing is the error of the saved curve
+*/
+class KeyReductionStage : public CurveFilterStage {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="angleTolerance">Largest error of rotation curves, in degrees</param>
+	/// <param name="positionTolerance">Largest error of translation curves, in scene units</param>
+	KeyReductionStage(double angleTolerance, double positionTolerance);
+
+	/// <summary>
+	/// Name of the stage, as shown in timelines
+	/// </summary>
+	virtual const char *getName() const { return "key_reduction"; };
+
+	/// <summary>
+	/// Filters plain keys only
+	/// </summary>
+	virtual bool isThreadSafe() const { return true; };
+
+	/// <summary>
+	/// Copies the keys of the curves of a transform, along with the slopes interpolation gave them
+	/// </summary>
+	/// <param name="curveNode">Curves to be read</param>
+	/// <param name="keys">Output, keys of every curve</param>
+	virtual void readKeys(const FilterCurveNode &curveNode, FilterCurveKeys &keys) const;
+
+	/// <summary>
+	/// Reduces the keys of every curve of a transform
+	/// </summary>
+	/// <param name="keys">Keys to be filtered</param>
+	virtual void filterKeys(FilterCurveKeys &keys) const;
+
+private:
+	// Longest run of keys replaced by a single segment, so still takes are not searched end to end
+	static const int c_maxSegmentKeys;
+
+	// Tolerances, in degrees and scene units
+	double m_angleTolerance;
+	double m_positionTolerance;
+
+	/// <summary>
+	/// Reduces the keys of a single curve
+	/// </summary>
+	/// <param name="keys">Keys of the curve, with their slopes</param>
+	/// <param name="tolerance">Largest error, in curve units</param>
+	static void reduceCurve(CurveKeys &keys, double tolerance);
+
+	/// <summary>
+	/// Whether a single segment between two keys reconstructs every key in between within tolerance
+	/// </summary>
+	/// <param name="keys">Keys of the curve, before any of them is removed</param>
+	/// <param name="seconds">Time of every key, in seconds</param>
+	/// <param name="first">Key starting the segment</param>
+	/// <param name="last">Key ending the segment</param>
+	/// <param name="tolerance">Largest error, in curve units</param>
+	static bool isSegmentWithin(const CurveKeys &keys, const std::vector<double> &seconds, int first, int last, double tolerance);
+};
+
+/*
+	Filters run on a take before it is saved
+*/
+struct PostProcessingSettings {
+	// Frame rate keys are resampled to ( see ResampleStage ), eDefaultMode keeps the times keys were captured at
+	FbxTime::EMode m_resampleMode;
+
+	// Unroll every rotation curve ( see UnrollFilterStage )
+	bool m_bUnroll;
+
+	// Remove keys interpolation can do without ( see KeyReductionStage )
+	bool m_bReduceKeys;
+
+	// Largest error left by key reduction, in degrees for rotations and scene units for translations
+	double m_reductionAngleTolerance;
+	double m_reductionPositionTolerance;
+
+	/// <summary>
+	/// Constructor, no filters
+	/// </summary>
+	PostProcessingSettings() :
+	m_resampleMode(FbxTime::eDefaultMode),
+	m_bUnroll(false),
+	m_bReduceKeys(false),
+	m_reductionAngleTolerance(0.25),
+	m_reductionPositionTolerance(0.1)
+	{
+	}
+};
+
+/*
+	Keys of a take, before and after post processing
+*/
+struct PostProcessingReport {
+	unsigned long long m_nKeysBefore;
+	unsigned long long m_nKeysAfter;
+
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	PostProcessingReport() :
+	m_nKeysBefore(0),
+	m_nKeysAfter(0)
+	{
+	}
+};
+
+/*
+	List of filter stages, applied to a list of curve nodes, one stage after the other. Curve nodes do not depend on each other,
+	so the keys of thread safe stages are split in shards shared among worker threads, between reading and writing them back
+	on the calling thread. Every curve node is filtered by a single thread at a time, so results do not depend on the number of threads.
+	Stages that are not thread safe run on the calling thread alone
+*/
+class PostProcessingPipeline {
+public:
+	// Called on the calling thread once a stage is done with every curve node
+	typedef void(*StageCallback)(void *pContext, const char *stageName, size_t stagesDone, size_t stageCount);
+
+	/// <summary>
+	/// Constructor, no stages
+	/// </summary>
+	PostProcessingPipeline() {};
+
+	/// <summary>
+	/// Constructor, stages chosen by the settings
+	/// </summary>
+	/// <param name="settings">Filters to be run</param>
+	PostProcessingPipeline(const PostProcessingSettings &settings);
+
+	/// <summary>
+	/// Appends a stage, run after every stage added before it
+	/// </summary>
+	/// <param name="stage">Stage to be added</param>
+	void addStage(std::unique_ptr<CurveFilterStage> stage);
+
+	/// <summary>
+	/// Number of stages
+	/// </summary>
+	size_t getStageCount() const { return m_stages.size(); };
+
+	/// <summary>
+	/// Lists every animated transform of the scene, in the layer of its current animation stack. Nodes are listed in scene order,
+	/// so the list is always the same for the same scene
+	/// </summary>
+	/// <param name="pScene">FBX scene</param>
+	/// <param name="curveNodes">Output, curve nodes of the scene</param>
+	static void collectCurveNodes(FbxScene *pScene, std::vector<FilterCurveNode> &curveNodes);
+
+	/// <summary>
+	/// Runs every stage on a list of curve nodes, and waits for all of them
+	/// </summary>
+	/// <param name="curveNodes">Curve nodes to be filtered</param>
+	/// <param name="pWorkers">Threads sharing the curve nodes with the calling one ( NULL filters them all on the calling thread )</param>
+	/// <param name="stageCallback">Called after every stage ( may be NULL )</param>
+	/// <param name="pStageContext">Passed to the stage callback</param>
+	void apply(const std::vector<FilterCurveNode> &curveNodes, MappingWorkerPool *pWorkers, StageCallback stageCallback = NULL, void *pStageContext = NULL) const;
+
+	/// <summary>
+	/// Runs every stage on every animated transform of a scene
+	/// </summary>
+	/// <param name="pScene">FBX scene</param>
+	/// <param name="pWorkers">Threads sharing the curve nodes with the calling one ( NULL filters them all on the calling thread )</param>
+	/// <param name="pReport">Output, key counts before and after the stages ( may be NULL )</param>
+	/// <param name="stageCallback">Called after every stage ( may be NULL )</param>
+	/// <param name="pStageContext">Passed to the stage callback</param>
+	void apply(FbxScene *pScene, MappingWorkerPool *pWorkers, PostProcessingReport *pReport = NULL, StageCallback stageCallback = NULL, void *pStageContext = NULL) const;
+
+	/// <summary>
+	/// Number of keys in a list of curve nodes
+	/// </summary>
+	/// <param name="curveNodes">Curve nodes to be counted</param>
+	static unsigned long long countKeys(const std::vector<FilterCurveNode> &curveNodes);
+
+private:
+	// Curve nodes taken by a worker at once
+	static const int c_curveNodesPerShard;
+
+	// Stages, in the order they run
+	std::vector<std::unique_ptr<CurveFilterStage>> m_stages;
+
+	/// <summary>
+	/// Filters the keys of a shard of curve nodes with a thread safe stage, on a worker
+	/// </summary>
+	/// <param name="pContext">Stage and keys ( FilterShardContext )</param>
+	/// <param name="index">Shard to be filtered</param>
+	static void applyShard(void *pContext, int index);
+};
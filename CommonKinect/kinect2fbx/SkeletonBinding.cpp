@@ -0,0 +1,256 @@
+#include "SkeletonBinding.h"
+#include "PipelineMetrics.h"
+#include "TraceRecorder.h"
+
+#include <float.h>
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+CurveKeyBuffer::CurveKeyBuffer() :
+m_pCurve(NULL),
+m_tolerance(0),
+m_bHasAnchor(false),
+m_anchorTime(0),
+m_anchorValue(0),
+m_bHasPending(false),
+m_pendingValue(0),
+m_minSlope(-DBL_MAX),
+m_maxSlope(DBL_MAX),
+m_nSkipped(0)
+{
+}
+
+/// <summary>
+/// Only keys samples that linear interpolation misses by more than a tolerance, from now on
+/// </summary>
+/// <param name="tolerance">Largest error of skipped samples ( 0 keys every sample, with cubic interpolation )</param>
+void CurveKeyBuffer::setTolerance(double tolerance) {
+
+	// Sample held back was decided with the old tolerance
+	if (m_bHasPending)
+		keepPending();
+
+	m_tolerance = tolerance;
+	m_bHasAnchor = false;
+}
+
+/// <summary>
+/// Decides whether the sample held back is needed, now that the next one is known
+/// </summary>
+/// <param name="keyTime">Sample time</param>
+/// <param name="keyVal">Sample value</param>
+void CurveKeyBuffer::addSample(FbxTime keyTime, float keyVal) {
+
+	double time = keyTime.GetSecondDouble();
+
+	// First sample is always kept, and so is one that does not come after the anchor
+	if (!m_bHasAnchor || time <= m_anchorTime) {
+		if (m_bHasPending)
+			keepPending();
+		m_pendingTime = keyTime;
+		m_pendingValue = keyVal;
+		keepPending();
+		return;
+	}
+
+	if (m_bHasPending) {
+		// Skipping the held back sample narrows the slopes the line from the anchor may take
+		double pendingTime = m_pendingTime.GetSecondDouble() - m_anchorTime;
+		double minSlope = (m_pendingValue - m_tolerance - m_anchorValue) / pendingTime;
+		double maxSlope = (m_pendingValue + m_tolerance - m_anchorValue) / pendingTime;
+		if (minSlope < m_minSlope)
+			minSlope = m_minSlope;
+		if (maxSlope > m_maxSlope)
+			maxSlope = m_maxSlope;
+
+		double slope = (keyVal - m_anchorValue) / (time - m_anchorTime);
+		if (slope >= minSlope && slope <= maxSlope) {
+			m_minSlope = minSlope;
+			m_maxSlope = maxSlope;
+			m_nSkipped++;
+		}
+		else {
+			// Line to the new sample would miss a skipped one, so the held back sample ends the segment
+			keepPending();
+		}
+	}
+
+	m_pendingTime = keyTime;
+	m_pendingValue = keyVal;
+	m_bHasPending = true;
+}
+
+/// <summary>
+/// Keeps the sample held back, which becomes the anchor
+/// </summary>
+void CurveKeyBuffer::keepPending() {
+	m_times.push_back(m_pendingTime);
+	m_values.push_back(m_pendingValue);
+
+	m_bHasAnchor = true;
+	m_anchorTime = m_pendingTime.GetSecondDouble();
+	m_anchorValue = m_pendingValue;
+	m_bHasPending = false;
+	m_minSlope = -DBL_MAX;
+	m_maxSlope = DBL_MAX;
+}
+
+/// <summary>
+/// Adds every buffered key to the curve, and empties the buffer ( keeping its capacity )
+/// </summary>
+/// <param name="bFlushPending">Key the sample held back as well, as no sample will follow it</param>
+void CurveKeyBuffer::commit(bool bFlushPending) {
+
+	if (bFlushPending && m_bHasPending)
+		keepPending();
+
+	if (m_nSkipped > 0) {
+		PipelineMetrics::add(MetricCounter_SamplesNotKeyed, m_nSkipped);
+		m_nSkipped = 0;
+	}
+
+	size_t count = m_times.size();
+	if (!m_pCurve || count == 0)
+		return;
+
+	// Skipped samples are only within tolerance of straight lines between kept keys
+	FbxAnimCurveDef::EInterpolationType interpolation = m_tolerance > 0 ? FbxAnimCurveDef::eInterpolationLinear : FbxAnimCurveDef::eInterpolationCubic;
+
+	m_pCurve->KeyModifyBegin();
+
+	// Captured keys come in chronological order, after every key already in the curve,
+	// so the curve can be grown once and filled in place
+	int keyCount = m_pCurve->KeyGetCount();
+	bool inOrder = keyCount == 0 || m_times[0] > m_pCurve->KeyGetTime(keyCount - 1);
+	for (size_t i = 1; inOrder && i < count; i++)
+		inOrder = m_times[i] > m_times[i - 1];
+
+	if (inOrder) {
+		m_pCurve->ResizeKeyBuffer(keyCount + (int)count);
+		for (size_t i = 0; i < count; i++)
+			m_pCurve->KeySet(keyCount + (int)i, m_times[i], m_values[i], interpolation);
+	}
+	else {
+		// Same as adding them one by one ( keys with the same time replace each other )
+		for (size_t i = 0; i < count; i++) {
+			int keyIndex = m_pCurve->KeyAdd(m_times[i]);
+			m_pCurve->KeySetInterpolation(keyIndex, interpolation);
+			m_pCurve->KeySetValue(keyIndex, m_values[i]);
+		}
+	}
+
+	m_pCurve->KeyModifyEnd();
+
+	PipelineMetrics::add(MetricCounter_KeysCommitted, count);
+	PipelineMetrics::record(MetricHistogram_KeysPerCurve, count);
+
+	m_times.clear();
+	m_values.clear();
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="pNode">FBX node of the joint</param>
+/// <param name="parentIndex">Index of parent joint in the binding</param>
+JointBinding::JointBinding(FbxNode *pNode, int parentIndex) :
+m_pNode(pNode),
+m_jointType(JointType_Count),
+m_parentIndex(parentIndex),
+m_firstChild(0),
+m_childCount(0),
+m_orientationSource(JointType_Count),
+m_boneEndIndex(-1)
+{
+}
+
+/// <summary>
+/// Sets how keys of every joint are added from now on
+/// </summary>
+/// <param name="keying">Keying settings</param>
+void SkeletonBinding::setKeying(const KeyingSettings &keying) {
+	for (auto &jBinding : m_joints) {
+		for (int i = 0; i < 3; i++) {
+			jBinding.m_translationCurves[i].setTolerance(keying.m_bAdaptive ? keying.m_positionTolerance : 0.0);
+			jBinding.m_rotationCurves[i].setTolerance(keying.m_bAdaptive ? keying.m_angleTolerance : 0.0);
+		}
+	}
+}
+
+/// <summary>
+/// Commits buffered keys of every joint to their curves
+/// </summary>
+/// <param name="bFlushPending">Key samples held back by adaptive keying as well</param>
+void SkeletonBinding::commitKeys(bool bFlushPending) {
+	for (auto &jBinding : m_joints) {
+		for (int i = 0; i < 3; i++) {
+			jBinding.m_translationCurves[i].commit(bFlushPending);
+			jBinding.m_rotationCurves[i].commit(bFlushPending);
+		}
+	}
+}
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="pScene">FBX scene, with an animation stack and layer ( may be NULL )</param>
+MappingSession::MappingSession(FbxScene *pScene) :
+m_bVerifyRotations(false),
+m_pWorkers(NULL)
+{
+	reset(pScene);
+}
+
+/// <summary>
+/// Starts mapping a new take
+/// </summary>
+/// <param name="pScene">FBX scene, with an animation stack and layer ( may be NULL )</param>
+void MappingSession::reset(FbxScene *pScene) {
+	m_pScene = pScene;
+	m_pLayer = NULL;
+	m_initTime = 0;
+	m_nMappedBodies = 0;
+	m_nBufferedFrames = 0;
+	m_bindings.clear();
+	m_spareSkeletons.clear();
+	m_nSpareSkeletons = 0;
+	m_jointFilter.reset();
+
+	if (!m_pScene)
+		return;
+
+	// Layer is looked up once, instead of for every body of every frame
+	FbxAnimStack *baseAnimStack = m_pScene->GetCurrentAnimationStack();
+	if (baseAnimStack)
+		m_pLayer = baseAnimStack->GetMember<FbxAnimLayer>();
+}
+
+/// <summary>
+/// Largest difference found between rotation keys and the FbxAMatrix reference, when verification is on
+/// </summary>
+/// <returns>Difference in degrees</returns>
+double MappingSession::getMaxRotationError() const {
+	double maxError = 0;
+	for (auto &it : m_bindings) {
+		if (it.second->m_maxRotationError > maxError)
+			maxError = it.second->m_maxRotationError;
+	}
+	return maxError;
+}
+
+/// <summary>
+/// Commits buffered keys of every skeleton to their curves. Must be called before curves are read, filtered or saved
+/// </summary>
+/// <param name="bFlushPending">Key samples held back by adaptive keying as well. Only left out by periodic commits in the middle of a take</param>
+void MappingSession::commitKeys(bool bFlushPending) {
+	TRACE_SCOPE("commit_keys");
+
+	for (auto &it : m_bindings)
+		it.second->commitKeys(bFlushPending);
+
+	m_nBufferedFrames = 0;
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "../stdafx.h"
+#include "BodyFrame.h"
+#include "JointMath.h"
+#include "JointNoiseFilter.h"
+
+class MappingWorkerPool;
+
+/*
+	How keys are added while a take is mapped
+*/
+struct KeyingSettings {
+	// Only key samples that interpolation from the kept keys cannot predict ( see CurveKeyBuffer )
+	bool m_bAdaptive;
+
+	// Largest error of skipped samples, in degrees for rotations and scene units for translations
+	double m_angleTolerance;
+	double m_positionTolerance;
+
+	/// <summary>
+	/// Constructor, every sample is keyed
+	/// </summary>
+	KeyingSettings() :
+	m_bAdaptive(false),
+	m_angleTolerance(0.25),
+	m_positionTolerance(0.1)
+	{
+	}
+};
+
+/*
+	Keys of an animation curve, buffered while capturing and committed to the curve in bulk.
+	Every sample becomes a cubic key, unless the buffer has a tolerance. Keys are then linear, and a sample is only kept
+	when the line from the last kept key to the next sample would miss it, or any sample skipped before it, by more than the tolerance.
+	Latest sample is held back until the next one arrives, so skipped samples cost two slopes instead of memory
+*/
+struct CurveKeyBuffer {
+
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	CurveKeyBuffer();
+
+	/// <summary>
+	/// Buffers a key
+	/// </summary>
+	/// <param name="keyTime">Key time</param>
+	/// <param name="keyVal">Key value</param>
+	void add(FbxTime keyTime, float keyVal) {
+		if (m_tolerance > 0) {
+			addSample(keyTime, keyVal);
+			return;
+		}
+		m_times.push_back(keyTime);
+		m_values.push_back(keyVal);
+	};
+
+	/// <summary>
+	/// Only keys samples that linear interpolation misses by more than a tolerance, from now on
+	/// </summary>
+	/// <param name="tolerance">Largest error of skipped samples ( 0 keys every sample, with cubic interpolation )</param>
+	void setTolerance(double tolerance);
+
+	/// <summary>
+	/// Adds every buffered key to the curve, and empties the buffer ( keeping its capacity )
+	/// </summary>
+	/// <param name="bFlushPending">Key the sample held back as well, as no sample will follow it</param>
+	void commit(bool bFlushPending = true);
+
+	// Curve receiving the keys ( NULL if not bound )
+	FbxAnimCurve *m_pCurve;
+
+	// Buffered keys
+	std::vector<FbxTime> m_times;
+	std::vector<float> m_values;
+
+	// Largest error of skipped samples ( 0 keys every sample )
+	double m_tolerance;
+
+	// Last kept key, where the line predicting the next samples starts
+	bool m_bHasAnchor;
+	double m_anchorTime;
+	float m_anchorValue;
+
+	// Latest sample, kept or skipped once the next one arrives
+	bool m_bHasPending;
+	FbxTime m_pendingTime;
+	float m_pendingValue;
+
+	// Slopes from the anchor keeping every skipped sample within tolerance
+	double m_minSlope;
+	double m_maxSlope;
+
+	// Samples skipped since the last commit
+	unsigned int m_nSkipped;
+
+private:
+	/// <summary>
+	/// Decides whether the sample held back is needed, now that the next one is known
+	/// </summary>
+	/// <param name="keyTime">Sample time</param>
+	/// <param name="keyVal">Sample value</param>
+	void addSample(FbxTime keyTime, float keyVal);
+
+	/// <summary>
+	/// Keeps the sample held back, which becomes the anchor
+	/// </summary>
+	void keepPending();
+};
+
+/*
+	Direct access to the FBX objects of one joint of a skeleton
+*/
+struct JointBinding {
+
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="pNode">FBX node of the joint</param>
+	/// <param name="parentIndex">Index of parent joint in the binding</param>
+	JointBinding(FbxNode *pNode = NULL, int parentIndex = -1);
+
+	// FBX node of the joint
+	FbxNode *m_pNode;
+
+	// Kinect corresponding joint ( JointType_Count if there is none )
+	JointType m_jointType;
+
+	// Index of parent joint in the binding ( -1 for the skeleton root )
+	int m_parentIndex;
+
+	// Children are stored next to each other, starting at this index
+	int m_firstChild;
+	int m_childCount;
+
+	// Joint translation when skeleton was created
+	FbxDouble3 m_baseTranslation;
+
+	// Kinect joint whose orientation drives this joint ( JointType_Count if joint is not animated )
+	JointType m_orientationSource;
+
+	// Child joint used to estimate the orientation when Kinect has none ( -1 if it cannot be estimated )
+	int m_boneEndIndex;
+
+	// Translation curves ( X, Y and Z ). Only bound for the Kinect root joint
+	CurveKeyBuffer m_translationCurves[3];
+
+	// Rotation curves ( X, Y and Z )
+	CurveKeyBuffer m_rotationCurves[3];
+
+	// Last rotation keyed, in Euler angles. Next key is kept within half a turn of it
+	FbxDouble3 m_lastEuler;
+};
+
+/*
+	Skeleton of a tracked body, resolved once when the skeleton is first seen.
+	Joints are stored breadth first, so parents always come before their children
+*/
+struct SkeletonBinding {
+
+	// Skeleton root node
+	FbxNode *m_pRootNode;
+
+	// Flattened joint hierarchy ( first entry is the skeleton root )
+	std::vector<JointBinding> m_joints;
+
+	// Global rotation of each joint for the frame being mapped ( same indices as m_joints )
+	std::vector<JointQuaternion> m_globalRotations;
+
+	// Largest difference found between our rotation keys and the FbxAMatrix reference, in degrees
+	double m_maxRotationError;
+
+	// Rotations of this skeleton for the frame being mapped, when bodies are mapped in parallel
+	JointRotationBatch m_rotationBatch;
+
+	// Joint each rotation of the batch belongs to
+	std::vector<JointBinding*> m_batchJoints;
+
+	/// <summary>
+	/// Sets how keys of every joint are added from now on
+	/// </summary>
+	/// <param name="keying">Keying settings</param>
+	void setKeying(const KeyingSettings &keying);
+
+	/// <summary>
+	/// Commits buffered keys of every joint to their curves
+	/// </summary>
+	/// <param name="bFlushPending">Key samples held back by adaptive keying as well</param>
+	void commitKeys(bool bFlushPending = true);
+};
+
+/*
+	State of a take being mapped to a FBX scene
+*/
+struct MappingSession {
+
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="pScene">FBX scene, with an animation stack and layer ( may be NULL )</param>
+	MappingSession(FbxScene *pScene = NULL);
+
+	/// <summary>
+	/// Starts mapping a new take
+	/// </summary>
+	/// <param name="pScene">FBX scene, with an animation stack and layer ( may be NULL )</param>
+	void reset(FbxScene *pScene);
+
+	// Target scene
+	FbxScene *m_pScene;
+
+	// Layer receiving animation keys
+	FbxAnimLayer *m_pLayer;
+
+	// Time of the first mapped frame, in milliseconds ( 0 if no frame has been mapped yet )
+	INT64 m_initTime;
+
+	// Skeletons of this take, by tracking id
+	std::unordered_map<UINT64, std::unique_ptr<SkeletonBinding>> m_bindings;
+
+	// Skeletons already in the scene, bound to the next bodies seen for the first time ( oldest first )
+	std::vector<std::unique_ptr<SkeletonBinding>> m_spareSkeletons;
+
+	// Spare skeletons built for this take, so each gets its own names
+	unsigned int m_nSpareSkeletons;
+
+	// Number of body frames mapped so far
+	unsigned long long m_nMappedBodies;
+
+	// Frames mapped since keys were last committed to the curves
+	unsigned int m_nBufferedFrames;
+
+	// Rotations of the frame being mapped, for every body
+	JointRotationBatch m_rotationBatch;
+
+	// Joint each rotation of the batch belongs to
+	std::vector<JointBinding*> m_batchJoints;
+
+	// Cross-check every rotation key against the FbxAMatrix reference ( slow, kept across takes )
+	bool m_bVerifyRotations;
+
+	// Threads mapping the bodies of a frame in parallel ( NULL maps them one after another, kept across takes )
+	MappingWorkerPool *m_pWorkers;
+
+	// How keys are added, applied to skeletons as bodies are bound to them ( kept across takes )
+	KeyingSettings m_keying;
+
+	// Smooths joints before they are keyed ( settings kept across takes, joints forgotten with every take )
+	JointNoiseFilter m_jointFilter;
+
+	/// <summary>
+	/// Largest difference found between rotation keys and the FbxAMatrix reference, when verification is on
+	/// </summary>
+	/// <returns>Difference in degrees</returns>
+	double getMaxRotationError() const;
+
+	/// <summary>
+	/// Commits buffered keys of every skeleton to their curves. Must be called before curves are read, filtered or saved
+	/// </summary>
+	/// <param name="bFlushPending">Key samples held back by adaptive keying as well. Only left out by periodic commits in the middle of a take</param>
+	void commitKeys(bool bFlushPending = true);
+};
@@ -0,0 +1,214 @@
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+
+/*
+	Span recorded by a thread
+*/
+struct TraceEvent {
+	const char *m_name;
+	unsigned long long m_start;
+	unsigned long long m_duration;
+};
+
+/*
+	Spans of a single thread. Only its thread adds spans, the mutex is only contended while the trace is written
+*/
+struct TraceBuffer {
+	std::mutex m_mutex;
+
+	// Preallocated spans
+	std::vector<TraceEvent> m_events;
+
+	// Slot of the oldest span
+	size_t m_first;
+
+	// Number of recorded spans
+	size_t m_count;
+
+	// Thread identifier written to the trace
+	unsigned long m_threadId;
+
+	// Thread name written to the trace ( NULL if thread was not named )
+	const char *m_threadName;
+
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	TraceBuffer(unsigned long threadId, const char *threadName) :
+	m_events(TraceRecorder::c_eventsPerThread),
+	m_first(0),
+	m_count(0),
+	m_threadId(threadId),
+	m_threadName(threadName)
+	{
+	}
+};
+
+std::atomic_bool TraceRecorder::s_enabled(false);
+
+// Buffers of every thread that recorded a span. They are never freed, so spans of finished threads are kept
+static std::mutex s_bufferMutex;
+static std::vector<TraceBuffer*> s_buffers;
+
+// Buffer of the calling thread ( NULL until it records its first span )
+static TRACE_THREAD_LOCAL TraceBuffer *t_pBuffer = NULL;
+
+// Name of the calling thread
+static TRACE_THREAD_LOCAL const char *t_threadName = NULL;
+
+
+/// <summary>
+/// Buffer of the calling thread, created the first time it is needed
+/// </summary>
+static TraceBuffer &getBuffer() {
+	TraceBuffer *pBuffer = t_pBuffer;
+	if (!pBuffer) {
+		std::lock_guard<std::mutex> lock(s_bufferMutex);
+#ifdef _WIN32
+		unsigned long threadId = GetCurrentThreadId();
+#else
+		unsigned long threadId = (unsigned long)s_buffers.size() + 1;
+#endif
+		pBuffer = new TraceBuffer(threadId, t_threadName);
+		s_buffers.push_back(pBuffer);
+		t_pBuffer = pBuffer;
+	}
+	return *pBuffer;
+}
+
+
+/// <summary>
+/// Starts or stops recording spans. Spans recorded so far are kept
+/// </summary>
+/// <param name="enabled">Whether spans are recorded</param>
+void TraceRecorder::setEnabled(bool enabled) {
+	s_enabled.store(enabled);
+}
+
+/// <summary>
+/// Names the calling thread in the timeline
+/// </summary>
+/// <param name="name">Thread name ( must outlive the thread, a string literal )</param>
+void TraceRecorder::setThreadName(const char *name) {
+	t_threadName = name;
+
+	// Thread may have recorded spans already
+	TraceBuffer *pBuffer = t_pBuffer;
+	if (pBuffer) {
+		std::lock_guard<std::mutex> lock(pBuffer->m_mutex);
+		pBuffer->m_threadName = name;
+	}
+}
+
+/// <summary>
+/// Records a span of the calling thread
+/// </summary>
+/// <param name="name">Span name ( must outlive the recorder, a string literal )</param>
+/// <param name="start">Start time, from PipelineMetrics::getTime</param>
+/// <param name="duration">Duration, in microseconds</param>
+void TraceRecorder::record(const char *name, unsigned long long start, unsigned long long duration) {
+	TraceBuffer &buffer = getBuffer();
+	TraceEvent event = { name, start, duration };
+
+	std::lock_guard<std::mutex> lock(buffer.m_mutex);
+	if (buffer.m_count < buffer.m_events.size()) {
+		buffer.m_events[(buffer.m_first + buffer.m_count) % buffer.m_events.size()] = event;
+		buffer.m_count++;
+	}
+	else {
+		buffer.m_events[buffer.m_first] = event;
+		buffer.m_first = (buffer.m_first + 1) % buffer.m_events.size();
+	}
+}
+
+/// <summary>
+/// Forgets every recorded span
+/// </summary>
+void TraceRecorder::clear() {
+	std::lock_guard<std::mutex> lock(s_bufferMutex);
+	for (auto pBuffer : s_buffers) {
+		std::lock_guard<std::mutex> bufferLock(pBuffer->m_mutex);
+		pBuffer->m_first = 0;
+		pBuffer->m_count = 0;
+	}
+}
+
+/// <summary>
+/// Number of spans currently recorded, over every thread
+/// </summary>
+size_t TraceRecorder::getEventCount() {
+	size_t count = 0;
+
+	std::lock_guard<std::mutex> lock(s_bufferMutex);
+	for (auto pBuffer : s_buffers) {
+		std::lock_guard<std::mutex> bufferLock(pBuffer->m_mutex);
+		count += pBuffer->m_count;
+	}
+	return count;
+}
+
+/// <summary>
+/// Writes every recorded span as Chrome trace event JSON
+/// </summary>
+/// <param name="fileName">JSON file name</param>
+/// <returns>True if file could be written</returns>
+bool TraceRecorder::writeChromeTrace(const char *fileName) {
+
+	// Written next to the target first, so a previous trace is only replaced by a complete one
+	FbxString tempFileName = FbxString(fileName) + ".tmp";
+
+	FILE *pFile;
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	pFile = fopen(tempFileName.Buffer(), "wb");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+	if (!pFile)
+		return false;
+
+#ifdef _WIN32
+	unsigned long processId = GetCurrentProcessId();
+#else
+	unsigned long processId = 1;
+#endif
+
+	bool success = fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") > 0;
+	bool first = true;
+	{
+		std::lock_guard<std::mutex> lock(s_bufferMutex);
+		for (auto pBuffer : s_buffers) {
+			// Thread keeps recording into its buffer while others are written
+			std::lock_guard<std::mutex> bufferLock(pBuffer->m_mutex);
+
+			if (pBuffer->m_threadName) {
+				fprintf(pFile, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+					first ? "" : ",", processId, pBuffer->m_threadId, pBuffer->m_threadName);
+				first = false;
+			}
+
+			for (size_t i = 0; i < pBuffer->m_count; i++) {
+				const TraceEvent &event = pBuffer->m_events[(pBuffer->m_first + i) % pBuffer->m_events.size()];
+				fprintf(pFile, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%lu,\"tid\":%lu}",
+					first ? "" : ",", event.m_name, event.m_start, event.m_duration, processId, pBuffer->m_threadId);
+				first = false;
+			}
+		}
+	}
+	success = (fprintf(pFile, "\n]}\n") > 0) && success;
+	success = (ferror(pFile) == 0) && success;
+	success = (fclose(pFile) == 0) && success;
+	if (!success)
+		return false;
+
+#ifdef _WIN32
+	return MoveFileExA(tempFileName.Buffer(), fileName, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(tempFileName.Buffer(), fileName) == 0;
+#endif
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "../stdafx.h"
+#include "PipelineMetrics.h"
+
+/*
+	Timeline of pipeline stages, written as Chrome trace events ( open with chrome://tracing or Perfetto ).
+	Every thread records its spans into its own buffer, so recording never contends with other threads.
+	When tracing is disabled a span costs a single flag check
+*/
+
+/*
+	Static class recording trace spans
+*/
+class TraceRecorder {
+public:
+	// Spans kept per thread, the oldest ones are overwritten when a buffer is full
+	static const size_t c_eventsPerThread = 65536;
+
+	/// <summary>
+	/// Starts or stops recording spans. Spans recorded so far are kept
+	/// </summary>
+	/// <param name="enabled">Whether spans are recorded</param>
+	static void setEnabled(bool enabled);
+
+	/// <summary>
+	/// Whether spans are being recorded
+	/// </summary>
+	static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); };
+
+	/// <summary>
+	/// Names the calling thread in the timeline
+	/// </summary>
+	/// <param name="name">Thread name ( must outlive the thread, a string literal )</param>
+	static void setThreadName(const char *name);
+
+	/// <summary>
+	/// Records a span of the calling thread
+	/// </summary>
+	/// <param name="name">Span name ( must outlive the recorder, a string literal )</param>
+	/// <param name="start">Start time, from PipelineMetrics::getTime</param>
+	/// <param name="duration">Duration, in microseconds</param>
+	static void record(const char *name, unsigned long long start, unsigned long long duration);
+
+	/// <summary>
+	/// Forgets every recorded span
+	/// </summary>
+	static void clear();
+
+	/// <summary>
+	/// Writes every recorded span as Chrome trace event JSON
+	/// </summary>
+	/// <param name="fileName">JSON file name</param>
+	/// <returns>True if file could be written</returns>
+	static bool writeChromeTrace(const char *fileName);
+
+	/// <summary>
+	/// Number of spans currently recorded, over every thread
+	/// </summary>
+	static size_t getEventCount();
+
+private:
+	// Whether spans are being recorded
+	static std::atomic_bool s_enabled;
+};
+
+/*
+	Records the time spent in a scope as a trace span. Nothing is measured when tracing is disabled
+*/
+class TraceScope {
+public:
+	/// <summary>
+	/// Constructor, starts the span
+	/// </summary>
+	/// <param name="name">Span name ( must outlive the recorder, a string literal )</param>
+	TraceScope(const char *name) :
+	m_name(TraceRecorder::isEnabled() ? name : NULL),
+	m_start(m_name ? PipelineMetrics::getTime() : 0)
+	{
+	}
+
+	/// <summary>
+	/// Destructor, records the span
+	/// </summary>
+	~TraceScope() {
+		if (m_name)
+			TraceRecorder::record(m_name, m_start, PipelineMetrics::getTime() - m_start);
+	}
+
+private:
+	const char *m_name;
+	unsigned long long m_start;
+};
+
+// Records the rest of the enclosing scope as a span
+#define TRACE_SCOPE_JOIN2(a, b) a##b
+#define TRACE_SCOPE_JOIN(a, b) TRACE_SCOPE_JOIN2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_JOIN(traceScope, __LINE__)(name)
@@ -5,20 +5,25 @@
 
 #pragma once
 
+#ifdef _WIN32
 #pragma comment(lib,"libfbxsdk.lib")
 #pragma comment(lib,"kinect20.lib")
-
-#include <windows.h>
+#endif
 
 // C++ STD header Files
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 #include <chrono>
 #include <memory>
 #include <vector>
+#include <unordered_map>
 
 
 // Reference additional headers your program requires here
-#include <Kinect.h>
+// ( Kinect SDK on Windows, plain definitions of its types elsewhere )
+#include "kinect2fbx/KinectTypes.h"
 #include <fbxsdk.h>
 
 
@@ -53,6 +53,39 @@ void CreateUIControls(HWND hWndParent);
 
 static bool gAutoQuit = false;
 
+// Window was closed while scenes were still being saved
+static bool gClosePending = false;
+
+// Queued log lines are shown this often, in milliseconds
+static const UINT c_logFlushInterval = 100;
+// At most this many log lines are shown each time
+static const unsigned int c_logMaxLinesPerFlush = 64;
+// Log file, next to the executable
+static const char *c_logFileName = "KinectAnimationStudio.log";
+// Log file is rotated when it reaches this size, in bytes
+static const long c_logFileMaxSize = 1024 * 1024;
+
+// Pipeline metrics are written this often, in milliseconds
+static const UINT c_metricsInterval = 5000;
+// Metrics snapshot, next to the executable
+static const char *c_metricsFileName = "KinectAnimationStudio.metrics.json";
+static char gszMetricsFile[_MAX_PATH];
+
+// Spare skeletons bound to new bodies are replaced this often, in milliseconds
+static const UINT c_spareSkeletonInterval = 1000;
+
+// Timeline of pipeline stages, next to the executable ( Chrome trace events )
+static const char *c_traceFileName = "KinectAnimationStudio.trace.json";
+
+/// <summary>
+/// Forwards a save notification to the UI thread ( the saver must never wait for the UI )
+/// </summary>
+static void PostSaveMessage(UINT message, WPARAM wParam, const char *fileName) {
+	char *fileNameCopy = _strdup(fileName);
+	if (!ghWnd || !PostMessage(ghWnd, message, wParam, (LPARAM)fileNameCopy))
+		free(fileNameCopy);
+}
+
 // entry point for the application
 int APIENTRY _tWinMain(
                        HINSTANCE hInstance,
@@ -201,6 +234,21 @@ LRESULT CALLBACK WndProc(
     case WM_CREATE:
 	{
             CreateUIControls(hWnd);
+
+			TraceRecorder::setThreadName("UI");
+
+			// Log lines can be queued by any thread, they are shown ( and written to file ) from here
+			char logFile[_MAX_PATH];
+			GetLocalFile(c_logFileName, logFile, sizeof(logFile));
+			UI_OpenLogFile(logFile, c_logFileMaxSize);
+			SetTimer(hWnd, LOG_TIMER_ID, c_logFlushInterval, NULL);
+
+			// Pipeline metrics are written as JSON, so they can be read while the application runs
+			GetLocalFile(c_metricsFileName, gszMetricsFile, sizeof(gszMetricsFile));
+			SetTimer(hWnd, METRICS_TIMER_ID, c_metricsInterval, NULL);
+
+			// Skeletons of bodies entering a take are built here, rather than by the frame worker
+			SetTimer(hWnd, SKELETON_TIMER_ID, c_spareSkeletonInterval, NULL);
 			
 			// Initalize FBX SDK Manager
 			InitializeSdkManager();
@@ -208,8 +256,13 @@ LRESULT CALLBACK WndProc(
 			// Initialize Kinect Sensor
 			InitializeDefaultSensor(&gKinectSensor);
 
-			// Associate the Kinect Exporter with the FBX SDK mmanager
-			kExporter->initFBXSDKManager(gSdkManager);
+			// Takes are saved in the background, report on them from the UI thread
+			kExporter->getSaver().setProgressCallback([](const char *fileName, int percentage) {
+				PostSaveMessage(WM_SAVE_PROGRESS, (WPARAM)percentage, fileName);
+			});
+			kExporter->getSaver().setCompletionCallback([](const char *fileName, bool success) {
+				PostSaveMessage(WM_SAVE_COMPLETED, (WPARAM)success, fileName);
+			});
 
 			// Associate frame reader Kinect frame processor
 			kFrameProcessor.init(gKinectSensor);
@@ -245,9 +298,77 @@ LRESULT CALLBACK WndProc(
             break;
 
         case IDM_EXIT:
-            DestroyWindow(hWnd);
+            PostMessage(hWnd, WM_CLOSE, 0, 0);
             break;
 
+		case IDM_TRACE_RECORD:
+			// Every recording starts a new timeline
+			if (!TraceRecorder::isEnabled())
+				TraceRecorder::clear();
+			TraceRecorder::setEnabled(!TraceRecorder::isEnabled());
+			CheckMenuItem(GetMenu(hWnd), IDM_TRACE_RECORD, MF_BYCOMMAND | (TraceRecorder::isEnabled() ? MF_CHECKED : MF_UNCHECKED));
+			UI_Printf(TraceRecorder::isEnabled() ? "Timeline recording started" : "Timeline recording stopped");
+			break;
+
+		case IDM_RESAMPLE_30FPS:
+		{
+			// Takes started from now on get a key on every frame, at the frame rate of the sensor
+			PostProcessingSettings filterSettings = kExporter->getSaver().getFilterSettings();
+			bool bResample = filterSettings.m_resampleMode == FbxTime::eDefaultMode;
+			filterSettings.m_resampleMode = bResample ? FbxTime::eFrames30 : FbxTime::eDefaultMode;
+			kExporter->getSaver().setFilterSettings(filterSettings);
+			CheckMenuItem(GetMenu(hWnd), IDM_RESAMPLE_30FPS, MF_BYCOMMAND | (bResample ? MF_CHECKED : MF_UNCHECKED));
+			UI_Printf(bResample ? "Resampling to 30 fps enabled" : "Resampling disabled");
+			break;
+		}
+
+		case IDM_REDUCE_KEYS:
+		{
+			// Default tolerances, keys are removed from takes started from now on
+			PostProcessingSettings filterSettings = kExporter->getSaver().getFilterSettings();
+			filterSettings.m_bReduceKeys = !filterSettings.m_bReduceKeys;
+			kExporter->getSaver().setFilterSettings(filterSettings);
+			CheckMenuItem(GetMenu(hWnd), IDM_REDUCE_KEYS, MF_BYCOMMAND | (filterSettings.m_bReduceKeys ? MF_CHECKED : MF_UNCHECKED));
+			UI_Printf(filterSettings.m_bReduceKeys ? "Key reduction enabled ( %g degrees, %g units )" : "Key reduction disabled",
+				filterSettings.m_reductionAngleTolerance, filterSettings.m_reductionPositionTolerance);
+			break;
+		}
+
+		case IDM_SMOOTH_JOINTS:
+		{
+			// Default parameters, used by takes started from now on
+			JointFilterSettings jointFiltering = kExporter->getJointFilterSettings();
+			jointFiltering.m_bEnabled = !jointFiltering.m_bEnabled;
+			kExporter->setJointFilterSettings(jointFiltering);
+			CheckMenuItem(GetMenu(hWnd), IDM_SMOOTH_JOINTS, MF_BYCOMMAND | (jointFiltering.m_bEnabled ? MF_CHECKED : MF_UNCHECKED));
+			UI_Printf(jointFiltering.m_bEnabled ? "Joint smoothing enabled from the next take" : "Joint smoothing disabled from the next take");
+			break;
+		}
+
+		case IDM_ADAPTIVE_KEYING:
+		{
+			// Default tolerances, used by takes started from now on
+			KeyingSettings keying = kExporter->getKeyingSettings();
+			keying.m_bAdaptive = !keying.m_bAdaptive;
+			kExporter->setKeyingSettings(keying);
+			CheckMenuItem(GetMenu(hWnd), IDM_ADAPTIVE_KEYING, MF_BYCOMMAND | (keying.m_bAdaptive ? MF_CHECKED : MF_UNCHECKED));
+			UI_Printf(keying.m_bAdaptive ? "Adaptive keying enabled from the next take ( %g degrees, %g units )" : "Adaptive keying disabled from the next take",
+				keying.m_angleTolerance, keying.m_positionTolerance);
+			break;
+		}
+
+		case IDM_TRACE_SAVE:
+		{
+			char traceFile[_MAX_PATH];
+			GetLocalFile(c_traceFileName, traceFile, sizeof(traceFile));
+			size_t spanCount = TraceRecorder::getEventCount();
+			if (TraceRecorder::writeChromeTrace(traceFile))
+				UI_Printf("Timeline ( %u spans ) saved to %s", (unsigned int)spanCount, traceFile);
+			else
+				UI_Printf("Could not save timeline to %s", traceFile);
+			break;
+		}
+
         case EXPORT_TO_BUTTON:
 			GetOutputFileName(hWnd, gszOutputFile);
 			kExporter->setExportFile(gszOutputFile);
@@ -268,8 +389,54 @@ LRESULT CALLBACK WndProc(
         }
         break;
 
+    case WM_TIMER:
+		if (wParam == LOG_TIMER_ID)
+			UI_FlushLog(c_logMaxLinesPerFlush);
+		else if (wParam == METRICS_TIMER_ID)
+			PipelineMetrics::writeSnapshot(gszMetricsFile);
+		else if (wParam == SKELETON_TIMER_ID)
+			kExporter->prepareSpareSkeletons();
+		break;
+
+    case WM_SAVE_PROGRESS:
+		UI_Printf("Saving %s: %d%%", (char*)lParam, (int)wParam);
+		free((void*)lParam);
+		break;
+
+    case WM_SAVE_COMPLETED:
+		if (wParam)
+			UI_Printf("Scene has been saved to file %s", (char*)lParam);
+		else
+			UI_Printf("Could not save scene to file %s", (char*)lParam);
+		free((void*)lParam);
+
+		// Window was only waiting for this
+		if (gClosePending && kExporter->getSaver().getPendingCount() == 0)
+			DestroyWindow(hWnd);
+		break;
+
+    case WM_CLOSE:
+		// Current take is saved as well
+		if (kExporter->recordingStatus()) {
+			UI_Printf("Recording has been disabled");
+			kExporter->stopRecording();
+		}
+
+		// Do not lose any take still being saved
+		if (kExporter->getSaver().getPendingCount() > 0) {
+			UI_Printf("Waiting for %u scenes to be saved before closing", kExporter->getSaver().getPendingCount());
+			gClosePending = true;
+			break;
+		}
+
+		DestroyWindow(hWnd);
+		break;
+
     case WM_DESTROY:
 
+		// Stop drawing while the view window still exists
+		kVisualizer->detach();
+
         // dont forget to delete the SdkManager 
         // and all objects created by the SDK manager
         DestroySdkObjects(gSdkManager, true);
@@ -277,6 +444,16 @@ LRESULT CALLBACK WndProc(
 		// Close Kinect Sensor
 		CloseDefaultSensor(gKinectSensor);
 
+		KillTimer(hWnd, SKELETON_TIMER_ID);
+
+		// Last metrics snapshot
+		KillTimer(hWnd, METRICS_TIMER_ID);
+		PipelineMetrics::writeSnapshot(gszMetricsFile);
+
+		// Anything still queued goes to the log file
+		KillTimer(hWnd, LOG_TIMER_ID);
+		UI_CloseLogFile();
+
         PostQuitMessage(0);
         break;
 
@@ -12,3 +12,17 @@
 #include "..\kinect\KBodyExporter.h"
 
 
+// Posted on behalf of the background saver ( lParam is the file name, freed by the receiver )
+#define WM_SAVE_PROGRESS	(WM_APP + 1)	// wParam: percentage
+#define WM_SAVE_COMPLETED	(WM_APP + 2)	// wParam: whether scene was saved
+
+// Timer showing queued log lines
+#define LOG_TIMER_ID		1
+
+// Timer writing pipeline metrics
+#define METRICS_TIMER_ID	2
+
+// Timer replacing spare skeletons used by the take being recorded
+#define SKELETON_TIMER_ID	3
+
+
@@ -8,6 +8,12 @@
 #define IDD_ABOUTBOX                    103
 #define IDM_ABOUT                       104
 #define IDM_EXIT                        105
+#define IDM_TRACE_RECORD                32771
+#define IDM_TRACE_SAVE                  32772
+#define IDM_REDUCE_KEYS                 32773
+#define IDM_ADAPTIVE_KEYING             32774
+#define IDM_RESAMPLE_30FPS              32775
+#define IDM_SMOOTH_JOINTS               32776
 #define IDI_UI                          107
 #define IDC_UI                          109
 #define IDR_MAINFRAME                   128
@@ -22,7 +28,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        130
-#define _APS_NEXT_COMMAND_VALUE         32771
+#define _APS_NEXT_COMMAND_VALUE         32777
 #define _APS_NEXT_CONTROL_VALUE         1000
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
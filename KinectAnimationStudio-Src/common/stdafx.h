@@ -28,6 +28,9 @@
 #include <exception>
 #include <future>
 #include <vector>
+#include <deque>
+#include <functional>
+#include <condition_variable>
 
 
 //Additional program headers
@@ -4,18 +4,18 @@
 /// <summary>
 /// Constructor
 /// </summary>
-KBodyExporter::KBodyExporter(IKinectSensor *kSensor, FbxManager *fManager) :
+KBodyExporter::KBodyExporter(IKinectSensor *kSensor) :
 m_pIsRecording(false),
-m_pFBXManager(NULL),
+m_pTakeManager(NULL),
 m_lScene(NULL),
 m_nRecordCount(0),
-m_initTime(0),
+m_mappingWorkers(MappingWorkerPool::getDefaultWorkerCount(BODY_COUNT)),
 m_exportFileName(NULL),
+m_preRoll(c_preRollSeconds * c_KinectFPS),
+m_bPreRollPending(false),
 KBodyReader(kSensor)
 {
-	if (fManager) {
-		initFBXSDKManager(fManager);
-	}
+	m_session.m_pWorkers = &m_mappingWorkers;
 }
 
 /// <summary>
@@ -23,44 +23,119 @@ KBodyReader(kSensor)
 /// </summary>
 KBodyExporter::~KBodyExporter() {
 
+	// Stop journaling, before anything else is released
+	m_journal.close();
+
+	// output any frame to file ( saver finishes it before being destroyed )
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+	m_pIsRecording = false;
+	flushScene();
+
 	// Clear export file name
 	if (m_exportFileName) {
 		free(m_exportFileName);
 		m_exportFileName = NULL;
 	}
-
-	// output any frame to file
-	flushScene();
 }
 
 /// <summary>
 /// Starts recording Skeleton Data to FBX
 /// </summary>
 void KBodyExporter::startRecording() {
-	m_pIsRecording = true;
 
+	std::lock_guard<std::mutex> lock(m_takeMutex);
 
-	// Create a scene
-	m_lScene = FbxScene::Create(m_pFBXManager, "");
+	// Already recording, the current take is finished first
+	if (m_pIsRecording) {
+		m_pIsRecording = false;
+		m_journal.close();
+		flushScene();
+	}
 
-	// Create Animation Stack
-	FbxAnimStack* lAnimStack = FbxAnimStack::Create(m_lScene, "Base animation");
+	// Create a scene, with its animation stack and layer. It gets its own manager, so it can be saved while the next take is recorded
+	m_pTakeManager = CreateSdkManager();
+	m_lScene = CreateAnimationScene(m_pTakeManager);
 
-	// The animation nodes can only exist on AnimLayers therefore it is mandatory to
-	// add at least one AnimLayer to the AnimStack. And for the purpose of this example,
-	// one layer is all we need.
-	FbxAnimLayer* lAnimLayer = FbxAnimLayer::Create(m_lScene, "Base Layer");
-	lAnimStack->AddMember(lAnimLayer);
+	// Settings are fixed for the whole take, so its journal can rebuild it exactly
+	m_takeSettings.m_keying = m_keying;
+	m_takeSettings.m_jointFilter = m_jointFilterSettings;
+	m_takeSettings.m_postProcessing = m_saver.getFilterSettings();
+
+	// Every take starts from scratch, so it can be replayed from its own journal
+	m_nRecordCount = 0;
+	m_session.reset(m_lScene);
+	m_session.m_keying = m_takeSettings.m_keying;
+	m_session.m_jointFilter.setSettings(m_takeSettings.m_jointFilter);
+
+	// Bodies get a skeleton that is already in the scene, so their first frame is mapped as fast as any other
+	KinectSkeletonMapper::prepareSpareSkeletons(m_session, c_spareSkeletonCount);
+
+	// Frames received before now are added by the frame worker, ahead of the next one
+	m_bPreRollPending = true;
+
+	// Journal every frame of the take, so it survives a crash before the scene is saved
+	FbxString journalFile = getCaptureJournalFileName(getExportFileName());
+	if (!m_journal.open(journalFile.Buffer(), m_takeSettings))
+		UI_Printf("Could not create capture journal %s", journalFile.Buffer());
+
+	m_pIsRecording = true;
 };
 
+/// <summary>
+/// Sets how keys are added to takes, from the next take on
+/// </summary>
+void KBodyExporter::setKeyingSettings(const KeyingSettings &keying) {
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+	m_keying = keying;
+}
+
+/// <summary>
+/// Returns how keys are added to takes started from now on
+/// </summary>
+KeyingSettings KBodyExporter::getKeyingSettings() {
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+	return m_keying;
+}
+
+/// <summary>
+/// Sets how joints are smoothed before they are keyed, from the next take on
+/// </summary>
+void KBodyExporter::setJointFilterSettings(const JointFilterSettings &settings) {
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+	m_jointFilterSettings = settings;
+}
+
+/// <summary>
+/// Returns how joints are smoothed in takes started from now on
+/// </summary>
+JointFilterSettings KBodyExporter::getJointFilterSettings() {
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+	return m_jointFilterSettings;
+}
+
 /// <summary>
 /// Stops recording Skeleton Data to FBX
 /// </summary>
 void KBodyExporter::stopRecording() {
+
+	// Wait for the frame being mapped, if any
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+
 	// Stop Recording
 	m_pIsRecording = false;
 
-	// Save scene
+	// Commit remaining frames to the journal
+	if (m_journal.isOpen()) {
+		m_journal.close();
+		FbxString journalFile = getCaptureJournalFileName(getExportFileName());
+		if (m_journal.hasFailed())
+			UI_Printf("Capture journal %s is incomplete: %u frames journaled, %u could not be written", journalFile.Buffer(),
+				m_journal.getCommittedFrameCount(), m_journal.getLostFrameCount());
+		else
+			UI_Printf("%u frames journaled to %s", m_journal.getCommittedFrameCount(), journalFile.Buffer());
+	}
+
+	// Save scene, in the background
 	flushScene();
 };
 
@@ -80,15 +155,30 @@ void KBodyExporter::setExportFile(char *fieName) {
 /// <summary>
 /// Notify class about a frame that arrived
 /// </summary>
-/// <param name="bFrame">Incoming frame</param>
-/// <param name="frameTime">Frame timestamp</param>
-void KBodyExporter::notify(IBodyFrame *bFrame, INT64 frameTime) {
-	// Not recording, ignore frame
-	if (!m_pIsRecording)
+/// <param name="bFrame">Decoded incoming frame</param>
+void KBodyExporter::notify(const BodyFrame_ptr &bFrame) {
+	// Not recording, keep frame in case recording starts soon
+	if (!m_pIsRecording) {
+		m_preRoll.push(*bFrame);
+		return;
+	}
+
+	// Take cannot be handed over while a frame is being added to it
+	std::lock_guard<std::mutex> lock(m_takeMutex);
+	if (!m_pIsRecording) {
+		m_preRoll.push(*bFrame);
 		return;
+	}
+
+	// Take has just started, frames received before are added first
+	if (m_bPreRollPending)
+		addPreRollToScene(*bFrame);
 
 	// Use the general notifier first, it will save the bodies of the current frame
-	KBodyReader::notify(bFrame, frameTime);
+	KBodyReader::notify(bFrame);
+
+	// Journal frame before mapping it ( writing happens in the background )
+	m_journal.append(bFrame);
 
 
 	// Take each one of the bodies that has been read, and add them to the scene
@@ -96,7 +186,7 @@ void KBodyExporter::notify(IBodyFrame *bFrame, INT64 frameTime) {
 }
 
 /// <summary>
-/// Save anything that has been recorded so far to output file
+/// Hands anything that has been recorded so far to the background saver. Take lock must be held
 /// </summary>
 void KBodyExporter::flushScene() {
 
@@ -104,67 +194,93 @@ void KBodyExporter::flushScene() {
 	if (!m_lScene)
 		return;
 
+	// Time the frame worker or the UI is kept waiting
+	MetricTimer timer(MetricHistogram_FlushSceneTime);
+
 
 	// Only save if at least one frame has been read, otherwise the FBX would be an empty scene
 	if (m_nRecordCount > 0) {
 
-		// Apply post processing filters
-		KinectSkeletonMapper::applyPostProcessingFilters(m_lScene);
+		// Keys still buffered by the mapper go to their curves first
+		m_session.commitKeys();
+
+		// Only skeletons of bodies that have been seen are saved
+		KinectSkeletonMapper::removeSpareSkeletons(m_session);
 
 		// Get File Format
-		int lFileFormat = m_pFBXManager->GetIOPluginRegistry()->FindReaderIDByDescription(c_FBXBinaryFileDesc);
+		int lFileFormat = m_pTakeManager->GetIOPluginRegistry()->FindReaderIDByDescription(c_FBXBinaryFileDesc);
 
 		// Define export file name ( If user did not define it, use a default file name )
-		const char *outputFile;
-		if (m_exportFileName)
-			outputFile = m_exportFileName;
-		else
-			outputFile = c_defaultExportFileName;
+		const char *outputFile = getExportFileName();
 
-		SaveScene(m_pFBXManager, m_lScene, outputFile, lFileFormat, false);
+		// Filters and file writing happen in the background. Saver now owns the scene and its manager
+		m_saver.queue(m_pTakeManager, m_lScene, outputFile, lFileFormat, m_takeSettings.m_postProcessing);
 
 		// Warn the user about the file
-		UI_Printf("Scene has been saved to file %s", outputFile);
+		UI_Printf("Saving %u frames to file %s", m_nRecordCount, outputFile);
+	}
+	else {
+		DestroySdkObjects(m_pTakeManager, false);
 	}
 
-	// Scene has been saved (or not), now clean it up
-	m_lScene->Destroy();
+	// Scene has been handed over (or not), a new take can start right away
+	m_session.reset(NULL);
+	m_pTakeManager = NULL;
 	m_lScene = NULL;
 };
 
+/// <summary>
+/// Adds the frames received shortly before recording started to the current take. Take lock must be held
+/// </summary>
+/// <param name="bFrame">First frame received while recording</param>
+void KBodyExporter::addPreRollToScene(const BodyFrame &bFrame) {
+
+	m_bPreRollPending = false;
+
+	// Frames older than the pre-roll duration are left out ( Kinect time is in 100ns increments )
+	unsigned int nPreRollFrames = KinectSkeletonMapper::mapPreRoll(m_session, m_preRoll, bFrame, (INT64)c_preRollSeconds * 10000000, &m_journal);
+	m_nRecordCount += nPreRollFrames;
+
+	if (nPreRollFrames > 0)
+		UI_Printf("%u frames recorded before start were added to the take", nPreRollFrames);
+}
+
 /// <summary>
 /// Save bodies of the current frame to the scene
 /// </summary>
 void KBodyExporter::addBodiesToScene() {
 
-
-	// If failed to read bodies for the last frame, just skip everything
-	if (!m_pBodyReadStatus)
+	if (!m_latestFrame)
 		return;
 
+	TRACE_SCOPE("add_bodies_to_scene");
 
-	// Process each body individually
-	for (int i = 0; i < BODY_COUNT; ++i)
-	{
-		IBody* pBody = m_ppBodies[i];
-		if (pBody)
-		{
-			BOOLEAN isTracked;
-			HRESULT hr =  pBody->get_IsTracked(&isTracked);
-
+	// Map every tracked body ( frames that failed to be read are skipped )
+	if (KinectSkeletonMapper::mapFrame(m_session, *m_latestFrame)) {
+		// Update frame count
+		m_nRecordCount++;
+	}
+};
 
-			if (SUCCEEDED(hr) && isTracked) {
-				// Kinect clock works in increments of 100ns. Who the hell needs documentation, let people figure it out.
-				INT64 timeMS = m_tlatestFrameTime / 10000;
+/// <summary>
+/// Replaces spare skeletons bound to bodies since the take started. Skipped if the frame worker is using the take, so the caller never waits
+/// </summary>
+void KBodyExporter::prepareSpareSkeletons() {
 
-				if (m_initTime == 0)
-					m_initTime = timeMS;
+	std::unique_lock<std::mutex> lock(m_takeMutex, std::try_to_lock);
+	if (!lock.owns_lock() || !m_pIsRecording)
+		return;
 
-				KinectSkeletonMapper::map(m_lScene, timeMS - m_initTime + 1, pBody);
-			}
-		}
-	}
+	KinectSkeletonMapper::prepareSpareSkeletons(m_session, c_spareSkeletonCount);
+}
 
-	// Update frame count
-	m_nRecordCount++;
-};
\ No newline at end of file
+/// <summary>
+/// Returns the file the scene will be saved to
+/// </summary>
+const char *KBodyExporter::getExportFileName() {
+	// If user did not define it, use a default file name
+	if (m_exportFileName)
+		return m_exportFileName;
+	else
+		return c_defaultExportFileName;
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "..\common\stdafx.h"
 #include "KBodyReader.h"
+#include "KSceneSaver.h"
 
 class KBodyExporter : public KBodyReader {
 public:
@@ -10,7 +11,7 @@ public:
 	/// <summary>
 	/// Constructor
 	/// </summary>
-	KBodyExporter(IKinectSensor *kSensor = NULL, FbxManager *fManager = NULL);
+	KBodyExporter(IKinectSensor *kSensor = NULL);
 
 	/// <summary>
 	/// Destructor
@@ -18,24 +19,43 @@ public:
 	~KBodyExporter();
 
 
-	/// <summary>
-	/// Sets SDK Manager
-	/// </summary>
-	/// <param name="fManager">SDK manager to be set</param>
-	void initFBXSDKManager(FbxManager *fManager) {
-		m_pFBXManager = fManager;
-	}
-
 	/// <summary>
 	/// Starts recording Skeleton Data to FBX
 	/// </summary>
 	void startRecording(); 
 
 	/// <summary>
-	/// Stops recording Skeleton Data to FBX
+	/// Stops recording Skeleton Data to FBX. The take is saved in the background
 	/// </summary>
 	void stopRecording();
 
+	/// <summary>
+	/// Background saver of finished takes
+	/// </summary>
+	KSceneSaver &getSaver() { return m_saver; };
+
+	/// <summary>
+	/// Sets how keys are added to takes, from the next take on
+	/// </summary>
+	/// <param name="keying">Keying of the next takes</param>
+	void setKeyingSettings(const KeyingSettings &keying);
+
+	/// <summary>
+	/// Returns how keys are added to takes started from now on
+	/// </summary>
+	KeyingSettings getKeyingSettings();
+
+	/// <summary>
+	/// Sets how joints are smoothed before they are keyed, from the next take on
+	/// </summary>
+	/// <param name="settings">Joint smoothing of the next takes</param>
+	void setJointFilterSettings(const JointFilterSettings &settings);
+
+	/// <summary>
+	/// Returns how joints are smoothed in takes started from now on
+	/// </summary>
+	JointFilterSettings getJointFilterSettings();
+
 
 	/// <summary>
 	/// Returns whether we are currently recording the skeletons
@@ -45,9 +65,8 @@ public:
 	/// <summary>
 	/// Notify class about a frame that arrived
 	/// </summary>
-	/// <param name="bFrame">Incoming frame</param>
-	/// <param name="frameTime">Frame timestamp</param>
-	virtual void notify(IBodyFrame *bFrame, INT64 frameTime);
+	/// <param name="bFrame">Decoded incoming frame</param>
+	virtual void notify(const BodyFrame_ptr &bFrame);
 
 	/// <summary>
 	/// Sets export file, which will be overwritten
@@ -61,6 +80,11 @@ public:
 	/// </summary>
 	void addBodiesToScene();
 
+	/// <summary>
+	/// Replaces spare skeletons bound to bodies since the take started. Skipped if the frame worker is using the take, so the caller never waits
+	/// </summary>
+	void prepareSpareSkeletons();
+
 private:
 
 	// Constants
@@ -68,18 +92,25 @@ private:
 	const char *c_FBXBinaryFileDesc = "FBX binary(*.fbx)";
 	// Kinect FPS ( Kinect V2 records at 30fps )
 	const int c_KinectFPS = 30;
+	// Seconds of frames kept before recording starts, and added to the take
+	const int c_preRollSeconds = 10;
+	// Skeletons built ahead of time, one for every body the sensor can track
+	const unsigned int c_spareSkeletonCount = BODY_COUNT;
 
 
 	// Variables
 
-	bool m_pIsRecording;
+	std::atomic_bool m_pIsRecording;
 
-	// FBX SDK Manager
-	FbxManager *m_pFBXManager;
+	// FBX SDK Manager of the current take ( every take has its own, so it can be saved in the background )
+	FbxManager *m_pTakeManager;
 
-	// FBX Scene - We only export one scene at a time
+	// FBX Scene - We only record one scene at a time
 	FbxScene* m_lScene;
 
+	// Protects the current take, which is mapped by the frame worker and handed over by the UI
+	std::mutex m_takeMutex;
+
 	// Frame Event Listener
 	WAITABLE_HANDLE m_hFrameEvent;
 
@@ -87,23 +118,58 @@ private:
 	// Number of frames processed for current scene
 	unsigned int m_nRecordCount;
 
-	// Initial timestamp
-	INT64 m_initTime;
+	// Skeletons and initial timestamp of the current take
+	MappingSession m_session;
+
+	// Map the bodies of a frame in parallel, for every take
+	MappingWorkerPool m_mappingWorkers;
+
+	// Keying of the next take ( the current one keeps the keying it started with )
+	KeyingSettings m_keying;
+
+	// Joint smoothing of the next take
+	JointFilterSettings m_jointFilterSettings;
+
+	// Settings the current take was started with, journaled with it and used to save it
+	CaptureJournalSettings m_takeSettings;
 
 
 	// Export file
 	char *m_exportFileName;
 
+	// Journal of the frames of the current take
+	CaptureJournalWriter m_journal;
+
+	// Latest frames received while not recording. Only used by the frame worker
+	KPreRollBuffer m_preRoll;
+
+	// Whether buffered frames still have to be added to the take that just started
+	bool m_bPreRollPending;
+
+	// Saves finished takes ( pending saves are completed when the exporter is destroyed )
+	KSceneSaver m_saver;
+
+	/// <summary>
+	/// Returns the file the scene will be saved to
+	/// </summary>
+	const char *getExportFileName();
+
 	/// <summary>
 	/// Keep reading new frames to be added to the scene
 	/// </summary>
 	void InternalFrameProcessingThread();
 
 	/// <summary>
-	/// Save anything that has been recorded so far to output file
+	/// Hands anything that has been recorded so far to the background saver. Take lock must be held
 	/// </summary>
 	void flushScene();
 
+	/// <summary>
+	/// Adds the frames received shortly before recording started to the current take. Take lock must be held
+	/// </summary>
+	/// <param name="bFrame">First frame received while recording</param>
+	void addPreRollToScene(const BodyFrame &bFrame);
+
 
 
 };
\ No newline at end of file
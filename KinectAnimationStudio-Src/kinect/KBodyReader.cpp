@@ -5,18 +5,11 @@
 /// </summary>
 KBodyReader::KBodyReader(IKinectSensor *kSensor) :
 m_pCoordinateMapper(NULL),
-m_pBodyReadStatus(false),
 m_nPreviousFrameTime(0),
 _m_pbodyUpdateMutex(NULL)
 {
 	// Allocate new mutex, necessary for synchronizing multiple readers
 	_m_pbodyUpdateMutex = new std::timed_mutex;
-
-	// Clear body data
-	for (int i = 0; i < _countof(m_ppBodies); ++i)
-	{
-		m_ppBodies[i] = nullptr;
-	}
 }
 
 /// <summary>
@@ -24,11 +17,6 @@ _m_pbodyUpdateMutex(NULL)
 /// </summary>
 KBodyReader::~KBodyReader() {
 
-	for (int i = 0; i < _countof(m_ppBodies); ++i)
-	{
-		SafeRelease(m_ppBodies[i]);
-	}
-
 	// Finalize lock
 	if ( _m_pbodyUpdateMutex ) 
 		delete _m_pbodyUpdateMutex;
@@ -38,9 +26,10 @@ KBodyReader::~KBodyReader() {
 /// <summary>
 /// Notify class about a frame that arrived
 /// </summary>
-/// <param name="bFrame">Incoming frame</param>
-void  KBodyReader::notify(IBodyFrame *bFrame, INT64 frameTime) {
-	HRESULT hr;
+/// <param name="bFrame">Decoded incoming frame</param>
+void  KBodyReader::notify(const BodyFrame_ptr &bFrame) {
+
+	TRACE_SCOPE("body_reader_notify");
 
 	// Lock mutex when running this method
 	std::unique_lock<std::timed_mutex> lockB(*_m_pbodyUpdateMutex, std::defer_lock);
@@ -49,12 +38,7 @@ void  KBodyReader::notify(IBodyFrame *bFrame, INT64 frameTime) {
 
 	
 	// ___ Entering sensitive area
-	m_tlatestFrameTime = frameTime;
-	hr = bFrame->GetAndRefreshBodyData(_countof(m_ppBodies), m_ppBodies);
-	if (SUCCEEDED(hr))
-		m_pBodyReadStatus = true;
-	else
-		m_pBodyReadStatus = false;
+	m_latestFrame = bFrame;
 	// ___ Leaving sensitive area
 
-}
\ No newline at end of file
+}
@@ -4,7 +4,7 @@
 
 
 // Main class that processes Skeleton data
-class KBodyReader {
+class KBodyReader : public FrameSubscriber {
 
 public:
 	/// <summary>
@@ -23,9 +23,8 @@ public:
 	/// <summary>
 	/// Notify class about a frame that arrived
 	/// </summary>
-	/// <param name="bFrame">Incoming frame</param>
-	/// <param name="frameTime">Incoming frame time</param>
-	virtual void  notify(IBodyFrame *bFrame, INT64 frameTime = 0);
+	/// <param name="bFrame">Decoded incoming frame</param>
+	virtual void  notify(const BodyFrame_ptr &bFrame);
 
 	/// <summary>
 	/// Sets coordinate mapper
@@ -38,21 +37,15 @@ protected:
 	// Coordinate Mapper
 	ICoordinateMapper*      m_pCoordinateMapper;
 
-	// Body Array
-	IBody* m_ppBodies[BODY_COUNT];
+	// Latest frame received ( NULL until the first frame arrives )
+	BodyFrame_ptr m_latestFrame;
 
 	// Body update mutex
 	std::timed_mutex *_m_pbodyUpdateMutex;
 
-	// Latest frame time
-	INT64 m_tlatestFrameTime;
-
 	// Frame time of the previously processed frame
 	INT64 m_nPreviousFrameTime;
 
-	// Body Read Status
-	bool m_pBodyReadStatus;
-
 
 
-};
\ No newline at end of file
+};
@@ -1,6 +1,8 @@
 #include "KBodyVisualizer.h"
 #include "..\common\stdafx.h"
 #include <strsafe.h>
+#include <math.h>
+#include <limits>
 
 /// <summary>
 /// Constructor
@@ -21,8 +23,19 @@ m_pBrushJointInferred(NULL),
 m_pBrushJointTracked(NULL),
 m_redBrush(NULL),
 m_pTextFormat(NULL),
+m_hRedrawEvent(NULL),
+m_bIntrinsicsChecked(false),
+m_bUseIntrinsics(false),
+m_bRedraw(false),
+m_quit(false),
+m_nReceived(0),
+m_nDrawn(0),
+m_nNotifyTotal(0),
+m_nNotifyMax(0),
 KBodyReader(kSensor)
 {
+	// Auto-reset event, so the render thread can sleep while there is nothing new to draw
+	m_hRedrawEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 
 	HRESULT hr = D2D1CreateFactory(
 		D2D1_FACTORY_TYPE_SINGLE_THREADED,
@@ -55,6 +68,14 @@ KBodyReader(kSensor)
 /// </summary>
 KBodyVisualizer::~KBodyVisualizer()
 {
+	// Nothing may draw while D2D structures are released
+	StopRendering();
+
+	if (m_hRedrawEvent) {
+		CloseHandle(m_hRedrawEvent);
+		m_hRedrawEvent = NULL;
+	}
+
 	// Release D2D structure
 	SafeRelease(m_pBrushBoneInferred);
 	SafeRelease(m_pBrushBoneTracked);
@@ -138,129 +159,199 @@ HRESULT KBodyVisualizer::attach(HWND hWnd)
 	//	hr = InitializeDefaultSensor();
 	}
 
+	// From now on, render target is only used by the render thread
+	if (SUCCEEDED(hr) && !m_renderThread.joinable()) {
+		m_quit = false;
+		m_renderThread = std::thread(&KBodyVisualizer::RenderLoop, this);
+	}
+
 	return hr;
 
 }
 
 
 /// <summary>
-/// Redraw window
+/// Stops the render thread, and reports how long frame delivery spent in the visualizer
+/// </summary>
+void KBodyVisualizer::detach() {
+	if (!StopRendering())
+		return;
+
+	UI_Printf("Visualizer: %u frames received, %u drawn, notify avg %.4f ms, max %.4f ms",
+		(unsigned int)m_nReceived, (unsigned int)m_nDrawn, getAverageNotifyTime(), getMaxNotifyTime());
+
+	// Projection path the joints ended up using ( the projection test of KinectPipelineTests compares their speed )
+	if (m_bIntrinsicsChecked) {
+		UI_Printf("Joint projection: %s",
+			m_bUseIntrinsics ? (isDepthProjectionVectorized() ? "depth calibration ( SSE )" : "depth calibration") : "coordinate mapper array");
+	}
+}
+
+/// <summary>
+/// Validates the window and asks the render thread to redraw it. Must be called on WM_PAINT
 /// </summary>
 bool KBodyVisualizer::update() {
+	// Drawing happens on the render thread, window only needs to be validated here
 	PAINTSTRUCT ps;
 	BeginPaint(m_hWnd, &ps);
-	m_pRT->BeginDraw();
-
-	// Read in Kinect Body information, and process all of them
-	ReceiveBodiesInfo();
-
-	m_pRT->EndDraw();
 	EndPaint(m_hWnd, &ps);
+
+	m_bRedraw = true;
+	SetEvent(m_hRedrawEvent);
 	return true;
 }
 
 /// <summary>
-/// Notify class about a frame that arrived
+/// Notify class about a frame that arrived. Frame is left for the render thread, nothing is drawn here
 /// </summary>
-/// <param name="bFrame">Incoming frame</param>
-/// <param name="frameTime">Frame timestamp</param>
-void KBodyVisualizer::notify(IBodyFrame *bFrame, INT64 frameTime) {
+/// <param name="bFrame">Decoded incoming frame</param>
+void KBodyVisualizer::notify(const BodyFrame_ptr &bFrame) {
 
 	// If visualizer is not attached to a window, just return
 	if (!m_hWnd)
 		return;
 
-	// Use the general notifier first, it will save the bodies of the current frame
-	KBodyReader::notify(bFrame, frameTime);
+	LARGE_INTEGER qpcStart = { 0 };
+	QueryPerformanceCounter(&qpcStart);
+
+	// Replace any frame that was not drawn yet, only the latest one matters
+	std::atomic_store(&m_mailbox, bFrame);
+	SetEvent(m_hRedrawEvent);
+
+	// Measure how long the frame worker was kept here
+	LARGE_INTEGER qpcNow = { 0 };
+	if (QueryPerformanceCounter(&qpcNow)) {
+		INT64 elapsed = qpcNow.QuadPart - qpcStart.QuadPart;
+		m_nNotifyTotal += elapsed;
+
+		INT64 currentMax = m_nNotifyMax;
+		while (elapsed > currentMax && !m_nNotifyMax.compare_exchange_weak(currentMax, elapsed));
+	}
+
+	m_nReceived++;
+}
+
+/// <summary>
+/// Average time, in milliseconds, spent in notify for each frame
+/// </summary>
+double KBodyVisualizer::getAverageNotifyTime() {
+	unsigned int received = m_nReceived;
+	if (!received || !m_fFreq)
+		return 0.0;
 
-	// Draw skeleton
-	update();
+	return 1000.0 * double(m_nNotifyTotal) / (m_fFreq * received);
 }
 
+/// <summary>
+/// Maximum time, in milliseconds, spent in notify for a frame
+/// </summary>
+double KBodyVisualizer::getMaxNotifyTime() {
+	if (!m_fFreq)
+		return 0.0;
 
+	return 1000.0 * double(m_nNotifyMax) / m_fFreq;
+}
 
 /// <summary>
-/// Main kinect processing function
+/// Render thread, draws the latest frame whenever there is a new one ( EndDraw waits for the display refresh )
+/// </summary>
+void KBodyVisualizer::RenderLoop() {
+
+	TraceRecorder::setThreadName("Body renderer");
+
+	while (!m_quit) {
+		WaitForSingleObject(m_hRedrawEvent, c_renderWaitTimeout);
+		if (m_quit)
+			break;
+
+		ReceiveBodiesInfo();
+	}
+}
+
+/// <summary>
+/// Stops the render thread
+/// </summary>
+/// <returns>False if it was not running</returns>
+bool KBodyVisualizer::StopRendering() {
+	if (!m_renderThread.joinable())
+		return false;
+
+	m_quit = true;
+	SetEvent(m_hRedrawEvent);
+	m_renderThread.join();
+	return true;
+}
+
+/// <summary>
+/// Draws the latest frame, if it has not been drawn yet
 /// </summary>
 void KBodyVisualizer::ReceiveBodiesInfo() {
 
-	// Lock mutex when running this method
-	std::unique_lock<std::timed_mutex> lockB(*_m_pbodyUpdateMutex, std::defer_lock);
-	// Failed to lock, just return
-	if (!lockB.try_lock_for(std::chrono::milliseconds(300)))
+	// Take the latest frame, capture side is never waited for
+	BodyFrame_ptr bFrame = std::atomic_load(&m_mailbox);
+	bool bRedraw = m_bRedraw.exchange(false);
+
+	if (!bFrame || !bFrame->readStatus)
 		return;
-	
 
-	// ___ Entering sensitive area - lock was granted
+	TRACE_SCOPE("draw_bodies");
 
-	// If we still the same frame, don't even bother redisplaying it
-	if (m_pBodyReadStatus && (m_tlatestFrameTime > m_nPreviousFrameTime))
-	{
-		// Update frame time
-		m_nPreviousFrameTime = m_tlatestFrameTime;
-		
-		// Clear background color
-		m_pRT->Clear(D2D1::ColorF(D2D1::ColorF::White));
+	// If we still the same frame, don't even bother redisplaying it ( unless window asked for it )
+	if (!bRedraw && bFrame->frameTime <= m_nPreviousFrameTime)
+		return;
 
-		ProcessBody(m_tlatestFrameTime, BODY_COUNT, m_ppBodies);
+	// Update frame time
+	m_nPreviousFrameTime = bFrame->frameTime;
 
-		// Release body information after using
-		for (int i = 0; i < _countof(m_ppBodies); ++i)
-		{
-			SafeRelease(m_ppBodies[i]);
-		}
-	}
+	m_pRT->BeginDraw();
 
-	// ___ Leaving sensitive area
+	// Clear background color
+	m_pRT->Clear(D2D1::ColorF(D2D1::ColorF::White));
 
+	ProcessBody(*bFrame);
 
+	m_pRT->EndDraw();
+	m_nDrawn++;
 }
 
 /// <summary>
 /// Handle new body data
-/// <param name="nTime">timestamp of frame</param>
-/// <param name="nBodyCount">body data count</param>
-/// <param name="ppBodies">body data in frame</param>
+/// <param name="bFrame">decoded frame</param>
 /// </summary>
-void KBodyVisualizer::ProcessBody(INT64 nTime, int nBodyCount, IBody** ppBodies)
+void KBodyVisualizer::ProcessBody(const BodyFrame &bFrame)
 {
 	if (m_pRT && m_pCoordinateMapper)
 	{
-		HRESULT hr;
+		INT64 nTime = bFrame.frameTime;
 
 		int width = m_rc.right;
 		int height = m_rc.bottom;
 
-		for (int i = 0; i < nBodyCount; ++i)
+		// Gather joints of every tracked body, so they are all projected at once
+		size_t nJoints = 0;
+		for (int i = 0; i < BODY_COUNT; ++i)
 		{
-			IBody* pBody = ppBodies[i];
-			if (pBody)
+			if (bFrame.bodies[i].isTracked)
 			{
-				BOOLEAN bTracked = false;
-				hr = pBody->get_IsTracked(&bTracked);
-
-				if (SUCCEEDED(hr) && bTracked)
+				const Joint *joints = bFrame.bodies[i].joints;
+				for (int j = 0; j < JointType_Count; ++j)
 				{
-					Joint joints[JointType_Count];
-					D2D1_POINT_2F jointPoints[JointType_Count];
-					HandState leftHandState = HandState_Unknown;
-					HandState rightHandState = HandState_Unknown;
-
-					pBody->get_HandLeftState(&leftHandState);
-					pBody->get_HandRightState(&rightHandState);
-
-					hr = pBody->GetJoints(_countof(joints), joints);
-					if (SUCCEEDED(hr))
-					{
-						for (int j = 0; j < _countof(joints); ++j)
-						{
-							jointPoints[j] = BodyToScreen(joints[j].Position, width, height);
-						}
-
-						DrawBody(joints, jointPoints);
-					}
+					m_cameraPoints[nJoints++] = joints[j].Position;
 				}
 			}
+		}
+
+		ProjectJoints(nJoints, width, height);
+
+		// Bodies are drawn in the same order they were gathered
+		nJoints = 0;
+		for (int i = 0; i < BODY_COUNT; ++i)
+		{
+			if (bFrame.bodies[i].isTracked)
+			{
+				DrawBody(bFrame.bodies[i].joints, &m_screenPoints[nJoints]);
+				nJoints += JointType_Count;
+			}
 
 
 		}
@@ -296,22 +387,99 @@ void KBodyVisualizer::ProcessBody(INT64 nTime, int nBodyCount, IBody** ppBodies)
 }
 
 /// <summary>
-/// Converts a body point to screen space
+/// Reads the depth camera calibration, and checks it projects joints as the coordinate mapper does
+/// </summary>
+/// <param name="count">Number of joints to check</param>
+void KBodyVisualizer::CheckIntrinsics(size_t count) {
+
+	CameraIntrinsics cIntrinsics = { 0 };
+	if (FAILED(m_pCoordinateMapper->GetDepthCameraIntrinsics(&cIntrinsics)))
+		return;
+
+	m_intrinsics.focalLengthX = cIntrinsics.FocalLengthX;
+	m_intrinsics.focalLengthY = cIntrinsics.FocalLengthY;
+	m_intrinsics.principalPointX = cIntrinsics.PrincipalPointX;
+	m_intrinsics.principalPointY = cIntrinsics.PrincipalPointY;
+	m_intrinsics.radialDistortionSecondOrder = cIntrinsics.RadialDistortionSecondOrder;
+	m_intrinsics.radialDistortionFourthOrder = cIntrinsics.RadialDistortionFourthOrder;
+	m_intrinsics.radialDistortionSixthOrder = cIntrinsics.RadialDistortionSixthOrder;
+
+	// Sensor has not calibrated itself yet, try again with the next frame
+	if (!m_intrinsics.isValid() || count == 0)
+		return;
+
+	m_bIntrinsicsChecked = true;
+
+	// Project joints of this frame both ways
+	if (FAILED(m_pCoordinateMapper->MapCameraPointsToDepthSpace((UINT)count, m_cameraPoints, (UINT)count, m_depthPoints)))
+		return;
+	projectToDepthSpace(m_intrinsics, m_cameraPoints, count, m_depthX, m_depthY);
+
+	// Joints the mapper cannot project are not compared
+	float maxError = 0.0f;
+	for (size_t i = 0; i < count; i++) {
+		if (m_depthPoints[i].X == -std::numeric_limits<float>::infinity() || m_depthX[i] == -std::numeric_limits<float>::infinity())
+			continue;
+
+		float errorX = fabsf(m_depthPoints[i].X - m_depthX[i]);
+		float errorY = fabsf(m_depthPoints[i].Y - m_depthY[i]);
+		if (errorX > maxError)
+			maxError = errorX;
+		if (errorY > maxError)
+			maxError = errorY;
+	}
+
+	// Otherwise, the coordinate mapper keeps projecting every frame in a single call
+	m_bUseIntrinsics = maxError <= c_maxCalibrationError;
+}
+
+/// <summary>
+/// Projects joints to depth space in a single call, with the calibration or with the coordinate mapper
+/// </summary>
+/// <param name="count">Number of joints</param>
+void KBodyVisualizer::ProjectToDepthSpace(size_t count) {
+
+	if (m_bUseIntrinsics) {
+		projectToDepthSpace(m_intrinsics, m_cameraPoints, count, m_depthX, m_depthY);
+		return;
+	}
+
+	if (FAILED(m_pCoordinateMapper->MapCameraPointsToDepthSpace((UINT)count, m_cameraPoints, (UINT)count, m_depthPoints))) {
+		for (size_t i = 0; i < count; i++) {
+			m_depthX[i] = 0.0f;
+			m_depthY[i] = 0.0f;
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		m_depthX[i] = m_depthPoints[i].X;
+		m_depthY[i] = m_depthPoints[i].Y;
+	}
+}
+
+/// <summary>
+/// Converts every gathered joint to screen space
 /// </summary>
-/// <param name="bodyPoint">body point to tranform</param>
+/// <param name="count">Number of joints</param>
 /// <param name="width">width (in pixels) of output buffer</param>
 /// <param name="height">height (in pixels) of output buffer</param>
-/// <returns>point in screen-space</returns>
-D2D1_POINT_2F KBodyVisualizer::BodyToScreen(const CameraSpacePoint& bodyPoint, int width, int height)
-{
-	// Calculate the body's position on the screen
-	DepthSpacePoint depthPoint = { 0 };
-	m_pCoordinateMapper->MapCameraPointToDepthSpace(bodyPoint, &depthPoint);
+void KBodyVisualizer::ProjectJoints(size_t count, int width, int height) {
+
+	if (count == 0)
+		return;
 
-	float screenPointX = static_cast<float>(depthPoint.X * width) / cDepthWidth;
-	float screenPointY = static_cast<float>(depthPoint.Y * height) / cDepthHeight;
+	// Calibration is only known once the sensor is running
+	if (!m_bIntrinsicsChecked)
+		CheckIntrinsics(count);
 
-	return D2D1::Point2F(screenPointX, screenPointY);
+	ProjectToDepthSpace(count);
+
+	float scaleX = static_cast<float>(width) / cDepthWidth;
+	float scaleY = static_cast<float>(height) / cDepthHeight;
+	for (size_t i = 0; i < count; i++) {
+		m_screenPoints[i] = D2D1::Point2F(m_depthX[i] * scaleX, m_depthY[i] * scaleY);
+	}
 }
 
 
@@ -33,16 +33,30 @@ public:
 	HRESULT   attach(HWND hWnd);
 
 	/// <summary>
-	/// Main update function, will redraw anything
+	/// Stops the render thread, and reports how long frame delivery spent in the visualizer
+	/// </summary>
+	void detach();
+
+	/// <summary>
+	/// Validates the window and asks the render thread to redraw it. Must be called on WM_PAINT
 	/// </summary>
 	bool update();
 
 	/// <summary>
-	/// Notify class about a frame that arrived
+	/// Notify class about a frame that arrived. Frame is left for the render thread, nothing is drawn here
+	/// </summary>
+	/// <param name="bFrame">Decoded incoming frame</param>
+	virtual void notify(const BodyFrame_ptr &bFrame);
+
+	/// <summary>
+	/// Average time, in milliseconds, spent in notify for each frame
+	/// </summary>
+	double getAverageNotifyTime();
+
+	/// <summary>
+	/// Maximum time, in milliseconds, spent in notify for a frame
 	/// </summary>
-	/// <param name="bFrame">Incoming frame</param>
-	/// <param name="frameTime">Frame timestamp</param>
-	virtual void notify(IBodyFrame *bFrame, INT64 frameTime);
+	double getMaxNotifyTime();
 
 
 	/// <summary>
@@ -61,6 +75,15 @@ private:
 	const int        cDepthWidth = 512;
 	const int        cDepthHeight = 424;
 
+	// Render thread wait timeout, in milliseconds
+	static const DWORD c_renderWaitTimeout = 100;
+
+	// Maximum number of joints in a frame
+	static const int c_maxJoints = BODY_COUNT * JointType_Count;
+
+	// Calibration is only used if it projects joints this close to the coordinate mapper, in depth pixels
+	const float c_maxCalibrationError = 0.5f;
+
 
 	// Variables
 	HWND                    m_hWnd;
@@ -89,27 +112,84 @@ private:
 	// D2D text format
 	IDWriteTextFormat* m_pTextFormat;
 
+	// Latest frame received. Every new frame replaces it, whether it was drawn or not ( only accessed through atomic operations )
+	BodyFrame_ptr m_mailbox;
+
+	// Signaled when a new frame arrives, or the window needs to be redrawn
+	HANDLE m_hRedrawEvent;
+
+	// Window has to be redrawn, even if no new frame arrived
+	std::atomic_bool m_bRedraw;
+
+	// Render thread, the only one drawing to the render target once attached
+	std::thread m_renderThread;
+
+	// Quit render thread
+	std::atomic_bool m_quit;
+
+	// Joints of every tracked body of the frame being drawn, projected together
+	CameraSpacePoint m_cameraPoints[c_maxJoints];
+	DepthSpacePoint m_depthPoints[c_maxJoints];
+	float m_depthX[c_maxJoints];
+	float m_depthY[c_maxJoints];
+	D2D1_POINT_2F m_screenPoints[c_maxJoints];
+
+	// Depth camera calibration, read once from the coordinate mapper
+	DepthIntrinsics m_intrinsics;
+
+	// Whether calibration has been read and checked against the coordinate mapper
+	bool m_bIntrinsicsChecked;
+
+	// Whether joints are projected with the calibration, instead of the coordinate mapper
+	bool m_bUseIntrinsics;
+
+	// Frame statistics
+	std::atomic<unsigned int> m_nReceived;
+	std::atomic<unsigned int> m_nDrawn;
+	std::atomic<INT64> m_nNotifyTotal;
+	std::atomic<INT64> m_nNotifyMax;
+
 	/// <summary>
-	/// Main kinect processing function
+	/// Render thread, draws the latest frame whenever there is a new one ( EndDraw waits for the display refresh )
+	/// </summary>
+	void RenderLoop();
+
+	/// <summary>
+	/// Stops the render thread
+	/// </summary>
+	/// <returns>False if it was not running</returns>
+	bool StopRendering();
+
+	/// <summary>
+	/// Draws the latest frame, if it has not been drawn yet
 	/// </summary>
 	void ReceiveBodiesInfo();
 
 	/// <summary>
 	/// Handle new body data
-	/// <param name="nTime">timestamp of frame</param>
-	/// <param name="nBodyCount">body data count</param>
-	/// <param name="ppBodies">body data in frame</param>
+	/// <param name="bFrame">decoded frame</param>
+	/// </summary>
+	void ProcessBody(const BodyFrame &bFrame);
+
+	/// <summary>
+	/// Reads the depth camera calibration, and checks it projects joints as the coordinate mapper does
+	/// </summary>
+	/// <param name="count">Number of joints to check</param>
+	void CheckIntrinsics(size_t count);
+
+	/// <summary>
+	/// Projects joints to depth space in a single call, with the calibration or with the coordinate mapper
 	/// </summary>
-	void ProcessBody(INT64 nTime, int nBodyCount, IBody** ppBodies);
+	/// <param name="count">Number of joints</param>
+	void ProjectToDepthSpace(size_t count);
 
 	/// <summary>
-	/// Converts a body point to screen space
+	/// Converts every gathered joint to screen space
 	/// </summary>
-	/// <param name="bodyPoint">body point to tranform</param>
+	/// <param name="count">Number of joints</param>
 	/// <param name="width">width (in pixels) of output buffer</param>
 	/// <param name="height">height (in pixels) of output buffer</param>
-	/// <returns>point in screen-space</returns>
-	D2D1_POINT_2F BodyToScreen(const CameraSpacePoint& bodyPoint, int width, int height);
+	void ProjectJoints(size_t count, int width, int height);
 
 	/// <summary>
 	/// Draws a body 
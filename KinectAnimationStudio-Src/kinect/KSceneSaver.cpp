@@ -0,0 +1,216 @@
+#include "KSceneSaver.h"
+
+// Progress of the take being saved, forwarded to the filter and exporter callbacks
+struct SaveProgressArgs {
+	const char *fileName;
+	int lastProgress;
+	int exportProgress;
+	KSceneSaver::ProgressCallback callback;
+};
+
+
+/// <summary>
+/// Constructor, starts the save worker
+/// </summary>
+KSceneSaver::KSceneSaver() :
+m_nPending(0),
+m_filterWorkers(MappingWorkerPool::getDefaultWorkerCount(0)),
+m_quit(false)
+{
+	m_worker = std::thread(&KSceneSaver::Process, this);
+}
+
+/// <summary>
+/// Destructor, saves every pending take before returning
+/// </summary>
+KSceneSaver::~KSceneSaver() {
+	stop();
+}
+
+/// <summary>
+/// Sets function called while a take is being written. Called from the save worker
+/// </summary>
+void KSceneSaver::setProgressCallback(const ProgressCallback &callback) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_progressCallback = callback;
+}
+
+/// <summary>
+/// Sets function called once a take is done. Called from the save worker
+/// </summary>
+void KSceneSaver::setCompletionCallback(const CompletionCallback &callback) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_completionCallback = callback;
+}
+
+/// <summary>
+/// Sets post processing filters of takes recorded from now on
+/// </summary>
+void KSceneSaver::setFilterSettings(const PostProcessingSettings &settings) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_filterSettings = settings;
+}
+
+/// <summary>
+/// Post processing filters of takes recorded from now on
+/// </summary>
+PostProcessingSettings KSceneSaver::getFilterSettings() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_filterSettings;
+}
+
+/// <summary>
+/// Queues a finished take to be saved. The saver takes ownership of the manager, and of every object created by it
+/// </summary>
+/// <param name="pManager">FBX SDK manager used only by this take</param>
+/// <param name="pScene">Scene to be saved</param>
+/// <param name="fileName">File to be written</param>
+/// <param name="fileFormat">Writer format, as registered in the manager</param>
+/// <param name="filterSettings">Post processing filters run on the take, as chosen when it started</param>
+void KSceneSaver::queue(FbxManager *pManager, FbxScene *pScene, const char *fileName, int fileFormat, const PostProcessingSettings &filterSettings) {
+	SaveJob job;
+	job.pManager = pManager;
+	job.pScene = pScene;
+	job.fileName = fileName;
+	job.fileFormat = fileFormat;
+	job.filterSettings = filterSettings;
+
+	m_nPending++;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_worker.joinable()) {
+		// Worker is gone ( application is shutting down ), nothing can be left behind
+		lock.unlock();
+		Save(job);
+		return;
+	}
+
+	m_jobs.push_back(job);
+	lock.unlock();
+
+	m_jobQueued.notify_one();
+}
+
+/// <summary>
+/// Number of takes queued or being saved
+/// </summary>
+unsigned int KSceneSaver::getPendingCount() {
+	return m_nPending;
+}
+
+/// <summary>
+/// Saves every pending take and stops the worker. Queued takes are saved synchronously afterwards
+/// </summary>
+void KSceneSaver::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_worker.joinable())
+			return;
+		m_quit = true;
+	}
+
+	m_jobQueued.notify_one();
+	m_worker.join();
+}
+
+/// <summary>
+/// Worker thread, saves queued takes until asked to quit
+/// </summary>
+void KSceneSaver::Process() {
+
+	TraceRecorder::setThreadName("Scene saver");
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		while (m_jobs.empty() && !m_quit)
+			m_jobQueued.wait(lock);
+
+		// Only quit once every take has been saved
+		if (m_jobs.empty())
+			break;
+
+		SaveJob job = m_jobs.front();
+		m_jobs.pop_front();
+
+		lock.unlock();
+		Save(job);
+		lock.lock();
+	}
+}
+
+/// <summary>
+/// Filters, saves and releases a take
+/// </summary>
+/// <param name="job">Take to be saved</param>
+void KSceneSaver::Save(SaveJob &job) {
+
+	TRACE_SCOPE("save_take");
+
+	ProgressCallback progressCallback;
+	CompletionCallback completionCallback;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		progressCallback = m_progressCallback;
+		completionCallback = m_completionCallback;
+	}
+	const PostProcessingSettings &filterSettings = job.filterSettings;
+
+	const char *fileName = job.fileName.Buffer();
+	if (progressCallback)
+		progressCallback(fileName, 0);
+
+	// Apply post processing filters, every joint transform on its own. Each filter done is a step of progress
+	SaveProgressArgs progressArgs = { fileName, 0, 0, progressCallback };
+	PostProcessingReport report;
+	KinectSkeletonMapper::applyPostProcessingFilters(job.pScene, filterSettings, &m_filterWorkers, &report,
+		progressCallback ? &KSceneSaver::OnFilterStageDone : NULL, &progressArgs);
+	if (filterSettings.m_bReduceKeys)
+		UI_Printf("%s: keys reduced from %llu to %llu", fileName, report.m_nKeysBefore, report.m_nKeysAfter);
+
+	// Writing is reported by the exporter itself, after the progress reached by filters
+	bool success = SaveScene(job.pManager, job.pScene, fileName, job.fileFormat, false,
+		progressCallback ? &KSceneSaver::OnExportProgress : NULL, &progressArgs);
+
+	if (success && filterSettings.m_bReduceKeys)
+		UI_Printf("%s: %lld bytes written", fileName, (long long)FbxFileUtils::Size(fileName));
+
+	// Scene, and everything else created for this take, goes with its manager
+	DestroySdkObjects(job.pManager, false);
+	job.pManager = NULL;
+	job.pScene = NULL;
+
+	// No longer pending by the time anyone is told about it
+	m_nPending--;
+
+	if (completionCallback)
+		completionCallback(fileName, success);
+}
+
+/// <summary>
+/// Post processing pipeline callback, called after every filter
+/// </summary>
+void KSceneSaver::OnFilterStageDone(void *pArgs, const char *stageName, size_t stagesDone, size_t stageCount) {
+	SaveProgressArgs *progressArgs = (SaveProgressArgs*)pArgs;
+
+	// Filters take a long time on long takes, so every one of them is reported
+	int percentage = (int)(c_filterProgress * stagesDone / stageCount);
+	progressArgs->lastProgress = percentage;
+	progressArgs->exportProgress = c_filterProgress;
+	progressArgs->callback(progressArgs->fileName, percentage);
+}
+
+/// <summary>
+/// FBX exporter progress callback
+/// </summary>
+bool KSceneSaver::OnExportProgress(void *pArgs, float pPercentage, const char *pStatus) {
+	SaveProgressArgs *progressArgs = (SaveProgressArgs*)pArgs;
+
+	int percentage = progressArgs->exportProgress + (int)(pPercentage * (100 - progressArgs->exportProgress) / 100);
+	if (percentage >= progressArgs->lastProgress + c_progressStep) {
+		progressArgs->lastProgress = percentage;
+		progressArgs->callback(progressArgs->fileName, percentage);
+	}
+
+	// Never cancel
+	return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "..\common\stdafx.h"
+
+/*
+ Saves finished takes in the background, so stopping a recording never blocks the UI or the next take.
+ Each take owns its FBX SDK manager, which is handed over to the saver together with the scene,
+ and destroyed once the scene has been written.
+*/
+class KSceneSaver {
+public:
+	// Called while a take is being written ( percentage goes from 0 to 100 )
+	typedef std::function<void(const char *fileName, int percentage)> ProgressCallback;
+
+	// Called once a take has been written, or failed to
+	typedef std::function<void(const char *fileName, bool success)> CompletionCallback;
+
+	/// <summary>
+	/// Constructor, starts the save worker
+	/// </summary>
+	KSceneSaver();
+
+	/// <summary>
+	/// Destructor, saves every pending take before returning
+	/// </summary>
+	~KSceneSaver();
+
+	/// <summary>
+	/// Sets function called while a take is being written. Called from the save worker
+	/// </summary>
+	void setProgressCallback(const ProgressCallback &callback);
+
+	/// <summary>
+	/// Sets function called once a take is done. Called from the save worker
+	/// </summary>
+	void setCompletionCallback(const CompletionCallback &callback);
+
+	/// <summary>
+	/// Sets post processing filters of takes recorded from now on
+	/// </summary>
+	void setFilterSettings(const PostProcessingSettings &settings);
+
+	/// <summary>
+	/// Post processing filters of takes recorded from now on
+	/// </summary>
+	PostProcessingSettings getFilterSettings();
+
+	/// <summary>
+	/// Queues a finished take to be saved. The saver takes ownership of the manager, and of every object created by it
+	/// </summary>
+	/// <param name="pManager">FBX SDK manager used only by this take</param>
+	/// <param name="pScene">Scene to be saved</param>
+	/// <param name="fileName">File to be written</param>
+	/// <param name="fileFormat">Writer format, as registered in the manager</param>
+	/// <param name="filterSettings">Post processing filters run on the take, as chosen when it started</param>
+	void queue(FbxManager *pManager, FbxScene *pScene, const char *fileName, int fileFormat, const PostProcessingSettings &filterSettings);
+
+	/// <summary>
+	/// Number of takes queued or being saved
+	/// </summary>
+	unsigned int getPendingCount();
+
+	/// <summary>
+	/// Saves every pending take and stops the worker. Queued takes are saved synchronously afterwards
+	/// </summary>
+	void stop();
+
+private:
+	// Progress is only reported in steps of this many percent
+	static const int c_progressStep = 10;
+
+	// Progress reached once post processing filters are done, the exporter reports the rest
+	static const int c_filterProgress = 50;
+
+	// A take waiting to be saved
+	struct SaveJob {
+		FbxManager *pManager;
+		FbxScene *pScene;
+		FbxString fileName;
+		int fileFormat;
+		PostProcessingSettings filterSettings;
+	};
+
+	// Takes waiting to be saved
+	std::deque<SaveJob> m_jobs;
+
+	// Number of takes queued or being saved
+	std::atomic<unsigned int> m_nPending;
+
+	// Protects the queue, callbacks and filter settings
+	std::mutex m_mutex;
+
+	// Signaled when a take is queued, or the worker should quit
+	std::condition_variable m_jobQueued;
+
+	// Callbacks
+	ProgressCallback m_progressCallback;
+	CompletionCallback m_completionCallback;
+
+	// Save worker
+	std::thread m_worker;
+
+	// Share the post processing filters of a take with the save worker
+	MappingWorkerPool m_filterWorkers;
+
+	// Filters of takes recorded from now on
+	PostProcessingSettings m_filterSettings;
+
+	// Quit once queue is empty
+	bool m_quit;
+
+	/// <summary>
+	/// Worker thread, saves queued takes until asked to quit
+	/// </summary>
+	void Process();
+
+	/// <summary>
+	/// Filters, saves and releases a take
+	/// </summary>
+	/// <param name="job">Take to be saved</param>
+	void Save(SaveJob &job);
+
+	/// <summary>
+	/// Post processing pipeline callback, called after every filter
+	/// </summary>
+	static void OnFilterStageDone(void *pArgs, const char *stageName, size_t stagesDone, size_t stageCount);
+
+	/// <summary>
+	/// FBX exporter progress callback
+	/// </summary>
+	static bool OnExportProgress(void *pArgs, float pPercentage, const char *pStatus);
+};
@@ -8,11 +8,18 @@ KinectFrameProcessor::KinectFrameProcessor(IKinectSensor *kSensor) :
 m_pKinectSensor(NULL),
 m_pBodyFrameReader(NULL),
 m_pCoordinateMapper(NULL),
+m_nDroppedFrames(0),
 m_pSubscriberListMutex(NULL)
 {
 	// Alocate new mutex
 	m_pSubscriberListMutex = new std::timed_mutex;
 
+	// Clear body data
+	for (int i = 0; i < _countof(m_ppBodies); ++i)
+	{
+		m_ppBodies[i] = nullptr;
+	}
+
 	if (kSensor)
 		init(kSensor);
 }
@@ -36,6 +43,11 @@ KinectFrameProcessor::~KinectFrameProcessor()
 	do {
 		status = m_pmainThread.wait_for(std::chrono::milliseconds(0));
 	} while (status != std::future_status::ready);
+
+	for (int i = 0; i < _countof(m_ppBodies); ++i)
+	{
+		SafeRelease(m_ppBodies[i]);
+	}
 }
 
 /// <summary>
@@ -77,7 +89,13 @@ HRESULT KinectFrameProcessor::init(IKinectSensor *kSensor) {
 void KinectFrameProcessor::subscribe(const KReader_ptr &subscriber)  {
 	if (m_pCoordinateMapper)
 		subscriber->setCoordinateMapper(m_pCoordinateMapper);
-	subscriberList.push_back(subscriber);
+
+	std::unique_lock<std::timed_mutex> lock_list(*m_pSubscriberListMutex, std::defer_lock);
+	if (!lock_list.try_lock_for(std::chrono::milliseconds(800)))
+		throw std::runtime_error("Failed to add subscriber");
+
+	// Each subscriber gets its own channel, and therefore its own worker thread
+	subscriberList.push_back(std::unique_ptr<KSubscriberChannel>(new KSubscriberChannel(subscriber)));
 }
 
 /// <summary>
@@ -88,6 +106,17 @@ void KinectFrameProcessor::unsubscribeAll()  {
 	if (!lock_list.try_lock_for(std::chrono::milliseconds(800)))
 		throw std::runtime_error("Failed to clear unsubscribers");
 
+	// Stop channels, and report how well each subscriber kept up
+	int subscriberIndex = 0;
+	for (auto& it : subscriberList) {
+		it->stop();
+		UI_Printf("Subscriber %d: %u frames delivered, %u dropped, latency avg %.2f ms, max %.2f ms",
+			subscriberIndex++, it->getDeliveredCount(), it->getDroppedCount(), it->getAverageLatency(), it->getMaxLatency());
+	}
+
+	if (m_nDroppedFrames > 0)
+		UI_Printf("%u frames dropped while subscriber list was busy", (unsigned int)m_nDroppedFrames);
+
 	subscriberList.clear();
 }
 
@@ -99,6 +128,8 @@ void KinectFrameProcessor::Process() {
 
 	HRESULT hr;
 
+	TraceRecorder::setThreadName("Kinect capture");
+
 	while (!quitMain) {
 
 		// Wait for event
@@ -114,30 +145,107 @@ void KinectFrameProcessor::Process() {
 			hr = pBodyArgs->get_FrameReference(&pBodyReference);
 
 			if (SUCCEEDED(hr)){
+				TRACE_SCOPE("capture_frame");
+
 				// Frame
 				IBodyFrame* pBodyFrame = nullptr;
 				hr = pBodyReference->AcquireFrame(&pBodyFrame);
+				if (SUCCEEDED(hr))
+					PipelineMetrics::add(MetricCounter_FramesReceived);
 				
 				// Frame time
 				INT64 nTime = 0;
 				if (SUCCEEDED(hr)){
 					hr = pBodyFrame->get_RelativeTime(&nTime);
 				}
+				BodyFrame_ptr decodedFrame;
+				if (SUCCEEDED(hr)){
+					// Decode frame once, so it can be released right away and shared by every subscriber
+					decodedFrame = DecodeFrame(pBodyFrame, nTime);
+				}
+				SafeRelease(pBodyFrame);
+
 				if (SUCCEEDED(hr)){
+					TRACE_SCOPE("publish_frame");
+
 					// Try locking the list, so we can safely notify everyone
 					std::unique_lock<std::timed_mutex> lock_list(*m_pSubscriberListMutex, std::defer_lock);
 					// Failed to lock, just continue
 					if (lock_list.try_lock_for(std::chrono::milliseconds(100))) {
 						// If we arrived here, frame has been succesfully acquired
-						// Notify subscribers
+						// Queue it for every subscriber, delivery happens on their own threads
 						for (auto& it : subscriberList) {
-							it->notify(pBodyFrame, nTime);
+							it->publish(decodedFrame);
 						}
 					}
+					else {
+						m_nDroppedFrames++;
+						PipelineMetrics::add(MetricCounter_FramesDroppedListBusy);
+					}
 
 				}
-				SafeRelease(pBodyFrame);
 			}
+			SafeRelease(pBodyReference);
 		}
+		SafeRelease(pBodyArgs);
 	} // END While
 }
+
+/// <summary>
+/// Decodes body data from a frame, so it no longer depends on the SDK objects
+/// </summary>
+/// <param name="bFrame">Frame to be decoded</param>
+/// <param name="frameTime">Frame timestamp</param>
+/// <returns>Immutable decoded frame</returns>
+BodyFrame_ptr KinectFrameProcessor::DecodeFrame(IBodyFrame *bFrame, INT64 frameTime) {
+
+	TRACE_SCOPE("decode_frame");
+
+	std::shared_ptr<BodyFrame> decoded = std::make_shared<BodyFrame>();
+
+	decoded->frameTime = frameTime;
+
+	decoded->captureCounter = INT64(PipelineMetrics::getTime());
+
+	HRESULT hr = bFrame->GetAndRefreshBodyData(_countof(m_ppBodies), m_ppBodies);
+	decoded->readStatus = SUCCEEDED(hr);
+	if (!decoded->readStatus)
+		PipelineMetrics::add(MetricCounter_BodyReadFailures);
+
+	unsigned int nTracked = 0;
+
+	for (int i = 0; i < BODY_COUNT; ++i) {
+		IBody* pBody = m_ppBodies[i];
+		BodyData &body = decoded->bodies[i];
+
+		body.isTracked = false;
+		body.trackingId = 0;
+		body.leftHandState = HandState_Unknown;
+		body.rightHandState = HandState_Unknown;
+
+		if (!decoded->readStatus || !pBody)
+			continue;
+
+		BOOLEAN isTracked = false;
+		hr = pBody->get_IsTracked(&isTracked);
+		if (FAILED(hr) || !isTracked)
+			continue;
+
+		// Hand states are optional, keep going if they are not available
+		pBody->get_HandLeftState(&body.leftHandState);
+		pBody->get_HandRightState(&body.rightHandState);
+
+		// Only report body as tracked if all of its data could be read
+		if (SUCCEEDED(pBody->get_TrackingId(&body.trackingId)) &&
+			SUCCEEDED(pBody->GetJoints(_countof(body.joints), body.joints)) &&
+			SUCCEEDED(pBody->GetJointOrientations(_countof(body.orientations), body.orientations))) {
+			body.isTracked = true;
+			nTracked++;
+		}
+	}
+
+	if (nTracked > 0)
+		PipelineMetrics::add(MetricCounter_BodiesTracked, nTracked);
+
+	return decoded;
+}
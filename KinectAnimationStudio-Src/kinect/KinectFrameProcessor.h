@@ -50,6 +50,11 @@ public:
 	/// </summary>
 	void unsubscribeAll();
 
+	/// <summary>
+	/// Number of frames that could not be delivered because the subscriber list was busy
+	/// </summary>
+	unsigned int getDroppedFrameCount() { return m_nDroppedFrames; };
+
 
 private:
 	// Current Kinect
@@ -68,8 +73,15 @@ private:
 	// Quit processing thread
 	std::atomic_bool quitMain;
 
-	// List of subscribers
-	std::list<std::shared_ptr<KBodyReader>> subscriberList;
+	// Body array, refreshed for every frame before being decoded
+	IBody* m_ppBodies[BODY_COUNT];
+
+
+	// Frames dropped because subscriber list could not be locked
+	std::atomic<unsigned int> m_nDroppedFrames;
+
+	// List of subscribers, each one fed by its own channel
+	std::list<std::unique_ptr<KSubscriberChannel>> subscriberList;
 
 	// Mutex for the list
 	std::timed_mutex *m_pSubscriberListMutex;
@@ -80,4 +92,12 @@ private:
 	/// </summary>
 	void Process();
 
+	/// <summary>
+	/// Decodes body data from a frame, so it no longer depends on the SDK objects
+	/// </summary>
+	/// <param name="bFrame">Frame to be decoded</param>
+	/// <param name="frameTime">Frame timestamp</param>
+	/// <returns>Immutable decoded frame</returns>
+	BodyFrame_ptr DecodeFrame(IBodyFrame *bFrame, INT64 frameTime);
+
 };
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "KBatchConverter.h"
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="workerCount">Number of worker threads ( 0 uses every core )</param>
+KBatchConverter::KBatchConverter(unsigned int workerCount) :
+m_nNextJob(0),
+m_nWorkers(workerCount),
+m_bVerifyRotations(false),
+m_bReplaceFilterSettings(false),
+m_bReplaceKeyingSettings(false),
+m_bReplaceJointFilterSettings(false),
+m_nConvertedFiles(0),
+m_nFailedFiles(0),
+m_nConvertedFrames(0),
+m_nMappedBodies(0),
+m_nMappingTime(0),
+m_nKeysBeforeFilters(0),
+m_nKeysAfterFilters(0),
+m_nOutputBytes(0),
+m_elapsedTime(0),
+m_maxRotationError(0)
+{
+	if (m_nWorkers == 0)
+		m_nWorkers = std::thread::hardware_concurrency();
+
+	// hardware_concurrency may not be able to tell
+	if (m_nWorkers == 0)
+		m_nWorkers = 1;
+}
+
+/// <summary>
+/// Queues a journal to be converted
+/// </summary>
+/// <param name="journalFile">Capture journal</param>
+/// <param name="outputFile">FBX file to be written</param>
+void KBatchConverter::addJournal(const char *journalFile, const char *outputFile) {
+	ConversionJob job;
+	job.journalFile = journalFile;
+	job.outputFile = outputFile;
+	m_jobs.push_back(job);
+}
+
+/// <summary>
+/// Converts every queued journal, returning once all of them are done
+/// </summary>
+/// <returns>True if every journal was converted</returns>
+bool KBatchConverter::run() {
+
+	m_nNextJob = 0;
+	m_nConvertedFiles = 0;
+	m_nFailedFiles = 0;
+	m_nConvertedFrames = 0;
+	m_nMappedBodies = 0;
+	m_nMappingTime = 0;
+	m_nKeysBeforeFilters = 0;
+	m_nKeysAfterFilters = 0;
+	m_nOutputBytes = 0;
+	m_maxRotationError = 0;
+
+	// No point in having idle workers
+	unsigned int workerCount = m_nWorkers;
+	if (workerCount > m_jobs.size())
+		workerCount = (unsigned int)m_jobs.size();
+
+	// FBX SDK objects are not thread safe, so every worker gets its own manager.
+	// Managers are created up front, from this thread only
+	std::vector<FbxManager*> managers;
+	for (unsigned int i = 0; i < workerCount; i++)
+		managers.push_back(CreateSdkManager());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < workerCount; i++)
+		workers.push_back(std::thread(&KBatchConverter::WorkerThread, this, managers[i]));
+
+	for (auto &worker : workers)
+		worker.join();
+
+	m_elapsedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (auto pManager : managers)
+		DestroySdkObjects(pManager, false);
+
+	return m_nFailedFiles == 0;
+}
+
+/// <summary>
+/// Average time spent mapping a single body frame in the last run, in microseconds
+/// </summary>
+double KBatchConverter::getMappingCostPerBody() {
+	if (m_nMappedBodies == 0)
+		return 0;
+
+	return (double)m_nMappingTime / (double)m_nMappedBodies;
+}
+
+/// <summary>
+/// Worker thread, converts journals until there are none left
+/// </summary>
+/// <param name="pManager">FBX SDK manager owned by this worker</param>
+void KBatchConverter::WorkerThread(FbxManager *pManager) {
+
+	TraceRecorder::setThreadName("Converter worker");
+
+	size_t jobIndex;
+	while ((jobIndex = m_nNextJob++) < m_jobs.size()) {
+
+		unsigned int frameCount = 0;
+		if (ConvertJournal(pManager, m_jobs[jobIndex], frameCount)) {
+			m_nConvertedFiles++;
+			m_nConvertedFrames += frameCount;
+		}
+		else {
+			m_nFailedFiles++;
+		}
+	}
+}
+
+/// <summary>
+/// Converts a single journal
+/// </summary>
+/// <param name="pManager">FBX SDK manager owned by the calling worker</param>
+/// <param name="job">Journal to be converted</param>
+/// <param name="frameCount">Output, number of frames mapped</param>
+/// <returns>True if FBX file was written</returns>
+bool KBatchConverter::ConvertJournal(FbxManager *pManager, const ConversionJob &job, unsigned int &frameCount) {
+
+	TRACE_SCOPE("convert_journal");
+
+	frameCount = 0;
+
+	CaptureJournalReader reader;
+	if (!reader.open(job.journalFile.Buffer())) {
+		UI_Printf("%s: not a valid capture journal", job.journalFile.Buffer());
+		return false;
+	}
+
+	// Take is rebuilt with the settings it was recorded with, unless they are replaced
+	CaptureJournalSettings settings = reader.getSettings();
+	if (m_bReplaceFilterSettings)
+		settings.m_postProcessing = m_settings.m_postProcessing;
+	if (m_bReplaceKeyingSettings)
+		settings.m_keying = m_settings.m_keying;
+	if (m_bReplaceJointFilterSettings)
+		settings.m_jointFilter = m_settings.m_jointFilter;
+
+	// Rebuild the take, exactly as it would have been recorded
+	FbxScene *pScene = CreateAnimationScene(pManager);
+	MappingSession session(pScene);
+	session.m_bVerifyRotations = m_bVerifyRotations;
+
+	std::chrono::steady_clock::time_point mappingStart = std::chrono::steady_clock::now();
+	{
+		TRACE_SCOPE("replay_journal");
+		frameCount = replayCaptureJournal(reader, session, &settings);
+	}
+	m_nMappingTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mappingStart).count();
+	m_nMappedBodies += session.m_nMappedBodies;
+
+	if (m_bVerifyRotations) {
+		std::lock_guard<std::mutex> lock(m_rotationErrorMutex);
+		if (session.getMaxRotationError() > m_maxRotationError)
+			m_maxRotationError = session.getMaxRotationError();
+	}
+
+	// A take interrupted by a crash still has every frame committed before it
+	if (reader.isTruncated())
+		UI_Printf("%s: journal is truncated, converting its first %u frames", job.journalFile.Buffer(), frameCount);
+
+	reader.close();
+
+	bool success = false;
+	if (frameCount > 0) {
+		session.commitKeys();
+
+		// Journals are already converted in parallel, so each one is filtered by its own worker
+		PostProcessingReport report;
+		KinectSkeletonMapper::applyPostProcessingFilters(pScene, settings.m_postProcessing, NULL, &report);
+
+		int lFileFormat = pManager->GetIOPluginRegistry()->GetNativeWriterFormat();
+		success = SaveScene(pManager, pScene, job.outputFile.Buffer(), lFileFormat, false);
+
+		if (success) {
+			long long fileSize = FbxFileUtils::Size(job.outputFile.Buffer());
+			m_nKeysBeforeFilters += report.m_nKeysBefore;
+			m_nKeysAfterFilters += report.m_nKeysAfter;
+			m_nOutputBytes += fileSize;
+
+			UI_Printf("%s: %u frames saved to %s ( %llu keys, %llu before filters, %lld bytes )", job.journalFile.Buffer(), frameCount, job.outputFile.Buffer(),
+				report.m_nKeysAfter, report.m_nKeysBefore, fileSize);
+		}
+		else
+			UI_Printf("%s: could not save %s", job.journalFile.Buffer(), job.outputFile.Buffer());
+	}
+	else {
+		UI_Printf("%s: journal has no frames", job.journalFile.Buffer());
+	}
+
+	pScene->Destroy();
+
+	return success;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/*
+ Converts capture journals to FBX files, without a sensor or UI.
+ Journals are shared among worker threads, each one with its own FBX SDK manager.
+ Every take is converted with the settings recorded in its journal, unless they are replaced
+*/
+class KBatchConverter {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="workerCount">Number of worker threads ( 0 uses every core )</param>
+	KBatchConverter(unsigned int workerCount = 0);
+
+	/// <summary>
+	/// Queues a journal to be converted
+	/// </summary>
+	/// <param name="journalFile">Capture journal</param>
+	/// <param name="outputFile">FBX file to be written</param>
+	void addJournal(const char *journalFile, const char *outputFile);
+
+	/// <summary>
+	/// Cross-checks every rotation key against the FbxAMatrix reference while converting ( slower )
+	/// </summary>
+	void setVerifyRotations(bool verify) { m_bVerifyRotations = verify; };
+
+	/// <summary>
+	/// Sets post processing filters run on every take before it is saved, instead of the ones recorded in its journal
+	/// </summary>
+	void setFilterSettings(const PostProcessingSettings &settings) { m_settings.m_postProcessing = settings; m_bReplaceFilterSettings = true; };
+
+	/// <summary>
+	/// Sets how keys are added while journals are mapped, instead of as recorded in each journal
+	/// </summary>
+	void setKeyingSettings(const KeyingSettings &keying) { m_settings.m_keying = keying; m_bReplaceKeyingSettings = true; };
+
+	/// <summary>
+	/// Sets how joints are smoothed before they are keyed, instead of as recorded in each journal
+	/// </summary>
+	void setJointFilterSettings(const JointFilterSettings &settings) { m_settings.m_jointFilter = settings; m_bReplaceJointFilterSettings = true; };
+
+	/// <summary>
+	/// Converts every queued journal, returning once all of them are done
+	/// </summary>
+	/// <returns>True if every journal was converted</returns>
+	bool run();
+
+	/// <summary>
+	/// Number of worker threads used
+	/// </summary>
+	unsigned int getWorkerCount() { return m_nWorkers; };
+
+	/// <summary>
+	/// Number of journals converted by the last run
+	/// </summary>
+	unsigned int getConvertedFileCount() { return m_nConvertedFiles; };
+
+	/// <summary>
+	/// Number of journals that failed to be converted by the last run
+	/// </summary>
+	unsigned int getFailedFileCount() { return m_nFailedFiles; };
+
+	/// <summary>
+	/// Number of frames mapped by the last run
+	/// </summary>
+	unsigned long long getConvertedFrameCount() { return m_nConvertedFrames; };
+
+	/// <summary>
+	/// Number of body frames mapped by the last run ( one per tracked body of each frame )
+	/// </summary>
+	unsigned long long getMappedBodyCount() { return m_nMappedBodies; };
+
+	/// <summary>
+	/// Average time spent mapping a single body frame in the last run, in microseconds
+	/// </summary>
+	double getMappingCostPerBody();
+
+	/// <summary>
+	/// Duration of the last run, in seconds
+	/// </summary>
+	double getElapsedTime() { return m_elapsedTime; };
+
+	/// <summary>
+	/// Largest difference between rotation keys and the FbxAMatrix reference found by the last run, in degrees
+	/// </summary>
+	double getMaxRotationError() { return m_maxRotationError; };
+
+	/// <summary>
+	/// Keys of the files converted by the last run, before post processing
+	/// </summary>
+	unsigned long long getKeyCountBeforeFilters() { return m_nKeysBeforeFilters; };
+
+	/// <summary>
+	/// Keys of the files converted by the last run, as saved
+	/// </summary>
+	unsigned long long getKeyCountAfterFilters() { return m_nKeysAfterFilters; };
+
+	/// <summary>
+	/// Size of the files written by the last run, in bytes
+	/// </summary>
+	unsigned long long getOutputSize() { return m_nOutputBytes; };
+
+private:
+	// A journal to be converted
+	struct ConversionJob {
+		FbxString journalFile;
+		FbxString outputFile;
+	};
+
+	// Queued journals
+	std::vector<ConversionJob> m_jobs;
+
+	// Next job to be taken by a worker
+	std::atomic<size_t> m_nNextJob;
+
+	// Number of worker threads
+	unsigned int m_nWorkers;
+
+	// Whether rotation keys are cross-checked
+	bool m_bVerifyRotations;
+
+	// Settings replacing the ones recorded in journals, and which of them are replaced
+	CaptureJournalSettings m_settings;
+	bool m_bReplaceFilterSettings;
+	bool m_bReplaceKeyingSettings;
+	bool m_bReplaceJointFilterSettings;
+
+	// Statistics of the last run
+	std::atomic<unsigned int> m_nConvertedFiles;
+	std::atomic<unsigned int> m_nFailedFiles;
+	std::atomic<unsigned long long> m_nConvertedFrames;
+	std::atomic<unsigned long long> m_nMappedBodies;
+	std::atomic<unsigned long long> m_nMappingTime;
+	std::atomic<unsigned long long> m_nKeysBeforeFilters;
+	std::atomic<unsigned long long> m_nKeysAfterFilters;
+	std::atomic<unsigned long long> m_nOutputBytes;
+	double m_elapsedTime;
+	double m_maxRotationError;
+	std::mutex m_rotationErrorMutex;
+
+	/// <summary>
+	/// Worker thread, converts journals until there are none left
+	/// </summary>
+	/// <param name="pManager">FBX SDK manager owned by this worker</param>
+	void WorkerThread(FbxManager *pManager);
+
+	/// <summary>
+	/// Converts a single journal
+	/// </summary>
+	/// <param name="pManager">FBX SDK manager owned by the calling worker</param>
+	/// <param name="job">Journal to be converted</param>
+	/// <param name="frameCount">Output, number of frames mapped</param>
+	/// <returns>True if FBX file was written</returns>
+	bool ConvertJournal(FbxManager *pManager, const ConversionJob &job, unsigned int &frameCount);
+};
@@ -0,0 +1,226 @@
+#include "KBatchConverter.h"
+
+#include <string.h>
+
+// Global FBX manager, required by CommonKinect helpers. The converter itself uses one manager per worker
+FbxManager* gSdkManager = NULL;
+
+// Serializes messages coming from different workers
+static std::mutex gPrintMutex;
+
+// Largest accepted difference between rotation keys and the FbxAMatrix reference, in degrees
+static const double c_rotationTolerance = 1e-2;
+
+
+/// <summary>
+/// Prints a message to the console ( same arguments as printf )
+/// </summary>
+void UI_Printf(const char* pMsg, ...) {
+	char msg[2048];
+
+	va_list Arguments;
+	va_start(Arguments, pMsg);
+	FBXSDK_vsprintf(msg, sizeof(msg), pMsg, Arguments);
+	va_end(Arguments);
+
+	std::lock_guard<std::mutex> lock(gPrintMutex);
+	printf("%s\n", msg);
+	fflush(stdout);
+}
+
+/// <summary>
+/// Prints command line usage
+/// </summary>
+static void PrintUsage(const char *programName) {
+	printf("Usage: %s [-j threads] [-o outputDir] [-v] [-s] [-e degrees units] [-f fps] [-r degrees units] [-m metricsFile] [-t traceFile] journal" CAPTURE_JOURNAL_EXTENSION " [...] [@listFile]\n", programName);
+	printf("  -j threads    Number of worker threads ( defaults to every core )\n");
+	printf("  -o outputDir  Directory FBX files are written to ( defaults to next to each journal )\n");
+	printf("  -v            Check every rotation key against the FbxAMatrix reference\n");
+	printf("  Takes are converted with the settings recorded in their journal, -s, -e and -f / -r replace them\n");
+	printf("  -s            Smooth joint positions and orientations before they are keyed\n");
+	printf("  -e deg units  Only key samples that linear interpolation from the kept keys misses by more than these rotation and translation errors\n");
+	printf("  -f fps        Resample every take to a key on every frame at this rate ( 24, 30, 60, ... )\n");
+	printf("  -r deg units  Remove keys interpolation reconstructs within these rotation and translation errors\n");
+	printf("  -m file       Write pipeline metrics to a JSON file when done\n");
+	printf("  -t file       Record a timeline of every stage, written as Chrome trace events when done\n");
+	printf("  @listFile     Text file with one journal per line\n");
+}
+
+/// <summary>
+/// Queues a journal, deciding where its FBX file goes
+/// </summary>
+static void AddJournal(KBatchConverter &converter, const char *journalFile, const char *outputDir) {
+	FbxString outputFile = getExportFileNameFromJournal(journalFile);
+
+	if (outputDir)
+		outputFile = FbxPathUtils::Bind(outputDir, FbxPathUtils::GetFileName(outputFile.Buffer()).Buffer());
+
+	converter.addJournal(journalFile, outputFile.Buffer());
+}
+
+/// <summary>
+/// Queues every journal listed in a text file
+/// </summary>
+/// <returns>False if list could not be read</returns>
+static bool AddJournalList(KBatchConverter &converter, const char *listFile, const char *outputDir) {
+	FILE *pList;
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	pList = fopen(listFile, "r");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+	if (!pList)
+		return false;
+
+	char line[2048];
+	while (fgets(line, sizeof(line), pList)) {
+		FbxString journalFile(line);
+		journalFile = journalFile.Trim();
+		if (!journalFile.IsEmpty())
+			AddJournal(converter, journalFile.Buffer(), outputDir);
+	}
+
+	fclose(pList);
+	return true;
+}
+
+
+int main(int argc, char **argv) {
+
+	unsigned int workerCount = 0;
+	const char *outputDir = NULL;
+	bool verifyRotations = false;
+	// Settings recorded in journals are only replaced by the ones given
+	PostProcessingSettings filterSettings;
+	KeyingSettings keying;
+	JointFilterSettings jointFiltering;
+	bool replaceFilters = false;
+	bool replaceKeying = false;
+	bool replaceJointFiltering = false;
+	const char *metricsFile = NULL;
+	const char *traceFile = NULL;
+	std::vector<const char*> inputs;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			workerCount = (unsigned int)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			outputDir = argv[++i];
+		else if (strcmp(argv[i], "-v") == 0)
+			verifyRotations = true;
+		else if (strcmp(argv[i], "-s") == 0) {
+			jointFiltering.m_bEnabled = true;
+			replaceJointFiltering = true;
+		}
+		else if (strcmp(argv[i], "-e") == 0 && i + 2 < argc) {
+			replaceKeying = true;
+			keying.m_bAdaptive = true;
+			keying.m_angleTolerance = atof(argv[++i]);
+			keying.m_positionTolerance = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			// Only frame rates FBX files can store as their time mode
+			replaceFilters = true;
+			filterSettings.m_resampleMode = FbxTime::ConvertFrameRateToTimeMode(atof(argv[++i]));
+			if (filterSettings.m_resampleMode == FbxTime::eDefaultMode || filterSettings.m_resampleMode == FbxTime::eCustom) {
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-r") == 0 && i + 2 < argc) {
+			replaceFilters = true;
+			filterSettings.m_bReduceKeys = true;
+			filterSettings.m_reductionAngleTolerance = atof(argv[++i]);
+			filterSettings.m_reductionPositionTolerance = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			metricsFile = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			traceFile = argv[++i];
+		else if (argv[i][0] == '-') {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		else
+			inputs.push_back(argv[i]);
+	}
+
+	if (inputs.empty()) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	KBatchConverter converter(workerCount);
+	converter.setVerifyRotations(verifyRotations);
+	if (replaceFilters)
+		converter.setFilterSettings(filterSettings);
+	if (replaceKeying)
+		converter.setKeyingSettings(keying);
+	if (replaceJointFiltering)
+		converter.setJointFilterSettings(jointFiltering);
+
+	for (auto input : inputs) {
+		if (input[0] == '@') {
+			if (!AddJournalList(converter, input + 1, outputDir)) {
+				UI_Printf("Could not read journal list %s", input + 1);
+				return 1;
+			}
+		}
+		else {
+			AddJournal(converter, input, outputDir);
+		}
+	}
+
+	if (traceFile) {
+		TraceRecorder::setThreadName("Main");
+		TraceRecorder::setEnabled(true);
+	}
+
+	bool success = converter.run();
+
+	// Throughput report
+	double elapsed = converter.getElapsedTime();
+	unsigned int files = converter.getConvertedFileCount();
+	unsigned long long frames = converter.getConvertedFrameCount();
+
+	UI_Printf("Converted %u files ( %llu frames ) in %.2fs using %u workers, %u failed",
+		files, frames, elapsed, converter.getWorkerCount(), converter.getFailedFileCount());
+	if (elapsed > 0)
+		UI_Printf("Throughput: %.1f frames/s, %.2f files/s", frames / elapsed, files / elapsed);
+	UI_Printf("Mapping: %llu body frames, %.2fus per body frame ( includes journal decoding )",
+		converter.getMappedBodyCount(), converter.getMappingCostPerBody());
+	UI_Printf("Output: %llu keys ( %llu before filters ), %.1f MB",
+		converter.getKeyCountAfterFilters(), converter.getKeyCountBeforeFilters(), double(converter.getOutputSize()) / (1024.0 * 1024.0));
+
+	if (metricsFile) {
+		MetricsSnapshot metrics = PipelineMetrics::getSnapshot();
+		const HistogramSnapshot &mapTime = metrics.m_histograms[MetricHistogram_MapFrameTime];
+		const HistogramSnapshot &saveTime = metrics.m_histograms[MetricHistogram_SaveSceneTime];
+		UI_Printf("Metrics: frame mapping p50 %lluus, p99 %lluus, %llu keys committed, scene saving p50 %lluus",
+			mapTime.getPercentile(0.5), mapTime.getPercentile(0.99), metrics.m_counters[MetricCounter_KeysCommitted], saveTime.getPercentile(0.5));
+
+		if (!PipelineMetrics::writeSnapshot(metricsFile)) {
+			UI_Printf("Could not write metrics to %s", metricsFile);
+			success = false;
+		}
+	}
+
+	if (traceFile) {
+		TraceRecorder::setEnabled(false);
+		size_t spanCount = TraceRecorder::getEventCount();
+		if (TraceRecorder::writeChromeTrace(traceFile)) {
+			UI_Printf("Timeline: %u spans written to %s", (unsigned int)spanCount, traceFile);
+		}
+		else {
+			UI_Printf("Could not write timeline to %s", traceFile);
+			success = false;
+		}
+	}
+
+	if (verifyRotations) {
+		double rotationError = converter.getMaxRotationError();
+		UI_Printf("Rotation check: largest difference from reference is %g degrees ( tolerance %g )", rotationError, c_rotationTolerance);
+		if (rotationError > c_rotationTolerance)
+			return 3;
+	}
+
+	return success ? 0 : 2;
+}
@@ -0,0 +1,40 @@
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+
+#pragma once
+
+// The converter only depends on FBX SDK and on the portable part of CommonKinect,
+// so it can be built wherever FBX SDK is available ( e.g. Linux render nodes )
+
+// C RunTime Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+// C++ STD header Files
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+
+//Additional program headers
+// FBX SDK
+#include <fbxsdk.h>
+
+// Portable helpers from CommonKinect ( no Kinect sensor or UI required )
+#include "CommonKinect/helpers/FBX_helpers.h"
+#include "CommonKinect/helpers/Log_helpers.h"
+#include "CommonKinect/kinect2fbx/KinectSkeletonMapper.h"
+#include "CommonKinect/kinect2fbx/CaptureJournal.h"
+#include "CommonKinect/kinect2fbx/PipelineMetrics.h"
+#include "CommonKinect/kinect2fbx/TraceRecorder.h"
+#include "CommonKinect/kinect2fbx/MappingWorkerPool.h"
+#include "CommonKinect/kinect2fbx/PostProcessingFilters.h"
+#include "CommonKinect/kinect2fbx/KSubscriberChannel.h"
+#include "CommonKinect/kinect2fbx/KPreRollBuffer.h"
+#include "CommonKinect/kinect2fbx/DepthProjection.h"
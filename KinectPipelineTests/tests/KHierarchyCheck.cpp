@@ -0,0 +1,310 @@
+#include "KHierarchyCheck.h"
+
+#include <map>
+#include <random>
+#include <math.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Same poses every time
+static const unsigned int c_checkSeed = 42;
+
+// One pose out of this many has every joint gimbal locked ( Y rotation of +/-90 degrees relative to its parent )
+static const unsigned int c_gimbalLockedPoseInterval = 4;
+
+// Share of joints with no orientation, carrying their parent orientation down as the mapper does
+static const double c_unanimatedJointRate = 0.1;
+
+// Radians to degrees
+static const double c_radToDeg = 57.295779513082321;
+
+/*
+	Rotation matrix, applied to column vectors
+*/
+struct RotationMatrix {
+	double m[3][3];
+};
+
+/// <summary>
+/// Rotation matrix of a unit quaternion
+/// </summary>
+static RotationMatrix MatrixFromQuaternion(const JointQuaternion &q) {
+	RotationMatrix r;
+	r.m[0][0] = 1 - 2 * (q.y * q.y + q.z * q.z);
+	r.m[0][1] = 2 * (q.x * q.y - q.z * q.w);
+	r.m[0][2] = 2 * (q.x * q.z + q.y * q.w);
+	r.m[1][0] = 2 * (q.x * q.y + q.z * q.w);
+	r.m[1][1] = 1 - 2 * (q.x * q.x + q.z * q.z);
+	r.m[1][2] = 2 * (q.y * q.z - q.x * q.w);
+	r.m[2][0] = 2 * (q.x * q.z - q.y * q.w);
+	r.m[2][1] = 2 * (q.y * q.z + q.x * q.w);
+	r.m[2][2] = 1 - 2 * (q.x * q.x + q.y * q.y);
+	return r;
+}
+
+/// <summary>
+/// Local rotation of a joint, from its parent global rotation and its own: inverse ( transpose ) of parent times global
+/// </summary>
+static RotationMatrix LocalMatrix(const RotationMatrix &parent, const RotationMatrix &global) {
+	RotationMatrix r;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++)
+			r.m[i][j] = parent.m[0][i] * global.m[0][j] + parent.m[1][i] * global.m[1][j] + parent.m[2][i] * global.m[2][j];
+	}
+	return r;
+}
+
+/// <summary>
+/// Angle between two rotations, in degrees. Computed from the distance between their matrices, which stays accurate for small angles
+/// </summary>
+static double RotationDifference(const RotationMatrix &a, const RotationMatrix &b) {
+	double distance = 0;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++)
+			distance += (a.m[i][j] - b.m[i][j]) * (a.m[i][j] - b.m[i][j]);
+	}
+
+	// Distance between rotation matrices is 2 * sqrt( 2 ) * sin( angle / 2 )
+	double halfSine = sqrt(distance) / (2.0 * sqrt(2.0));
+	return 2.0 * asin(halfSine < 1.0 ? halfSine : 1.0) * c_radToDeg;
+}
+
+/// <summary>
+/// Random rotation, uniformly distributed
+/// </summary>
+static JointQuaternion RandomRotation(std::mt19937 &generator) {
+	std::normal_distribution<double> distribution;
+	JointQuaternion q;
+	do {
+		q.x = distribution(generator);
+		q.y = distribution(generator);
+		q.z = distribution(generator);
+		q.w = distribution(generator);
+	} while (!quatNormalize(q));
+	return q;
+}
+
+/*
+	Global rotations of every joint of a pose, in flattened order
+*/
+struct HierarchyPose {
+	std::vector<JointQuaternion> m_globalRotations;
+
+	// Whether a joint has an orientation of its own
+	std::vector<bool> m_animated;
+};
+
+/// <summary>
+/// Walks the hierarchy recursively, passing the parent global rotation down by value, as mapping did before it was flattened
+/// </summary>
+/// <param name="node">Current node</param>
+/// <param name="parentGlobal">Global rotation of its parent</param>
+/// <param name="indices">Index of every node in the flattened array</param>
+/// <param name="pose">Global rotations of the pose</param>
+/// <param name="locals">Output, local rotation of every joint, in flattened order</param>
+static void WalkReference(const HierarchyNodeDefinition *node, RotationMatrix parentGlobal, const std::map<const HierarchyNodeDefinition*, size_t> &indices,
+	const HierarchyPose &pose, std::vector<RotationMatrix> &locals) {
+
+	size_t index = indices.find(node)->second;
+	RotationMatrix global = pose.m_animated[index] ? MatrixFromQuaternion(pose.m_globalRotations[index]) : parentGlobal;
+	locals[index] = LocalMatrix(parentGlobal, global);
+
+	for (auto &child : node->m_children)
+		WalkReference(child.get(), global, indices, pose, locals);
+}
+
+/// <summary>
+/// Records the parent of every node of a hierarchy, walking it recursively
+/// </summary>
+/// <returns>False if a node is reached twice</returns>
+static bool CollectParents(const HierarchyNodeDefinition *node, const HierarchyNodeDefinition *parent, std::map<const HierarchyNodeDefinition*, const HierarchyNodeDefinition*> &parents) {
+	if (!parents.insert(std::make_pair(node, parent)).second)
+		return false;
+
+	for (auto &child : node->m_children) {
+		if (!CollectParents(child.get(), node, parents))
+			return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Checks a flattened hierarchy holds every node of its definition once, each one after its parent
+/// </summary>
+/// <param name="root">Hierarchy definition</param>
+/// <param name="nodes">Flattened hierarchy</param>
+/// <param name="indices">Output, index of every node in the flattened array</param>
+/// <returns>False if the flattened hierarchy does not match its definition</returns>
+static bool CheckFlattenedHierarchy(const std::shared_ptr<HierarchyNodeDefinition> &root, const std::vector<FlatHierarchyNode> &nodes,
+	std::map<const HierarchyNodeDefinition*, size_t> &indices) {
+
+	std::map<const HierarchyNodeDefinition*, const HierarchyNodeDefinition*> parents;
+	if (!CollectParents(root.get(), NULL, parents)) {
+		UI_Printf("  Hierarchy definition reaches a node twice");
+		return false;
+	}
+
+	if (nodes.size() != parents.size()) {
+		UI_Printf("  Flattened hierarchy has %u nodes, its definition %u", (unsigned int)nodes.size(), (unsigned int)parents.size());
+		return false;
+	}
+
+	if (nodes.empty() || nodes[0].m_definition != root || nodes[0].m_parentIndex != -1) {
+		UI_Printf("  Flattened hierarchy does not start with its root");
+		return false;
+	}
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const HierarchyNodeDefinition *node = nodes[i].m_definition.get();
+		if (!indices.insert(std::make_pair(node, i)).second) {
+			UI_Printf("  %s appears twice in the flattened hierarchy", node->m_fNodeName.Buffer());
+			return false;
+		}
+
+		auto parent = parents.find(node);
+		if (parent == parents.end()) {
+			UI_Printf("  %s is not part of the hierarchy definition", node->m_fNodeName.Buffer());
+			return false;
+		}
+
+		if (i == 0)
+			continue;
+
+		// Forward pass needs every parent rotation before its children
+		int parentIndex = nodes[i].m_parentIndex;
+		if (parentIndex < 0 || size_t(parentIndex) >= i || nodes[parentIndex].m_definition.get() != parent->second) {
+			UI_Printf("  %s does not come after its parent in the flattened hierarchy", node->m_fNodeName.Buffer());
+			return false;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Random pose. Gimbal locked poses rotate every joint by +/-90 degrees around Y relative to its parent, with random X and Z
+/// </summary>
+static void GeneratePose(const std::vector<FlatHierarchyNode> &nodes, bool gimbalLocked, std::mt19937 &generator, HierarchyPose &pose) {
+	std::uniform_real_distribution<double> angle(-180.0, 180.0);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+	pose.m_globalRotations.resize(nodes.size());
+	pose.m_animated.resize(nodes.size());
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		int parentIndex = nodes[i].m_parentIndex;
+		JointQuaternion parentRot = parentIndex < 0 ? quatIdentity() : pose.m_globalRotations[parentIndex];
+
+		// Root is always animated
+		pose.m_animated[i] = parentIndex < 0 || chance(generator) >= c_unanimatedJointRate;
+		if (!pose.m_animated[i]) {
+			pose.m_globalRotations[i] = parentRot;
+			continue;
+		}
+
+		if (gimbalLocked) {
+			double y = chance(generator) < 0.5 ? 90.0 : -90.0;
+			pose.m_globalRotations[i] = quatMultiply(parentRot, quatFromEulerXYZ(angle(generator), y, angle(generator)));
+			quatNormalize(pose.m_globalRotations[i]);
+		}
+		else {
+			pose.m_globalRotations[i] = RandomRotation(generator);
+		}
+	}
+}
+
+/// <summary>
+/// Largest difference between local euler angles of a batch and reference local rotations, in degrees
+/// </summary>
+static double MaxDifference(const JointRotationBatch &batch, const std::vector<size_t> &batchJoints, const std::vector<RotationMatrix> &locals) {
+	double maxDifference = 0;
+	for (size_t i = 0; i < batchJoints.size(); i++) {
+		// Angles are compared as the rotation they give, since several angles give the same gimbal locked rotation
+		RotationMatrix euler = MatrixFromQuaternion(quatFromEulerXYZ(batch.m_eulerX[i], batch.m_eulerY[i], batch.m_eulerZ[i]));
+		double difference = RotationDifference(euler, locals[batchJoints[i]]);
+		if (!(difference <= maxDifference))
+			maxDifference = difference;
+	}
+	return maxDifference;
+}
+
+/// <summary>
+/// Checks the flattened default joint hierarchy against its definition, then poses it with random joint rotations
+/// ( gimbal locked ones included ) and compares local rotations of the mapper's forward pass over the flattened array
+/// with the recursive walk and 3x3 matrix inverses mapping used before
+/// </summary>
+/// <param name="poseCount">Number of random poses</param>
+/// <param name="tolerance">Largest accepted difference between both local rotations, in degrees</param>
+/// <returns>False if the flattened hierarchy is wrong, or a local rotation differs by more than tolerance</returns>
+bool RunHierarchyCheck(unsigned int poseCount, double tolerance) {
+
+	// Same hierarchy the mapper builds skeletons from
+	std::shared_ptr<HierarchyNodeDefinition> root = GetDefaultHierarchyNodeDefinition();
+	std::vector<FlatHierarchyNode> nodes = FlattenHierarchyNodeDefinition(root);
+
+	UI_Printf("Hierarchy check, %u joints, %u poses ( one out of %u gimbal locked ):", (unsigned int)nodes.size(), poseCount, c_gimbalLockedPoseInterval);
+
+	std::map<const HierarchyNodeDefinition*, size_t> indices;
+	if (!CheckFlattenedHierarchy(root, nodes, indices))
+		return false;
+
+	std::mt19937 generator(c_checkSeed);
+	HierarchyPose pose;
+	std::vector<RotationMatrix> locals(nodes.size());
+	std::vector<JointQuaternion> globalRotations(nodes.size());
+	JointRotationBatch batch;
+	std::vector<size_t> batchJoints;
+
+	double scalarDifference = 0, vectorDifference = 0, lockedDifference = 0;
+	for (unsigned int p = 0; p < poseCount; p++) {
+		bool gimbalLocked = p % c_gimbalLockedPoseInterval == c_gimbalLockedPoseInterval - 1;
+		GeneratePose(nodes, gimbalLocked, generator, pose);
+
+		// Forward pass over the flattened hierarchy, as KinectSkeletonMapper::collectRotations does
+		batch.clear();
+		batchJoints.clear();
+		for (size_t i = 0; i < nodes.size(); i++) {
+			int parentIndex = nodes[i].m_parentIndex;
+			const JointQuaternion parentRot = parentIndex < 0 ? quatIdentity() : globalRotations[parentIndex];
+			if (!pose.m_animated[i]) {
+				globalRotations[i] = parentRot;
+				continue;
+			}
+
+			batch.add(parentRot, pose.m_globalRotations[i]);
+			batchJoints.push_back(i);
+			globalRotations[i] = pose.m_globalRotations[i];
+		}
+
+		// Reference, recursive with matrices
+		RotationMatrix identity = MatrixFromQuaternion(quatIdentity());
+		WalkReference(root.get(), identity, indices, pose, locals);
+
+		batch.computeLocalEuler();
+		double difference = MaxDifference(batch, batchJoints, locals);
+		if (difference > vectorDifference)
+			vectorDifference = difference;
+		if (gimbalLocked && difference > lockedDifference)
+			lockedDifference = difference;
+
+		computeLocalEulerXYZScalar(&batch.m_parentX[0], &batch.m_parentY[0], &batch.m_parentZ[0], &batch.m_parentW[0],
+			&batch.m_globalX[0], &batch.m_globalY[0], &batch.m_globalZ[0], &batch.m_globalW[0], batch.size(),
+			&batch.m_eulerX[0], &batch.m_eulerY[0], &batch.m_eulerZ[0]);
+		difference = MaxDifference(batch, batchJoints, locals);
+		if (difference > scalarDifference)
+			scalarDifference = difference;
+		if (gimbalLocked && difference > lockedDifference)
+			lockedDifference = difference;
+	}
+
+	UI_Printf("  Flattened hierarchy matches its definition, every parent before its children");
+	UI_Printf("  Scalar kernel  largest difference %g degrees", scalarDifference);
+	UI_Printf("  %s kernel     largest difference %g degrees", isLocalEulerVectorized() ? "SSE" : "n/a", vectorDifference);
+	UI_Printf("  Gimbal locked  largest difference %g degrees", lockedDifference);
+
+	if (scalarDifference > tolerance || vectorDifference > tolerance) {
+		UI_Printf("Local rotations differ from the recursive reference by more than %g degrees", tolerance);
+		return false;
+	}
+	return true;
+}
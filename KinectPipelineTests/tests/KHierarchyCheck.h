@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Checks the flattened default joint hierarchy against its definition, then poses it with random joint rotations
+/// ( gimbal locked ones included ) and compares local rotations of the mapper's forward pass over the flattened array
+/// with the recursive walk and 3x3 matrix inverses mapping used before
+/// </summary>
+/// <param name="poseCount">Number of random poses</param>
+/// <param name="tolerance">Largest accepted difference between both local rotations, in degrees</param>
+/// <returns>False if the flattened hierarchy is wrong, or a local rotation differs by more than tolerance</returns>
+bool RunHierarchyCheck(unsigned int poseCount, double tolerance);
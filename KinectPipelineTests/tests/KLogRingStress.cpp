@@ -0,0 +1,224 @@
+#include "KLogRingStress.h"
+
+#include <string.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Lines pushed by every producer while the consumer drains the ring
+static const unsigned int c_drainedLineCount = 200000;
+
+// Lines pushed by every producer into a ring nobody drains, so most of them are refused
+static const unsigned int c_fullLineCount = 4 * LogRing::c_capacity;
+
+// Producer id and line number take this many characters at the start of every line
+static const size_t c_lineHeaderSize = 16;
+
+/// <summary>
+/// Line a producer pushes: its id and line number, then a run of a single character whose length and value depend on both,
+/// up to the longest line the ring keeps. A line mixing two writes no longer matches
+/// </summary>
+/// <param name="producer">Producer id</param>
+/// <param name="index">Line number, for that producer</param>
+/// <param name="line">Output, LogRing::c_lineSize characters</param>
+static void FormatLine(unsigned int producer, unsigned int index, char *line) {
+	FBXSDK_sprintf(line, LogRing::c_lineSize, "%03u %011u ", producer, index);
+
+	size_t fillSize = (size_t(index) * 7 + producer) % (LogRing::c_lineSize - c_lineHeaderSize);
+	memset(line + c_lineHeaderSize, 'a' + (producer + index) % 26, fillSize);
+	line[c_lineHeaderSize + fillSize] = '\0';
+}
+
+/*
+	What a producer pushed, and what came out of the ring for it
+*/
+struct ProducerLog {
+	// Pushes the ring accepted and refused
+	unsigned int m_nAccepted;
+	unsigned int m_nRefused;
+
+	// Lines popped, and the next line number expected ( anything lower is a duplicate or out of order )
+	unsigned int m_nPopped;
+	unsigned int m_nextIndex;
+};
+
+/*
+	Checks lines popped from the ring
+*/
+class LineChecker {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="logs">What every producer pushed</param>
+	LineChecker(std::vector<ProducerLog> &logs) :
+	m_logs(logs),
+	m_nTorn(0),
+	m_nReordered(0)
+	{
+	}
+
+	/// <summary>
+	/// Checks a popped line
+	/// </summary>
+	void check(const char *line) {
+		unsigned int producer = 0, index = 0;
+		if (sscanf(line, "%u %u", &producer, &index) != 2 || producer >= m_logs.size()) {
+			m_nTorn++;
+			return;
+		}
+
+		char expected[LogRing::c_lineSize];
+		FormatLine(producer, index, expected);
+		if (strcmp(line, expected) != 0) {
+			m_nTorn++;
+			return;
+		}
+
+		// Lines of a producer leave the ring in the order it pushed them, some of them missing if they were refused
+		ProducerLog &log = m_logs[producer];
+		if (index < log.m_nextIndex)
+			m_nReordered++;
+		log.m_nextIndex = index + 1;
+		log.m_nPopped++;
+	}
+
+	unsigned int getTornCount() const { return m_nTorn; };
+	unsigned int getReorderedCount() const { return m_nReordered; };
+
+private:
+	std::vector<ProducerLog> &m_logs;
+	unsigned int m_nTorn;
+	unsigned int m_nReordered;
+};
+
+/// <summary>
+/// Pushes lines from a producer thread, counting the ones the ring refused. A refused producer yields, leaving the consumer
+/// some time to drain the ring even with fewer cores than threads
+/// </summary>
+static void ProduceLines(LogRing *pRing, unsigned int producer, unsigned int lineCount, ProducerLog *pLog) {
+	char line[LogRing::c_lineSize];
+	for (unsigned int i = 0; i < lineCount; i++) {
+		FormatLine(producer, i, line);
+		if (pRing->push(line))
+			pLog->m_nAccepted++;
+		else {
+			pLog->m_nRefused++;
+			std::this_thread::yield();
+		}
+	}
+}
+
+/// <summary>
+/// Pushes lines from every producer at once, into a ring being drained or not, then checks every line
+/// </summary>
+/// <param name="producerCount">Number of producer threads</param>
+/// <param name="lineCount">Lines pushed by every producer</param>
+/// <param name="drain">Whether a consumer drains the ring while producers push</param>
+/// <returns>False if a line was lost, torn or reordered, or the dropped count is wrong</returns>
+static bool RunProducers(unsigned int producerCount, unsigned int lineCount, bool drain) {
+
+	// Too big for the stack
+	std::unique_ptr<LogRing> ring(new LogRing);
+
+	ProducerLog emptyLog = { 0, 0, 0, 0 };
+	std::vector<ProducerLog> logs(producerCount, emptyLog);
+	LineChecker checker(logs);
+
+	std::atomic_bool producing(true);
+	std::thread consumer;
+	if (drain) {
+		consumer = std::thread([&] {
+			char line[LogRing::c_lineSize];
+			for (;;) {
+				// Producers are checked before popping, so nothing they pushed is left behind
+				bool done = !producing;
+				while (ring->pop(line, sizeof(line)))
+					checker.check(line);
+				if (done)
+					break;
+			}
+		});
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> producers;
+	for (unsigned int p = 0; p < producerCount; p++)
+		producers.push_back(std::thread(ProduceLines, ring.get(), p, lineCount, &logs[p]));
+	for (auto &it : producers)
+		it.join();
+
+	producing = false;
+	if (drain) {
+		consumer.join();
+	}
+	else {
+		char line[LogRing::c_lineSize];
+		while (ring->pop(line, sizeof(line)))
+			checker.check(line);
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long long accepted = 0, refused = 0, popped = 0;
+	for (auto &log : logs) {
+		accepted += log.m_nAccepted;
+		refused += log.m_nRefused;
+		popped += log.m_nPopped;
+	}
+
+	UI_Printf("  %-8s  %9llu  %9llu  %9llu  %9u  %5u  %9u  %7.0f",
+		drain ? "drained" : "full", (unsigned long long)producerCount * lineCount, accepted, popped,
+		ring->getDroppedCount(), checker.getTornCount(), checker.getReorderedCount(), elapsed > 0 ? accepted / elapsed / 1000.0 : 0.0);
+
+	bool success = true;
+	for (unsigned int p = 0; p < producerCount; p++) {
+		const ProducerLog &log = logs[p];
+		if (log.m_nPopped != log.m_nAccepted) {
+			UI_Printf("  Producer %u: %u lines accepted, but %u popped", p, log.m_nAccepted, log.m_nPopped);
+			success = false;
+		}
+	}
+
+	if (ring->getDroppedCount() != refused) {
+		UI_Printf("  Ring counted %u dropped lines, producers were refused %llu", ring->getDroppedCount(), refused);
+		success = false;
+	}
+
+	// Nobody drained the ring, so it took exactly as many lines as it has slots
+	if (!drain && accepted != LogRing::c_capacity) {
+		UI_Printf("  Full ring accepted %llu lines, instead of %u", accepted, (unsigned int)LogRing::c_capacity);
+		success = false;
+	}
+
+	if (checker.getTornCount() > 0 || checker.getReorderedCount() > 0)
+		success = false;
+
+	return success;
+}
+
+/// <summary>
+/// Pushes log lines into a LogRing from several producer threads at once, first with a consumer draining it, then with nobody
+/// draining it until it is full. Checks every line arrives once, whole and in the order its producer pushed it, and that
+/// every line the ring refused is counted as dropped
+/// </summary>
+/// <param name="producerCount">Number of producer threads</param>
+/// <returns>False if a line was lost, torn, duplicated or reordered, or the dropped count is wrong</returns>
+bool RunLogRingStress(unsigned int producerCount) {
+
+	if (producerCount == 0)
+		producerCount = 1;
+
+	UI_Printf("Log ring, %u producers, %u slots of %u characters:", producerCount, (unsigned int)LogRing::c_capacity, (unsigned int)LogRing::c_lineSize);
+	UI_Printf("  ring         pushed   accepted     popped    dropped  torn  reordered  k lines/s");
+
+	bool success = RunProducers(producerCount, c_drainedLineCount, true);
+	if (!RunProducers(producerCount, c_fullLineCount, false))
+		success = false;
+
+	if (!success)
+		UI_Printf("Log ring lost, tore or reordered lines, or miscounted dropped ones");
+
+	return success;
+}
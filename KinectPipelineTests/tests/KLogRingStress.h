@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Pushes log lines into a LogRing from several producer threads at once, first with a consumer draining it, then with nobody
+/// draining it until it is full. Checks every line arrives once, whole and in the order its producer pushed it, and that
+/// every line the ring refused is counted as dropped
+/// </summary>
+/// <param name="producerCount">Number of producer threads</param>
+/// <returns>False if a line was lost, torn, duplicated or reordered, or the dropped count is wrong</returns>
+bool RunLogRingStress(unsigned int producerCount);
@@ -0,0 +1,294 @@
+#include "KMetricsCheck.h"
+
+#include <algorithm>
+#include <random>
+#include <string.h>
+#include <math.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Times every thread adds to every counter
+static const unsigned int c_addCount = 1000000;
+
+// Values every thread records in every histogram
+static const unsigned int c_recordCount = 250000;
+
+// Percentiles checked against the recorded values
+static const double c_checkedPercentiles[] = { 0.5, 0.9, 0.99 };
+
+/*
+	What a thread recorded, to be compared with snapshots
+*/
+struct RecordedMetrics {
+	unsigned long long m_counters[MetricCounter_Count];
+	HistogramSnapshot m_histograms[MetricHistogram_Count];
+
+	// Every value recorded in the first histogram, to check percentiles
+	std::vector<unsigned long long> m_values;
+
+	// Time spent adding and recording, in seconds
+	double m_addTime;
+	double m_recordTime;
+};
+
+/// <summary>
+/// Bucket a value falls in: 0 for zero, otherwise one more than the position of its highest bit
+/// </summary>
+static int ExpectedBucket(unsigned long long value) {
+	int bucket = value ? int(floor(log2(double(value)))) + 1 : 0;
+	return bucket < HistogramSnapshot::c_bucketCount ? bucket : HistogramSnapshot::c_bucketCount - 1;
+}
+
+/// <summary>
+/// Adds to every counter and records values in every histogram, from a thread of its own, keeping track of what it recorded
+/// </summary>
+/// <param name="threadIndex">Thread index, which makes its values differ from the other threads</param>
+/// <param name="pRecorded">Output, what was recorded</param>
+static void RecordMetrics(unsigned int threadIndex, RecordedMetrics *pRecorded) {
+	memset(pRecorded->m_counters, 0, sizeof(pRecorded->m_counters));
+	memset(pRecorded->m_histograms, 0, sizeof(pRecorded->m_histograms));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int c = 0; c < MetricCounter_Count; c++) {
+		unsigned long long amount = threadIndex + c + 1;
+		for (unsigned int i = 0; i < c_addCount; i++)
+			PipelineMetrics::add(MetricCounter(c), amount);
+		pRecorded->m_counters[c] = amount * c_addCount;
+	}
+	pRecorded->m_addTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Spread over many buckets, zeros included
+	std::mt19937 generator(threadIndex);
+	std::vector<unsigned long long> values(c_recordCount);
+	for (auto &value : values)
+		value = generator() >> (11 + generator() % 22);
+
+	start = std::chrono::steady_clock::now();
+	for (int h = 0; h < MetricHistogram_Count; h++) {
+		for (auto value : values)
+			PipelineMetrics::record(MetricHistogram(h), value << h);
+	}
+	pRecorded->m_recordTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (int h = 0; h < MetricHistogram_Count; h++) {
+		HistogramSnapshot &histogram = pRecorded->m_histograms[h];
+		for (auto value : values) {
+			unsigned long long recorded = value << h;
+			histogram.m_count++;
+			histogram.m_sum += recorded;
+			histogram.m_max = std::max(histogram.m_max, recorded);
+			histogram.m_buckets[ExpectedBucket(recorded)]++;
+		}
+	}
+	pRecorded->m_values.swap(values);
+}
+
+/// <summary>
+/// Whether every counter and histogram of a snapshot is at least as high as in an earlier one
+/// </summary>
+static bool IsNotBehind(const MetricsSnapshot &snapshot, const MetricsSnapshot &earlier) {
+	for (int c = 0; c < MetricCounter_Count; c++) {
+		if (snapshot.m_counters[c] < earlier.m_counters[c])
+			return false;
+	}
+	for (int h = 0; h < MetricHistogram_Count; h++) {
+		const HistogramSnapshot &histogram = snapshot.m_histograms[h];
+		const HistogramSnapshot &earlierHistogram = earlier.m_histograms[h];
+		if (histogram.m_count < earlierHistogram.m_count || histogram.m_sum < earlierHistogram.m_sum || histogram.m_max < earlierHistogram.m_max)
+			return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Percentile of recorded values as HistogramSnapshot::getPercentile reports it: upper bound of the bucket the value of that rank falls in
+/// </summary>
+/// <param name="sortedValues">Recorded values, sorted</param>
+/// <param name="fraction">Percentile, between 0 and 1</param>
+static unsigned long long ExpectedPercentile(const std::vector<unsigned long long> &sortedValues, double fraction) {
+	size_t rank = size_t(ceil(fraction * double(sortedValues.size())));
+	if (rank < 1)
+		rank = 1;
+
+	unsigned long long value = sortedValues[rank - 1];
+	int bucket = ExpectedBucket(value);
+	unsigned long long upperBound = bucket ? (1ULL << bucket) - 1 : 0;
+	return std::min(upperBound, sortedValues.back());
+}
+
+/// <summary>
+/// Reads a whole text file
+/// </summary>
+/// <returns>False if file could not be read</returns>
+static bool ReadTextFile(const char *fileName, std::string &text) {
+	FILE *pFile;
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	pFile = fopen(fileName, "rb");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+	if (!pFile)
+		return false;
+
+	char buffer[4096];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		text.append(buffer, size);
+
+	fclose(pFile);
+	return true;
+}
+
+/// <summary>
+/// Records known counter and histogram values from several threads at once, while snapshots are taken, then writes the
+/// snapshot as JSON and reads it back. Checks snapshots never go backwards, and the final one and its file hold exactly what was recorded
+/// </summary>
+/// <param name="threadCount">Number of recording threads</param>
+/// <param name="fileName">JSON file the snapshot is written to</param>
+/// <returns>False if a snapshot or the file differ from what was recorded</returns>
+bool RunMetricsCheck(unsigned int threadCount, const char *fileName) {
+
+	if (threadCount == 0)
+		threadCount = 1;
+
+	// Anything recorded before is left out of the comparison
+	MetricsSnapshot baseline = PipelineMetrics::getSnapshot();
+
+	std::vector<RecordedMetrics> recorded(threadCount);
+	std::atomic<unsigned int> runningCount(threadCount);
+	std::vector<std::thread> threads;
+	for (unsigned int t = 0; t < threadCount; t++) {
+		threads.push_back(std::thread([&recorded, &runningCount, t] {
+			RecordMetrics(t, &recorded[t]);
+			runningCount--;
+		}));
+	}
+
+	// Queried while threads record, as the application does every 5 seconds
+	unsigned int snapshotCount = 0, behindCount = 0;
+	MetricsSnapshot previous = baseline;
+	while (runningCount > 0) {
+		MetricsSnapshot snapshot = PipelineMetrics::getSnapshot();
+		if (!IsNotBehind(snapshot, previous))
+			behindCount++;
+		previous = snapshot;
+		snapshotCount++;
+	}
+
+	for (auto &it : threads)
+		it.join();
+
+	MetricsSnapshot last = PipelineMetrics::getSnapshot();
+	if (!IsNotBehind(last, previous))
+		behindCount++;
+
+	UI_Printf("Metrics check, %u threads, %u snapshots taken while recording:", threadCount, snapshotCount);
+
+	bool success = true;
+	if (behindCount > 0) {
+		UI_Printf("  %u snapshots went backwards", behindCount);
+		success = false;
+	}
+
+	// Counters
+	for (int c = 0; c < MetricCounter_Count; c++) {
+		unsigned long long expected = 0;
+		for (auto &it : recorded)
+			expected += it.m_counters[c];
+
+		unsigned long long value = last.m_counters[c] - baseline.m_counters[c];
+		if (value != expected) {
+			UI_Printf("  %s is %llu, %llu were added", PipelineMetrics::getName(MetricCounter(c)), value, expected);
+			success = false;
+		}
+	}
+
+	// Histograms, bucket by bucket
+	for (int h = 0; h < MetricHistogram_Count; h++) {
+		HistogramSnapshot expected;
+		memset(&expected, 0, sizeof(expected));
+		for (auto &it : recorded) {
+			const HistogramSnapshot &histogram = it.m_histograms[h];
+			expected.m_count += histogram.m_count;
+			expected.m_sum += histogram.m_sum;
+			expected.m_max = std::max(expected.m_max, histogram.m_max);
+			for (int b = 0; b < HistogramSnapshot::c_bucketCount; b++)
+				expected.m_buckets[b] += histogram.m_buckets[b];
+		}
+
+		const HistogramSnapshot &histogram = last.m_histograms[h];
+		const HistogramSnapshot &before = baseline.m_histograms[h];
+		bool matches = histogram.m_count - before.m_count == expected.m_count && histogram.m_sum - before.m_sum == expected.m_sum
+			&& histogram.m_max == std::max(before.m_max, expected.m_max);
+		for (int b = 0; b < HistogramSnapshot::c_bucketCount; b++) {
+			if (histogram.m_buckets[b] - before.m_buckets[b] != expected.m_buckets[b])
+				matches = false;
+		}
+
+		if (!matches) {
+			UI_Printf("  %s holds %llu values summing to %llu, %llu summing to %llu were recorded, or its buckets differ",
+				PipelineMetrics::getName(MetricHistogram(h)), histogram.m_count - before.m_count, histogram.m_sum - before.m_sum, expected.m_count, expected.m_sum);
+			success = false;
+		}
+	}
+
+	// Percentiles, only meaningful if nothing was recorded before
+	const HistogramSnapshot &checked = last.m_histograms[0];
+	if (baseline.m_histograms[0].m_count == 0) {
+		std::vector<unsigned long long> values;
+		for (auto &it : recorded)
+			values.insert(values.end(), it.m_values.begin(), it.m_values.end());
+		std::sort(values.begin(), values.end());
+
+		for (double fraction : c_checkedPercentiles) {
+			unsigned long long expected = ExpectedPercentile(values, fraction);
+			unsigned long long value = checked.getPercentile(fraction);
+			UI_Printf("  %s p%g %llu ( expected %llu )", PipelineMetrics::getName(MetricHistogram(0)), fraction * 100, value, expected);
+			if (value != expected)
+				success = false;
+		}
+	}
+
+	// Snapshot file, as a headless client reads it
+	if (!PipelineMetrics::writeSnapshot(fileName)) {
+		UI_Printf("  Could not write %s", fileName);
+		return false;
+	}
+
+	std::string json;
+	if (!ReadTextFile(fileName, json)) {
+		UI_Printf("  Could not read %s back", fileName);
+		return false;
+	}
+
+	char entry[256];
+	for (int c = 0; c < MetricCounter_Count; c++) {
+		FBXSDK_sprintf(entry, sizeof(entry), "\"%s\": %llu%s\n", PipelineMetrics::getName(MetricCounter(c)), last.m_counters[c], (c + 1 < MetricCounter_Count) ? "," : "");
+		if (json.find(entry) == std::string::npos) {
+			UI_Printf("  %s does not hold %s = %llu", fileName, PipelineMetrics::getName(MetricCounter(c)), last.m_counters[c]);
+			success = false;
+		}
+	}
+	for (int h = 0; h < MetricHistogram_Count; h++) {
+		const HistogramSnapshot &histogram = last.m_histograms[h];
+		FBXSDK_sprintf(entry, sizeof(entry), "\"%s\": { \"count\": %llu, \"sum\": %llu, ", PipelineMetrics::getName(MetricHistogram(h)), histogram.m_count, histogram.m_sum);
+		if (json.find(entry) == std::string::npos) {
+			UI_Printf("  %s does not hold %s with %llu values", fileName, PipelineMetrics::getName(MetricHistogram(h)), histogram.m_count);
+			success = false;
+		}
+	}
+
+	// Cost of recording, on the threads that recorded
+	double addTime = 0, recordTime = 0;
+	for (auto &it : recorded) {
+		addTime += it.m_addTime;
+		recordTime += it.m_recordTime;
+	}
+	UI_Printf("  add() %.2f ns, record() %.2f ns, snapshot written to %s",
+		addTime * 1e9 / (double(threadCount) * c_addCount * MetricCounter_Count),
+		recordTime * 1e9 / (double(threadCount) * c_recordCount * MetricHistogram_Count), fileName);
+
+	if (!success)
+		UI_Printf("Metrics differ from what was recorded");
+
+	return success;
+}
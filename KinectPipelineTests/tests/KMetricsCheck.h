@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Records known counter and histogram values from several threads at once, while snapshots are taken, then writes the
+/// snapshot as JSON and reads it back. Checks snapshots never go backwards, and the final one and its file hold exactly what was recorded
+/// </summary>
+/// <param name="threadCount">Number of recording threads</param>
+/// <param name="fileName">JSON file the snapshot is written to</param>
+/// <returns>False if a snapshot or the file differ from what was recorded</returns>
+bool RunMetricsCheck(unsigned int threadCount, const char *fileName);
@@ -0,0 +1,673 @@
+#include "KPipelineBenchmark.h"
+#include "KSyntheticTake.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib,"psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+/*
+	Take run by the benchmark
+*/
+struct BenchmarkTake {
+	unsigned int m_bodyCount;
+	unsigned int m_seconds;
+};
+
+// Save time against session length with a single body, then mapping cost against body count.
+// Takes grow, so peak memory after each one is that of the largest take so far
+static const BenchmarkTake c_takes[] = {
+	{ 1, 10 },
+	{ 1, 60 },
+	{ 2, 60 },
+	{ 4, 60 },
+	{ 6, 60 },
+	{ 1, 300 },
+	{ 6, 300 }
+};
+
+// Same takes on every run
+static const unsigned int c_benchmarkSeed = 42;
+
+// Take mapped with skeletons bound once, then looked up by name on every frame as mapping used to
+static const BenchmarkTake c_bindingTake = { 6, 60 };
+
+// Body counts mapped one after another, then on the mapping workers, then with spare skeletons
+static const unsigned int c_parallelBodyCounts[] = { 1, 3, 6 };
+
+// Length of the parallel mapping takes
+static const unsigned int c_parallelSeconds = 20;
+
+// Takes filtered on a single thread and on the workers, against body count and take length
+static const BenchmarkTake c_filterTakes[] = {
+	{ 1, 60 },
+	{ 3, 60 },
+	{ 6, 60 },
+	{ 1, 300 },
+	{ 6, 300 }
+};
+
+// Takes saved with and without key reduction, at the default tolerances
+static const BenchmarkTake c_reductionTakes[] = {
+	{ 1, 60 },
+	{ 6, 60 },
+	{ 6, 300 }
+};
+
+/*
+	Measures of a single take
+*/
+struct BenchmarkResult {
+	BenchmarkTake m_take;
+	unsigned int m_frames;
+	unsigned long long m_bodyFrames;
+	unsigned long long m_keys;
+
+	// Times, in seconds
+	double m_mapTime;
+	double m_commitTime;
+	double m_filterTime;
+	double m_saveTime;
+
+	// Size of the saved scene, in bytes
+	long long m_fileSize;
+
+	// Largest memory use of the process so far, in bytes
+	unsigned long long m_peakMemory;
+};
+
+/*
+	Time spent mapping each frame of a take, in seconds
+*/
+struct FrameMappingTime {
+	double m_mean;
+	double m_worst;
+	// Frame in which every body is seen for the first time
+	double m_first;
+};
+
+/*
+	Mapping time of a take, with skeletons bound once and looked up on every frame
+*/
+struct SkeletonBindingResult {
+	BenchmarkTake m_take;
+	unsigned long long m_bodyFrames;
+
+	// Times, in seconds
+	double m_boundTime;
+	double m_lookedUpTime;
+};
+
+/*
+	Mapping time of a body count, with and without workers, and with skeletons built ahead of time
+*/
+struct ParallelMappingResult {
+	unsigned int m_bodyCount;
+	FrameMappingTime m_serial;
+	FrameMappingTime m_parallel;
+	FrameMappingTime m_spare;
+};
+
+/*
+	Post processing time of a take, on a single thread and shared among the workers
+*/
+struct ParallelFilterResult {
+	BenchmarkTake m_take;
+	size_t m_curveNodes;
+
+	// Times, in seconds
+	double m_serialTime;
+	double m_parallelTime;
+
+	// Both ways gave the same keys
+	bool m_bIdentical;
+};
+
+/*
+	Keys and file size of a take, with and without key reduction
+*/
+struct KeyReductionResult {
+	BenchmarkTake m_take;
+	PostProcessingReport m_report;
+
+	// Time to reduce every curve on the workers, in seconds
+	double m_reductionTime;
+
+	// Size of the saved scene, in bytes
+	long long m_fullSize;
+	long long m_reducedSize;
+};
+
+
+/// <summary>
+/// Largest memory use of the process so far, in bytes
+/// </summary>
+static unsigned long long GetPeakMemory() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+}
+
+/// <summary>
+/// Seconds elapsed since a point in time
+/// </summary>
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// <summary>
+/// Maps, filters and saves a synthetic take
+/// </summary>
+/// <param name="take">Take to be run</param>
+/// <param name="sceneFile">FBX file the take is saved to</param>
+/// <param name="result">Output, measures of the take</param>
+/// <returns>False if scene could not be saved</returns>
+static bool RunTake(const BenchmarkTake &take, const char *sceneFile, BenchmarkResult &result) {
+
+	memset(&result, 0, sizeof(result));
+	result.m_take = take;
+	result.m_frames = take.m_seconds * c_syntheticFPS;
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = take.m_bodyCount;
+	settings.m_seed = c_benchmarkSeed;
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pScene = CreateAnimationScene(pManager);
+	MappingSession session(pScene);
+
+	unsigned long long keysBefore = PipelineMetrics::getSnapshot().m_counters[MetricCounter_KeysCommitted];
+
+	// Frames are generated one at a time, so generation is neither timed nor held in memory
+	BodyFrame frame;
+	std::chrono::steady_clock::duration mapTime(0);
+	for (unsigned int i = 0; i < result.m_frames; i++) {
+		GenerateSyntheticFrame(settings, i, frame);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		KinectSkeletonMapper::mapFrame(session, frame);
+		mapTime += std::chrono::steady_clock::now() - start;
+	}
+	result.m_mapTime = std::chrono::duration<double>(mapTime).count();
+	result.m_bodyFrames = session.m_nMappedBodies;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	session.commitKeys();
+	result.m_commitTime = SecondsSince(start);
+
+	result.m_keys = PipelineMetrics::getSnapshot().m_counters[MetricCounter_KeysCommitted] - keysBefore;
+
+	start = std::chrono::steady_clock::now();
+	KinectSkeletonMapper::applyPostProcessingFilters(pScene);
+	result.m_filterTime = SecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	bool success = SaveScene(pManager, pScene, sceneFile, pManager->GetIOPluginRegistry()->GetNativeWriterFormat(), false);
+	result.m_saveTime = SecondsSince(start);
+
+	result.m_peakMemory = GetPeakMemory();
+
+	session.reset(NULL);
+	DestroySdkObjects(pManager, false);
+
+	if (success) {
+		result.m_fileSize = FbxFileUtils::Size(sceneFile);
+		FbxFileUtils::Delete(sceneFile);
+	}
+
+	return success;
+}
+
+/// <summary>
+/// Maps a synthetic take twice: with skeletons bound the first time their body is seen, then with every skeleton
+/// looked up by name on every frame, as mapping did before bindings. Nothing is saved
+/// </summary>
+/// <param name="take">Take to be mapped</param>
+static SkeletonBindingResult RunBindingTake(const BenchmarkTake &take) {
+
+	SkeletonBindingResult result;
+	result.m_take = take;
+	result.m_bodyFrames = 0;
+	result.m_boundTime = result.m_lookedUpTime = 0;
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = take.m_bodyCount;
+	settings.m_seed = c_benchmarkSeed;
+
+	unsigned int frameCount = take.m_seconds * c_syntheticFPS;
+	BodyFrame frame;
+
+	for (int lookUp = 0; lookUp < 2; lookUp++) {
+		FbxManager *pManager = CreateSdkManager();
+		FbxScene *pScene = CreateAnimationScene(pManager);
+		MappingSession session(pScene);
+
+		std::chrono::steady_clock::duration mapTime(0);
+		for (unsigned int i = 0; i < frameCount; i++) {
+			GenerateSyntheticFrame(settings, i, frame);
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if (lookUp && frame.readStatus) {
+				for (int b = 0; b < BODY_COUNT; b++) {
+					if (frame.bodies[b].isTracked)
+						KinectSkeletonMapper::lookUpSkeleton(session, frame.bodies[b].trackingId);
+				}
+			}
+			KinectSkeletonMapper::mapFrame(session, frame);
+			mapTime += std::chrono::steady_clock::now() - start;
+		}
+
+		if (lookUp)
+			result.m_lookedUpTime = std::chrono::duration<double>(mapTime).count();
+		else
+			result.m_boundTime = std::chrono::duration<double>(mapTime).count();
+		result.m_bodyFrames = session.m_nMappedBodies;
+
+		session.reset(NULL);
+		DestroySdkObjects(pManager, false);
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Maps a synthetic take, and measures the time taken by every frame. Nothing is saved
+/// </summary>
+/// <param name="bodyCount">Number of bodies of the take</param>
+/// <param name="pWorkers">Workers mapping bodies in parallel, NULL maps them one after another</param>
+/// <param name="spareSkeletons">Build skeletons before the first frame, as the recording application does</param>
+static FrameMappingTime RunMappingTake(unsigned int bodyCount, MappingWorkerPool *pWorkers, bool spareSkeletons) {
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = bodyCount;
+	settings.m_seed = c_benchmarkSeed;
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pScene = CreateAnimationScene(pManager);
+	MappingSession session(pScene);
+	session.m_pWorkers = pWorkers;
+	if (spareSkeletons)
+		KinectSkeletonMapper::prepareSpareSkeletons(session, BODY_COUNT);
+
+	FrameMappingTime time = { 0.0, 0.0, 0.0 };
+	unsigned int frameCount = c_parallelSeconds * c_syntheticFPS;
+	BodyFrame frame;
+	for (unsigned int i = 0; i < frameCount; i++) {
+		GenerateSyntheticFrame(settings, i, frame);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		KinectSkeletonMapper::mapFrame(session, frame);
+		double frameTime = SecondsSince(start);
+
+		time.m_mean += frameTime;
+		if (frameTime > time.m_worst)
+			time.m_worst = frameTime;
+		if (i == 0)
+			time.m_first = frameTime;
+	}
+	time.m_mean /= frameCount;
+
+	session.reset(NULL);
+	DestroySdkObjects(pManager, false);
+	return time;
+}
+
+/// <summary>
+/// Maps a synthetic take into a new scene, with every key committed
+/// </summary>
+/// <param name="pManager">FBX SDK manager owning the scene</param>
+/// <param name="take">Take to be mapped</param>
+static FbxScene *MapTake(FbxManager *pManager, const BenchmarkTake &take) {
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = take.m_bodyCount;
+	settings.m_seed = c_benchmarkSeed;
+
+	FbxScene *pScene = CreateAnimationScene(pManager);
+	MappingSession session(pScene);
+
+	unsigned int frameCount = take.m_seconds * c_syntheticFPS;
+	BodyFrame frame;
+	for (unsigned int i = 0; i < frameCount; i++) {
+		GenerateSyntheticFrame(settings, i, frame);
+		KinectSkeletonMapper::mapFrame(session, frame);
+	}
+	session.commitKeys();
+
+	return pScene;
+}
+
+/// <summary>
+/// Whether two lists of curve nodes have the same keys
+/// </summary>
+static bool HaveSameKeys(const std::vector<FilterCurveNode> &curveNodesA, const std::vector<FilterCurveNode> &curveNodesB) {
+	if (curveNodesA.size() != curveNodesB.size())
+		return false;
+
+	for (size_t i = 0; i < curveNodesA.size(); i++) {
+		for (unsigned int c = 0; c < 3; c++) {
+			FbxAnimCurve *pCurveA = curveNodesA[i].m_pCurveNode->GetCurve(c);
+			FbxAnimCurve *pCurveB = curveNodesB[i].m_pCurveNode->GetCurve(c);
+			if (!pCurveA || !pCurveB) {
+				if (pCurveA != pCurveB)
+					return false;
+				continue;
+			}
+
+			int keyCount = pCurveA->KeyGetCount();
+			if (keyCount != pCurveB->KeyGetCount())
+				return false;
+			for (int k = 0; k < keyCount; k++) {
+				if (pCurveA->KeyGetTime(k) != pCurveB->KeyGetTime(k) || pCurveA->KeyGetValue(k) != pCurveB->KeyGetValue(k))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Maps the same synthetic take twice, and resamples and reduces one copy on a single thread and the other on the workers
+/// </summary>
+/// <param name="take">Take to be filtered</param>
+/// <param name="workers">Workers sharing the curve nodes with the calling thread</param>
+static ParallelFilterResult RunFilterTake(const BenchmarkTake &take, MappingWorkerPool &workers) {
+
+	ParallelFilterResult result;
+	result.m_take = take;
+
+	// Resampling and key reduction go over every key of every curve. The unroll filter always runs on the calling thread,
+	// so it has no parallel time to measure
+	PostProcessingSettings settings;
+	settings.m_resampleMode = FbxTime::eFrames30;
+	settings.m_bReduceKeys = true;
+	PostProcessingPipeline pipeline(settings);
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pSerialScene = MapTake(pManager, take);
+	FbxScene *pParallelScene = MapTake(pManager, take);
+
+	std::vector<FilterCurveNode> serialCurveNodes, parallelCurveNodes;
+	PostProcessingPipeline::collectCurveNodes(pSerialScene, serialCurveNodes);
+	PostProcessingPipeline::collectCurveNodes(pParallelScene, parallelCurveNodes);
+	result.m_curveNodes = serialCurveNodes.size();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pipeline.apply(serialCurveNodes, NULL);
+	result.m_serialTime = SecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	pipeline.apply(parallelCurveNodes, &workers);
+	result.m_parallelTime = SecondsSince(start);
+
+	result.m_bIdentical = HaveSameKeys(serialCurveNodes, parallelCurveNodes);
+
+	DestroySdkObjects(pManager, false);
+	return result;
+}
+
+/// <summary>
+/// Saves a synthetic take, then reduces its keys on the workers and saves it again
+/// </summary>
+/// <param name="take">Take to be reduced</param>
+/// <param name="workers">Workers sharing the curve nodes with the calling thread</param>
+/// <param name="sceneFile">FBX file the take is saved to</param>
+/// <param name="result">Output, keys and file sizes</param>
+/// <returns>False if scene could not be saved</returns>
+static bool RunReductionTake(const BenchmarkTake &take, MappingWorkerPool &workers, const char *sceneFile, KeyReductionResult &result) {
+
+	result.m_take = take;
+	result.m_reductionTime = 0;
+	result.m_fullSize = result.m_reducedSize = 0;
+
+	PostProcessingSettings settings;
+	settings.m_bReduceKeys = true;
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pScene = MapTake(pManager, take);
+	int fileFormat = pManager->GetIOPluginRegistry()->GetNativeWriterFormat();
+
+	bool success = SaveScene(pManager, pScene, sceneFile, fileFormat, false);
+	if (success) {
+		result.m_fullSize = FbxFileUtils::Size(sceneFile);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		KinectSkeletonMapper::applyPostProcessingFilters(pScene, settings, &workers, &result.m_report);
+		result.m_reductionTime = SecondsSince(start);
+
+		success = SaveScene(pManager, pScene, sceneFile, fileFormat, false);
+		if (success)
+			result.m_reducedSize = FbxFileUtils::Size(sceneFile);
+		FbxFileUtils::Delete(sceneFile);
+	}
+
+	DestroySdkObjects(pManager, false);
+	return success;
+}
+
+/// <summary>
+/// Writes results as JSON
+/// </summary>
+/// <returns>False if file could not be written</returns>
+static bool WriteResults(const char *resultFile, const std::vector<BenchmarkResult> &results, const SkeletonBindingResult &bindingResult, unsigned int workerCount, const std::vector<ParallelMappingResult> &parallelResults, const std::vector<ParallelFilterResult> &filterResults, const std::vector<KeyReductionResult> &reductionResults) {
+	FILE *pFile;
+	FBXSDK_CRT_SECURE_NO_WARNING_BEGIN
+	pFile = fopen(resultFile, "w");
+	FBXSDK_CRT_SECURE_NO_WARNING_END
+	if (!pFile)
+		return false;
+
+	fprintf(pFile, "{\n\t\"seed\": %u,\n\t\"rotation_kernel\": \"%s\",\n\t\"takes\": [\n",
+		c_benchmarkSeed, isLocalEulerVectorized() ? "sse" : "scalar");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult &result = results[i];
+		double keyTime = result.m_mapTime + result.m_commitTime;
+
+		fprintf(pFile, "\t\t{ \"bodies\": %u, \"seconds\": %u, \"frames\": %u, \"body_frames\": %llu, \"keys\": %llu, "
+			"\"map_ns_per_body_frame\": %.1f, \"keys_per_second\": %.0f, \"commit_ms\": %.3f, \"filter_ms\": %.3f, \"save_ms\": %.3f, "
+			"\"file_bytes\": %lld, \"peak_memory_bytes\": %llu }%s\n",
+			result.m_take.m_bodyCount, result.m_take.m_seconds, result.m_frames, result.m_bodyFrames, result.m_keys,
+			result.m_bodyFrames ? 1e9 * result.m_mapTime / double(result.m_bodyFrames) : 0.0,
+			keyTime > 0 ? double(result.m_keys) / keyTime : 0.0,
+			1e3 * result.m_commitTime, 1e3 * result.m_filterTime, 1e3 * result.m_saveTime,
+			result.m_fileSize, result.m_peakMemory, (i + 1 < results.size()) ? "," : "");
+	}
+
+	fprintf(pFile, "\t],\n\t\"skeleton_binding\": { \"bodies\": %u, \"seconds\": %u, \"body_frames\": %llu, "
+		"\"bound_ns_per_body_frame\": %.1f, \"looked_up_ns_per_body_frame\": %.1f },\n",
+		bindingResult.m_take.m_bodyCount, bindingResult.m_take.m_seconds, bindingResult.m_bodyFrames,
+		bindingResult.m_bodyFrames ? 1e9 * bindingResult.m_boundTime / double(bindingResult.m_bodyFrames) : 0.0,
+		bindingResult.m_bodyFrames ? 1e9 * bindingResult.m_lookedUpTime / double(bindingResult.m_bodyFrames) : 0.0);
+
+	fprintf(pFile, "\t\"mapping_workers\": %u,\n\t\"parallel_mapping\": [\n", workerCount);
+
+	for (size_t i = 0; i < parallelResults.size(); i++) {
+		const ParallelMappingResult &result = parallelResults[i];
+		fprintf(pFile, "\t\t{ \"bodies\": %u, \"serial_us_per_frame\": %.2f, \"serial_worst_us\": %.2f, "
+			"\"parallel_us_per_frame\": %.2f, \"parallel_worst_us\": %.2f }%s\n",
+			result.m_bodyCount, 1e6 * result.m_serial.m_mean, 1e6 * result.m_serial.m_worst,
+			1e6 * result.m_parallel.m_mean, 1e6 * result.m_parallel.m_worst, (i + 1 < parallelResults.size()) ? "," : "");
+	}
+
+	fprintf(pFile, "\t],\n\t\"spare_skeletons\": [\n");
+
+	for (size_t i = 0; i < parallelResults.size(); i++) {
+		const ParallelMappingResult &result = parallelResults[i];
+		fprintf(pFile, "\t\t{ \"bodies\": %u, \"first_frame_us\": %.2f, \"worst_us\": %.2f, "
+			"\"spare_first_frame_us\": %.2f, \"spare_worst_us\": %.2f }%s\n",
+			result.m_bodyCount, 1e6 * result.m_serial.m_first, 1e6 * result.m_serial.m_worst,
+			1e6 * result.m_spare.m_first, 1e6 * result.m_spare.m_worst, (i + 1 < parallelResults.size()) ? "," : "");
+	}
+
+	fprintf(pFile, "\t],\n\t\"parallel_filters\": [\n");
+
+	for (size_t i = 0; i < filterResults.size(); i++) {
+		const ParallelFilterResult &result = filterResults[i];
+		fprintf(pFile, "\t\t{ \"bodies\": %u, \"seconds\": %u, \"curve_nodes\": %u, \"serial_ms\": %.3f, \"parallel_ms\": %.3f, "
+			"\"speedup\": %.2f, \"identical\": %s }%s\n",
+			result.m_take.m_bodyCount, result.m_take.m_seconds, (unsigned int)result.m_curveNodes,
+			1e3 * result.m_serialTime, 1e3 * result.m_parallelTime,
+			result.m_parallelTime > 0 ? result.m_serialTime / result.m_parallelTime : 0.0,
+			result.m_bIdentical ? "true" : "false", (i + 1 < filterResults.size()) ? "," : "");
+	}
+
+	fprintf(pFile, "\t],\n\t\"key_reduction\": [\n");
+
+	for (size_t i = 0; i < reductionResults.size(); i++) {
+		const KeyReductionResult &result = reductionResults[i];
+		fprintf(pFile, "\t\t{ \"bodies\": %u, \"seconds\": %u, \"keys_before\": %llu, \"keys_after\": %llu, \"reduction_ms\": %.3f, "
+			"\"file_bytes_before\": %lld, \"file_bytes_after\": %lld }%s\n",
+			result.m_take.m_bodyCount, result.m_take.m_seconds, result.m_report.m_nKeysBefore, result.m_report.m_nKeysAfter,
+			1e3 * result.m_reductionTime, result.m_fullSize, result.m_reducedSize, (i + 1 < reductionResults.size()) ? "," : "");
+	}
+
+	fprintf(pFile, "\t]\n}\n");
+
+	bool success = ferror(pFile) == 0;
+	return (fclose(pFile) == 0) && success;
+}
+
+/// <summary>
+/// Runs synthetic takes of several lengths and body counts through mapping, post processing filters and saving.
+/// Reports time per body frame, keys per second, peak memory and save time, then time per body frame with skeletons bound once
+/// and looked up on every frame, then time per frame with bodies mapped
+/// one after another and in parallel, worst frame time with and without spare skeletons, post processing time
+/// on a single thread and on every core, and keys and file size with and without key reduction, and writes them as JSON
+/// </summary>
+/// <param name="resultFile">JSON file receiving the results. Scenes are saved next to it, and deleted afterwards</param>
+/// <returns>False if a take could not be saved, filtering on several threads changed its keys, or results could not be written</returns>
+bool RunPipelineBenchmark(const char *resultFile) {
+
+	FbxString sceneFile = FbxString(resultFile) + ".fbx";
+
+	// Runs of different builds can only be compared if they are fed the same frames, so the largest take is checked first
+	const BenchmarkTake &checkedTake = c_takes[sizeof(c_takes) / sizeof(c_takes[0]) - 1];
+	SyntheticTakeSettings checkedSettings;
+	checkedSettings.m_bodyCount = checkedTake.m_bodyCount;
+	checkedSettings.m_seed = c_benchmarkSeed;
+	if (!CheckSyntheticTake(checkedSettings, checkedTake.m_seconds * c_syntheticFPS)) {
+		UI_Printf("Synthetic takes do not match their settings, or depend on the order frames are generated in");
+		return false;
+	}
+
+	UI_Printf("Pipeline benchmark, %s rotation kernel:", isLocalEulerVectorized() ? "SSE" : "scalar");
+	UI_Printf("  bodies  seconds  ns/body frame     keys/s  filters ms    save ms   peak MB");
+
+	bool success = true;
+	std::vector<BenchmarkResult> results;
+	for (size_t i = 0; i < sizeof(c_takes) / sizeof(c_takes[0]); i++) {
+		BenchmarkResult result;
+		if (!RunTake(c_takes[i], sceneFile.Buffer(), result)) {
+			UI_Printf("Could not save %s", sceneFile.Buffer());
+			success = false;
+			continue;
+		}
+		results.push_back(result);
+
+		double keyTime = result.m_mapTime + result.m_commitTime;
+		UI_Printf("  %6u  %7u  %13.1f  %9.0f  %10.2f  %9.2f  %8.1f",
+			result.m_take.m_bodyCount, result.m_take.m_seconds,
+			result.m_bodyFrames ? 1e9 * result.m_mapTime / double(result.m_bodyFrames) : 0.0,
+			keyTime > 0 ? double(result.m_keys) / keyTime : 0.0,
+			1e3 * result.m_filterTime, 1e3 * result.m_saveTime, double(result.m_peakMemory) / (1024.0 * 1024.0));
+	}
+
+	// What binding skeletons once saves, with every body of the sensor tracked
+	SkeletonBindingResult bindingResult = RunBindingTake(c_bindingTake);
+	UI_Printf("Skeleton binding, %u bodies, %u seconds:", bindingResult.m_take.m_bodyCount, bindingResult.m_take.m_seconds);
+	UI_Printf("  bound ns/body frame  looked up ns/body frame  speedup");
+	UI_Printf("  %19.1f  %23.1f  %7.2f",
+		bindingResult.m_bodyFrames ? 1e9 * bindingResult.m_boundTime / double(bindingResult.m_bodyFrames) : 0.0,
+		bindingResult.m_bodyFrames ? 1e9 * bindingResult.m_lookedUpTime / double(bindingResult.m_bodyFrames) : 0.0,
+		bindingResult.m_boundTime > 0 ? bindingResult.m_lookedUpTime / bindingResult.m_boundTime : 0.0);
+
+	// Same workers as the recording application
+	MappingWorkerPool workers(MappingWorkerPool::getDefaultWorkerCount(BODY_COUNT));
+	UI_Printf("Parallel mapping, %u workers besides the mapping thread:", workers.getWorkerCount());
+	UI_Printf("  bodies  serial us/frame  worst us  parallel us/frame  worst us");
+
+	std::vector<ParallelMappingResult> parallelResults;
+	for (size_t i = 0; i < sizeof(c_parallelBodyCounts) / sizeof(c_parallelBodyCounts[0]); i++) {
+		ParallelMappingResult result;
+		result.m_bodyCount = c_parallelBodyCounts[i];
+		result.m_serial = RunMappingTake(result.m_bodyCount, NULL, false);
+		result.m_parallel = RunMappingTake(result.m_bodyCount, &workers, false);
+		result.m_spare = RunMappingTake(result.m_bodyCount, NULL, true);
+		parallelResults.push_back(result);
+
+		UI_Printf("  %6u  %15.2f  %8.2f  %17.2f  %8.2f", result.m_bodyCount,
+			1e6 * result.m_serial.m_mean, 1e6 * result.m_serial.m_worst, 1e6 * result.m_parallel.m_mean, 1e6 * result.m_parallel.m_worst);
+	}
+
+	// Bodies are seen for the first time in the first frame, which is the slowest one unless their skeletons already exist
+	UI_Printf("Spare skeletons, bodies mapped one after another:");
+	UI_Printf("  bodies  first frame us  worst us  spare first frame us  worst us");
+	for (size_t i = 0; i < parallelResults.size(); i++) {
+		const ParallelMappingResult &result = parallelResults[i];
+		UI_Printf("  %6u  %14.2f  %8.2f  %20.2f  %8.2f", result.m_bodyCount,
+			1e6 * result.m_serial.m_first, 1e6 * result.m_serial.m_worst, 1e6 * result.m_spare.m_first, 1e6 * result.m_spare.m_worst);
+	}
+
+	// Post processing with every core, as the recording application saves takes
+	MappingWorkerPool filterWorkers(MappingWorkerPool::getDefaultWorkerCount(0));
+	UI_Printf("Parallel post processing ( resampling to 30 fps and key reduction ), %u workers besides the saving thread:", filterWorkers.getWorkerCount());
+	UI_Printf("  bodies  seconds  curve nodes  serial ms  parallel ms  speedup  identical");
+
+	std::vector<ParallelFilterResult> filterResults;
+	for (size_t i = 0; i < sizeof(c_filterTakes) / sizeof(c_filterTakes[0]); i++) {
+		ParallelFilterResult result = RunFilterTake(c_filterTakes[i], filterWorkers);
+		filterResults.push_back(result);
+
+		UI_Printf("  %6u  %7u  %11u  %9.2f  %11.2f  %7.2f  %9s", result.m_take.m_bodyCount, result.m_take.m_seconds,
+			(unsigned int)result.m_curveNodes, 1e3 * result.m_serialTime, 1e3 * result.m_parallelTime,
+			result.m_parallelTime > 0 ? result.m_serialTime / result.m_parallelTime : 0.0, result.m_bIdentical ? "yes" : "NO");
+
+		// Filtering on several threads must never change the take
+		if (!result.m_bIdentical)
+			success = false;
+	}
+
+	PostProcessingSettings defaultSettings;
+	UI_Printf("Key reduction ( %g degrees, %g units ):", defaultSettings.m_reductionAngleTolerance, defaultSettings.m_reductionPositionTolerance);
+	UI_Printf("  bodies  seconds  keys before  keys after  reduction ms  MB before  MB after");
+
+	std::vector<KeyReductionResult> reductionResults;
+	for (size_t i = 0; i < sizeof(c_reductionTakes) / sizeof(c_reductionTakes[0]); i++) {
+		KeyReductionResult result;
+		if (!RunReductionTake(c_reductionTakes[i], filterWorkers, sceneFile.Buffer(), result)) {
+			UI_Printf("Could not save %s", sceneFile.Buffer());
+			success = false;
+			continue;
+		}
+		reductionResults.push_back(result);
+
+		UI_Printf("  %6u  %7u  %11llu  %10llu  %12.2f  %9.2f  %8.2f", result.m_take.m_bodyCount, result.m_take.m_seconds,
+			result.m_report.m_nKeysBefore, result.m_report.m_nKeysAfter, 1e3 * result.m_reductionTime,
+			double(result.m_fullSize) / (1024.0 * 1024.0), double(result.m_reducedSize) / (1024.0 * 1024.0));
+	}
+
+	if (!WriteResults(resultFile, results, bindingResult, workers.getWorkerCount(), parallelResults, filterResults, reductionResults)) {
+		UI_Printf("Could not write benchmark results to %s", resultFile);
+		return false;
+	}
+
+	UI_Printf("Benchmark results written to %s", resultFile);
+	return success;
+}
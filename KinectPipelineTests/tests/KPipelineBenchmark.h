@@ -0,0 +1,11 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Runs synthetic takes of several lengths and body counts through mapping, post processing filters and saving.
+/// Reports time per body frame, keys per second, peak memory and save time, and writes them as JSON
+/// </summary>
+/// <param name="resultFile">JSON file receiving the results. Scenes are saved next to it, and deleted afterwards</param>
+/// <returns>False if a take could not be saved, filtering on several threads changed its keys, or results could not be written</returns>
+bool RunPipelineBenchmark(const char *resultFile);
@@ -0,0 +1,232 @@
+#include "KPreRollSoak.h"
+#include "KSyntheticTake.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib,"psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Pre-roll of the application: the last 10 seconds at the sensor frame rate
+static const unsigned int c_preRollSeconds = 10;
+
+// Simulated time between two reports, in seconds
+static const unsigned int c_reportInterval = 30 * 60;
+
+// Idle time before every take, in seconds
+static const unsigned int c_takeInterval = 5 * 60;
+
+// Frames recorded after every take starts, in seconds
+static const unsigned int c_takeSeconds = 2;
+
+// Takes recorded before the working set is measured, as the first ones grow the heaps of the threads they use
+static const unsigned int c_warmUpTakes = 3;
+
+// Skeletons built ahead of time, as the exporter does
+static const unsigned int c_spareSkeletonCount = BODY_COUNT;
+
+// Export file the takes are journaled for ( the journal is deleted once the soak is done )
+static const char *c_soakExportFile = "preroll_soak.fbx";
+
+// Working set may move by a few pages ( e.g. console buffers ) without the buffer allocating anything.
+// Scenes of the takes are destroyed, but the heap may keep some of their memory around
+static const unsigned long long c_workingSetSlack = 4 * 1024 * 1024;
+
+// Same frames on every run
+static const unsigned int c_soakSeed = 42;
+
+/// <summary>
+/// Memory currently used by the process, in bytes ( 0 if it cannot be queried )
+/// </summary>
+static unsigned long long GetWorkingSet() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize;
+#else
+	// Resident pages are the second field of /proc/self/statm ( Linux only )
+	FILE *pStatm = fopen("/proc/self/statm", "r");
+	if (!pStatm)
+		return 0;
+
+	unsigned long long totalPages = 0, residentPages = 0;
+	int fields = fscanf(pStatm, "%llu %llu", &totalPages, &residentPages);
+	fclose(pStatm);
+
+	if (fields != 2)
+		return 0;
+	return residentPages * (unsigned long long)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/*
+	What the takes of the soak mapped
+*/
+struct SoakTakes {
+	// Takes recorded so far
+	unsigned int m_count;
+
+	// Takes that did not start with every buffered frame, or left frames in the buffer
+	unsigned int m_failedCount;
+
+	// Pre-roll frames mapped by all takes
+	unsigned long long m_preRollFrames;
+};
+
+/// <summary>
+/// Records a short take as the exporter does: the first frame received while recording maps the pre-roll buffer ahead of itself,
+/// then a few frames are mapped and the take is thrown away instead of being saved
+/// </summary>
+/// <param name="preRoll">Frames received while not recording, emptied by the take</param>
+/// <param name="settings">Synthetic take the frames come from</param>
+/// <param name="frameIndex">Input, index of the first frame received while recording. Output, index of the next frame</param>
+/// <param name="frame">Frame the synthetic frames are generated in</param>
+/// <param name="takes">Output, what the take mapped is added</param>
+static void RecordTake(KPreRollBuffer &preRoll, const SyntheticTakeSettings &settings, unsigned int &frameIndex, BodyFrame &frame, SoakTakes &takes) {
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pScene = CreateAnimationScene(pManager);
+	MappingSession session(pScene);
+	KinectSkeletonMapper::prepareSpareSkeletons(session, c_spareSkeletonCount);
+
+	CaptureJournalWriter journal;
+	FbxString journalFile = getCaptureJournalFileName(c_soakExportFile);
+	if (!journal.open(journalFile.Buffer()))
+		UI_Printf("Could not create capture journal %s", journalFile.Buffer());
+
+	// Take must start at the oldest buffered frame, every one of them being within the pre-roll
+	size_t bufferedCount = preRoll.size();
+	INT64 oldestTime = bufferedCount > 0 ? preRoll.at(0).frameTime : 0;
+
+	GenerateSyntheticFrame(settings, frameIndex, frame);
+	unsigned int nPreRollFrames = KinectSkeletonMapper::mapPreRoll(session, preRoll, frame, (INT64)c_preRollSeconds * 10000000, &journal);
+
+	if (nPreRollFrames != bufferedCount || preRoll.size() != 0 || session.m_initTime != oldestTime / 10000) {
+		UI_Printf("Take %u mapped %u of %u buffered frames, and left %u in the buffer", takes.m_count + 1, nPreRollFrames, (unsigned int)bufferedCount, (unsigned int)preRoll.size());
+		takes.m_failedCount++;
+	}
+
+	// Frames received while recording are journaled and mapped as they arrive
+	const unsigned int endIndex = frameIndex + c_takeSeconds * c_syntheticFPS;
+	for (; frameIndex < endIndex; frameIndex++) {
+		GenerateSyntheticFrame(settings, frameIndex, frame);
+		journal.append(std::make_shared<BodyFrame>(frame));
+		KinectSkeletonMapper::mapFrame(session, frame);
+	}
+
+	journal.close();
+
+	session.commitKeys();
+	KinectSkeletonMapper::removeSpareSkeletons(session);
+	session.reset(NULL);
+	DestroySdkObjects(pManager, false);
+
+	takes.m_count++;
+	takes.m_preRollFrames += nPreRollFrames;
+}
+
+/// <summary>
+/// Pushes hours of synthetic frames into a pre-roll buffer sized like the application's, as the exporter does between takes,
+/// and starts a short take every few minutes, which maps and journals the buffered frames the way the exporter does. Reports buffer memory and process working set as it goes
+/// </summary>
+/// <param name="hours">Time simulated, at the sensor frame rate</param>
+/// <returns>False if a take did not start with every buffered frame, buffer memory changed, or the working set grew once the first takes were thrown away</returns>
+bool RunPreRollSoak(double hours) {
+
+	KPreRollBuffer preRoll(c_preRollSeconds * c_syntheticFPS);
+	const size_t memorySize = preRoll.getMemorySize();
+	const size_t capacity = preRoll.capacity();
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = BODY_COUNT;
+	settings.m_seed = c_soakSeed;
+
+	// Every frame can be mapped, so a take must map each buffered one
+	settings.m_dropoutRate = 0;
+	settings.m_readFailureRate = 0;
+
+	// Frames are generated in place, the way the decoder fills them, so idle frames allocate nothing
+	BodyFrame frame;
+
+	const unsigned int frameCount = (unsigned int)(hours * 3600.0 * c_syntheticFPS);
+	const unsigned int reportFrames = c_reportInterval * c_syntheticFPS;
+	const unsigned int idleFrames = c_takeInterval * c_syntheticFPS;
+
+	UI_Printf("Pushing %.1f hours of %d-body frames ( %u frames ) into a %u frame pre-roll buffer of %.2f MB, with a %us take every %u minutes",
+		hours, BODY_COUNT, frameCount, (unsigned int)capacity, double(memorySize) / (1024.0 * 1024.0), c_takeSeconds, c_takeInterval / 60);
+
+	SoakTakes takes;
+	memset(&takes, 0, sizeof(takes));
+
+	// Working set is only measured once the first takes have been thrown away, so the pages of the buffer and of the FBX SDK are counted
+	unsigned long long baseline = 0, maxWorkingSet = 0;
+
+	bool success = true;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	unsigned int f = 0, nextReport = reportFrames;
+	while (f < frameCount) {
+
+		// Not recording, frames go to the pre-roll buffer
+		unsigned int idleEnd = f + idleFrames < frameCount ? f + idleFrames : frameCount;
+		for (; f < idleEnd; f++) {
+			GenerateSyntheticFrame(settings, f, frame);
+			preRoll.push(frame);
+		}
+
+		if (preRoll.getMemorySize() != memorySize || preRoll.capacity() != capacity) {
+			UI_Printf("Pre-roll buffer changed size: %llu bytes for %u frames, instead of %llu bytes for %u frames",
+				(unsigned long long)preRoll.getMemorySize(), (unsigned int)preRoll.capacity(), (unsigned long long)memorySize, (unsigned int)capacity);
+			success = false;
+			break;
+		}
+
+		if (f >= frameCount)
+			break;
+
+		RecordTake(preRoll, settings, f, frame, takes);
+
+		unsigned long long workingSet = GetWorkingSet();
+		if (takes.m_count == c_warmUpTakes) {
+			baseline = maxWorkingSet = workingSet;
+			if (!baseline)
+				UI_Printf("Working set cannot be queried on this system, only buffer memory is checked");
+		}
+		else if (takes.m_count > c_warmUpTakes && workingSet > maxWorkingSet) {
+			maxWorkingSet = workingSet;
+		}
+
+		if (f >= nextReport) {
+			UI_Printf("%6.2f h: %u takes, %llu pre-roll frames mapped, buffer %llu bytes, working set %.2f MB",
+				double(f) / (3600.0 * c_syntheticFPS), takes.m_count, takes.m_preRollFrames,
+				(unsigned long long)preRoll.getMemorySize(), double(workingSet) / (1024.0 * 1024.0));
+			nextReport += reportFrames;
+		}
+	}
+
+	FbxFileUtils::Delete(getCaptureJournalFileName(c_soakExportFile).Buffer());
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	UI_Printf("%u takes mapped %llu pre-roll frames. Working set %.2f MB after %u takes, %.2f MB at most afterwards ( %.1fs )",
+		takes.m_count, takes.m_preRollFrames, double(baseline) / (1024.0 * 1024.0), c_warmUpTakes, double(maxWorkingSet) / (1024.0 * 1024.0), elapsed);
+
+	if (takes.m_failedCount > 0) {
+		UI_Printf("%u takes did not start with the buffered frames", takes.m_failedCount);
+		success = false;
+	}
+
+	if (baseline && maxWorkingSet > baseline + c_workingSetSlack) {
+		UI_Printf("Working set grew by %llu KB between takes", (maxWorkingSet - baseline) / 1024);
+		success = false;
+	}
+
+	return success;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Pushes hours of synthetic frames into a pre-roll buffer sized like the application's, as the exporter does between takes,
+/// and starts a short take every few minutes, which maps and journals the buffered frames the way the exporter does. Reports buffer memory and process working set as it goes
+/// </summary>
+/// <param name="hours">Time simulated, at the sensor frame rate</param>
+/// <returns>False if a take did not start with every buffered frame, buffer memory changed, or the working set grew once the first takes were thrown away</returns>
+bool RunPreRollSoak(double hours);
@@ -0,0 +1,157 @@
+#include "KProjectionBenchmark.h"
+#include "KSyntheticTake.h"
+
+#include <math.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Projections are timed several times, keeping the best run
+static const int c_projectionRuns = 5;
+
+// Same frames on every run
+static const unsigned int c_benchmarkSeed = 42;
+
+/// <summary>
+/// Calibration of a typical Kinect v2 depth camera, as GetDepthCameraIntrinsics reports it
+/// </summary>
+static DepthIntrinsics GetTypicalIntrinsics() {
+	DepthIntrinsics intrinsics;
+	intrinsics.focalLengthX = 365.5f;
+	intrinsics.focalLengthY = 365.5f;
+	intrinsics.principalPointX = 257.0f;
+	intrinsics.principalPointY = 208.0f;
+	intrinsics.radialDistortionSecondOrder = 0.091f;
+	intrinsics.radialDistortionFourthOrder = -0.271f;
+	intrinsics.radialDistortionSixthOrder = 0.094f;
+	return intrinsics;
+}
+
+/*
+	Joints of every tracked body of every frame, gathered the way the skeleton preview does before projecting them
+*/
+struct ProjectionInput {
+	std::vector<CameraSpacePoint> m_points;
+
+	// First joint of every frame, and one past the last joint of the last frame
+	std::vector<size_t> m_firstPoints;
+};
+
+/// <summary>
+/// Time of a projection path, best of a few runs over every frame, in seconds
+/// </summary>
+/// <param name="input">Joints of every frame</param>
+/// <param name="intrinsics">Depth camera calibration</param>
+/// <param name="path">0 projects one joint at a time, 1 every joint of a frame with the scalar kernel, 2 with projectToDepthSpace</param>
+/// <param name="depthX, depthY">Output, depth image coordinates of every joint</param>
+static double TimeProjection(const ProjectionInput &input, const DepthIntrinsics &intrinsics, int path, std::vector<float> &depthX, std::vector<float> &depthY) {
+
+	size_t count = input.m_points.size();
+	depthX.resize(count);
+	depthY.resize(count);
+
+	double bestTime = 0;
+	for (int run = 0; run < c_projectionRuns; run++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (path == 0) {
+			for (size_t i = 0; i < count; i++)
+				projectToDepthSpaceScalar(intrinsics, &input.m_points[i], 1, &depthX[i], &depthY[i]);
+		}
+		else {
+			for (size_t f = 0; f + 1 < input.m_firstPoints.size(); f++) {
+				size_t first = input.m_firstPoints[f];
+				size_t frameCount = input.m_firstPoints[f + 1] - first;
+				if (frameCount == 0)
+					continue;
+
+				if (path == 1)
+					projectToDepthSpaceScalar(intrinsics, &input.m_points[first], frameCount, &depthX[first], &depthY[first]);
+				else
+					projectToDepthSpace(intrinsics, &input.m_points[first], frameCount, &depthX[first], &depthY[first]);
+			}
+		}
+
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (run == 0 || elapsed < bestTime)
+			bestTime = elapsed;
+	}
+	return bestTime;
+}
+
+/// <summary>
+/// Largest difference between two projections of the same joints, in depth pixels. Joints neither can project are skipped
+/// </summary>
+static double MaxDifference(const std::vector<float> &referenceX, const std::vector<float> &referenceY, const std::vector<float> &depthX, const std::vector<float> &depthY) {
+	double maxDifference = 0;
+	for (size_t i = 0; i < referenceX.size(); i++) {
+		if (referenceX[i] == depthX[i] && referenceY[i] == depthY[i])
+			continue;
+
+		double difference = fabs(double(referenceX[i]) - depthX[i]);
+		double differenceY = fabs(double(referenceY[i]) - depthY[i]);
+		if (differenceY > difference)
+			difference = differenceY;
+
+		// Also catches a joint only one of them could project
+		if (!(difference <= maxDifference))
+			maxDifference = difference;
+	}
+	return maxDifference;
+}
+
+/// <summary>
+/// Projects the joints of a synthetic 6-body take to the depth image one joint at a time, as the skeleton preview used to,
+/// then every joint of a frame at once with the scalar and SSE kernels. Reports how long each one takes, and how far the batches are from the per joint path
+/// </summary>
+/// <param name="frameCount">Number of synthetic frames</param>
+/// <returns>Largest difference between a batch and the per joint path, in depth pixels</returns>
+double RunProjectionBenchmark(unsigned int frameCount) {
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = BODY_COUNT;
+	settings.m_seed = c_benchmarkSeed;
+
+	// Gathering joints is the same for every path, so it is not timed
+	ProjectionInput input;
+	input.m_points.reserve(size_t(frameCount) * BODY_COUNT * JointType_Count);
+	BodyFrame frame;
+	for (unsigned int f = 0; f < frameCount; f++) {
+		GenerateSyntheticFrame(settings, f, frame);
+
+		input.m_firstPoints.push_back(input.m_points.size());
+		if (!frame.readStatus)
+			continue;
+
+		for (int b = 0; b < BODY_COUNT; b++) {
+			if (!frame.bodies[b].isTracked)
+				continue;
+			for (int j = 0; j < JointType_Count; j++)
+				input.m_points.push_back(frame.bodies[b].joints[j].Position);
+		}
+	}
+	input.m_firstPoints.push_back(input.m_points.size());
+
+	size_t jointCount = input.m_points.size();
+	if (jointCount == 0)
+		return 0;
+
+	DepthIntrinsics intrinsics = GetTypicalIntrinsics();
+
+	std::vector<float> perJointX, perJointY, batchX, batchY;
+	double perJointTime = TimeProjection(input, intrinsics, 0, perJointX, perJointY);
+
+	double scalarTime = TimeProjection(input, intrinsics, 1, batchX, batchY);
+	double scalarDifference = MaxDifference(perJointX, perJointY, batchX, batchY);
+
+	double vectorTime = TimeProjection(input, intrinsics, 2, batchX, batchY);
+	double vectorDifference = MaxDifference(perJointX, perJointY, batchX, batchY);
+
+	double nsPerJoint = 1e9 / jointCount;
+	UI_Printf("Projection benchmark, %u frames, %u joints ( %.1f per frame ):", frameCount, (unsigned int)jointCount, double(jointCount) / frameCount);
+	UI_Printf("  Per joint         %8.2f ns/joint", perJointTime * nsPerJoint);
+	UI_Printf("  Batched scalar    %8.2f ns/joint, largest difference %g pixels", scalarTime * nsPerJoint, scalarDifference);
+	UI_Printf("  Batched %-6s    %8.2f ns/joint, largest difference %g pixels", isDepthProjectionVectorized() ? "SSE" : "n/a", vectorTime * nsPerJoint, vectorDifference);
+
+	return scalarDifference > vectorDifference ? scalarDifference : vectorDifference;
+}
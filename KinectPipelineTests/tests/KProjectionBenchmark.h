@@ -0,0 +1,11 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Projects the joints of a synthetic 6-body take to the depth image one joint at a time, as the skeleton preview used to,
+/// then every joint of a frame at once with the scalar and SSE kernels. Reports how long each one takes, and how far the batches are from the per joint path
+/// </summary>
+/// <param name="frameCount">Number of synthetic frames</param>
+/// <returns>Largest difference between a batch and the per joint path, in depth pixels</returns>
+double RunProjectionBenchmark(unsigned int frameCount);
@@ -0,0 +1,345 @@
+#include "KReplayComparison.h"
+#include "../../KinectBatchConverter/converter/KBatchConverter.h"
+#include "KSyntheticTake.h"
+
+#include <math.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Curve components compared for every joint
+static const char *c_components[3] = { FBXSDK_CURVENODE_COMPONENT_X, FBXSDK_CURVENODE_COMPONENT_Y, FBXSDK_CURVENODE_COMPONENT_Z };
+
+// Rotation noise added to the take a self check must tell apart from its golden file, in radians ( about half a degree )
+static const double c_selfCheckExtraNoise = 0.01;
+
+/*
+	Differences found for a single joint
+*/
+struct JointDifference {
+	FbxString m_name;
+
+	// Rotation keys of each file ( X curve )
+	int m_goldenKeys;
+	int m_resultKeys;
+
+	// Largest differences, and when the largest rotation difference happens
+	double m_rotation;
+	double m_translation;
+	FbxTime m_rotationTime;
+
+	// Joint, or one of its curves, only exists in one of the files
+	const char *m_missing;
+};
+
+
+/// <summary>
+/// Difference between two angles, in degrees. Angles 360 degrees apart are the same
+/// </summary>
+static double AngleDifference(double a, double b) {
+	double difference = fmod(fabs(a - b), 360.0);
+	return difference > 180.0 ? 360.0 - difference : difference;
+}
+
+/// <summary>
+/// Largest difference between two curves, evaluated at the keys of both
+/// </summary>
+/// <param name="pGolden, pResult">Curves to be compared ( neither is NULL )</param>
+/// <param name="isAngle">Whether curves hold angles, in degrees</param>
+/// <param name="worstTime">Output, time of the largest difference</param>
+static double CompareCurves(FbxAnimCurve *pGolden, FbxAnimCurve *pResult, bool isAngle, FbxTime &worstTime) {
+
+	int goldenCount = pGolden->KeyGetCount();
+	int resultCount = pResult->KeyGetCount();
+
+	// Keys of both curves are visited in time order. Last evaluated keys speed up evaluation of the next time
+	int goldenLast = 0, resultLast = 0;
+	double worst = 0.0;
+	int g = 0, r = 0;
+	while (g < goldenCount || r < resultCount) {
+		FbxTime time;
+		if (r >= resultCount || (g < goldenCount && pGolden->KeyGetTime(g) <= pResult->KeyGetTime(r)))
+			time = pGolden->KeyGetTime(g);
+		else
+			time = pResult->KeyGetTime(r);
+
+		// Both curves may have a key at this time
+		while (g < goldenCount && pGolden->KeyGetTime(g) <= time)
+			g++;
+		while (r < resultCount && pResult->KeyGetTime(r) <= time)
+			r++;
+
+		double goldenValue = pGolden->Evaluate(time, &goldenLast);
+		double resultValue = pResult->Evaluate(time, &resultLast);
+		double difference = isAngle ? AngleDifference(goldenValue, resultValue) : fabs(goldenValue - resultValue);
+		if (difference > worst) {
+			worst = difference;
+			worstTime = time;
+		}
+	}
+
+	return worst;
+}
+
+/// <summary>
+/// Compares the curves of one property of a joint in both files
+/// </summary>
+/// <returns>False if property is animated in only one of the files</returns>
+static bool CompareProperty(FbxPropertyT<FbxDouble3> &goldenProperty, FbxAnimLayer *pGoldenLayer, FbxPropertyT<FbxDouble3> &resultProperty, FbxAnimLayer *pResultLayer,
+	bool isAngle, double &worst, FbxTime &worstTime) {
+
+	for (int c = 0; c < 3; c++) {
+		FbxAnimCurve *pGolden = goldenProperty.GetCurve(pGoldenLayer, c_components[c]);
+		FbxAnimCurve *pResult = resultProperty.GetCurve(pResultLayer, c_components[c]);
+		if (!pGolden && !pResult)
+			continue;
+		if (!pGolden || !pResult)
+			return false;
+
+		FbxTime time;
+		double difference = CompareCurves(pGolden, pResult, isAngle, time);
+		if (difference > worst) {
+			worst = difference;
+			worstTime = time;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Compares a joint, and its children, to the joints with the same names in the result
+/// </summary>
+static void CompareNode(FbxNode *pGolden, FbxAnimLayer *pGoldenLayer, FbxScene *pResultScene, FbxAnimLayer *pResultLayer, std::vector<JointDifference> &differences) {
+
+	JointDifference difference;
+	difference.m_name = pGolden->GetName();
+	difference.m_goldenKeys = 0;
+	difference.m_resultKeys = 0;
+	difference.m_rotation = 0.0;
+	difference.m_translation = 0.0;
+	difference.m_missing = NULL;
+
+	FbxAnimCurve *pGoldenCurve = pGolden->LclRotation.GetCurve(pGoldenLayer, FBXSDK_CURVENODE_COMPONENT_X);
+	if (pGoldenCurve)
+		difference.m_goldenKeys = pGoldenCurve->KeyGetCount();
+
+	FbxNode *pResult = pResultScene->FindNodeByName(difference.m_name);
+	if (!pResult) {
+		difference.m_missing = "missing from result";
+	}
+	else {
+		FbxAnimCurve *pResultCurve = pResult->LclRotation.GetCurve(pResultLayer, FBXSDK_CURVENODE_COMPONENT_X);
+		if (pResultCurve)
+			difference.m_resultKeys = pResultCurve->KeyGetCount();
+
+		FbxTime translationTime;
+		if (!CompareProperty(pGolden->LclRotation, pGoldenLayer, pResult->LclRotation, pResultLayer, true, difference.m_rotation, difference.m_rotationTime) ||
+			!CompareProperty(pGolden->LclTranslation, pGoldenLayer, pResult->LclTranslation, pResultLayer, false, difference.m_translation, translationTime)) {
+			difference.m_missing = "animated in only one file";
+		}
+	}
+	differences.push_back(difference);
+
+	for (int i = 0; i < pGolden->GetChildCount(); i++)
+		CompareNode(pGolden->GetChild(i), pGoldenLayer, pResultScene, pResultLayer, differences);
+}
+
+/// <summary>
+/// Adds joints of the result that the golden file does not have
+/// </summary>
+static void FindExtraNodes(FbxNode *pResult, FbxScene *pGoldenScene, std::vector<JointDifference> &differences) {
+
+	if (!pGoldenScene->FindNodeByName(pResult->GetName())) {
+		JointDifference difference;
+		difference.m_name = pResult->GetName();
+		difference.m_goldenKeys = 0;
+		difference.m_resultKeys = 0;
+		difference.m_rotation = 0.0;
+		difference.m_translation = 0.0;
+		difference.m_missing = "missing from golden file";
+		differences.push_back(difference);
+	}
+
+	for (int i = 0; i < pResult->GetChildCount(); i++)
+		FindExtraNodes(pResult->GetChild(i), pGoldenScene, differences);
+}
+
+/// <summary>
+/// Animation layer of a scene, NULL if it has none
+/// </summary>
+static FbxAnimLayer *GetAnimLayer(FbxScene *pScene) {
+	FbxAnimStack *pStack = pScene->GetCurrentAnimationStack();
+	return pStack ? pStack->GetMember<FbxAnimLayer>() : NULL;
+}
+
+/// <summary>
+/// Converts a journal exactly as batches are converted, reads the FBX file back and compares every translation and rotation curve
+/// of every joint to a golden file. Curves are compared at the keys of both files, so a different number of keys is fine.
+/// Prints the largest differences of every joint
+/// </summary>
+/// <param name="journalFile">Capture journal to be replayed</param>
+/// <param name="goldenFile">FBX file the result must match</param>
+/// <param name="angleTolerance">Largest accepted rotation difference, in degrees ( adaptive keying adds its own tolerance )</param>
+/// <param name="positionTolerance">Largest accepted translation difference, in scene units ( adaptive keying adds its own tolerance )</param>
+/// <param name="pKeying">How keys are added while the journal is converted ( NULL keys them as recorded in the journal )</param>
+/// <param name="pJointFiltering">How joints are smoothed while the journal is converted ( NULL smooths them as recorded in the journal )</param>
+/// <returns>Whether the result matches the golden file</returns>
+ReplayComparisonResult RunReplayComparison(const char *journalFile, const char *goldenFile, double angleTolerance, double positionTolerance,
+	const KeyingSettings *pKeying, const JointFilterSettings *pJointFiltering) {
+
+	// Keying the take is converted with
+	KeyingSettings keying;
+	if (pKeying) {
+		keying = *pKeying;
+	}
+	else {
+		CaptureJournalReader reader;
+		if (!reader.open(journalFile)) {
+			UI_Printf("%s: not a valid capture journal", journalFile);
+			return ReplayComparison_Failed;
+		}
+		keying = reader.getSettings().m_keying;
+	}
+
+	// Golden file has every sample keyed, adaptive keys may miss them by the keying tolerances
+	if (keying.m_bAdaptive) {
+		angleTolerance += keying.m_angleTolerance;
+		positionTolerance += keying.m_positionTolerance;
+	}
+
+	// Result is written next to the golden file, and kept if it does not match
+	FbxString replayFile = FbxString(goldenFile) + ".replay.fbx";
+	{
+		KBatchConverter converter(1);
+		if (pKeying)
+			converter.setKeyingSettings(*pKeying);
+		if (pJointFiltering)
+			converter.setJointFilterSettings(*pJointFiltering);
+		converter.addJournal(journalFile, replayFile.Buffer());
+		if (!converter.run())
+			return ReplayComparison_Failed;
+	}
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pGoldenScene = FbxScene::Create(pManager, "Golden");
+	FbxScene *pResultScene = FbxScene::Create(pManager, "Replay");
+	if (!LoadScene(pManager, pGoldenScene, goldenFile) || !LoadScene(pManager, pResultScene, replayFile.Buffer())) {
+		UI_Printf("Could not read %s or %s", goldenFile, replayFile.Buffer());
+		DestroySdkObjects(pManager, false);
+		return ReplayComparison_Failed;
+	}
+
+	FbxAnimLayer *pGoldenLayer = GetAnimLayer(pGoldenScene);
+	FbxAnimLayer *pResultLayer = GetAnimLayer(pResultScene);
+	if (!pGoldenLayer || !pResultLayer) {
+		UI_Printf("%s or %s has no animation", goldenFile, replayFile.Buffer());
+		DestroySdkObjects(pManager, false);
+		return ReplayComparison_Failed;
+	}
+
+	std::vector<JointDifference> differences;
+	FbxNode *pGoldenRoot = pGoldenScene->GetRootNode();
+	for (int i = 0; i < pGoldenRoot->GetChildCount(); i++)
+		CompareNode(pGoldenRoot->GetChild(i), pGoldenLayer, pResultScene, pResultLayer, differences);
+	FbxNode *pResultRoot = pResultScene->GetRootNode();
+	for (int i = 0; i < pResultRoot->GetChildCount(); i++)
+		FindExtraNodes(pResultRoot->GetChild(i), pGoldenScene, differences);
+
+	DestroySdkObjects(pManager, false);
+
+	// Per joint report
+	UI_Printf("  %-40s %6s %6s %14s %10s %14s", "Joint", "Golden", "Replay", "Rotation deg", "at s", "Translation");
+	unsigned int failedCount = 0;
+	double worstRotation = 0.0, worstTranslation = 0.0;
+	for (auto &difference : differences) {
+		bool failed = difference.m_missing || difference.m_rotation > angleTolerance || difference.m_translation > positionTolerance;
+		if (failed)
+			failedCount++;
+		if (difference.m_rotation > worstRotation)
+			worstRotation = difference.m_rotation;
+		if (difference.m_translation > worstTranslation)
+			worstTranslation = difference.m_translation;
+
+		if (difference.m_missing) {
+			UI_Printf("  %-40s %s", difference.m_name.Buffer(), difference.m_missing);
+		}
+		else {
+			UI_Printf("  %-40s %6d %6d %14.6f %10.3f %14.6f%s", difference.m_name.Buffer(), difference.m_goldenKeys, difference.m_resultKeys,
+				difference.m_rotation, difference.m_rotationTime.GetSecondDouble(), difference.m_translation, failed ? "  FAIL" : "");
+		}
+	}
+
+	UI_Printf("Replay comparison: %u joints, %u out of tolerance. Largest rotation difference %g degrees ( tolerance %g ), largest translation difference %g ( tolerance %g )",
+		(unsigned int)differences.size(), failedCount, worstRotation, angleTolerance, worstTranslation, positionTolerance);
+
+	if (failedCount > 0) {
+		UI_Printf("Replayed take kept in %s", replayFile.Buffer());
+		return ReplayComparison_Mismatch;
+	}
+
+	FbxFileUtils::Delete(replayFile.Buffer());
+	return ReplayComparison_Match;
+}
+
+/// <summary>
+/// Checks replay comparisons themselves: writes a synthetic journal, converts it into a golden file and compares a replay of the
+/// same journal to it, which must match. Then compares a replay of the same take with slightly more rotation noise, which must not
+/// </summary>
+/// <param name="directory">Directory journals and FBX files are written to ( removed once the check passes )</param>
+/// <param name="bodyCount">Bodies of the synthetic take</param>
+/// <param name="frameCount">Frames of the synthetic take</param>
+/// <param name="angleTolerance">Largest accepted rotation difference, in degrees</param>
+/// <param name="positionTolerance">Largest accepted translation difference, in scene units</param>
+/// <returns>Match if both comparisons gave the expected result, Mismatch if one did not</returns>
+ReplayComparisonResult RunReplaySelfCheck(const char *directory, unsigned int bodyCount, unsigned int frameCount, double angleTolerance, double positionTolerance) {
+
+	FbxString journalFile = FbxPathUtils::Bind(directory, "selfcheck" CAPTURE_JOURNAL_EXTENSION);
+	FbxString changedJournalFile = FbxPathUtils::Bind(directory, "selfcheck.changed" CAPTURE_JOURNAL_EXTENSION);
+	FbxString goldenFile = FbxPathUtils::Bind(directory, "selfcheck.golden.fbx");
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = bodyCount;
+	SyntheticTakeSettings changedSettings = settings;
+	changedSettings.m_rotationNoise += c_selfCheckExtraNoise;
+
+	if (!WriteSyntheticJournal(settings, frameCount, journalFile.Buffer()) || !WriteSyntheticJournal(changedSettings, frameCount, changedJournalFile.Buffer())) {
+		UI_Printf("Could not write journals to %s", directory);
+		return ReplayComparison_Failed;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Golden file, converted the way a batch converts it
+	{
+		KBatchConverter converter(1);
+		converter.addJournal(journalFile.Buffer(), goldenFile.Buffer());
+		if (!converter.run()) {
+			UI_Printf("Could not convert %s", journalFile.Buffer());
+			return ReplayComparison_Failed;
+		}
+	}
+
+	UI_Printf("Replaying the journal of the golden file, expected to match:");
+	ReplayComparisonResult sameResult = RunReplayComparison(journalFile.Buffer(), goldenFile.Buffer(), angleTolerance, positionTolerance);
+	double sameTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	UI_Printf("Replaying the take with %g more radians of rotation noise, expected not to match:", c_selfCheckExtraNoise);
+	ReplayComparisonResult changedResult = RunReplayComparison(changedJournalFile.Buffer(), goldenFile.Buffer(), angleTolerance, positionTolerance);
+
+	if (sameResult == ReplayComparison_Failed || changedResult == ReplayComparison_Failed)
+		return ReplayComparison_Failed;
+
+	bool success = sameResult == ReplayComparison_Match && changedResult == ReplayComparison_Mismatch;
+	UI_Printf("Replay self check: same take %s, changed take %s. Converting and comparing %u frames of %u bodies took %.2f s",
+		sameResult == ReplayComparison_Match ? "matches" : "DOES NOT MATCH", changedResult == ReplayComparison_Mismatch ? "does not match" : "MATCHES",
+		frameCount, bodyCount, sameTime);
+
+	if (!success)
+		return ReplayComparison_Mismatch;
+
+	FbxFileUtils::Delete(journalFile.Buffer());
+	FbxFileUtils::Delete(changedJournalFile.Buffer());
+	FbxFileUtils::Delete(goldenFile.Buffer());
+	FbxFileUtils::Delete((goldenFile + ".replay.fbx").Buffer());
+	return ReplayComparison_Match;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+// Outcome of a replay comparison
+enum ReplayComparisonResult {
+	// Every curve is within tolerance of the golden file
+	ReplayComparison_Match,
+	// Some joint is out of tolerance, or missing from one of the files
+	ReplayComparison_Mismatch,
+	// Journal could not be converted, or a file could not be read
+	ReplayComparison_Failed
+};
+
+/// <summary>
+/// Converts a journal exactly as batches are converted, reads the FBX file back and compares every translation and rotation curve
+/// of every joint to a golden file. Curves are compared at the keys of both files, so a different number of keys is fine.
+/// Prints the largest differences of every joint
+/// </summary>
+/// <param name="journalFile">Capture journal to be replayed</param>
+/// <param name="goldenFile">FBX file the result must match</param>
+/// <param name="angleTolerance">Largest accepted rotation difference, in degrees ( adaptive keying adds its own tolerance )</param>
+/// <param name="positionTolerance">Largest accepted translation difference, in scene units ( adaptive keying adds its own tolerance )</param>
+/// <param name="pKeying">How keys are added while the journal is converted ( NULL keys them as recorded in the journal )</param>
+/// <param name="pJointFiltering">How joints are smoothed while the journal is converted ( NULL smooths them as recorded in the journal )</param>
+/// <returns>Whether the result matches the golden file</returns>
+ReplayComparisonResult RunReplayComparison(const char *journalFile, const char *goldenFile, double angleTolerance, double positionTolerance,
+	const KeyingSettings *pKeying = NULL, const JointFilterSettings *pJointFiltering = NULL);
+
+/// <summary>
+/// Checks replay comparisons themselves: writes a synthetic journal, converts it into a golden file and compares a replay of the
+/// same journal to it, which must match. Then compares a replay of the same take with slightly more rotation noise, which must not
+/// </summary>
+/// <param name="directory">Directory journals and FBX files are written to ( removed once the check passes )</param>
+/// <param name="bodyCount">Bodies of the synthetic take</param>
+/// <param name="frameCount">Frames of the synthetic take</param>
+/// <param name="angleTolerance">Largest accepted rotation difference, in degrees</param>
+/// <param name="positionTolerance">Largest accepted translation difference, in scene units</param>
+/// <returns>Match if both comparisons gave the expected result, Mismatch if one did not</returns>
+ReplayComparisonResult RunReplaySelfCheck(const char *directory, unsigned int bodyCount, unsigned int frameCount, double angleTolerance, double positionTolerance);
@@ -0,0 +1,123 @@
+#include "KRotationBenchmark.h"
+
+#include <random>
+#include <math.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Kernels are timed several times, keeping the best run
+static const int c_kernelRuns = 5;
+
+
+/// <summary>
+/// Random rotation, uniformly distributed
+/// </summary>
+static JointQuaternion RandomRotation(std::mt19937 &generator) {
+	std::normal_distribution<double> distribution;
+	JointQuaternion q;
+	do {
+		q.x = distribution(generator);
+		q.y = distribution(generator);
+		q.z = distribution(generator);
+		q.w = distribution(generator);
+	} while (!quatNormalize(q));
+	return q;
+}
+
+/// <summary>
+/// Difference between two angles, in degrees. Angles 360 degrees apart are the same
+/// </summary>
+static double AngleDifference(double a, double b) {
+	double difference = fmod(fabs(a - b), 360.0);
+	return difference > 180.0 ? 360.0 - difference : difference;
+}
+
+/// <summary>
+/// Largest difference between kernel output and FbxAMatrix output
+/// </summary>
+static double MaxDifference(const std::vector<FbxVector4> &reference, const JointRotationBatch &batch) {
+	double maxDifference = 0;
+	for (size_t i = 0; i < reference.size(); i++) {
+		double differences[3] = {
+			AngleDifference(reference[i][0], batch.m_eulerX[i]),
+			AngleDifference(reference[i][1], batch.m_eulerY[i]),
+			AngleDifference(reference[i][2], batch.m_eulerZ[i])
+		};
+		for (int j = 0; j < 3; j++) {
+			if (differences[j] > maxDifference)
+				maxDifference = differences[j];
+		}
+	}
+	return maxDifference;
+}
+
+/// <summary>
+/// Best time of a few kernel runs over the whole batch, in seconds
+/// </summary>
+static double TimeKernel(JointRotationBatch &batch, bool vectorized) {
+	double bestTime = 0;
+	for (int run = 0; run < c_kernelRuns; run++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (vectorized) {
+			batch.computeLocalEuler();
+		}
+		else {
+			computeLocalEulerXYZScalar(&batch.m_parentX[0], &batch.m_parentY[0], &batch.m_parentZ[0], &batch.m_parentW[0],
+				&batch.m_globalX[0], &batch.m_globalY[0], &batch.m_globalZ[0], &batch.m_globalW[0], batch.size(),
+				&batch.m_eulerX[0], &batch.m_eulerY[0], &batch.m_eulerZ[0]);
+		}
+
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (run == 0 || elapsed < bestTime)
+			bestTime = elapsed;
+	}
+	return bestTime;
+}
+
+/// <summary>
+/// Converts random joint rotations to local euler angles through the FbxAMatrix path, the scalar kernel and the SSE kernel.
+/// Reports how long each one takes, and how far the kernels are from FbxAMatrix
+/// </summary>
+/// <param name="jointCount">Number of random joint rotations</param>
+/// <returns>Largest difference between a kernel and FbxAMatrix, in degrees</returns>
+double RunRotationBenchmark(unsigned int jointCount) {
+
+	// Same input every time
+	std::mt19937 generator(42);
+
+	JointRotationBatch batch;
+	for (unsigned int i = 0; i < jointCount; i++) {
+		JointQuaternion parentRot = RandomRotation(generator);
+		JointQuaternion globalRot = RandomRotation(generator);
+		batch.add(parentRot, globalRot);
+	}
+	// Sizes output
+	batch.computeLocalEuler();
+
+	// Reference, the way rotations used to be converted ( from the same single precision input as the kernels )
+	std::vector<FbxVector4> reference(jointCount);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < jointCount; i++) {
+		FbxAMatrix parentMat, qMat;
+		parentMat.SetQ(FbxQuaternion(batch.m_parentX[i], batch.m_parentY[i], batch.m_parentZ[i], batch.m_parentW[i]));
+		qMat.SetQ(FbxQuaternion(batch.m_globalX[i], batch.m_globalY[i], batch.m_globalZ[i], batch.m_globalW[i]));
+		reference[i] = (parentMat.Inverse() * qMat).GetR();
+	}
+	double matrixTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	double scalarTime = TimeKernel(batch, false);
+	double scalarDifference = MaxDifference(reference, batch);
+
+	double vectorTime = TimeKernel(batch, true);
+	double vectorDifference = MaxDifference(reference, batch);
+
+	double nsPerJoint = 1e9 / jointCount;
+	UI_Printf("Rotation benchmark, %u joints:", jointCount);
+	UI_Printf("  FbxAMatrix     %8.2f ns/joint", matrixTime * nsPerJoint);
+	UI_Printf("  Scalar kernel  %8.2f ns/joint, largest difference %g degrees", scalarTime * nsPerJoint, scalarDifference);
+	UI_Printf("  %s kernel     %8.2f ns/joint, largest difference %g degrees", isLocalEulerVectorized() ? "SSE" : "n/a", vectorTime * nsPerJoint, vectorDifference);
+
+	return scalarDifference > vectorDifference ? scalarDifference : vectorDifference;
+}
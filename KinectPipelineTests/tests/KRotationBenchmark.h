@@ -0,0 +1,11 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Converts random joint rotations to local euler angles through the FbxAMatrix path, the scalar kernel and the SSE kernel.
+/// Reports how long each one takes, and how far the kernels are from FbxAMatrix
+/// </summary>
+/// <param name="jointCount">Number of random joint rotations</param>
+/// <returns>Largest difference between a kernel and FbxAMatrix, in degrees</returns>
+double RunRotationBenchmark(unsigned int jointCount);
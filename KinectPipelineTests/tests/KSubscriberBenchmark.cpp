@@ -0,0 +1,169 @@
+#include "KSubscriberBenchmark.h"
+#include "KSyntheticTake.h"
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Rates frames are published at: the sensor, then twice and four times as fast
+static const unsigned int c_publishRates[] = { 30, 60, 120 };
+
+// Seconds of frames published at each rate
+static const unsigned int c_publishSeconds = 10;
+
+// Same frames on every run
+static const unsigned int c_benchmarkSeed = 42;
+
+/*
+	Kind of subscriber fed by a channel, and the time it spends on every frame
+*/
+struct BenchmarkSubscriberKind {
+	const char *m_name;
+
+	// Time spent in notify, in microseconds
+	unsigned int m_workTime;
+};
+
+// A visualizer drawing every frame, an exporter mapping every body, and a subscriber slower than 120 Hz
+static const BenchmarkSubscriberKind c_subscriberKinds[] = {
+	{ "visualizer", 1000 },
+	{ "exporter", 5000 },
+	{ "slow", 12000 }
+};
+
+static const int c_subscriberCount = sizeof(c_subscriberKinds) / sizeof(c_subscriberKinds[0]);
+
+/*
+	Subscriber busy for a fixed time on every frame, checking frames arrive in order
+*/
+class BenchmarkSubscriber : public FrameSubscriber {
+public:
+	/// <summary>
+	/// Constructor
+	/// </summary>
+	/// <param name="workTime">Time spent on every frame, in microseconds</param>
+	BenchmarkSubscriber(unsigned int workTime) :
+	m_workTime(workTime),
+	m_nLastFrameTime(-1),
+	m_nReceived(0),
+	m_nOutOfOrder(0)
+	{
+	}
+
+	/// <summary>
+	/// Notify class about a frame that arrived
+	/// </summary>
+	/// <param name="bFrame">Decoded incoming frame</param>
+	virtual void notify(const BodyFrame_ptr &bFrame) {
+		if (bFrame->frameTime <= m_nLastFrameTime)
+			m_nOutOfOrder++;
+		m_nLastFrameTime = bFrame->frameTime;
+		m_nReceived++;
+
+		// Spin rather than sleep, so work time does not depend on the scheduler resolution
+		unsigned long long start = PipelineMetrics::getTime();
+		while (PipelineMetrics::getTime() - start < m_workTime);
+	}
+
+	/// <summary>
+	/// Number of frames received
+	/// </summary>
+	unsigned int getReceivedCount() const { return m_nReceived; };
+
+	/// <summary>
+	/// Number of frames received after a later one
+	/// </summary>
+	unsigned int getOutOfOrderCount() const { return m_nOutOfOrder; };
+
+private:
+	unsigned int m_workTime;
+
+	// Only touched by the channel thread
+	INT64 m_nLastFrameTime;
+	unsigned int m_nReceived;
+	unsigned int m_nOutOfOrder;
+};
+
+/// <summary>
+/// Publishes frames at a fixed rate to a channel for each kind of subscriber, and reports how every one kept up
+/// </summary>
+/// <param name="rate">Frames per second</param>
+/// <returns>False if a frame went missing or was delivered out of order</returns>
+static bool RunRate(unsigned int rate) {
+
+	std::vector<std::shared_ptr<BenchmarkSubscriber>> subscribers;
+	std::vector<std::unique_ptr<KSubscriberChannel>> channels;
+	for (int s = 0; s < c_subscriberCount; s++) {
+		subscribers.push_back(std::make_shared<BenchmarkSubscriber>(c_subscriberKinds[s].m_workTime));
+		channels.push_back(std::unique_ptr<KSubscriberChannel>(new KSubscriberChannel(subscribers.back())));
+	}
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = BODY_COUNT;
+	settings.m_seed = c_benchmarkSeed;
+
+	const unsigned int frameCount = rate * c_publishSeconds;
+	const std::chrono::microseconds period(1000000 / rate);
+	std::chrono::steady_clock::time_point nextFrame = std::chrono::steady_clock::now();
+
+	for (unsigned int f = 0; f < frameCount; f++) {
+		std::shared_ptr<BodyFrame> frame = std::make_shared<BodyFrame>();
+		GenerateSyntheticFrame(settings, f, *frame);
+		// Kinect clock of the rate, in 100ns increments
+		frame->frameTime = INT64(f + 1) * 10000000 / rate;
+
+		nextFrame += period;
+		std::this_thread::sleep_until(nextFrame);
+
+		// Published as soon as it is decoded, like the capture thread does
+		frame->captureCounter = INT64(PipelineMetrics::getTime());
+		BodyFrame_ptr published(frame);
+		for (auto& it : channels)
+			it->publish(published);
+	}
+
+	bool success = true;
+	for (int s = 0; s < c_subscriberCount; s++) {
+		KSubscriberChannel &channel = *channels[s];
+		const BenchmarkSubscriber &subscriber = *subscribers[s];
+		channel.stop();
+
+		unsigned int delivered = channel.getDeliveredCount();
+		unsigned int dropped = channel.getDroppedCount();
+		UI_Printf("%3u Hz, %-10s ( %5.1f ms per frame ): %5u delivered, %5u dropped, latency avg %6.2f ms, max %6.2f ms",
+			rate, c_subscriberKinds[s].m_name, c_subscriberKinds[s].m_workTime / 1000.0,
+			delivered, dropped, channel.getAverageLatency(), channel.getMaxLatency());
+
+		if (delivered + dropped != frameCount || subscriber.getReceivedCount() != delivered) {
+			UI_Printf("  %u frames published, but %u received and %u counted as dropped",
+				frameCount, subscriber.getReceivedCount(), dropped);
+			success = false;
+		}
+		if (subscriber.getOutOfOrderCount() > 0) {
+			UI_Printf("  %u frames delivered out of order", subscriber.getOutOfOrderCount());
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+/// <summary>
+/// Publishes synthetic frames at 30, 60 and 120 Hz through subscriber channels, one for each kind of subscriber
+/// ( from a light visualizer to one slower than the fastest rate ). Reports latency and dropped frames of every subscriber
+/// </summary>
+/// <returns>False if a frame was neither delivered nor counted as dropped, or was delivered out of order</returns>
+bool RunSubscriberBenchmark() {
+
+	UI_Printf("Publishing %u seconds of %d-body frames at each rate, %u cores", c_publishSeconds, BODY_COUNT, std::thread::hardware_concurrency());
+
+	bool success = true;
+	for (unsigned int rate : c_publishRates) {
+		if (!RunRate(rate))
+			success = false;
+	}
+
+	if (!success)
+		UI_Printf("Subscriber channels lost frames without counting them, or reordered them");
+
+	return success;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Publishes synthetic frames at 30, 60 and 120 Hz through subscriber channels, one for each kind of subscriber
+/// ( from a light visualizer to one slower than the fastest rate ). Reports latency and dropped frames of every subscriber
+/// </summary>
+/// <returns>False if a frame was neither delivered nor counted as dropped, or was delivered out of order</returns>
+bool RunSubscriberBenchmark();
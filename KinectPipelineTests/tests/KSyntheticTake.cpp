@@ -0,0 +1,345 @@
+#include "KSyntheticTake.h"
+
+#include <math.h>
+#include <string.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Kinect clock increments between two frames ( 100ns each )
+static const INT64 c_frameInterval = 10000000 / c_syntheticFPS;
+
+// Duration of a walk cycle, in seconds
+static const double c_walkCycle = 1.1;
+
+// Frames a body stays lost once tracking drops
+static const unsigned int c_dropoutFrames = c_syntheticFPS / 2;
+
+// Fraction of joints reported as inferred instead of tracked
+static const double c_inferredRate = 0.02;
+
+// Tracking id of the first body, as the sensor numbers them
+static const UINT64 c_firstTrackingId = 72057594037927936ULL;
+
+static const double c_pi = 3.14159265358979323846;
+
+// Largest accepted difference between the length of a joint orientation and 1
+static const double c_unitTolerance = 1e-4;
+
+/*
+	Joint of the synthetic skeleton, animated by a single rotation following the walk cycle
+*/
+struct SyntheticJoint {
+	JointType m_joint;
+	JointType m_parent;
+
+	// Position relative to parent when no rotation is applied, in meters
+	double m_offset[3];
+
+	// Rotation axis ( 0 X, 1 Y, 2 Z ) and angle = bias + amplitude * sin( cycle + phase ), in radians
+	int m_axis;
+	double m_bias;
+	double m_amplitude;
+	double m_phase;
+
+	// Sensor reports no orientation for the end of a bone chain
+	bool m_isLeaf;
+};
+
+// Parents always come before their children. Body faces the sensor, so feet point to -Z
+static const SyntheticJoint c_joints[JointType_Count] = {
+	{ JointType_SpineBase, JointType_Count, { 0.0, 0.0, 0.0 }, 1, 0.0, 0.10, 0.0, false },
+	{ JointType_SpineMid, JointType_SpineBase, { 0.0, 0.30, 0.0 }, 1, 0.0, -0.08, 0.0, false },
+	{ JointType_SpineShoulder, JointType_SpineMid, { 0.0, 0.22, 0.0 }, 0, 0.05, 0.03, 0.5, false },
+	{ JointType_Neck, JointType_SpineShoulder, { 0.0, 0.06, 0.0 }, 0, 0.0, 0.03, 1.0, false },
+	{ JointType_Head, JointType_Neck, { 0.0, 0.12, 0.0 }, 0, 0.0, 0.0, 0.0, true },
+	{ JointType_ShoulderLeft, JointType_SpineShoulder, { -0.17, -0.04, 0.0 }, 0, 0.0, 0.35, c_pi, false },
+	{ JointType_ElbowLeft, JointType_ShoulderLeft, { 0.0, -0.27, 0.0 }, 0, -0.30, 0.15, c_pi, false },
+	{ JointType_WristLeft, JointType_ElbowLeft, { 0.0, -0.24, 0.0 }, 2, 0.0, 0.05, 0.0, false },
+	{ JointType_HandLeft, JointType_WristLeft, { 0.0, -0.07, 0.0 }, 0, 0.0, 0.05, 0.3, false },
+	{ JointType_HandTipLeft, JointType_HandLeft, { 0.0, -0.08, 0.0 }, 0, 0.0, 0.0, 0.0, true },
+	{ JointType_ThumbLeft, JointType_HandLeft, { 0.03, -0.04, 0.0 }, 0, 0.0, 0.0, 0.0, true },
+	{ JointType_ShoulderRight, JointType_SpineShoulder, { 0.17, -0.04, 0.0 }, 0, 0.0, 0.35, 0.0, false },
+	{ JointType_ElbowRight, JointType_ShoulderRight, { 0.0, -0.27, 0.0 }, 0, -0.30, 0.15, 0.0, false },
+	{ JointType_WristRight, JointType_ElbowRight, { 0.0, -0.24, 0.0 }, 2, 0.0, 0.05, c_pi, false },
+	{ JointType_HandRight, JointType_WristRight, { 0.0, -0.07, 0.0 }, 0, 0.0, 0.05, c_pi + 0.3, false },
+	{ JointType_HandTipRight, JointType_HandRight, { 0.0, -0.08, 0.0 }, 0, 0.0, 0.0, 0.0, true },
+	{ JointType_ThumbRight, JointType_HandRight, { -0.03, -0.04, 0.0 }, 0, 0.0, 0.0, 0.0, true },
+	{ JointType_HipLeft, JointType_SpineBase, { -0.08, -0.04, 0.0 }, 0, 0.0, 0.45, 0.0, false },
+	{ JointType_KneeLeft, JointType_HipLeft, { 0.0, -0.40, 0.0 }, 0, 0.35, 0.35, -c_pi / 2, false },
+	{ JointType_AnkleLeft, JointType_KneeLeft, { 0.0, -0.40, 0.0 }, 0, -0.05, 0.15, 0.0, false },
+	{ JointType_FootLeft, JointType_AnkleLeft, { 0.0, -0.05, -0.10 }, 0, 0.0, 0.0, 0.0, true },
+	{ JointType_HipRight, JointType_SpineBase, { 0.08, -0.04, 0.0 }, 0, 0.0, 0.45, c_pi, false },
+	{ JointType_KneeRight, JointType_HipRight, { 0.0, -0.40, 0.0 }, 0, 0.35, 0.35, c_pi / 2, false },
+	{ JointType_AnkleRight, JointType_KneeRight, { 0.0, -0.40, 0.0 }, 0, -0.05, 0.15, c_pi, false },
+	{ JointType_FootRight, JointType_AnkleRight, { 0.0, -0.05, -0.10 }, 0, 0.0, 0.0, 0.0, true }
+};
+
+
+/// <summary>
+/// Random value between -1 and 1, always the same for the same arguments
+/// </summary>
+static double Noise(unsigned int seed, unsigned int a, unsigned int b, unsigned int c) {
+	UINT64 h = seed;
+	h = h * 0x9E3779B97F4A7C15ULL + a;
+	h = h * 0x9E3779B97F4A7C15ULL + b;
+	h = h * 0x9E3779B97F4A7C15ULL + c;
+
+	// Finalizer of MurmurHash3, spreads every input bit over the whole value
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	return double(h >> 11) / double(1ULL << 52) - 1.0;
+}
+
+/// <summary>
+/// Random value between 0 and 1, always the same for the same arguments
+/// </summary>
+static double Chance(unsigned int seed, unsigned int a, unsigned int b, unsigned int c) {
+	return 0.5 * (Noise(seed, a, b, c) + 1.0);
+}
+
+/// <summary>
+/// Rotation of an angle around one of the coordinate axes
+/// </summary>
+static JointQuaternion AxisRotation(int axis, double angle) {
+	JointQuaternion q = quatIdentity();
+	double s = sin(0.5 * angle);
+	q.w = cos(0.5 * angle);
+	if (axis == 0)
+		q.x = s;
+	else if (axis == 1)
+		q.y = s;
+	else
+		q.z = s;
+	return q;
+}
+
+/// <summary>
+/// Rotates a vector by a unit quaternion
+/// </summary>
+static void RotateVector(const JointQuaternion &q, const double v[3], double out[3]) {
+	JointQuaternion p = { v[0], v[1], v[2], 0.0 };
+	JointQuaternion r = quatMultiply(quatMultiply(q, p), quatConjugate(q));
+	out[0] = r.x;
+	out[1] = r.y;
+	out[2] = r.z;
+}
+
+/// <summary>
+/// Generates a single walking body
+/// </summary>
+static void GenerateBody(const SyntheticTakeSettings &settings, unsigned int frameIndex, unsigned int bodyIndex, BodyData &body) {
+	body.isTracked = true;
+	body.trackingId = c_firstTrackingId + bodyIndex;
+
+	// Every body walks at its own pace
+	double time = double(frameIndex) / c_syntheticFPS;
+	double cycle = 2.0 * c_pi * time * (1.0 + 0.1 * bodyIndex) / c_walkCycle + 0.7 * bodyIndex;
+
+	// Hands open and close every few seconds
+	body.leftHandState = (frameIndex / (2 * c_syntheticFPS) + bodyIndex) % 2 ? HandState_Closed : HandState_Open;
+	body.rightHandState = (frameIndex / (3 * c_syntheticFPS) + bodyIndex) % 2 ? HandState_Closed : HandState_Open;
+
+	// Bodies stand side by side, swaying while they walk
+	double rootPosition[3] = {
+		0.8 * (double(bodyIndex) - 0.5 * double(settings.m_bodyCount - 1)) + 0.04 * sin(cycle),
+		0.05 + 0.02 * sin(2.0 * cycle),
+		2.5 + 0.3 * sin(0.1 * time + bodyIndex)
+	};
+
+	JointQuaternion globalRotations[JointType_Count];
+	double positions[JointType_Count][3];
+
+	for (int i = 0; i < JointType_Count; i++) {
+		const SyntheticJoint &sJoint = c_joints[i];
+		unsigned int channel = bodyIndex * JointType_Count + sJoint.m_joint;
+
+		double angle = sJoint.m_bias + sJoint.m_amplitude * sin(cycle + sJoint.m_phase);
+		angle += settings.m_rotationNoise * Noise(settings.m_seed, frameIndex, channel, 0);
+		JointQuaternion localRotation = AxisRotation(sJoint.m_axis, angle);
+
+		double *position = positions[sJoint.m_joint];
+		if (sJoint.m_parent == JointType_Count) {
+			// Whole body turns around the vertical axis
+			globalRotations[sJoint.m_joint] = quatMultiply(AxisRotation(1, 2.0 * c_pi * settings.m_turnRate * time), localRotation);
+			memcpy(position, rootPosition, sizeof(rootPosition));
+		}
+		else {
+			const JointQuaternion &parentRotation = globalRotations[sJoint.m_parent];
+			globalRotations[sJoint.m_joint] = quatMultiply(parentRotation, localRotation);
+
+			double offset[3];
+			RotateVector(parentRotation, sJoint.m_offset, offset);
+			for (int c = 0; c < 3; c++)
+				position[c] = positions[sJoint.m_parent][c] + offset[c];
+		}
+
+		Joint &joint = body.joints[sJoint.m_joint];
+		joint.JointType = sJoint.m_joint;
+		joint.Position.X = float(position[0] + settings.m_positionNoise * Noise(settings.m_seed, frameIndex, channel, 1));
+		joint.Position.Y = float(position[1] + settings.m_positionNoise * Noise(settings.m_seed, frameIndex, channel, 2));
+		joint.Position.Z = float(position[2] + settings.m_positionNoise * Noise(settings.m_seed, frameIndex, channel, 3));
+		joint.TrackingState = Chance(settings.m_seed, frameIndex, channel, 4) < c_inferredRate ? TrackingState_Inferred : TrackingState_Tracked;
+
+		JointOrientation &orientation = body.orientations[sJoint.m_joint];
+		orientation.JointType = sJoint.m_joint;
+		if (sJoint.m_isLeaf) {
+			memset(&orientation.Orientation, 0, sizeof(orientation.Orientation));
+		}
+		else {
+			const JointQuaternion &q = globalRotations[sJoint.m_joint];
+			orientation.Orientation.x = float(q.x);
+			orientation.Orientation.y = float(q.y);
+			orientation.Orientation.z = float(q.z);
+			orientation.Orientation.w = float(q.w);
+		}
+	}
+}
+
+/// <summary>
+/// Generates a frame of a synthetic take: every body walks in place, with noise, inferred joints and tracking dropouts.
+/// Frames do not depend on each other, so they can be generated in any order
+/// </summary>
+/// <param name="settings">Take settings</param>
+/// <param name="frameIndex">Frame number, 0 being the first one</param>
+/// <param name="frame">Output, decoded frame as the sensor would have delivered it</param>
+void GenerateSyntheticFrame(const SyntheticTakeSettings &settings, unsigned int frameIndex, BodyFrame &frame) {
+
+	memset(&frame, 0, sizeof(frame));
+	frame.frameTime = (INT64)(frameIndex + 1) * c_frameInterval;
+	frame.captureCounter = 0;
+	frame.readStatus = Chance(settings.m_seed, frameIndex, 0xFFFFFFFF, 0) >= settings.m_readFailureRate;
+
+	if (!frame.readStatus)
+		return;
+
+	unsigned int bodyCount = settings.m_bodyCount < BODY_COUNT ? settings.m_bodyCount : BODY_COUNT;
+	for (unsigned int b = 0; b < bodyCount; b++) {
+		// Tracking is lost for a while, the same way for every frame of the window
+		if (Chance(settings.m_seed, frameIndex / c_dropoutFrames, b, 0xFFFFFFFF) < settings.m_dropoutRate)
+			continue;
+
+		GenerateBody(settings, frameIndex, b, frame.bodies[b]);
+	}
+}
+
+/// <summary>
+/// Writes a synthetic take as a capture journal, so it can be converted like a recorded one
+/// </summary>
+/// <param name="settings">Take settings</param>
+/// <param name="frameCount">Number of frames</param>
+/// <param name="fileName">Journal file name</param>
+/// <returns>False if journal could not be written</returns>
+bool WriteSyntheticJournal(const SyntheticTakeSettings &settings, unsigned int frameCount, const char *fileName) {
+
+	CaptureJournalWriter writer;
+	if (!writer.open(fileName))
+		return false;
+
+	for (unsigned int i = 0; i < frameCount; i++) {
+		std::shared_ptr<BodyFrame> frame = std::make_shared<BodyFrame>();
+		GenerateSyntheticFrame(settings, i, *frame);
+		writer.append(frame);
+	}
+
+	writer.close();
+	return writer.getCommittedFrameCount() == frameCount;
+}
+
+/// <summary>
+/// Hash of every byte of a frame ( FNV-1a ). Frames are cleared before being generated, so padding bytes are always zero
+/// </summary>
+static UINT64 HashFrame(const BodyFrame &frame) {
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&frame);
+	UINT64 h = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < sizeof(frame); i++) {
+		h ^= bytes[i];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+/// <summary>
+/// Whether an observed rate is within half and twice the one asked for
+/// </summary>
+static bool IsRateClose(double observed, double expected) {
+	return observed >= 0.5 * expected && observed <= 2.0 * expected;
+}
+
+/// <summary>
+/// Checks a synthetic take is the same whatever order its frames are generated in, and looks like the settings ask for:
+/// frame times, tracking ids, unit orientations, no orientation for leaf joints, and rates of unreadable frames, lost bodies and inferred joints
+/// </summary>
+/// <param name="settings">Take settings</param>
+/// <param name="frameCount">Number of frames</param>
+/// <returns>False if a frame differs between two generations, or the take does not match its settings</returns>
+bool CheckSyntheticTake(const SyntheticTakeSettings &settings, unsigned int frameCount) {
+
+	// Too big for the stack
+	std::unique_ptr<BodyFrame> frame(new BodyFrame);
+
+	unsigned int bodyCount = settings.m_bodyCount < BODY_COUNT ? settings.m_bodyCount : BODY_COUNT;
+	unsigned long long unreadableFrames = 0, lostBodies = 0, trackedBodies = 0, inferredJoints = 0, invalidFrames = 0;
+	std::vector<UINT64> hashes(frameCount);
+
+	for (unsigned int i = 0; i < frameCount; i++) {
+		GenerateSyntheticFrame(settings, i, *frame);
+		hashes[i] = HashFrame(*frame);
+
+		bool valid = frame->frameTime == (INT64)(i + 1) * c_frameInterval;
+		if (!frame->readStatus)
+			unreadableFrames++;
+
+		for (unsigned int b = 0; b < BODY_COUNT; b++) {
+			const BodyData &body = frame->bodies[b];
+			if (!body.isTracked) {
+				if (frame->readStatus && b < bodyCount)
+					lostBodies++;
+				continue;
+			}
+
+			// Only readable frames hold bodies, and only as many as asked for
+			if (!frame->readStatus || b >= bodyCount || body.trackingId != c_firstTrackingId + b)
+				valid = false;
+			trackedBodies++;
+
+			for (int j = 0; j < JointType_Count; j++) {
+				const SyntheticJoint &sJoint = c_joints[j];
+				const Vector4 &q = body.orientations[sJoint.m_joint].Orientation;
+				double length = sqrt(double(q.x) * q.x + double(q.y) * q.y + double(q.z) * q.z + double(q.w) * q.w);
+				if (sJoint.m_isLeaf ? length != 0.0 : fabs(length - 1.0) > c_unitTolerance)
+					valid = false;
+
+				if (body.joints[sJoint.m_joint].TrackingState == TrackingState_Inferred)
+					inferredJoints++;
+			}
+		}
+
+		if (!valid)
+			invalidFrames++;
+	}
+
+	// Backwards this time, so any state kept from one frame to the next would show
+	unsigned int differentFrames = 0;
+	for (unsigned int i = frameCount; i-- > 0;) {
+		GenerateSyntheticFrame(settings, i, *frame);
+		if (HashFrame(*frame) != hashes[i])
+			differentFrames++;
+	}
+
+	double unreadableRate = frameCount ? double(unreadableFrames) / frameCount : 0.0;
+	double lostRate = frameCount > unreadableFrames ? double(lostBodies) / (double(frameCount - unreadableFrames) * bodyCount) : 0.0;
+	double inferredRate = trackedBodies ? double(inferredJoints) / (double(trackedBodies) * JointType_Count) : 0.0;
+
+	UI_Printf("Synthetic take, %u bodies, %u frames: %u frames differ when generated backwards, %llu frames do not match their settings",
+		bodyCount, frameCount, differentFrames, invalidFrames);
+	UI_Printf("  unreadable frames %.2f%% ( %.2f%% asked ), lost bodies %.2f%% ( %.2f%% ), inferred joints %.2f%% ( %.2f%% )",
+		100.0 * unreadableRate, 100.0 * settings.m_readFailureRate, 100.0 * lostRate, 100.0 * settings.m_dropoutRate, 100.0 * inferredRate, 100.0 * c_inferredRate);
+
+	return differentFrames == 0 && invalidFrames == 0 && IsRateClose(unreadableRate, settings.m_readFailureRate)
+		&& IsRateClose(lostRate, settings.m_dropoutRate) && IsRateClose(inferredRate, c_inferredRate);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/*
+	Settings of a synthetic take. Same settings always give the same frames
+*/
+struct SyntheticTakeSettings {
+	// Number of people walking in front of the sensor ( 1 to BODY_COUNT )
+	unsigned int m_bodyCount;
+
+	// Seed of every random choice
+	unsigned int m_seed;
+
+	// Largest error added to joint positions, in meters
+	double m_positionNoise;
+
+	// Largest error added to joint rotations, in radians
+	double m_rotationNoise;
+
+	// Fraction of time a body is not tracked. Bodies are lost for half a second at a time
+	double m_dropoutRate;
+
+	// Fraction of frames whose body data cannot be read
+	double m_readFailureRate;
+
+	// Turns every body makes around the vertical axis per second, walking in place, so rotations keep crossing 180 degrees
+	double m_turnRate;
+
+	/// <summary>
+	/// Constructor, a single body with sensor-like noise and dropouts
+	/// </summary>
+	SyntheticTakeSettings() :
+	m_bodyCount(1),
+	m_seed(1),
+	m_positionNoise(0.005),
+	m_rotationNoise(0.02),
+	m_dropoutRate(0.02),
+	m_readFailureRate(0.005),
+	m_turnRate(0)
+	{
+	}
+};
+
+// Frames per second of a synthetic take, same as the sensor
+const unsigned int c_syntheticFPS = 30;
+
+/// <summary>
+/// Generates a frame of a synthetic take: every body walks in place, with noise, inferred joints and tracking dropouts.
+/// Frames do not depend on each other, so they can be generated in any order
+/// </summary>
+/// <param name="settings">Take settings</param>
+/// <param name="frameIndex">Frame number, 0 being the first one</param>
+/// <param name="frame">Output, decoded frame as the sensor would have delivered it</param>
+void GenerateSyntheticFrame(const SyntheticTakeSettings &settings, unsigned int frameIndex, BodyFrame &frame);
+
+/// <summary>
+/// Writes a synthetic take as a capture journal, so it can be converted like a recorded one
+/// </summary>
+/// <param name="settings">Take settings</param>
+/// <param name="frameCount">Number of frames</param>
+/// <param name="fileName">Journal file name</param>
+/// <returns>False if journal could not be written</returns>
+bool WriteSyntheticJournal(const SyntheticTakeSettings &settings, unsigned int frameCount, const char *fileName);
+
+/// <summary>
+/// Checks a synthetic take is the same whatever order its frames are generated in, and looks like the settings ask for:
+/// frame times, tracking ids, unit orientations, no orientation for leaf joints, and rates of unreadable frames, lost bodies and inferred joints
+/// </summary>
+/// <param name="settings">Take settings</param>
+/// <param name="frameCount">Number of frames</param>
+/// <returns>False if a frame differs between two generations, or the take does not match its settings</returns>
+bool CheckSyntheticTake(const SyntheticTakeSettings &settings, unsigned int frameCount);
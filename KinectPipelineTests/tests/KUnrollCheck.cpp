@@ -0,0 +1,164 @@
+#include "KUnrollCheck.h"
+#include "KSyntheticTake.h"
+
+#include <math.h>
+#include <string.h>
+
+// a UI file provide a function to print messages
+extern void UI_Printf(const char* msg, ...);
+
+// Bodies of the synthetic take
+static const unsigned int c_unrollBodyCount = 2;
+
+// Turns per second of every body, so each one spins several times during the take
+static const double c_unrollTurnRate = 0.3;
+
+// Same frames on every run
+static const unsigned int c_unrollSeed = 42;
+
+// Keys beyond this are only reached by turning, in degrees
+static const double c_halfTurnDegrees = 180;
+
+/*
+	Keys compared by the check
+*/
+struct UnrollComparison {
+	// Rotation curves and keys compared
+	unsigned int m_curveCount;
+	unsigned long long m_keyCount;
+
+	// Keys beyond half a turn, which were kept continuous while mapping
+	unsigned long long m_turnedKeyCount;
+
+	// Keys the filter changed, and the largest change, in degrees
+	unsigned long long m_changedKeyCount;
+	double m_largestChange;
+};
+
+/// <summary>
+/// Copies the keys of a curve into a new curve of the same scene
+/// </summary>
+/// <param name="pScene">Scene the copy is created in</param>
+/// <param name="pCurve">Curve to be copied</param>
+/// <returns>Copy, to be destroyed by the caller</returns>
+static FbxAnimCurve *CopyCurve(FbxScene *pScene, FbxAnimCurve *pCurve) {
+	FbxAnimCurve *pCopy = FbxAnimCurve::Create(pScene, "");
+
+	pCopy->KeyModifyBegin();
+	for (int k = 0; k < pCurve->KeyGetCount(); k++) {
+		int index = pCopy->KeyAdd(pCurve->KeyGetTime(k));
+		pCopy->KeySetValue(index, pCurve->KeyGetValue(k));
+		pCopy->KeySetInterpolation(index, pCurve->KeyGetInterpolation(k));
+	}
+	pCopy->KeyModifyEnd();
+
+	return pCopy;
+}
+
+/// <summary>
+/// Unrolls copies of the three curves of a rotation, and compares their keys with the mapped ones
+/// </summary>
+/// <param name="pScene">Scene the copies are created in</param>
+/// <param name="curveNode">Rotation curves, as mapped</param>
+/// <param name="comparison">Output, what was compared is added</param>
+static void CompareUnrolled(FbxScene *pScene, const FilterCurveNode &curveNode, UnrollComparison &comparison) {
+
+	FbxAnimCurve *pCurves[3];
+	FbxAnimCurve *pCopies[3];
+	for (int c = 0; c < 3; c++) {
+		pCurves[c] = curveNode.m_pCurveNode->GetCurve(c);
+		if (!pCurves[c])
+			return;
+	}
+	for (int c = 0; c < 3; c++)
+		pCopies[c] = CopyCurve(pScene, pCurves[c]);
+
+	// Default settings, as the filter was run before saving
+	FbxAnimCurveFilterUnroll filter;
+	filter.Apply(pCopies, 3);
+
+	comparison.m_curveCount += 3;
+	for (int c = 0; c < 3; c++) {
+		int keyCount = pCurves[c]->KeyGetCount();
+		if (pCopies[c]->KeyGetCount() != keyCount) {
+			UI_Printf("  %s has %d keys once unrolled, instead of %d", curveNode.m_pCurveNode->GetName(), pCopies[c]->KeyGetCount(), keyCount);
+			comparison.m_changedKeyCount += keyCount;
+			continue;
+		}
+
+		for (int k = 0; k < keyCount; k++) {
+			float value = pCurves[c]->KeyGetValue(k);
+			float unrolled = pCopies[c]->KeyGetValue(k);
+
+			comparison.m_keyCount++;
+			if (fabs(value) > c_halfTurnDegrees)
+				comparison.m_turnedKeyCount++;
+
+			// Raw values, a whole turn is a difference like any other
+			if (unrolled != value) {
+				if (comparison.m_changedKeyCount == 0)
+					UI_Printf("  First change: channel %d of %s at %.3fs, %.9g mapped, %.9g unrolled", c, curveNode.m_pCurveNode->GetName(),
+						pCurves[c]->KeyGetTime(k).GetSecondDouble(), value, unrolled);
+
+				comparison.m_changedKeyCount++;
+				comparison.m_largestChange = fmax(comparison.m_largestChange, fabs(double(unrolled) - double(value)));
+			}
+		}
+	}
+
+	for (int c = 0; c < 3; c++)
+		pCopies[c]->Destroy();
+}
+
+/// <summary>
+/// Maps a synthetic take of bodies turning around, so joint rotations keep crossing 180 degrees, then runs the unroll filter the mapper
+/// used to run before saving, with its default settings, on a copy of every rotation curve. Key values of the copies must be exactly the mapped ones
+/// </summary>
+/// <param name="frameCount">Frames of the synthetic take</param>
+/// <returns>False if the filter changed a key, or no rotation crossed 180 degrees</returns>
+bool RunUnrollCheck(unsigned int frameCount) {
+
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = c_unrollBodyCount;
+	settings.m_seed = c_unrollSeed;
+	settings.m_turnRate = c_unrollTurnRate;
+
+	FbxManager *pManager = CreateSdkManager();
+	FbxScene *pScene = CreateAnimationScene(pManager);
+	MappingSession session(pScene);
+
+	BodyFrame frame;
+	for (unsigned int i = 0; i < frameCount; i++) {
+		GenerateSyntheticFrame(settings, i, frame);
+		KinectSkeletonMapper::mapFrame(session, frame);
+	}
+	session.commitKeys();
+
+	std::vector<FilterCurveNode> curveNodes;
+	PostProcessingPipeline::collectCurveNodes(pScene, curveNodes);
+
+	UnrollComparison comparison;
+	memset(&comparison, 0, sizeof(comparison));
+	for (auto &curveNode : curveNodes) {
+		if (curveNode.m_isRotation)
+			CompareUnrolled(pScene, curveNode, comparison);
+	}
+
+	session.reset(NULL);
+	DestroySdkObjects(pManager, false);
+
+	UI_Printf("Unroll check, %u frames of %u bodies turning %g times a second:", frameCount, c_unrollBodyCount, c_unrollTurnRate);
+	UI_Printf("  %u rotation curves, %llu keys, %llu of them beyond %g degrees", comparison.m_curveCount, comparison.m_keyCount, comparison.m_turnedKeyCount, c_halfTurnDegrees);
+
+	bool success = true;
+	if (comparison.m_turnedKeyCount == 0) {
+		UI_Printf("  No rotation crossed %g degrees, so continuity was not checked", c_halfTurnDegrees);
+		success = false;
+	}
+	if (comparison.m_changedKeyCount > 0) {
+		UI_Printf("  Unroll filter changed %llu keys, by %g degrees at most", comparison.m_changedKeyCount, comparison.m_largestChange);
+		success = false;
+	}
+
+	return success;
+}
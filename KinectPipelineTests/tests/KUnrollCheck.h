@@ -0,0 +1,11 @@
+#pragma once
+
+#include "../common/stdafx.h"
+
+/// <summary>
+/// Maps a synthetic take of bodies turning around, so joint rotations keep crossing 180 degrees, then runs the unroll filter the mapper
+/// used to run before saving, with its default settings, on a copy of every rotation curve. Key values of the copies must be exactly the mapped ones
+/// </summary>
+/// <param name="frameCount">Frames of the synthetic take</param>
+/// <returns>False if the filter changed a key, or no rotation crossed 180 degrees</returns>
+bool RunUnrollCheck(unsigned int frameCount);
@@ -0,0 +1,302 @@
+#include "KRotationBenchmark.h"
+#include "KLogRingStress.h"
+#include "KSubscriberBenchmark.h"
+#include "KPreRollSoak.h"
+#include "KProjectionBenchmark.h"
+#include "KReplayComparison.h"
+#include "KPipelineBenchmark.h"
+#include "KHierarchyCheck.h"
+#include "KUnrollCheck.h"
+#include "KMetricsCheck.h"
+#include "KSyntheticTake.h"
+
+#include <string.h>
+
+// Global FBX manager, required by CommonKinect helpers. Tests create managers of their own
+FbxManager* gSdkManager = NULL;
+
+// Serializes messages coming from different threads
+static std::mutex gPrintMutex;
+
+// Producer threads of the log ring stress
+static const unsigned int c_logRingProducerCount = 4;
+
+// Largest accepted difference between local rotations and the matrix reference, in degrees
+static const double c_rotationTolerance = 1e-2;
+
+// Number of random joint rotations used by the rotation benchmark
+static const unsigned int c_benchmarkJointCount = 1000000;
+
+// Number of random poses used by the hierarchy check
+static const unsigned int c_hierarchyPoseCount = 100000;
+
+// Recording threads of the metrics check
+static const unsigned int c_metricsThreadCount = 4;
+
+// Synthetic frames mapped by the unroll check: 20 seconds at the sensor frame rate
+static const unsigned int c_unrollFrameCount = 20 * c_syntheticFPS;
+
+// Largest accepted difference between batched and per joint projections, in depth pixels
+static const double c_projectionTolerance = 1e-2;
+
+// Synthetic frames projected by the projection benchmark: 5 minutes at the sensor frame rate
+static const unsigned int c_projectionFrameCount = 5 * 60 * c_syntheticFPS;
+
+// Default tolerances of replay comparisons, in degrees and scene units
+static const double c_replayAngleTolerance = 1e-3;
+static const double c_replayPositionTolerance = 1e-3;
+
+// Synthetic journals: a few people walking for 20 seconds
+static const unsigned int c_syntheticJournalBodies = 3;
+static const unsigned int c_syntheticJournalFrames = 20 * c_syntheticFPS;
+
+
+/// <summary>
+/// Prints a message to the console ( same arguments as printf )
+/// </summary>
+void UI_Printf(const char* pMsg, ...) {
+	char msg[2048];
+
+	va_list Arguments;
+	va_start(Arguments, pMsg);
+	FBXSDK_vsprintf(msg, sizeof(msg), pMsg, Arguments);
+	va_end(Arguments);
+
+	std::lock_guard<std::mutex> lock(gPrintMutex);
+	printf("%s\n", msg);
+	fflush(stdout);
+}
+
+/// <summary>
+/// Log ring stress, from an optional number of producer threads
+/// </summary>
+static int RunLogRing(int argc, char **argv) {
+	unsigned int producerCount = argc > 0 ? (unsigned int)atoi(argv[0]) : c_logRingProducerCount;
+	return RunLogRingStress(producerCount) ? 0 : 3;
+}
+
+/// <summary>
+/// Subscriber channels fed with synthetic frames
+/// </summary>
+static int RunSubscribers(int argc, char **argv) {
+	return RunSubscriberBenchmark() ? 0 : 3;
+}
+
+/// <summary>
+/// Batched joint projection against one joint at a time
+/// </summary>
+static int RunProjection(int argc, char **argv) {
+	return RunProjectionBenchmark(c_projectionFrameCount) > c_projectionTolerance ? 3 : 0;
+}
+
+/// <summary>
+/// Mapping, filters and saving of synthetic takes, with results written to a JSON file
+/// </summary>
+static int RunPipeline(int argc, char **argv) {
+	return RunPipelineBenchmark(argv[0]) ? 0 : 2;
+}
+
+/// <summary>
+/// Exit code of a replay comparison
+/// </summary>
+static int GetReplayExitCode(ReplayComparisonResult result) {
+	return result == ReplayComparison_Match ? 0 : (result == ReplayComparison_Mismatch ? 3 : 2);
+}
+
+/// <summary>
+/// Converts a journal and compares it to a golden file: golden [-a degrees] [-p units] [-s] [-e degrees units] journal
+/// </summary>
+static int RunReplay(int argc, char **argv) {
+	const char *goldenFile = argv[0];
+	const char *journalFile = NULL;
+	double angleTolerance = c_replayAngleTolerance;
+	double positionTolerance = c_replayPositionTolerance;
+	KeyingSettings keying;
+	JointFilterSettings jointFiltering;
+	bool replaceKeying = false;
+	bool replaceJointFiltering = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+			angleTolerance = atof(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			positionTolerance = atof(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0) {
+			jointFiltering.m_bEnabled = true;
+			replaceJointFiltering = true;
+		}
+		else if (strcmp(argv[i], "-e") == 0 && i + 2 < argc) {
+			replaceKeying = true;
+			keying.m_bAdaptive = true;
+			keying.m_angleTolerance = atof(argv[++i]);
+			keying.m_positionTolerance = atof(argv[++i]);
+		}
+		else if (argv[i][0] == '-' || journalFile)
+			return 1;
+		else
+			journalFile = argv[i];
+	}
+
+	if (!journalFile)
+		return 1;
+
+	return GetReplayExitCode(RunReplayComparison(journalFile, goldenFile, angleTolerance, positionTolerance,
+		replaceKeying ? &keying : NULL, replaceJointFiltering ? &jointFiltering : NULL));
+}
+
+/// <summary>
+/// Writes a synthetic take as a journal, to be converted into a golden file
+/// </summary>
+static int RunJournal(int argc, char **argv) {
+	SyntheticTakeSettings settings;
+	settings.m_bodyCount = c_syntheticJournalBodies;
+	if (!WriteSyntheticJournal(settings, c_syntheticJournalFrames, argv[0])) {
+		UI_Printf("Could not write %s", argv[0]);
+		return 2;
+	}
+	UI_Printf("%u synthetic frames written to %s", c_syntheticJournalFrames, argv[0]);
+	return 0;
+}
+
+/// <summary>
+/// Replay comparison of a synthetic take against itself and a slightly changed one, in a directory
+/// </summary>
+static int RunReplayCheck(int argc, char **argv) {
+	return GetReplayExitCode(RunReplaySelfCheck(argv[0], c_syntheticJournalBodies, c_syntheticJournalFrames, c_replayAngleTolerance, c_replayPositionTolerance));
+}
+
+/// <summary>
+/// Rotation conversion against the FbxAMatrix reference
+/// </summary>
+static int RunRotation(int argc, char **argv) {
+	return RunRotationBenchmark(c_benchmarkJointCount) > c_rotationTolerance ? 3 : 0;
+}
+
+/// <summary>
+/// Flattened joint hierarchy, and its forward pass against the recursive walk with matrices
+/// </summary>
+static int RunHierarchy(int argc, char **argv) {
+	return RunHierarchyCheck(c_hierarchyPoseCount, c_rotationTolerance) ? 0 : 3;
+}
+
+/// <summary>
+/// Mapped rotation curves against the unroll filter
+/// </summary>
+static int RunUnroll(int argc, char **argv) {
+	return RunUnrollCheck(c_unrollFrameCount) ? 0 : 3;
+}
+
+/// <summary>
+/// Known metrics recorded from several threads, written to a JSON file
+/// </summary>
+static int RunMetrics(int argc, char **argv) {
+	return RunMetricsCheck(c_metricsThreadCount, argv[0]) ? 0 : 3;
+}
+
+/// <summary>
+/// Pre-roll soak, for a number of hours
+/// </summary>
+static int RunPreRoll(int argc, char **argv) {
+	return RunPreRollSoak(atof(argv[0])) ? 0 : 3;
+}
+
+/*
+	Check or benchmark, run by name. Returns 0 if it passed, 3 if a check failed, 2 if it could not run and 1 if its arguments are wrong
+*/
+struct PipelineTest {
+	// Name given on the command line
+	const char *m_name;
+
+	// Arguments, as printed by the usage
+	const char *m_arguments;
+
+	// Number of arguments that must be given
+	int m_requiredArguments;
+
+	// Run by "all": needs no arguments and takes no more than a minute or so
+	bool m_bQuick;
+
+	// What it does, as printed by the usage
+	const char *m_description;
+
+	// Runs it, with the arguments following its name
+	int(*m_run)(int argc, char **argv);
+};
+
+// Every test, in the order "all" runs them
+static const PipelineTest c_tests[] = {
+	{ "logring", "[producers]", 0, true, "Push log lines from 4 threads into a log ring, fail if one is lost, torn or reordered, or drops are miscounted", &RunLogRing },
+	{ "subscribers", "", 0, true, "Publish synthetic frames to subscribers at 30, 60 and 120 Hz, report their latency and dropped frames, fail if one is lost or reordered", &RunSubscribers },
+	{ "rotation", "", 0, true, "Convert 1000000 random joint rotations with FbxAMatrix and the scalar and SSE kernels, fail if a kernel is 0.01 degrees away", &RunRotation },
+	{ "hierarchy", "", 0, true, "Check the flattened joint hierarchy, and its local rotations against a recursive walk with matrices on 100000 random poses", &RunHierarchy },
+	{ "unroll", "", 0, true, "Map 20 seconds of bodies turning around, run the unroll filter on copies of the rotation curves, fail if it changes any key", &RunUnroll },
+	{ "projection", "", 0, true, "Project 5 minutes of synthetic 6-body frames to the depth image one joint at a time and batched, fail if a batch lands 0.01 pixels away", &RunProjection },
+	{ "metrics", "<file>", 1, false, "Record known metrics from 4 threads while snapshots are taken, write them to a JSON file, fail if it or any snapshot differs", &RunMetrics },
+	{ "pipeline", "<resultFile>", 1, false, "Benchmark mapping, filters and saving with synthetic takes of 1 to 6 bodies, write results as JSON", &RunPipeline },
+	{ "replay", "<golden> <journal>", 2, false, "Convert a journal, read it back and compare every joint curve to a golden FBX file, within -a degrees and -p units ( 0.001 by default ). "
+		"Options go before the journal: -s smooths joints and -e degrees units keys adaptively, accepting keying errors on top", &RunReplay },
+	{ "journal", "<file>", 1, false, "Write a synthetic 20 second take with 3 bodies as a journal, to be converted into a golden file", &RunJournal },
+	{ "replaycheck", "<directory>", 1, false, "Check replay matches its own golden take and catches a slightly changed one, working in this directory", &RunReplayCheck },
+	{ "preroll", "<hours>", 1, false, "Push hours of synthetic frames into a pre-roll buffer with a short take every 5 minutes, fail if a take misses buffered frames or memory grows", &RunPreRoll },
+};
+
+static const size_t c_testCount = sizeof(c_tests) / sizeof(c_tests[0]);
+
+
+/// <summary>
+/// Prints command line usage
+/// </summary>
+static void PrintUsage(const char *programName) {
+	printf("Usage: %s test [arguments]\n", programName);
+	printf("       %s all\n", programName);
+	printf("  all                              Run every test marked with *\n");
+	for (size_t t = 0; t < c_testCount; t++) {
+		const PipelineTest &test = c_tests[t];
+		printf("%c %-12s %-19s %s\n", test.m_bQuick ? '*' : ' ', test.m_name, test.m_arguments, test.m_description);
+	}
+	printf("Exits with code 0 if tests pass, 3 if a check fails and 2 if a test cannot run\n");
+}
+
+
+int main(int argc, char **argv) {
+
+	if (argc < 2) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[1], "all") == 0) {
+		int result = 0;
+		for (size_t t = 0; t < c_testCount; t++) {
+			const PipelineTest &test = c_tests[t];
+			if (!test.m_bQuick)
+				continue;
+
+			UI_Printf("== %s", test.m_name);
+			int testResult = test.m_run(0, argv + argc);
+			UI_Printf("== %s %s", test.m_name, testResult == 0 ? "passed" : (testResult == 3 ? "failed" : "could not run"));
+
+			// A failed check outranks a test that could not run
+			if (testResult > result)
+				result = testResult;
+		}
+		return result;
+	}
+
+	for (size_t t = 0; t < c_testCount; t++) {
+		const PipelineTest &test = c_tests[t];
+		if (strcmp(argv[1], test.m_name) != 0)
+			continue;
+
+		if (argc - 2 < test.m_requiredArguments)
+			break;
+
+		int result = test.m_run(argc - 2, argv + 2);
+		if (result == 1)
+			break;
+		return result;
+	}
+
+	PrintUsage(argv[0]);
+	return 1;
+}